@@ -84,6 +84,22 @@ static BlockDriverState *bdrv_open_inherit(const char *filename,
 /* If non-zero, use only whitelisted block drivers */
 static int use_bdrv_whitelist;
 
+/*
+ * Bumped whenever a child link is replaced or permissions change anywhere
+ * in the graph.  Accessed with atomic ops.
+ */
+static unsigned bdrv_graph_gen;
+
+/**
+ * Return a counter that changes on every graph or permission update.
+ * Caches derived from the shape of the graph (e.g. which node of a
+ * backing chain is read-only) can compare it to detect staleness.
+ */
+unsigned bdrv_graph_generation(void)
+{
+    return qatomic_read(&bdrv_graph_gen);
+}
+
 #ifdef _WIN32
 static int is_windows_drive_prefix(const char *filename)
 {
@@ -382,6 +398,7 @@ BlockDriverState *bdrv_new(void)
     notifier_with_return_list_init(&bs->before_write_notifiers);
     qemu_co_mutex_init(&bs->reqs_lock);
     qemu_mutex_init(&bs->dirty_bitmap_mutex);
+    bdrv_bsc_init(bs);
     bs->refcnt = 1;
     bs->aio_context = qemu_get_aio_context();
 
@@ -2111,6 +2128,7 @@ static void bdrv_set_perm(BlockDriverState *bs, uint64_t cumulative_perms,
 {
     BlockDriver *drv = bs->drv;
     BdrvChild *c;
+    bool cache_zero;
 
     if (!drv) {
         return;
@@ -2121,6 +2139,14 @@ static void bdrv_set_perm(BlockDriverState *bs, uint64_t cumulative_perms,
         drv->bdrv_set_perm(bs, cumulative_perms, cumulative_shared_perms);
     }
 
+    qatomic_inc(&bdrv_graph_gen);
+
+    /* Holes may only be cached as long as nobody else can write */
+    cache_zero = !(cumulative_shared_perms & BLK_PERM_WRITE);
+    if (qatomic_xchg(&bs->bsc.cache_zero, cache_zero) && !cache_zero) {
+        bdrv_bsc_invalidate_all(bs);
+    }
+
     /* Drivers that never have children can omit .bdrv_child_perm() */
     if (!drv->bdrv_child_perm) {
         assert(QLIST_EMPTY(&bs->children));
@@ -2570,6 +2596,7 @@ static void bdrv_replace_child_noperm(BdrvChild *child,
     }
 
     child->bs = new_bs;
+    qatomic_inc(&bdrv_graph_gen);
 
     if (new_bs) {
         QLIST_INSERT_HEAD(&new_bs->parents, child, next_parent);
@@ -4441,6 +4468,7 @@ static void bdrv_close(BlockDriverState *bs)
     bs->backing_file[0] = '\0';
     bs->backing_format[0] = '\0';
     bs->total_sectors = 0;
+    bdrv_bsc_invalidate_all(bs);
     bs->encrypted = false;
     bs->sg = false;
     qobject_unref(bs->options);
@@ -4666,6 +4694,8 @@ static void bdrv_delete(BlockDriverState *bs)
     QTAILQ_REMOVE(&all_bdrv_states, bs, bs_list);
 
     bdrv_close(bs);
+    bdrv_bsc_cleanup(bs);
+    block_node_timing_free(bs->timing);
 
     g_free(bs);
 }
@@ -5787,6 +5817,7 @@ int coroutine_fn bdrv_co_invalidate_cache(BlockDriverState *bs, Error **errp)
             return ret;
         }
         bdrv_set_perm(bs, perm, shared_perm);
+        bdrv_bsc_invalidate_all(bs);
 
         if (bs->drv->bdrv_co_invalidate_cache) {
             bs->drv->bdrv_co_invalidate_cache(bs, &local_err);
@@ -138,10 +138,9 @@ static void block_latency_histogram_account(BlockLatencyHistogram *hist,
     hist->bins[pos - hist->boundaries + 1]++;
 }
 
-int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
-                                uint64List *boundaries)
+static int block_latency_histogram_init(BlockLatencyHistogram *hist,
+                                       uint64List *boundaries)
 {
-    BlockLatencyHistogram *hist = &stats->latency_histogram[type];
     uint64List *entry;
     uint64_t *ptr;
     uint64_t prev = 0;
@@ -170,6 +169,13 @@ int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
     return 0;
 }
 
+int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
+                                uint64List *boundaries)
+{
+    return block_latency_histogram_init(&stats->latency_histogram[type],
+                                        boundaries);
+}
+
 void block_latency_histograms_clear(BlockAcctStats *stats)
 {
     int i;
@@ -182,6 +188,78 @@ void block_latency_histograms_clear(BlockAcctStats *stats)
     }
 }
 
+/* Default histogram intervals for node timing, from 10 us to 1 s */
+static const uint64_t block_node_timing_boundaries[] = {
+    10 * SCALE_US, 50 * SCALE_US, 100 * SCALE_US, 500 * SCALE_US,
+    1 * SCALE_MS, 5 * SCALE_MS, 10 * SCALE_MS, 50 * SCALE_MS,
+    100 * SCALE_MS, 500 * SCALE_MS, 1000 * SCALE_MS,
+};
+
+/* Return new node timing statistics for read and write requests, with
+ * histogram intervals corresponding to @boundaries, or to a default set of
+ * intervals if @boundaries is NULL.  Return NULL if @boundaries is invalid.
+ */
+BlockNodeTiming *block_node_timing_new(uint64List *boundaries)
+{
+    BlockNodeTiming *timing = g_new0(BlockNodeTiming, 1);
+    uint64List *defaults = NULL;
+    int i, ret;
+
+    if (!boundaries) {
+        for (i = ARRAY_SIZE(block_node_timing_boundaries) - 1; i >= 0; i--) {
+            uint64List *entry = g_new(uint64List, 1);
+            entry->value = block_node_timing_boundaries[i];
+            entry->next = defaults;
+            defaults = entry;
+        }
+        boundaries = defaults;
+    }
+
+    qemu_mutex_init(&timing->lock);
+    ret = block_latency_histogram_init(
+        &timing->latency_histogram[BLOCK_ACCT_READ], boundaries);
+    if (ret == 0) {
+        ret = block_latency_histogram_init(
+            &timing->latency_histogram[BLOCK_ACCT_WRITE], boundaries);
+    }
+    qapi_free_uint64List(defaults);
+
+    if (ret < 0) {
+        block_node_timing_free(timing);
+        return NULL;
+    }
+    return timing;
+}
+
+void block_node_timing_free(BlockNodeTiming *timing)
+{
+    int i;
+
+    if (!timing) {
+        return;
+    }
+
+    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+        g_free(timing->latency_histogram[i].bins);
+        g_free(timing->latency_histogram[i].boundaries);
+    }
+    qemu_mutex_destroy(&timing->lock);
+    g_free(timing);
+}
+
+void block_node_timing_account(BlockNodeTiming *timing,
+                               enum BlockAcctType type, int64_t latency_ns)
+{
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    qemu_mutex_lock(&timing->lock);
+    timing->nr_ops[type]++;
+    timing->total_time_ns[type] += latency_ns;
+    block_latency_histogram_account(&timing->latency_histogram[type],
+                                    latency_ns);
+    qemu_mutex_unlock(&timing->lock);
+}
+
 static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
                                  bool failed)
 {
@@ -1187,6 +1187,7 @@ blk_do_preadv(BlockBackend *blk, int64_t offset, unsigned int bytes,
               QEMUIOVector *qiov, BdrvRequestFlags flags)
 {
     int ret;
+    int64_t start_ns = 0;
     BlockDriverState *bs;
 
     blk_wait_while_drained(blk);
@@ -1206,9 +1207,15 @@ blk_do_preadv(BlockBackend *blk, int64_t offset, unsigned int bytes,
     if (blk->public.throttle_group_member.throttle_state) {
         throttle_group_co_io_limits_intercept(&blk->public.throttle_group_member,
                 bytes, false);
+        start_ns = throttle_group_latency_start(
+                &blk->public.throttle_group_member);
     }
 
     ret = bdrv_co_preadv(blk->root, offset, bytes, qiov, flags);
+    if (start_ns) {
+        throttle_group_account_latency(&blk->public.throttle_group_member,
+                                       start_ns);
+    }
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -1233,6 +1240,7 @@ blk_do_pwritev_part(BlockBackend *blk, int64_t offset, unsigned int bytes,
                     BdrvRequestFlags flags)
 {
     int ret;
+    int64_t start_ns = 0;
     BlockDriverState *bs;
 
     blk_wait_while_drained(blk);
@@ -1251,6 +1259,8 @@ blk_do_pwritev_part(BlockBackend *blk, int64_t offset, unsigned int bytes,
     if (blk->public.throttle_group_member.throttle_state) {
         throttle_group_co_io_limits_intercept(&blk->public.throttle_group_member,
                 bytes, true);
+        start_ns = throttle_group_latency_start(
+                &blk->public.throttle_group_member);
     }
 
     if (!blk->enable_write_cache) {
@@ -1259,6 +1269,10 @@ blk_do_pwritev_part(BlockBackend *blk, int64_t offset, unsigned int bytes,
 
     ret = bdrv_co_pwritev_part(blk->root, offset, bytes, qiov, qiov_offset,
                                flags);
+    if (start_ns) {
+        throttle_group_account_latency(&blk->public.throttle_group_member,
+                                       start_ns);
+    }
     bdrv_dec_in_flight(bs);
     return ret;
 }
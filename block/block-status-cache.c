@@ -0,0 +1,218 @@
+/*
+ * Block layer block-status cache
+ *
+ * Remembers the results of bdrv_co_block_status() on protocol nodes so
+ * that repeated queries (mirror, backup, qemu-img map/convert, NBD
+ * block-status replies) do not have to go back to the driver, e.g. to
+ * lseek(SEEK_DATA/SEEK_HOLE) in file-posix, for every call.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block_int.h"
+
+/*
+ * Upper bound on the number of cached extents per node.  When it is
+ * reached the whole cache is dropped; refilling it is cheap compared to
+ * tracking usage for an LRU policy.
+ */
+#define BDRV_BSC_MAX_ENTRIES 1024
+
+typedef struct BdrvBlockStatusCacheEntry {
+    int64_t offset;
+    int64_t bytes;
+    int ret;
+} BdrvBlockStatusCacheEntry;
+
+typedef struct BdrvBlockStatusCacheRange {
+    int64_t offset;
+    int64_t bytes;
+} BdrvBlockStatusCacheRange;
+
+static gint bsc_entry_cmp(gconstpointer a, gconstpointer b, gpointer opaque)
+{
+    const BdrvBlockStatusCacheEntry *ea = a;
+    const BdrvBlockStatusCacheEntry *eb = b;
+
+    return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+}
+
+/*
+ * g_tree_search() callback: return 0 if the entry intersects the range,
+ * otherwise the direction in which to continue the search.  Entries are
+ * never overlapping, so this is a total order with respect to the range.
+ */
+static gint bsc_entry_search(gconstpointer key, gconstpointer opaque)
+{
+    const BdrvBlockStatusCacheEntry *e = key;
+    const BdrvBlockStatusCacheRange *r = opaque;
+
+    if (r->offset + r->bytes <= e->offset) {
+        return -1;
+    }
+    if (r->offset >= e->offset + e->bytes) {
+        return 1;
+    }
+    return 0;
+}
+
+static GTree *bsc_new_tree(void)
+{
+    return g_tree_new_full(bsc_entry_cmp, NULL, g_free, NULL);
+}
+
+void bdrv_bsc_init(BlockDriverState *bs)
+{
+    qemu_mutex_init(&bs->bsc.lock);
+    bs->bsc.entries = bsc_new_tree();
+}
+
+void bdrv_bsc_cleanup(BlockDriverState *bs)
+{
+    g_tree_unref(bs->bsc.entries);
+    bs->bsc.entries = NULL;
+    qemu_mutex_destroy(&bs->bsc.lock);
+}
+
+/*
+ * The two helpers below only drop entries.  The generation is bumped by
+ * the callers that invalidate because the status may have changed, not
+ * by bdrv_bsc_fill() making room for a new extent: that would make every
+ * fill discard the results of all concurrent queries.
+ *
+ * Called with bs->bsc.lock held.
+ */
+static void bsc_drop_all_locked(BlockDriverState *bs)
+{
+    if (g_tree_nnodes(bs->bsc.entries)) {
+        g_tree_unref(bs->bsc.entries);
+        bs->bsc.entries = bsc_new_tree();
+    }
+}
+
+/* Called with bs->bsc.lock held */
+static void bsc_drop_range_locked(BlockDriverState *bs,
+                                  int64_t offset, int64_t bytes)
+{
+    BdrvBlockStatusCacheRange range = { .offset = offset, .bytes = bytes };
+    BdrvBlockStatusCacheEntry *e;
+
+    while ((e = g_tree_search(bs->bsc.entries, bsc_entry_search, &range))) {
+        g_tree_remove(bs->bsc.entries, e);
+    }
+}
+
+/**
+ * bdrv_bsc_generation:
+ *
+ * Return a counter that changes whenever cached extents of @bs are
+ * invalidated.  Sample it before querying the driver and pass it to
+ * bdrv_bsc_fill(), so that a result which raced with a write is not
+ * cached.
+ */
+unsigned bdrv_bsc_generation(BlockDriverState *bs)
+{
+    return qatomic_read(&bs->bsc.gen);
+}
+
+/**
+ * bdrv_bsc_lookup:
+ *
+ * Look up the block status of @offset in the cache of @bs.  On a hit,
+ * store the cached status in @ret and the number of bytes starting at
+ * @offset that share it (at most @bytes) in @pnum, and return true.
+ */
+bool bdrv_bsc_lookup(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                     int64_t *pnum, int *ret)
+{
+    BdrvBlockStatusCacheRange range = { .offset = offset, .bytes = 1 };
+    BdrvBlockStatusCacheEntry *e;
+    bool hit = false;
+
+    qemu_mutex_lock(&bs->bsc.lock);
+    e = g_tree_search(bs->bsc.entries, bsc_entry_search, &range);
+    if (e) {
+        *pnum = MIN(bytes, e->offset + e->bytes - offset);
+        *ret = e->ret;
+        hit = true;
+    }
+    qemu_mutex_unlock(&bs->bsc.lock);
+
+    return hit;
+}
+
+/**
+ * bdrv_bsc_fill:
+ *
+ * Record that [@offset, @offset + @bytes) has block status @ret, which
+ * must be a combination of BDRV_BLOCK_DATA, BDRV_BLOCK_ZERO and
+ * BDRV_BLOCK_OFFSET_VALID with the mapping being the identity.  @gen is
+ * the value of bdrv_bsc_generation() from before @ret was computed.
+ */
+void bdrv_bsc_fill(BlockDriverState *bs, unsigned gen,
+                   int64_t offset, int64_t bytes, int ret)
+{
+    BdrvBlockStatusCacheEntry *e;
+
+    assert(!(ret & ~(BDRV_BLOCK_DATA | BDRV_BLOCK_ZERO |
+                     BDRV_BLOCK_OFFSET_VALID)));
+
+    /*
+     * A hole may only be cached if nobody else can write to the node
+     * behind our back: other users of the same image have to go through
+     * bdrv_co_write_req_finish() of this node, or are locked out by the
+     * lack of a shared WRITE permission.  Data extents are always safe to
+     * report, because data is also a valid answer for zeroed areas.
+     */
+    if ((ret & BDRV_BLOCK_ZERO) && !qatomic_read(&bs->bsc.cache_zero)) {
+        return;
+    }
+
+    e = g_new(BdrvBlockStatusCacheEntry, 1);
+    e->offset = offset;
+    e->bytes = bytes;
+    e->ret = ret;
+
+    qemu_mutex_lock(&bs->bsc.lock);
+    if (qatomic_read(&bs->bsc.gen) != gen) {
+        qemu_mutex_unlock(&bs->bsc.lock);
+        g_free(e);
+        return;
+    }
+    if (g_tree_nnodes(bs->bsc.entries) >= BDRV_BSC_MAX_ENTRIES) {
+        bsc_drop_all_locked(bs);
+    } else {
+        bsc_drop_range_locked(bs, offset, bytes);
+    }
+    g_tree_insert(bs->bsc.entries, e, e);
+    qemu_mutex_unlock(&bs->bsc.lock);
+}
+
+/**
+ * bdrv_bsc_invalidate_range:
+ *
+ * Drop all cached extents that intersect [@offset, @offset + @bytes).
+ */
+void bdrv_bsc_invalidate_range(BlockDriverState *bs,
+                               int64_t offset, int64_t bytes)
+{
+    qemu_mutex_lock(&bs->bsc.lock);
+    qatomic_inc(&bs->bsc.gen);
+    bsc_drop_range_locked(bs, offset, bytes);
+    qemu_mutex_unlock(&bs->bsc.lock);
+}
+
+/**
+ * bdrv_bsc_invalidate_all:
+ *
+ * Drop all cached extents of @bs.
+ */
+void bdrv_bsc_invalidate_all(BlockDriverState *bs)
+{
+    qemu_mutex_lock(&bs->bsc.lock);
+    qatomic_inc(&bs->bsc.gen);
+    bsc_drop_all_locked(bs);
+    qemu_mutex_unlock(&bs->bsc.lock);
+}
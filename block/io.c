@@ -142,6 +142,9 @@ void bdrv_refresh_limits(BlockDriverState *bs, Error **errp)
 
     memset(&bs->bl, 0, sizeof(bs->bl));
 
+    /* Cached extents are aligned to the old request_alignment */
+    bdrv_bsc_invalidate_all(bs);
+
     if (!drv) {
         return;
     }
@@ -1618,6 +1621,28 @@ int coroutine_fn bdrv_co_preadv(BdrvChild *child,
     return bdrv_co_preadv_part(child, offset, bytes, qiov, 0, flags);
 }
 
+/*
+ * Return the start time of a request for bdrv_timing_done(), or 0 if timing
+ * is disabled for @bs.
+ */
+static inline int64_t bdrv_timing_start(BlockDriverState *bs)
+{
+    if (likely(!qatomic_read(&bs->timing))) {
+        return 0;
+    }
+    return qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+}
+
+static void bdrv_timing_done(BlockDriverState *bs, enum BlockAcctType type,
+                             int64_t start_ns)
+{
+    if (start_ns) {
+        block_node_timing_account(bs->timing, type,
+                                  qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                  start_ns);
+    }
+}
+
 int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     int64_t offset, unsigned int bytes,
     QEMUIOVector *qiov, size_t qiov_offset,
@@ -1626,6 +1651,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     BlockDriverState *bs = child->bs;
     BdrvTrackedRequest req;
     BdrvRequestPadding pad;
+    int64_t start_ns;
     int ret;
 
     trace_bdrv_co_preadv(bs, offset, bytes, flags);
@@ -1648,6 +1674,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     }
 
     bdrv_inc_in_flight(bs);
+    start_ns = bdrv_timing_start(bs);
 
     /* Don't do copy-on-read if we read data before write operation */
     if (qatomic_read(&bs->copy_on_read)) {
@@ -1661,6 +1688,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
                               bs->bl.request_alignment,
                               qiov, qiov_offset, flags);
     tracked_request_end(&req);
+    bdrv_timing_done(bs, BLOCK_ACCT_READ, start_ns);
     bdrv_dec_in_flight(bs);
 
     bdrv_padding_destroy(&pad);
@@ -1840,6 +1868,12 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, uint64_t bytes,
 
     qatomic_inc(&bs->write_gen);
 
+    if (req->type == BDRV_TRACKED_TRUNCATE) {
+        bdrv_bsc_invalidate_all(bs);
+    } else {
+        bdrv_bsc_invalidate_range(bs, offset, bytes);
+    }
+
     /*
      * Discard cannot extend the image, but in error handling cases, such as
      * when reverting a qcow2 cluster allocation, the discarded range can pass
@@ -2038,6 +2072,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     BdrvTrackedRequest req;
     uint64_t align = bs->bl.request_alignment;
     BdrvRequestPadding pad;
+    int64_t start_ns;
     int ret;
 
     trace_bdrv_co_pwritev(child->bs, offset, bytes, flags);
@@ -2071,6 +2106,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     }
 
     bdrv_inc_in_flight(bs);
+    start_ns = bdrv_timing_start(bs);
     /*
      * Align write if necessary by performing a read-modify-write cycle.
      * Pad qiov with the read parts and be sure to have a tracked request not
@@ -2095,6 +2131,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
 
 out:
     tracked_request_end(&req);
+    bdrv_timing_done(bs, BLOCK_ACCT_WRITE, start_ns);
     bdrv_dec_in_flight(bs);
 
     return ret;
@@ -2235,9 +2272,32 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
     aligned_bytes = ROUND_UP(offset + bytes, align) - aligned_offset;
 
     if (bs->drv->bdrv_co_block_status) {
-        ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
-                                            aligned_bytes, pnum, &local_map,
-                                            &local_file);
+        /*
+         * Protocol nodes may have to ask the host (e.g. lseek() with
+         * SEEK_DATA/SEEK_HOLE) for every query, so consult the
+         * block-status cache first.
+         */
+        bool use_cache = want_zero && bs->drv->protocol_name;
+        unsigned bsc_gen = 0;
+
+        if (use_cache &&
+            bdrv_bsc_lookup(bs, aligned_offset, aligned_bytes, pnum, &ret)) {
+            local_map = aligned_offset;
+            local_file = bs;
+        } else {
+            if (use_cache) {
+                bsc_gen = bdrv_bsc_generation(bs);
+            }
+            ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
+                                                aligned_bytes, pnum,
+                                                &local_map, &local_file);
+            if (use_cache && ret >= 0 && local_file == bs &&
+                local_map == aligned_offset &&
+                (ret == (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID) ||
+                 ret == (BDRV_BLOCK_ZERO | BDRV_BLOCK_OFFSET_VALID))) {
+                bdrv_bsc_fill(bs, bsc_gen, aligned_offset, *pnum, ret);
+            }
+        }
     } else {
         /* Default code for filters */
 
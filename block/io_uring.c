@@ -30,6 +30,9 @@ typedef struct LuringAIOCB {
     bool is_read;
     QSIMPLEQ_ENTRY(LuringAIOCB) next;
 
+    /* For requests on the AioContext's ring, see luring_add_sqe() */
+    CqeHandler cqe_handler;
+
     /*
      * Buffered reads may require resubmission, see
      * luring_resubmit_short_read().
@@ -58,14 +61,59 @@ typedef struct LuringState {
     QEMUBH *completion_bh;
 } LuringState;
 
+static void luring_complete(LuringState *s, LuringAIOCB *luringcb, int ret);
+
+static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
+{
+    LuringAIOCB *luringcb = opaque;
+
+    *sqe = luringcb->sqeq;
+}
+
+static void luring_cqe_handler(CqeHandler *cqe_handler)
+{
+    LuringAIOCB *luringcb = container_of(cqe_handler, LuringAIOCB,
+                                         cqe_handler);
+
+    trace_luring_process_completion(NULL, luringcb, cqe_handler->cqe_res);
+    luring_complete(NULL, luringcb, cqe_handler->cqe_res);
+}
+
+/**
+ * luring_add_sqe:
+ *
+ * Submit a request on the io_uring that the current AioContext uses for file
+ * descriptor monitoring.  It is submitted together with the next event loop
+ * iteration's wait for events, which saves the io_uring_enter(2) calls of a
+ * separate ring.
+ *
+ * Returns false if that ring already has as many requests in flight as it
+ * can take, in which case the LuringState ring must be used.
+ */
+static bool luring_add_sqe(LuringAIOCB *luringcb)
+{
+    luringcb->cqe_handler.cb = luring_cqe_handler;
+    return aio_add_sqe(luring_prep_sqe, luringcb, &luringcb->cqe_handler);
+}
+
 /**
  * luring_resubmit:
  *
  * Resubmit a request by appending it to submit_queue.  The caller must ensure
  * that ioq_submit() is called later so that submit_queue requests are started.
+ *
+ * @s is NULL for requests on the AioContext's ring, which are simply queued
+ * there again.  This cannot fail because the completion of the request has
+ * freed its slot.
  */
 static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
 {
+    if (!s) {
+        bool queued = luring_add_sqe(luringcb);
+        assert(queued);
+        return;
+    }
+
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
     s->io_q.in_queue++;
 }
@@ -89,7 +137,7 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     trace_luring_resubmit_short_read(s, luringcb, nread);
 
     /* Update read position */
-    luringcb->total_read = nread;
+    luringcb->total_read += nread;
     remaining = luringcb->qiov->size - luringcb->total_read;
 
     /* Shorten qiov */
@@ -103,13 +151,66 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
                       remaining);
 
     /* Update sqe */
-    luringcb->sqeq.off = nread;
+    luringcb->sqeq.off += nread;
     luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
     luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
 
     luring_resubmit(s, luringcb);
 }
 
+/**
+ * luring_complete:
+ *
+ * Handle the result of a request: resubmit it if it was interrupted or
+ * incomplete, otherwise store the return value and wake up its coroutine.
+ * @s is NULL for requests on the AioContext's ring.
+ */
+static void luring_complete(LuringState *s, LuringAIOCB *luringcb, int ret)
+{
+    /* total_read is non-zero only for resubmitted read requests */
+    int total_bytes = ret + luringcb->total_read;
+
+    if (ret < 0) {
+        if (ret == -EINTR) {
+            luring_resubmit(s, luringcb);
+            return;
+        }
+    } else if (!luringcb->qiov) {
+        goto end;
+    } else if (total_bytes == luringcb->qiov->size) {
+        ret = 0;
+    /* Only read/write */
+    } else {
+        /* Short Read/Write */
+        if (luringcb->is_read) {
+            if (ret > 0) {
+                luring_resubmit_short_read(s, luringcb, ret);
+                return;
+            } else {
+                /* Pad with zeroes */
+                qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
+                                  luringcb->qiov->size - total_bytes);
+                ret = 0;
+            }
+        } else {
+            ret = -ENOSPC;
+        }
+    }
+end:
+    luringcb->ret = ret;
+    qemu_iovec_destroy(&luringcb->resubmit_qiov);
+
+    /*
+     * If the coroutine is already entered it must be in ioq_submit()
+     * and will notice luringcb->ret has been filled in when it
+     * eventually runs later. Coroutines cannot be entered recursively
+     * so avoid doing that!
+     */
+    if (!qemu_coroutine_entered(luringcb->co)) {
+        aio_co_wake(luringcb->co);
+    }
+}
+
 /**
  * luring_process_completions:
  * @s: AIO state
@@ -126,7 +227,6 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 static void luring_process_completions(LuringState *s)
 {
     struct io_uring_cqe *cqes;
-    int total_bytes;
     /*
      * Request completion callbacks can run the nested event loop.
      * Schedule ourselves so the nested event loop will "see" remaining
@@ -161,48 +261,7 @@ static void luring_process_completions(LuringState *s)
         s->io_q.in_flight--;
         trace_luring_process_completion(s, luringcb, ret);
 
-        /* total_read is non-zero only for resubmitted read requests */
-        total_bytes = ret + luringcb->total_read;
-
-        if (ret < 0) {
-            if (ret == -EINTR) {
-                luring_resubmit(s, luringcb);
-                continue;
-            }
-        } else if (!luringcb->qiov) {
-            goto end;
-        } else if (total_bytes == luringcb->qiov->size) {
-            ret = 0;
-        /* Only read/write */
-        } else {
-            /* Short Read/Write */
-            if (luringcb->is_read) {
-                if (ret > 0) {
-                    luring_resubmit_short_read(s, luringcb, ret);
-                    continue;
-                } else {
-                    /* Pad with zeroes */
-                    qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
-                                      luringcb->qiov->size - total_bytes);
-                    ret = 0;
-                }
-            } else {
-                ret = -ENOSPC;
-            }
-        }
-end:
-        luringcb->ret = ret;
-        qemu_iovec_destroy(&luringcb->resubmit_qiov);
-
-        /*
-         * If the coroutine is already entered it must be in ioq_submit()
-         * and will notice luringcb->ret has been filled in when it
-         * eventually runs later. Coroutines cannot be entered recursively
-         * so avoid doing that!
-         */
-        if (!qemu_coroutine_entered(luringcb->co)) {
-            aio_co_wake(luringcb->co);
-        }
+        luring_complete(s, luringcb, ret);
     }
     qemu_bh_cancel(s->completion_bh);
 }
@@ -348,6 +407,12 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     }
     io_uring_sqe_set_data(sqes, luringcb);
 
+    /* Share the event loop's ring if it has one and it has room */
+    if (aio_has_io_uring(qemu_get_current_aio_context()) &&
+        luring_add_sqe(luringcb)) {
+        return 0;
+    }
+
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
     s->io_q.in_queue++;
     trace_luring_do_submit(s, s->io_q.blocked, s->io_q.plugged,
@@ -372,6 +437,7 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
         .qiov       = qiov,
         .is_read    = (type == QEMU_AIO_READ),
     };
+
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
     ret = luring_do_submit(fd, &luringcb, s, offset, type);
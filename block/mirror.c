@@ -28,6 +28,18 @@
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
+/* Maximum number of coroutines prefetching block status ahead of the copy */
+#define MAX_PREFETCH 4
+/* How far ahead of the current iteration block status is prefetched,
+ * in multiples of buf_size */
+#define PREFETCH_BUFS 4
+
+/* Interval in which copy throughput is measured and the size of copy
+ * requests is adapted */
+#define ADAPT_INTERVAL_NS (100 * SCALE_MS)
+/* Copy requests are made smaller if their average latency exceeds this */
+#define ADAPT_MAX_LATENCY_NS (50 * SCALE_MS)
+
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
  */
@@ -84,6 +96,30 @@ typedef struct MirrorBlockJob {
     int in_active_write_counter;
     bool prepared;
     bool in_drain;
+
+    /* Maximum size of a single copy request, adapted at runtime between
+     * min_io_bytes and max_io_bytes by mirror_adapt_io_bytes() */
+    int64_t io_bytes;
+    int64_t min_io_bytes;
+    int64_t max_io_bytes;
+    int adapt_direction;
+    uint64_t last_throughput;
+
+    /* Copy requests completed in the current measurement interval */
+    int64_t window_start_ns;
+    uint64_t window_bytes;
+    uint64_t window_ops;
+    uint64_t window_latency_ns;
+    bool window_throttled;
+
+    /* Throughput of the last complete interval, in bytes per second */
+    uint64_t throughput;
+
+    /* Block status prefetching for upcoming dirty areas */
+    int prefetch_in_flight;
+    uint64_t prefetch_count;
+    int64_t prefetch_offset;
+    CoQueue prefetch_queue;
 } MirrorBlockJob;
 
 typedef struct MirrorBDSOpaque {
@@ -107,6 +143,9 @@ struct MirrorOp {
     CoQueue waiting_requests;
     Coroutine *co;
 
+    /* Time at which a copy operation was issued */
+    int64_t start_ns;
+
     QTAILQ_ENTRY(MirrorOp) next;
 };
 
@@ -165,6 +204,48 @@ static void coroutine_fn mirror_wait_on_conflicts(MirrorOp *self,
     }
 }
 
+/* Grow or shrink copy requests depending on the effect the last change had
+ * on throughput, and on the latency of the requests. */
+static void mirror_adapt_io_bytes(MirrorBlockJob *s, int64_t now)
+{
+    int64_t elapsed = now - s->window_start_ns;
+    uint64_t avg_latency;
+
+    if (elapsed < ADAPT_INTERVAL_NS) {
+        return;
+    }
+
+    s->throughput = muldiv64(s->window_bytes, NANOSECONDS_PER_SECOND,
+                             elapsed);
+
+    /* With a rate limit, throughput says nothing about the request size */
+    if (s->window_ops && !s->window_throttled) {
+        avg_latency = s->window_latency_ns / s->window_ops;
+
+        if (avg_latency > ADAPT_MAX_LATENCY_NS) {
+            s->adapt_direction = -1;
+        } else if (s->throughput * 100 < s->last_throughput * 95) {
+            /* The last step made things worse, go back */
+            s->adapt_direction = -s->adapt_direction;
+        }
+
+        if (s->adapt_direction > 0) {
+            s->io_bytes = MIN(s->io_bytes * 2, s->max_io_bytes);
+        } else {
+            s->io_bytes = MAX(s->io_bytes / 2, s->min_io_bytes);
+        }
+        s->last_throughput = s->throughput;
+        trace_mirror_adapt_io_bytes(s, s->throughput, avg_latency,
+                                    s->io_bytes);
+    }
+
+    s->window_start_ns = now;
+    s->window_bytes = 0;
+    s->window_ops = 0;
+    s->window_latency_ns = 0;
+    s->window_throttled = false;
+}
+
 static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
@@ -174,6 +255,15 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
 
     trace_mirror_iteration_done(s, op->offset, op->bytes, ret);
 
+    if (op->start_ns && ret >= 0) {
+        int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+        s->window_bytes += op->bytes;
+        s->window_ops++;
+        s->window_latency_ns += now - op->start_ns;
+        mirror_adapt_io_bytes(s, now);
+    }
+
     s->in_flight--;
     s->bytes_in_flight -= op->bytes;
     iov = op->qiov.iov;
@@ -372,6 +462,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
     s->in_flight++;
     s->bytes_in_flight += op->bytes;
     op->is_in_flight = true;
+    op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
     ret = bdrv_co_preadv(s->mirror_top_bs->backing, op->offset, op->bytes,
@@ -454,6 +545,92 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
     return bytes_handled;
 }
 
+typedef struct MirrorPrefetch {
+    MirrorBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+} MirrorPrefetch;
+
+/* Query the block status of an area that is going to be copied soon, so
+ * that the metadata needed for it is cached by the time mirror_iteration()
+ * gets there.  The result itself is not used: the area may be written to
+ * before it is copied. */
+static void coroutine_fn mirror_co_prefetch(void *opaque)
+{
+    MirrorPrefetch *p = opaque;
+    MirrorBlockJob *s = p->s;
+    BlockDriverState *source = s->mirror_top_bs->backing->bs;
+    int64_t offset = p->offset;
+    int64_t end = p->offset + p->bytes;
+
+    trace_mirror_prefetch(s, p->offset, p->bytes);
+
+    while (offset < end && s->ret >= 0 &&
+           !job_is_cancelled(&s->common.job))
+    {
+        int64_t pnum;
+        int ret;
+
+        ret = bdrv_block_status_above(source, NULL, offset, end - offset,
+                                      &pnum, NULL, NULL);
+        if (ret < 0 || pnum == 0) {
+            break;
+        }
+        offset += pnum;
+    }
+
+    s->prefetch_in_flight--;
+    qemu_co_queue_restart_all(&s->prefetch_queue);
+    g_free(p);
+}
+
+/* Start prefetching block status for the dirty areas following @end */
+static void coroutine_fn mirror_prefetch_block_status(MirrorBlockJob *s,
+                                                      int64_t end)
+{
+    int64_t limit = MIN(end + PREFETCH_BUFS * s->buf_size, s->bdev_length);
+
+    /* Restart behind the current iteration if the dirty iterator wrapped */
+    if (s->prefetch_offset < end || s->prefetch_offset > limit) {
+        s->prefetch_offset = end;
+    }
+
+    while (s->prefetch_in_flight < MAX_PREFETCH && s->prefetch_offset < limit) {
+        MirrorPrefetch *p;
+        int64_t dirty_offset, dirty_bytes;
+        bool found;
+
+        bdrv_dirty_bitmap_lock(s->dirty_bitmap);
+        found = bdrv_dirty_bitmap_next_dirty_area(s->dirty_bitmap,
+                                                  s->prefetch_offset, limit,
+                                                  s->buf_size, &dirty_offset,
+                                                  &dirty_bytes);
+        bdrv_dirty_bitmap_unlock(s->dirty_bitmap);
+        if (!found) {
+            s->prefetch_offset = limit;
+            break;
+        }
+
+        p = g_new(MirrorPrefetch, 1);
+        *p = (MirrorPrefetch) {
+            .s      = s,
+            .offset = dirty_offset,
+            .bytes  = dirty_bytes,
+        };
+        s->prefetch_offset = dirty_offset + dirty_bytes;
+        s->prefetch_in_flight++;
+        s->prefetch_count++;
+        qemu_coroutine_enter(qemu_coroutine_create(mirror_co_prefetch, p));
+    }
+}
+
+static void coroutine_fn mirror_wait_for_prefetch(MirrorBlockJob *s)
+{
+    while (s->prefetch_in_flight > 0) {
+        qemu_co_queue_wait(&s->prefetch_queue, NULL);
+    }
+}
+
 static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
 {
     BlockDriverState *source = s->mirror_top_bs->backing->bs;
@@ -463,7 +640,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int64_t max_io_bytes = s->io_bytes;
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -528,6 +705,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     QTAILQ_INSERT_TAIL(&s->ops_in_flight, pseudo_op, next);
 
     bitmap_set(s->in_flight_bitmap, offset / s->granularity, nb_chunks);
+    mirror_prefetch_block_status(s, offset + nb_chunks * s->granularity);
     while (nb_chunks > 0 && offset < s->bdev_length) {
         int ret;
         int64_t io_bytes;
@@ -581,6 +759,9 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
         offset += io_bytes;
         nb_chunks -= DIV_ROUND_UP(io_bytes, s->granularity);
         delay_ns = block_job_ratelimit_get_delay(&s->common, io_bytes_acct);
+        if (delay_ns) {
+            s->window_throttled = true;
+        }
     }
 
     ret = delay_ns;
@@ -615,6 +796,7 @@ static void mirror_free_init(MirrorBlockJob *s)
  */
 static void coroutine_fn mirror_wait_for_all_io(MirrorBlockJob *s)
 {
+    mirror_wait_for_prefetch(s);
     while (s->in_flight > 0) {
         mirror_wait_for_free_in_flight_slot(s);
     }
@@ -953,8 +1135,15 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     }
 
     mirror_free_init(s);
+    qemu_co_queue_init(&s->prefetch_queue);
+
+    s->io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    s->min_io_bytes = s->granularity;
+    s->max_io_bytes = MAX(s->io_bytes, s->buf_size / 4);
+    s->adapt_direction = 1;
 
     s->last_pause_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    s->window_start_ns = s->last_pause_ns;
     if (!s->is_none_mode) {
         ret = mirror_dirty_init(s);
         if (ret < 0 || job_is_cancelled(&s->common.job)) {
@@ -1088,6 +1277,7 @@ immediate_exit:
         assert(need_drain);
         mirror_wait_for_all_io(s);
     }
+    mirror_wait_for_prefetch(s);
 
     assert(s->in_flight == 0);
     qemu_vfree(s->buf);
@@ -1176,7 +1366,19 @@ static bool mirror_drained_poll(BlockJob *job)
         return true;
     }
 
-    return !!s->in_flight;
+    return s->in_flight || s->prefetch_in_flight;
+}
+
+static void mirror_query_io_stats(BlockJob *job, BlockJobIoStats *stats)
+{
+    MirrorBlockJob *s = container_of(job, MirrorBlockJob, common);
+
+    stats->throughput = s->throughput;
+    stats->in_flight_ops = s->in_flight;
+    stats->in_flight_bytes = s->bytes_in_flight;
+    stats->chunk_size = s->io_bytes;
+    stats->prefetch_in_flight = s->prefetch_in_flight;
+    stats->prefetch_count = s->prefetch_count;
 }
 
 static const BlockJobDriver mirror_job_driver = {
@@ -1192,6 +1394,7 @@ static const BlockJobDriver mirror_job_driver = {
         .complete               = mirror_complete,
     },
     .drained_poll           = mirror_drained_poll,
+    .query_io_stats         = mirror_query_io_stats,
 };
 
 static const BlockJobDriver commit_active_job_driver = {
@@ -1207,6 +1410,7 @@ static const BlockJobDriver commit_active_job_driver = {
         .complete               = mirror_complete,
     },
     .drained_poll           = mirror_drained_poll,
+    .query_io_stats         = mirror_query_io_stats,
 };
 
 static void coroutine_fn
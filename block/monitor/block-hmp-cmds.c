@@ -840,7 +840,7 @@ void hmp_info_block_jobs(Monitor *mon, const QDict *qdict)
 {
     BlockJobInfoList *list;
 
-    list = qmp_query_block_jobs(&error_abort);
+    list = qmp_query_block_jobs(false, false, &error_abort);
 
     if (!list) {
         monitor_printf(mon, "No active jobs\n");
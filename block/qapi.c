@@ -528,6 +528,27 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
                                  &ds->flush_latency_histogram);
 }
 
+static BlockNodeTimingStats *bdrv_query_node_timing(BlockNodeTiming *timing)
+{
+    BlockNodeTimingStats *nt = g_new0(BlockNodeTimingStats, 1);
+    bool has_histogram;
+
+    qemu_mutex_lock(&timing->lock);
+    nt->rd_operations = timing->nr_ops[BLOCK_ACCT_READ];
+    nt->wr_operations = timing->nr_ops[BLOCK_ACCT_WRITE];
+    nt->rd_total_time_ns = timing->total_time_ns[BLOCK_ACCT_READ];
+    nt->wr_total_time_ns = timing->total_time_ns[BLOCK_ACCT_WRITE];
+    bdrv_latency_histogram_stats(&timing->latency_histogram[BLOCK_ACCT_READ],
+                                 &has_histogram, &nt->rd_latency_histogram);
+    assert(has_histogram);
+    bdrv_latency_histogram_stats(&timing->latency_histogram[BLOCK_ACCT_WRITE],
+                                 &has_histogram, &nt->wr_latency_histogram);
+    assert(has_histogram);
+    qemu_mutex_unlock(&timing->lock);
+
+    return nt;
+}
+
 static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
                                         bool blk_level)
 {
@@ -561,6 +582,11 @@ static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
         s->has_driver_specific = true;
     }
 
+    if (bs->timing) {
+        s->has_node_timing = true;
+        s->node_timing = bdrv_query_node_timing(bs->timing);
+    }
+
     parent_child = bdrv_primary_child(bs);
     if (!parent_child ||
         !(parent_child->role & (BDRV_CHILD_DATA | BDRV_CHILD_FILTERED)))
@@ -0,0 +1,404 @@
+/*
+ * Flattened read index for qcow2 backing chains
+ *
+ * Reads of clusters that are unallocated in a qcow2 image are passed to
+ * the backing file, which repeats its own L2 lookup and possibly passes
+ * the request on again.  With long chains of snapshot overlays a cold
+ * read therefore costs one metadata lookup per layer.
+ *
+ * As long as the backing chain is read-only, which layer provides the
+ * data for a given guest offset cannot change.  This file computes that
+ * "owner" lazily, in chunks, from the allocation status of the layers and
+ * remembers it, so that subsequent reads can be issued directly to the
+ * owning node.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block_int.h"
+#include "qemu/bitmap.h"
+#include "qcow2.h"
+
+/* Granularity in which the index is built: 1 GB of guest address space */
+#define QCOW2_BACKING_INDEX_CHUNK_BITS 30
+#define QCOW2_BACKING_INDEX_CHUNK_SIZE (1ULL << QCOW2_BACKING_INDEX_CHUNK_BITS)
+
+/* Extent owner for ranges that are not allocated anywhere in the chain */
+#define QCOW2_BACKING_INDEX_ZERO (-1)
+
+typedef struct Qcow2BackingIndexExtent {
+    uint64_t offset;
+    uint64_t bytes;
+    int owner; /* Index into Qcow2BackingIndex.layers, or _ZERO */
+} Qcow2BackingIndexExtent;
+
+typedef struct Qcow2BackingIndexChunk {
+    int nb_extents;
+    Qcow2BackingIndexExtent extents[];
+} Qcow2BackingIndexChunk;
+
+struct Qcow2BackingIndex {
+    /*
+     * One reference is held by s->backing_index, and one by each coroutine
+     * that is building a chunk without holding s->backing_index_lock.
+     */
+    unsigned refcnt;
+
+    /* Value of bdrv_graph_generation() when the index was created */
+    unsigned graph_gen;
+
+    /*
+     * false if the chain cannot be indexed (e.g. some layer is writable);
+     * reads then simply go to bs->backing.
+     */
+    bool usable;
+
+    /*
+     * layers[i] is the BdrvChild through which layer i is read, i.e.
+     * layers[0] == bs->backing and layers[i + 1] == layers[i]->bs->backing.
+     */
+    int nb_layers;
+    BdrvChild **layers;
+    int64_t *layer_len;
+
+    /* Guest size of the indexed image, rounded up to whole chunks */
+    uint64_t nb_chunks;
+    Qcow2BackingIndexChunk **chunks;
+
+    /*
+     * Chunks are built outside s->backing_index_lock; a set bit means that
+     * some coroutine is building that chunk.  Readers of the same chunk
+     * wait on chunk_built instead of walking the chain a second time.
+     */
+    unsigned long *building;
+    CoQueue chunk_built;
+};
+
+static void qcow2_backing_index_unref(Qcow2BackingIndex *idx)
+{
+    uint64_t i;
+
+    if (!idx || --idx->refcnt) {
+        return;
+    }
+
+    for (i = 0; i < idx->nb_chunks; i++) {
+        g_free(idx->chunks[i]);
+    }
+    g_free(idx->chunks);
+    g_free(idx->building);
+    g_free(idx->layers);
+    g_free(idx->layer_len);
+    g_free(idx);
+}
+
+void qcow2_backing_index_drop(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    qcow2_backing_index_unref(s->backing_index);
+    s->backing_index = NULL;
+}
+
+/*
+ * A layer can be skipped over only if it just passes unallocated reads to
+ * its backing file, and the data it provides cannot change while the
+ * index exists.
+ */
+static bool qcow2_backing_index_layer_ok(BlockDriverState *bs)
+{
+    uint64_t perm, shared_perm;
+
+    if (!bs->drv || bs->drv->is_filter || qatomic_read(&bs->copy_on_read)) {
+        return false;
+    }
+
+    bdrv_get_cumulative_perm(bs, &perm, &shared_perm);
+    return !(perm & (BLK_PERM_WRITE | BLK_PERM_RESIZE));
+}
+
+static Qcow2BackingIndex *qcow2_backing_index_new(BlockDriverState *bs)
+{
+    Qcow2BackingIndex *idx = g_new0(Qcow2BackingIndex, 1);
+    BdrvChild *c;
+    int64_t len;
+    int i;
+
+    idx->refcnt = 1;
+    idx->graph_gen = bdrv_graph_generation();
+    qemu_co_queue_init(&idx->chunk_built);
+
+    len = bdrv_getlength(bs);
+    for (c = bs->backing; c; c = c->bs->backing) {
+        if (!qcow2_backing_index_layer_ok(c->bs)) {
+            return idx;
+        }
+        idx->nb_layers++;
+    }
+
+    /* With a single backing layer there is nothing to skip */
+    if (len < 0 || idx->nb_layers < 2) {
+        return idx;
+    }
+
+    idx->layers = g_new(BdrvChild *, idx->nb_layers);
+    idx->layer_len = g_new(int64_t, idx->nb_layers);
+    for (c = bs->backing, i = 0; c; c = c->bs->backing, i++) {
+        idx->layers[i] = c;
+        idx->layer_len[i] = bdrv_getlength(c->bs);
+        if (idx->layer_len[i] < 0) {
+            return idx;
+        }
+    }
+
+    idx->nb_chunks = DIV_ROUND_UP(len, QCOW2_BACKING_INDEX_CHUNK_SIZE);
+    idx->chunks = g_new0(Qcow2BackingIndexChunk *, idx->nb_chunks);
+    idx->building = bitmap_new(idx->nb_chunks);
+    idx->usable = true;
+
+    return idx;
+}
+
+/*
+ * Find the owner of the guest range starting at @offset and store it in
+ * @owner: the first layer in which it is allocated, or
+ * QCOW2_BACKING_INDEX_ZERO if reads from bs->backing return zeroes for it.
+ * The number of bytes (at most @bytes) that share this owner is stored in
+ * @pnum.  Returns 0 on success and negative errno on error.
+ */
+static int coroutine_fn
+qcow2_backing_index_find_owner(Qcow2BackingIndex *idx, uint64_t offset,
+                               uint64_t bytes, int *owner, uint64_t *pnum)
+{
+    int64_t n = bytes;
+    int i;
+
+    for (i = 0; i < idx->nb_layers; i++) {
+        int64_t layer_pnum;
+        int ret;
+
+        /* Reads past the end of a layer return zeroes */
+        if (offset >= (uint64_t)idx->layer_len[i]) {
+            break;
+        }
+        n = MIN(n, idx->layer_len[i] - offset);
+
+        ret = bdrv_is_allocated(idx->layers[i]->bs, offset, n, &layer_pnum);
+        if (ret < 0) {
+            return ret;
+        }
+        assert(layer_pnum > 0 && layer_pnum <= n);
+        n = layer_pnum;
+        if (ret) {
+            *owner = i;
+            *pnum = n;
+            return 0;
+        }
+    }
+
+    *owner = QCOW2_BACKING_INDEX_ZERO;
+    *pnum = n;
+    return 0;
+}
+
+/*
+ * Compute the extents of chunk @chunk_idx and return them in @pchunk.
+ * Called without s->backing_index_lock, with a reference to @idx held.
+ */
+static int coroutine_fn
+qcow2_backing_index_build_chunk(Qcow2BackingIndex *idx, uint64_t chunk_idx,
+                                uint64_t len, Qcow2BackingIndexChunk **pchunk)
+{
+    uint64_t start = chunk_idx << QCOW2_BACKING_INDEX_CHUNK_BITS;
+    uint64_t end = MIN(start + QCOW2_BACKING_INDEX_CHUNK_SIZE, len);
+    GArray *extents;
+    Qcow2BackingIndexChunk *chunk;
+    uint64_t offset = start;
+    int ret;
+
+    extents = g_array_new(false, false, sizeof(Qcow2BackingIndexExtent));
+
+    while (offset < end) {
+        Qcow2BackingIndexExtent *last = NULL;
+        uint64_t pnum;
+        int owner;
+
+        ret = qcow2_backing_index_find_owner(idx, offset, end - offset,
+                                             &owner, &pnum);
+        if (ret < 0) {
+            g_array_free(extents, true);
+            return ret;
+        }
+
+        if (extents->len) {
+            last = &g_array_index(extents, Qcow2BackingIndexExtent,
+                                  extents->len - 1);
+        }
+        if (last && last->owner == owner) {
+            last->bytes += pnum;
+        } else {
+            Qcow2BackingIndexExtent e = {
+                .offset = offset,
+                .bytes  = pnum,
+                .owner  = owner,
+            };
+            g_array_append_val(extents, e);
+        }
+        offset += pnum;
+    }
+
+    chunk = g_malloc(sizeof(*chunk) +
+                     extents->len * sizeof(Qcow2BackingIndexExtent));
+    chunk->nb_extents = extents->len;
+    memcpy(chunk->extents, extents->data,
+           extents->len * sizeof(Qcow2BackingIndexExtent));
+    *pchunk = chunk;
+    g_array_free(extents, true);
+
+    return 0;
+}
+
+/*
+ * Look up @offset in the index, building the index and the covering chunk
+ * if necessary.  Returns 1 and stores the child to read from in @child
+ * (NULL if the range reads as zeroes) and the length of the range in
+ * @pnum (at most @bytes) on success, 0 if the index cannot be used, and
+ * negative errno on error.
+ *
+ * Called with s->backing_index_lock held.  The lock is dropped while the
+ * chunk is built, so that reads of other chunks can proceed.
+ */
+static int coroutine_fn
+qcow2_backing_index_lookup(BlockDriverState *bs, uint64_t offset,
+                           uint64_t bytes, BdrvChild **child, uint64_t *pnum)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2BackingIndex *idx;
+    Qcow2BackingIndexChunk *chunk;
+    uint64_t chunk_idx = offset >> QCOW2_BACKING_INDEX_CHUNK_BITS;
+    int lo, hi;
+    int ret;
+
+retry:
+    idx = s->backing_index;
+    if (!idx || idx->graph_gen != bdrv_graph_generation()) {
+        qcow2_backing_index_drop(bs);
+        idx = s->backing_index = qcow2_backing_index_new(bs);
+        if (idx->usable) {
+            s->backing_index_builds++;
+        }
+    }
+
+    if (!idx->usable || chunk_idx >= idx->nb_chunks) {
+        return 0;
+    }
+
+    if (!idx->chunks[chunk_idx]) {
+        if (test_bit(chunk_idx, idx->building)) {
+            qemu_co_queue_wait(&idx->chunk_built, &s->backing_index_lock);
+            goto retry;
+        }
+
+        set_bit(chunk_idx, idx->building);
+        idx->refcnt++;
+        qemu_co_mutex_unlock(&s->backing_index_lock);
+
+        chunk = NULL;
+        ret = qcow2_backing_index_build_chunk(idx, chunk_idx,
+                                              bdrv_getlength(bs), &chunk);
+
+        qemu_co_mutex_lock(&s->backing_index_lock);
+        clear_bit(chunk_idx, idx->building);
+        qemu_co_queue_restart_all(&idx->chunk_built);
+
+        /* Only publish into an index that has not been dropped meanwhile */
+        if (ret == 0 && idx == s->backing_index) {
+            idx->chunks[chunk_idx] = chunk;
+        } else {
+            g_free(chunk);
+        }
+        qcow2_backing_index_unref(idx);
+        if (ret < 0) {
+            return ret;
+        }
+        goto retry;
+    }
+    chunk = idx->chunks[chunk_idx];
+
+    /* Binary search for the extent containing offset */
+    lo = 0;
+    hi = chunk->nb_extents;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (chunk->extents[mid].offset <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo >= chunk->nb_extents ||
+        offset >= chunk->extents[lo].offset + chunk->extents[lo].bytes) {
+        /* Beyond the end of the image */
+        return 0;
+    }
+
+    *pnum = MIN(bytes, chunk->extents[lo].offset + chunk->extents[lo].bytes -
+                       offset);
+    *child = chunk->extents[lo].owner == QCOW2_BACKING_INDEX_ZERO ? NULL :
+             idx->layers[chunk->extents[lo].owner];
+
+    return 1;
+}
+
+/*
+ * Read a range that is unallocated in @bs from its backing chain, using
+ * the backing index to go directly to the layer that has the data.
+ */
+int coroutine_fn qcow2_co_preadv_backing(BlockDriverState *bs,
+                                         uint64_t offset, uint64_t bytes,
+                                         QEMUIOVector *qiov,
+                                         size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    assert(bs->backing);
+
+    while (bytes) {
+        BdrvChild *child = NULL;
+        uint64_t cur_bytes = 0;
+
+        qemu_co_mutex_lock(&s->backing_index_lock);
+        ret = qcow2_backing_index_lookup(bs, offset, bytes, &child,
+                                         &cur_bytes);
+        if (ret > 0) {
+            s->backing_index_reads++;
+        }
+        qemu_co_mutex_unlock(&s->backing_index_lock);
+
+        if (ret < 0) {
+            return ret;
+        } else if (ret == 0) {
+            return bdrv_co_preadv_part(bs->backing, offset, bytes,
+                                       qiov, qiov_offset, 0);
+        }
+
+        if (child) {
+            ret = bdrv_co_preadv_part(child, offset, cur_bytes,
+                                      qiov, qiov_offset, 0);
+            if (ret < 0) {
+                return ret;
+            }
+        } else {
+            qemu_iovec_memset(qiov, qiov_offset, 0, cur_bytes);
+        }
+
+        offset += cur_bytes;
+        bytes -= cur_bytes;
+        qiov_offset += cur_bytes;
+    }
+
+    return 0;
+}
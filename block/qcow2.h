@@ -150,6 +150,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_BACKING_READ_INDEX "backing-read-index"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -324,6 +325,8 @@ typedef struct Qcow2BitmapHeaderExt {
 
 #define QCOW2_MAX_THREADS 4
 
+typedef struct Qcow2BackingIndex Qcow2BackingIndex;
+
 typedef struct BDRVQcow2State {
     int cluster_bits;
     int cluster_size;
@@ -420,6 +423,19 @@ typedef struct BDRVQcow2State {
      * is to convert the image with the desired compression type set.
      */
     Qcow2CompressionType compression_type;
+
+    /*
+     * Which layer of the (read-only) backing chain provides the data for
+     * unallocated clusters, see qcow2-backing-index.c.  Only used if
+     * use_backing_index is set.  Protected by backing_index_lock.
+     */
+    bool use_backing_index;
+    CoMutex backing_index_lock;
+    Qcow2BackingIndex *backing_index;
+
+    /* For query-blockstats: indexes built, and reads served through them */
+    uint64_t backing_index_builds;
+    uint64_t backing_index_reads;
 } BDRVQcow2State;
 
 typedef struct Qcow2COWRegion {
@@ -971,6 +987,13 @@ void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
 
+/* qcow2-backing-index.c functions */
+void qcow2_backing_index_drop(BlockDriverState *bs);
+int coroutine_fn qcow2_co_preadv_backing(BlockDriverState *bs,
+                                         uint64_t offset, uint64_t bytes,
+                                         QEMUIOVector *qiov,
+                                         size_t qiov_offset);
+
 /* qcow2-bitmap.c functions */
 int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
                                   void **refcount_table,
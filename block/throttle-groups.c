@@ -34,10 +34,35 @@
 #include "qapi/qapi-visit-block-core.h"
 #include "qom/object.h"
 #include "qom/object_interfaces.h"
+#include "qemu/host-utils.h"
+#include "trace.h"
 
 static void throttle_group_obj_init(Object *obj);
 static void throttle_group_obj_complete(UserCreatable *obj, Error **errp);
 static void timer_cb(ThrottleGroupMember *tgm, bool is_write);
+static void throttle_group_lat_window_end(ThrottleGroup *tg, int64_t now);
+
+/* Requests of the lower priority classes are promoted to the top class once
+ * they have been waiting for this long.  Foreground requests are always
+ * served first, so they need no deadline. */
+static const int64_t throttle_group_deadline_ns[THROTTLE_GROUP_PRIORITY__MAX] = {
+    [THROTTLE_GROUP_PRIORITY_FOREGROUND] = 0,
+    [THROTTLE_GROUP_PRIORITY_BLOCK_JOB]  = 100 * SCALE_MS,
+    [THROTTLE_GROUP_PRIORITY_BACKGROUND] = 1000 * SCALE_MS,
+};
+
+/* How long lower priority requests sleep while the group is congested */
+#define THROTTLE_GROUP_YIELD_NS (5 * SCALE_MS)
+
+/* Foreground latency is sampled in windows of at most this many requests
+ * or this much time, whatever is reached first.  Windows with too few
+ * samples for a meaningful 99th percentile clear the congestion flag. */
+#define THROTTLE_GROUP_LAT_WINDOW_SAMPLES 1024
+#define THROTTLE_GROUP_LAT_WINDOW_NS NANOSECONDS_PER_SECOND
+#define THROTTLE_GROUP_LAT_MIN_SAMPLES 100
+
+/* Latency histogram buckets: four per power of two */
+#define THROTTLE_GROUP_LAT_BUCKETS 256
 
 /* The ThrottleGroup structure (with its ThrottleState) is shared
  * among different ThrottleGroupMembers and it's independent from
@@ -77,6 +102,16 @@ struct ThrottleGroup {
     bool any_timer_armed[2];
     QEMUClockType clock_type;
 
+    /* Latency target for foreground requests, 0 if there is none. Also
+     * read without the lock. */
+    int64_t latency_target;
+    /* Whether foreground p99 latency currently exceeds latency_target.
+     * Also read without the lock. */
+    bool congested;
+    int64_t lat_window_start;
+    unsigned lat_samples;
+    unsigned lat_hist[THROTTLE_GROUP_LAT_BUCKETS];
+
     /* This field is protected by the global QEMU mutex */
     QTAILQ_ENTRY(ThrottleGroup) list;
 };
@@ -206,8 +241,51 @@ static inline bool tgm_has_pending_reqs(ThrottleGroupMember *tgm,
     return tgm->pending_reqs[is_write];
 }
 
+/*
+ * Return the scheduling rank of a ThrottleGroupMember's oldest pending
+ * request: its priority class, or -1 if it has missed its deadline.  Lower
+ * ranks are served first.  The deadline is stored in @deadline.
+ *
+ * This assumes that tg->lock is held and that tgm has pending requests.
+ */
+static int tgm_rank(ThrottleGroupMember *tgm, bool is_write, int64_t now,
+                    int64_t *deadline)
+{
+    ThrottleGroupWaiter *w = QTAILQ_FIRST(&tgm->waiters[is_write]);
+
+    if (tgm->priority == THROTTLE_GROUP_PRIORITY_FOREGROUND || !w) {
+        *deadline = INT64_MAX;
+        return tgm->priority;
+    }
+
+    *deadline = w->start_ns + throttle_group_deadline_ns[tgm->priority];
+    return *deadline <= now ? -1 : tgm->priority;
+}
+
+/*
+ * Return whether the pending requests of @a should be scheduled before those
+ * of @b.  Overdue requests go first, earliest deadline first; otherwise the
+ * higher priority class wins.
+ *
+ * This assumes that tg->lock is held and that both have pending requests.
+ */
+static bool tgm_goes_before(ThrottleGroupMember *a, ThrottleGroupMember *b,
+                            bool is_write, int64_t now)
+{
+    int64_t deadline_a, deadline_b;
+    int rank_a = tgm_rank(a, is_write, now, &deadline_a);
+    int rank_b = tgm_rank(b, is_write, now, &deadline_b);
+
+    if (rank_a != rank_b) {
+        return rank_a < rank_b;
+    }
+    return rank_a < 0 && deadline_a < deadline_b;
+}
+
 /* Return the next ThrottleGroupMember in the round-robin sequence with pending
- * I/O requests.
+ * I/O requests.  Members whose requests go before the others' according to
+ * tgm_goes_before() are preferred; the round-robin order decides between
+ * members of the same rank.
  *
  * This assumes that tg->lock is held.
  *
@@ -221,7 +299,8 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
 {
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
-    ThrottleGroupMember *token, *start;
+    ThrottleGroupMember *token, *start, *best = NULL;
+    int64_t now = qemu_clock_get_ns(tg->clock_type);
 
     /* If this member has its I/O limits disabled then it means that
      * it's being drained. Skip the round-robin search and return tgm
@@ -234,19 +313,20 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
 
     start = token = tg->tokens[is_write];
 
-    /* get next bs round in round robin style */
-    token = throttle_group_next_tgm(token);
-    while (token != start && !tgm_has_pending_reqs(token, is_write)) {
+    /* get next bs round in round robin style, ending with start */
+    do {
         token = throttle_group_next_tgm(token);
-    }
+        if (tgm_has_pending_reqs(token, is_write) &&
+            (!best || tgm_goes_before(token, best, is_write, now))) {
+            best = token;
+        }
+    } while (token != start);
 
     /* If no IO are queued for scheduling on the next round robin token
      * then decide the token is the current tgm because chances are
      * the current tgm got the current request queued.
      */
-    if (token == start && !tgm_has_pending_reqs(token, is_write)) {
-        token = tgm;
-    }
+    token = best ? best : tgm;
 
     /* Either we return the original TGM, or one with pending requests */
     assert(token == tgm || tgm_has_pending_reqs(token, is_write));
@@ -335,8 +415,12 @@ static void schedule_next_request(ThrottleGroupMember *tgm, bool is_write)
 
     /* If it doesn't have to wait, queue it for immediate execution */
     if (!must_wait) {
-        /* Give preference to requests from the current tgm */
+        /* Give preference to requests from the current tgm, unless the
+         * token's requests are more urgent */
         if (qemu_in_coroutine() &&
+            (token == tgm || !tgm_has_pending_reqs(tgm, is_write) ||
+             !tgm_goes_before(token, tgm, is_write,
+                              qemu_clock_get_ns(tg->clock_type))) &&
             throttle_group_co_restart_queue(tgm, is_write)) {
             token = tgm;
         } else {
@@ -349,6 +433,40 @@ static void schedule_next_request(ThrottleGroupMember *tgm, bool is_write)
     }
 }
 
+/* While the foreground requests of the group miss their latency target,
+ * hold back a request of a lower priority class, but no longer than its
+ * deadline.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ */
+static void coroutine_fn throttle_group_co_yield(ThrottleGroupMember *tgm)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    int64_t start, now;
+
+    if (tgm->priority == THROTTLE_GROUP_PRIORITY_FOREGROUND ||
+        !qatomic_read(&tg->congested)) {
+        return;
+    }
+
+    start = now = qemu_clock_get_ns(tg->clock_type);
+    trace_throttle_group_yield(tgm, tgm->priority);
+    while (qatomic_read(&tg->congested) &&
+           !qatomic_read(&tgm->io_limits_disabled) &&
+           now - start < throttle_group_deadline_ns[tgm->priority])
+    {
+        qemu_co_sleep_ns(tg->clock_type, THROTTLE_GROUP_YIELD_NS);
+        now = qemu_clock_get_ns(tg->clock_type);
+
+        /* Don't keep waiting on stale data if foreground I/O has stopped */
+        qemu_mutex_lock(&tg->lock);
+        if (now - tg->lat_window_start >= THROTTLE_GROUP_LAT_WINDOW_NS) {
+            throttle_group_lat_window_end(tg, now);
+        }
+        qemu_mutex_unlock(&tg->lock);
+    }
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
@@ -364,6 +482,9 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     bool must_wait;
     ThrottleGroupMember *token;
     ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    throttle_group_co_yield(tgm);
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -372,13 +493,19 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[is_write]) {
+        ThrottleGroupWaiter waiter = {
+            .start_ns = qemu_clock_get_ns(tg->clock_type),
+        };
+
         tgm->pending_reqs[is_write]++;
+        QTAILQ_INSERT_TAIL(&tgm->waiters[is_write], &waiter, next);
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[is_write],
                            &tgm->throttled_reqs_lock);
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
+        QTAILQ_REMOVE(&tgm->waiters[is_write], &waiter, next);
         tgm->pending_reqs[is_write]--;
     }
 
@@ -493,6 +620,131 @@ void throttle_group_get_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     qemu_mutex_unlock(&tg->lock);
 }
 
+/* Set the scheduling class of a ThrottleGroupMember's requests.
+ *
+ * @tgm:       a ThrottleGroupMember
+ * @priority:  the new class
+ */
+void throttle_group_set_priority(ThrottleGroupMember *tgm,
+                                 ThrottleGroupPriority priority)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    qemu_mutex_lock(&tg->lock);
+    tgm->priority = priority;
+    qemu_mutex_unlock(&tg->lock);
+
+    throttle_group_restart_tgm(tgm);
+}
+
+/* This assumes that tg->lock is held. */
+static void throttle_group_do_set_latency_target(ThrottleGroup *tg,
+                                                 int64_t latency_ns)
+{
+    qatomic_set(&tg->latency_target, latency_ns);
+    qatomic_set(&tg->congested, false);
+    tg->lat_window_start = qemu_clock_get_ns(tg->clock_type);
+    tg->lat_samples = 0;
+    memset(tg->lat_hist, 0, sizeof(tg->lat_hist));
+}
+
+/* Return the index of the latency histogram bucket for @ns */
+static int throttle_group_lat_bucket(uint64_t ns)
+{
+    int msb;
+
+    if (ns < 4) {
+        return ns;
+    }
+    msb = 63 - clz64(ns);
+    return msb * 4 + ((ns >> (msb - 2)) & 3) - 4;
+}
+
+/* Return the smallest latency that falls into bucket @i */
+static uint64_t throttle_group_lat_bucket_start(int i)
+{
+    if (i < 4) {
+        return i;
+    }
+    return (uint64_t)(4 + i % 4) << (i / 4 - 1);
+}
+
+/* Close the current latency window and update the congestion flag.
+ *
+ * This assumes that tg->lock is held.
+ */
+static void throttle_group_lat_window_end(ThrottleGroup *tg, int64_t now)
+{
+    bool congested = false;
+
+    if (tg->lat_samples >= THROTTLE_GROUP_LAT_MIN_SAMPLES) {
+        unsigned threshold = DIV_ROUND_UP(tg->lat_samples * 99, 100);
+        unsigned count = 0;
+        uint64_t p99 = 0;
+        int i;
+
+        for (i = 0; i < THROTTLE_GROUP_LAT_BUCKETS; i++) {
+            count += tg->lat_hist[i];
+            if (count >= threshold) {
+                p99 = throttle_group_lat_bucket_start(i);
+                break;
+            }
+        }
+        congested = p99 > tg->latency_target;
+        trace_throttle_group_latency(tg, tg->lat_samples, p99, congested);
+    }
+
+    qatomic_set(&tg->congested, congested);
+    tg->lat_window_start = now;
+    tg->lat_samples = 0;
+    memset(tg->lat_hist, 0, sizeof(tg->lat_hist));
+}
+
+/* Return the start time to pass to throttle_group_account_latency() for a
+ * request that is about to be submitted, or 0 if its latency is not needed.
+ *
+ * @tgm:  the ThrottleGroupMember that submits the request
+ */
+int64_t throttle_group_latency_start(ThrottleGroupMember *tgm)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    if (tgm->priority != THROTTLE_GROUP_PRIORITY_FOREGROUND ||
+        !qatomic_read(&tg->latency_target)) {
+        return 0;
+    }
+    return qemu_clock_get_ns(tg->clock_type);
+}
+
+/* Record the completion of a request for the foreground latency statistics
+ * of the group.
+ *
+ * @tgm:       the ThrottleGroupMember that submitted the request
+ * @start_ns:  the value returned by throttle_group_latency_start()
+ */
+void throttle_group_account_latency(ThrottleGroupMember *tgm,
+                                    int64_t start_ns)
+{
+    ThrottleGroup *tg;
+    int64_t now;
+
+    if (!start_ns) {
+        return;
+    }
+
+    tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    now = qemu_clock_get_ns(tg->clock_type);
+
+    qemu_mutex_lock(&tg->lock);
+    tg->lat_hist[throttle_group_lat_bucket(MAX(now - start_ns, 0))]++;
+    tg->lat_samples++;
+    if (tg->lat_samples >= THROTTLE_GROUP_LAT_WINDOW_SAMPLES ||
+        now - tg->lat_window_start >= THROTTLE_GROUP_LAT_WINDOW_NS) {
+        throttle_group_lat_window_end(tg, now);
+    }
+    qemu_mutex_unlock(&tg->lock);
+}
+
 /* ThrottleTimers callback. This wakes up a request that was waiting
  * because it had been throttled.
  *
@@ -565,6 +817,8 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     qemu_co_mutex_init(&tgm->throttled_reqs_lock);
     qemu_co_queue_init(&tgm->throttled_reqs[0]);
     qemu_co_queue_init(&tgm->throttled_reqs[1]);
+    QTAILQ_INIT(&tgm->waiters[0]);
+    QTAILQ_INIT(&tgm->waiters[1]);
 
     qemu_mutex_unlock(&tg->lock);
 }
@@ -760,6 +1014,7 @@ static void throttle_group_obj_init(Object *obj)
     qemu_mutex_init(&tg->lock);
     throttle_init(&tg->ts);
     QLIST_INIT(&tg->head);
+    tg->lat_window_start = qemu_clock_get_ns(tg->clock_type);
 }
 
 /* This function edits throttle_groups and must be called under the global
@@ -925,6 +1180,44 @@ static void throttle_group_get_limits(Object *obj, Visitor *v,
     visit_type_ThrottleLimits(v, name, &argp, errp);
 }
 
+static void throttle_group_set_latency_target_prop(Object *obj, Visitor *v,
+                                                   const char *name,
+                                                   void *opaque, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    int64_t value;
+
+    if (!visit_type_int64(v, name, &value, errp)) {
+        return;
+    }
+    if (value < 0) {
+        error_setg(errp, "Property values cannot be negative");
+        return;
+    }
+
+    qemu_mutex_lock(&tg->lock);
+    throttle_group_do_set_latency_target(tg, value);
+    qemu_mutex_unlock(&tg->lock);
+}
+
+static void throttle_group_get_latency_target_prop(Object *obj, Visitor *v,
+                                                   const char *name,
+                                                   void *opaque, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    int64_t value = qatomic_read(&tg->latency_target);
+
+    visit_type_int64(v, name, &value, errp);
+}
+
+/* Whether foreground requests currently miss their latency target */
+static bool throttle_group_get_congested(Object *obj, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    return qatomic_read(&tg->congested);
+}
+
 static bool throttle_group_can_be_deleted(UserCreatable *uc)
 {
     return OBJECT(uc)->ref == 1;
@@ -954,6 +1247,15 @@ static void throttle_group_obj_class_init(ObjectClass *klass, void *class_data)
                               throttle_group_get_limits,
                               throttle_group_set_limits,
                               NULL, NULL);
+
+    /* 99th percentile latency target for foreground requests, in ns */
+    object_class_property_add(klass,
+                              "latency-target", "int",
+                              throttle_group_get_latency_target_prop,
+                              throttle_group_set_latency_target_prop,
+                              NULL, NULL);
+    object_class_property_add_bool(klass, "congested",
+                                   throttle_group_get_congested, NULL);
 }
 
 static const TypeInfo throttle_group_info = {
@@ -23,6 +23,7 @@
 #include "qemu/option.h"
 #include "qemu/throttle-options.h"
 #include "qapi/error.h"
+#include "qapi/qapi-visit-block-core.h"
 
 static QemuOptsList throttle_opts = {
     .name = "throttle",
@@ -33,19 +34,35 @@ static QemuOptsList throttle_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Name of the throttle group",
         },
+        {
+            .name = QEMU_OPT_THROTTLE_PRIORITY,
+            .type = QEMU_OPT_STRING,
+            .help = "Scheduling class of the requests "
+                    "(foreground, block-job, background)",
+        },
         { /* end of list */ }
     },
 };
 
+typedef struct ThrottleReopenState {
+    char *group;
+    ThrottleGroupPriority priority;
+} ThrottleReopenState;
+
 /*
  * If this function succeeds then the throttle group name is stored in
- * @group and must be freed by the caller.
- * If there's an error then @group remains unmodified.
+ * @group and must be freed by the caller, and the scheduling class is
+ * stored in @priority.
+ * If there's an error then @group and @priority remain unmodified.
  */
-static int throttle_parse_options(QDict *options, char **group, Error **errp)
+static int throttle_parse_options(QDict *options, char **group,
+                                  ThrottleGroupPriority *priority,
+                                  Error **errp)
 {
     int ret;
     const char *group_name;
+    ThrottleGroupPriority prio;
+    Error *local_err = NULL;
     QemuOpts *opts = qemu_opts_create(&throttle_opts, NULL, 0, &error_abort);
 
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
@@ -64,7 +81,17 @@ static int throttle_parse_options(QDict *options, char **group, Error **errp)
         goto fin;
     }
 
+    prio = qapi_enum_parse(&ThrottleGroupPriority_lookup,
+                           qemu_opt_get(opts, QEMU_OPT_THROTTLE_PRIORITY),
+                           THROTTLE_GROUP_PRIORITY_FOREGROUND, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto fin;
+    }
+
     *group = g_strdup(group_name);
+    *priority = prio;
     ret = 0;
 fin:
     qemu_opts_del(opts);
@@ -75,6 +102,7 @@ static int throttle_open(BlockDriverState *bs, QDict *options,
                          int flags, Error **errp)
 {
     ThrottleGroupMember *tgm = bs->opaque;
+    ThrottleGroupPriority priority;
     char *group;
     int ret;
 
@@ -89,9 +117,10 @@ static int throttle_open(BlockDriverState *bs, QDict *options,
     bs->supported_zero_flags = bs->file->bs->supported_zero_flags |
                                BDRV_REQ_WRITE_UNCHANGED;
 
-    ret = throttle_parse_options(options, &group, errp);
+    ret = throttle_parse_options(options, &group, &priority, errp);
     if (ret == 0) {
         /* Register membership to group with name group_name */
+        tgm->priority = priority;
         throttle_group_register_tgm(tgm, group, bdrv_get_aio_context(bs));
         g_free(group);
     }
@@ -117,9 +146,16 @@ static int coroutine_fn throttle_co_preadv(BlockDriverState *bs,
 {
 
     ThrottleGroupMember *tgm = bs->opaque;
+    int64_t start_ns;
+    int ret;
+
     throttle_group_co_io_limits_intercept(tgm, bytes, false);
 
-    return bdrv_co_preadv(bs->file, offset, bytes, qiov, flags);
+    start_ns = throttle_group_latency_start(tgm);
+    ret = bdrv_co_preadv(bs->file, offset, bytes, qiov, flags);
+    throttle_group_account_latency(tgm, start_ns);
+
+    return ret;
 }
 
 static int coroutine_fn throttle_co_pwritev(BlockDriverState *bs,
@@ -127,9 +163,16 @@ static int coroutine_fn throttle_co_pwritev(BlockDriverState *bs,
                                             QEMUIOVector *qiov, int flags)
 {
     ThrottleGroupMember *tgm = bs->opaque;
+    int64_t start_ns;
+    int ret;
+
     throttle_group_co_io_limits_intercept(tgm, bytes, true);
 
-    return bdrv_co_pwritev(bs->file, offset, bytes, qiov, flags);
+    start_ns = throttle_group_latency_start(tgm);
+    ret = bdrv_co_pwritev(bs->file, offset, bytes, qiov, flags);
+    throttle_group_account_latency(tgm, start_ns);
+
+    return ret;
 }
 
 static int coroutine_fn throttle_co_pwrite_zeroes(BlockDriverState *bs,
@@ -181,14 +224,16 @@ static void throttle_attach_aio_context(BlockDriverState *bs,
 static int throttle_reopen_prepare(BDRVReopenState *reopen_state,
                                    BlockReopenQueue *queue, Error **errp)
 {
+    ThrottleReopenState *s;
     int ret;
-    char *group = NULL;
 
     assert(reopen_state != NULL);
     assert(reopen_state->bs != NULL);
 
-    ret = throttle_parse_options(reopen_state->options, &group, errp);
-    reopen_state->opaque = group;
+    s = g_new0(ThrottleReopenState, 1);
+    ret = throttle_parse_options(reopen_state->options, &s->group,
+                                 &s->priority, errp);
+    reopen_state->opaque = s;
     return ret;
 }
 
@@ -196,21 +241,30 @@ static void throttle_reopen_commit(BDRVReopenState *reopen_state)
 {
     BlockDriverState *bs = reopen_state->bs;
     ThrottleGroupMember *tgm = bs->opaque;
-    char *group = reopen_state->opaque;
+    ThrottleReopenState *s = reopen_state->opaque;
 
-    assert(group);
+    assert(s->group);
 
-    if (strcmp(group, throttle_group_get_name(tgm))) {
+    if (strcmp(s->group, throttle_group_get_name(tgm))) {
         throttle_group_unregister_tgm(tgm);
-        throttle_group_register_tgm(tgm, group, bdrv_get_aio_context(bs));
+        tgm->priority = s->priority;
+        throttle_group_register_tgm(tgm, s->group, bdrv_get_aio_context(bs));
+    } else if (tgm->priority != s->priority) {
+        throttle_group_set_priority(tgm, s->priority);
     }
-    g_free(reopen_state->opaque);
+    g_free(s->group);
+    g_free(s);
     reopen_state->opaque = NULL;
 }
 
 static void throttle_reopen_abort(BDRVReopenState *reopen_state)
 {
-    g_free(reopen_state->opaque);
+    ThrottleReopenState *s = reopen_state->opaque;
+
+    if (s) {
+        g_free(s->group);
+        g_free(s);
+    }
     reopen_state->opaque = NULL;
 }
 
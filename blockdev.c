@@ -3668,7 +3668,8 @@ void qmp_x_blockdev_change(const char *parent, bool has_child,
     }
 }
 
-BlockJobInfoList *qmp_query_block_jobs(Error **errp)
+BlockJobInfoList *qmp_query_block_jobs(bool has_io_stats, bool io_stats,
+                                       Error **errp)
 {
     BlockJobInfoList *head = NULL, **p_next = &head;
     BlockJob *job;
@@ -3684,6 +3685,9 @@ BlockJobInfoList *qmp_query_block_jobs(Error **errp)
         aio_context = blk_get_aio_context(job->blk);
         aio_context_acquire(aio_context);
         elem->value = block_job_query(job, errp);
+        if (elem->value && io_stats) {
+            block_job_query_io_stats(job, elem->value);
+        }
         aio_context_release(aio_context);
         if (!elem->value) {
             g_free(elem);
@@ -3738,6 +3742,43 @@ void qmp_x_blockdev_set_iothread(const char *node_name, StrOrNull *iothread,
     aio_context_release(old_context);
 }
 
+void qmp_block_node_timing_set(const char *node_name, bool enable,
+                               bool has_boundaries, uint64List *boundaries,
+                               Error **errp)
+{
+    BlockDriverState *bs;
+    BlockNodeTiming *old_timing, *new_timing = NULL;
+    AioContext *aio_context;
+
+    bs = bdrv_find_node(node_name);
+    if (!bs) {
+        error_setg(errp, "Cannot find node %s", node_name);
+        return;
+    }
+
+    if (enable) {
+        new_timing = block_node_timing_new(has_boundaries ? boundaries : NULL);
+        if (!new_timing) {
+            error_setg(errp, "Invalid latency histogram boundaries");
+            return;
+        }
+    } else if (has_boundaries) {
+        error_setg(errp, "boundaries can only be given if timing is enabled");
+        return;
+    }
+
+    /* Requests in flight must see the same timing object at start and end */
+    aio_context = bdrv_get_aio_context(bs);
+    aio_context_acquire(aio_context);
+    bdrv_drained_begin(bs);
+    old_timing = bs->timing;
+    qatomic_set(&bs->timing, new_timing);
+    bdrv_drained_end(bs);
+    aio_context_release(aio_context);
+
+    block_node_timing_free(old_timing);
+}
+
 QemuOptsList qemu_common_drive_opts = {
     .name = "drive",
     .head = QTAILQ_HEAD_INITIALIZER(qemu_common_drive_opts.head),
@@ -313,6 +313,18 @@ BlockJobInfo *block_job_query(BlockJob *job, Error **errp)
     return info;
 }
 
+void block_job_query_io_stats(BlockJob *job, BlockJobInfo *info)
+{
+    const BlockJobDriver *drv = block_job_driver(job);
+
+    if (!drv->query_io_stats) {
+        return;
+    }
+    info->has_io_stats = true;
+    info->io_stats = g_new0(BlockJobIoStats, 1);
+    drv->query_io_stats(job, info->io_stats);
+}
+
 static void block_job_iostatus_set_err(BlockJob *job, int error)
 {
     if (job->iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
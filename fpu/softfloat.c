@@ -241,6 +241,11 @@ static inline bool can_use_fpu(const float_status *s)
                   s->float_rounding_mode == float_round_nearest_even);
 }
 
+bool float_host_fpu_usable(const float_status *s)
+{
+    return can_use_fpu(s);
+}
+
 /*
  * Hardfloat generation functions. Each operation can have two flavors:
  * either using softfloat primitives (e.g. float32_is_zero_or_normal) for
@@ -401,6 +406,155 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+/*
+ * Half precision and bfloat16 operations are done in host single
+ * precision.  Both formats convert exactly to float32, and float32 has
+ * at least 2p + 2 bits of precision for either of them (p = 11 and 8),
+ * so rounding an add, sub, mul, div or sqrt first to float32 and then to
+ * the narrow format gives the same result as rounding once.  The second
+ * rounding is always to nearest even and is done with integer arithmetic,
+ * since hosts do not generally have instructions for it.
+ *
+ * As in the gen2 functions above, a result that may be tiny goes back to
+ * softfloat unless the inputs make it an exact zero.
+ */
+
+typedef bool (*f16_check_fn)(float16 a, float16 b);
+typedef bool (*bf16_check_fn)(bfloat16 a, bfloat16 b);
+
+typedef float16 (*soft_f16_op2_fn)(float16 a, float16 b, float_status *s);
+typedef bfloat16 (*soft_bf16_op2_fn)(bfloat16 a, bfloat16 b, float_status *s);
+
+/* Magnitude of the smallest normal of each format, as float32 bits */
+#define F16_MIN_NORMAL_F32  0x38800000
+#define BF16_MIN_NORMAL_F32 0x00800000
+
+static inline bool f16_is_zon(float16 a)
+{
+    return float16_is_zero(a) || float16_is_normal(a);
+}
+
+static inline bool bf16_is_zon(bfloat16 a)
+{
+    return bfloat16_is_zero(a) || bfloat16_is_normal(a);
+}
+
+/* Widen a zero or normal float16; only the exponent bias changes.  */
+static inline union_float32 f16_to_host(float16 a)
+{
+    uint32_t v = float16_val(a);
+    uint32_t mag = v & 0x7fff;
+    union_float32 r;
+
+    if (mag) {
+        mag = (mag << 13) + ((127 - 15) << 23);
+    }
+    r.s = make_float32(((v & 0x8000) << 16) | mag);
+    return r;
+}
+
+static inline union_float32 bf16_to_host(bfloat16 a)
+{
+    union_float32 r;
+
+    r.s = make_float32((uint32_t)a << 16);
+    return r;
+}
+
+/*
+ * Round a finite float32 whose magnitude is above the smallest normal of
+ * the narrow format.  Overflow goes to infinity; inexact is already set.
+ */
+static inline float16 f16_round_host(union_float32 r, float_status *s)
+{
+    uint32_t v = float32_val(r.s);
+    uint32_t m = (v & 0x7fffffff) - ((127 - 15) << 23);
+
+    m = (m + 0xfff + ((m >> 13) & 1)) >> 13;
+    if (unlikely(m >= 0x7c00)) {
+        s->float_exception_flags |= float_flag_overflow;
+        m = 0x7c00;
+    }
+    return make_float16(((v >> 16) & 0x8000) | m);
+}
+
+static inline bfloat16 bf16_round_host(union_float32 r, float_status *s)
+{
+    uint32_t v = float32_val(r.s);
+    uint32_t m = v & 0x7fffffff;
+
+    m = (m + 0x7fff + ((m >> 16) & 1)) >> 16;
+    if (unlikely(m >= 0x7f80)) {
+        s->float_exception_flags |= float_flag_overflow;
+        m = 0x7f80;
+    }
+    return ((v >> 16) & 0x8000) | m;
+}
+
+static inline float16
+float16_gen2(float16 a, float16 b, float_status *s,
+             hard_f32_op2_fn hard, soft_f16_op2_fn soft,
+             f16_check_fn pre, f16_check_fn post)
+{
+    union_float32 ur;
+
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+    if (unlikely(!pre(a, b))) {
+        goto soft;
+    }
+
+    ur.h = hard(f16_to_host(a).h, f16_to_host(b).h);
+    if (unlikely((float32_val(ur.s) & 0x7fffffff) <= F16_MIN_NORMAL_F32)) {
+        if (post(a, b)) {
+            goto soft;
+        }
+        return float16_set_sign(float16_zero, float32_is_neg(ur.s));
+    }
+    return f16_round_host(ur, s);
+
+ soft:
+    return soft(a, b, s);
+}
+
+static inline bfloat16
+bfloat16_gen2(bfloat16 a, bfloat16 b, float_status *s,
+              hard_f32_op2_fn hard, soft_bf16_op2_fn soft,
+              bf16_check_fn pre, bf16_check_fn post)
+{
+    union_float32 ur;
+
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+    if (unlikely(!pre(a, b))) {
+        goto soft;
+    }
+
+    ur.h = hard(bf16_to_host(a).h, bf16_to_host(b).h);
+    if (unlikely((float32_val(ur.s) & 0x7fffffff) <= BF16_MIN_NORMAL_F32)) {
+        if (post(a, b)) {
+            goto soft;
+        }
+        return bfloat16_set_sign(bfloat16_zero, float32_is_neg(ur.s));
+    }
+    return bf16_round_host(ur, s);
+
+ soft:
+    return soft(a, b, s);
+}
+
+static bool f16_is_zon2(float16 a, float16 b)
+{
+    return f16_is_zon(a) && f16_is_zon(b);
+}
+
+static bool bf16_is_zon2(bfloat16 a, bfloat16 b)
+{
+    return bf16_is_zon(a) && bf16_is_zon(b);
+}
+
 /*----------------------------------------------------------------------------
 | Returns the fraction bits of the single-precision floating-point value `a'.
 *----------------------------------------------------------------------------*/
@@ -1049,22 +1203,24 @@ static FloatParts addsub_floats(FloatParts a, FloatParts b, bool subtract,
  * IEC/IEEE Standard for Binary Floating-Point Arithmetic.
  */
 
-float16 QEMU_FLATTEN float16_add(float16 a, float16 b, float_status *status)
+static float16 QEMU_SOFTFLOAT_ATTR
+soft_f16_addsub(float16 a, float16 b, bool subtract, float_status *status)
 {
     FloatParts pa = float16_unpack_canonical(a, status);
     FloatParts pb = float16_unpack_canonical(b, status);
-    FloatParts pr = addsub_floats(pa, pb, false, status);
+    FloatParts pr = addsub_floats(pa, pb, subtract, status);
 
     return float16_round_pack_canonical(pr, status);
 }
 
-float16 QEMU_FLATTEN float16_sub(float16 a, float16 b, float_status *status)
+static inline float16 soft_f16_add(float16 a, float16 b, float_status *status)
 {
-    FloatParts pa = float16_unpack_canonical(a, status);
-    FloatParts pb = float16_unpack_canonical(b, status);
-    FloatParts pr = addsub_floats(pa, pb, true, status);
+    return soft_f16_addsub(a, b, false, status);
+}
 
-    return float16_round_pack_canonical(pr, status);
+static inline float16 soft_f16_sub(float16 a, float16 b, float_status *status)
+{
+    return soft_f16_addsub(a, b, true, status);
 }
 
 static float32 QEMU_SOFTFLOAT_ATTR
@@ -1158,6 +1314,30 @@ static float64 float64_addsub(float64 a, float64 b, float_status *s,
                         f64_is_zon2, f64_addsubmul_post);
 }
 
+static bool f16_addsubmul_post(float16 a, float16 b)
+{
+    return !(float16_is_zero(a) && float16_is_zero(b));
+}
+
+static bool bf16_addsubmul_post(bfloat16 a, bfloat16 b)
+{
+    return !(bfloat16_is_zero(a) && bfloat16_is_zero(b));
+}
+
+float16 QEMU_FLATTEN
+float16_add(float16 a, float16 b, float_status *s)
+{
+    return float16_gen2(a, b, s, hard_f32_add, soft_f16_add,
+                        f16_is_zon2, f16_addsubmul_post);
+}
+
+float16 QEMU_FLATTEN
+float16_sub(float16 a, float16 b, float_status *s)
+{
+    return float16_gen2(a, b, s, hard_f32_sub, soft_f16_sub,
+                        f16_is_zon2, f16_addsubmul_post);
+}
+
 float32 QEMU_FLATTEN
 float32_add(float32 a, float32 b, float_status *s)
 {
@@ -1186,22 +1366,38 @@ float64_sub(float64 a, float64 b, float_status *s)
  * Returns the result of adding or subtracting the bfloat16
  * values `a' and `b'.
  */
-bfloat16 QEMU_FLATTEN bfloat16_add(bfloat16 a, bfloat16 b, float_status *status)
+static bfloat16 QEMU_SOFTFLOAT_ATTR
+soft_bf16_addsub(bfloat16 a, bfloat16 b, bool subtract, float_status *status)
 {
     FloatParts pa = bfloat16_unpack_canonical(a, status);
     FloatParts pb = bfloat16_unpack_canonical(b, status);
-    FloatParts pr = addsub_floats(pa, pb, false, status);
+    FloatParts pr = addsub_floats(pa, pb, subtract, status);
 
     return bfloat16_round_pack_canonical(pr, status);
 }
 
-bfloat16 QEMU_FLATTEN bfloat16_sub(bfloat16 a, bfloat16 b, float_status *status)
+static inline bfloat16
+soft_bf16_add(bfloat16 a, bfloat16 b, float_status *status)
 {
-    FloatParts pa = bfloat16_unpack_canonical(a, status);
-    FloatParts pb = bfloat16_unpack_canonical(b, status);
-    FloatParts pr = addsub_floats(pa, pb, true, status);
+    return soft_bf16_addsub(a, b, false, status);
+}
 
-    return bfloat16_round_pack_canonical(pr, status);
+static inline bfloat16
+soft_bf16_sub(bfloat16 a, bfloat16 b, float_status *status)
+{
+    return soft_bf16_addsub(a, b, true, status);
+}
+
+bfloat16 QEMU_FLATTEN bfloat16_add(bfloat16 a, bfloat16 b, float_status *s)
+{
+    return bfloat16_gen2(a, b, s, hard_f32_add, soft_bf16_add,
+                         bf16_is_zon2, bf16_addsubmul_post);
+}
+
+bfloat16 QEMU_FLATTEN bfloat16_sub(bfloat16 a, bfloat16 b, float_status *s)
+{
+    return bfloat16_gen2(a, b, s, hard_f32_sub, soft_bf16_sub,
+                         bf16_is_zon2, bf16_addsubmul_post);
 }
 
 /*
@@ -1253,7 +1449,8 @@ static FloatParts mul_floats(FloatParts a, FloatParts b, float_status *s)
     g_assert_not_reached();
 }
 
-float16 QEMU_FLATTEN float16_mul(float16 a, float16 b, float_status *status)
+static float16 QEMU_SOFTFLOAT_ATTR
+soft_f16_mul(float16 a, float16 b, float_status *status)
 {
     FloatParts pa = float16_unpack_canonical(a, status);
     FloatParts pb = float16_unpack_canonical(b, status);
@@ -1292,6 +1489,13 @@ static double hard_f64_mul(double a, double b)
     return a * b;
 }
 
+float16 QEMU_FLATTEN
+float16_mul(float16 a, float16 b, float_status *s)
+{
+    return float16_gen2(a, b, s, hard_f32_mul, soft_f16_mul,
+                        f16_is_zon2, f16_addsubmul_post);
+}
+
 float32 QEMU_FLATTEN
 float32_mul(float32 a, float32 b, float_status *s)
 {
@@ -1311,7 +1515,8 @@ float64_mul(float64 a, float64 b, float_status *s)
  * values `a' and `b'.
  */
 
-bfloat16 QEMU_FLATTEN bfloat16_mul(bfloat16 a, bfloat16 b, float_status *status)
+static bfloat16 QEMU_SOFTFLOAT_ATTR
+soft_bf16_mul(bfloat16 a, bfloat16 b, float_status *status)
 {
     FloatParts pa = bfloat16_unpack_canonical(a, status);
     FloatParts pb = bfloat16_unpack_canonical(b, status);
@@ -1320,6 +1525,12 @@ bfloat16 QEMU_FLATTEN bfloat16_mul(bfloat16 a, bfloat16 b, float_status *status)
     return bfloat16_round_pack_canonical(pr, status);
 }
 
+bfloat16 QEMU_FLATTEN bfloat16_mul(bfloat16 a, bfloat16 b, float_status *s)
+{
+    return bfloat16_gen2(a, b, s, hard_f32_mul, soft_bf16_mul,
+                         bf16_is_zon2, bf16_addsubmul_post);
+}
+
 /*
  * Returns the result of multiplying the floating-point values `a' and
  * `b' then adding 'c', with no intermediate rounding step after the
@@ -1798,7 +2009,8 @@ static FloatParts div_floats(FloatParts a, FloatParts b, float_status *s)
     g_assert_not_reached();
 }
 
-float16 float16_div(float16 a, float16 b, float_status *status)
+static float16 QEMU_SOFTFLOAT_ATTR
+soft_f16_div(float16 a, float16 b, float_status *status)
 {
     FloatParts pa = float16_unpack_canonical(a, status);
     FloatParts pb = float16_unpack_canonical(b, status);
@@ -1871,6 +2083,33 @@ static bool f64_div_post(union_float64 a, union_float64 b)
     return !float64_is_zero(a.s);
 }
 
+static bool f16_div_pre(float16 a, float16 b)
+{
+    return f16_is_zon(a) && float16_is_normal(b);
+}
+
+static bool bf16_div_pre(bfloat16 a, bfloat16 b)
+{
+    return bf16_is_zon(a) && bfloat16_is_normal(b);
+}
+
+static bool f16_div_post(float16 a, float16 b)
+{
+    return !float16_is_zero(a);
+}
+
+static bool bf16_div_post(bfloat16 a, bfloat16 b)
+{
+    return !bfloat16_is_zero(a);
+}
+
+float16 QEMU_FLATTEN
+float16_div(float16 a, float16 b, float_status *s)
+{
+    return float16_gen2(a, b, s, hard_f32_div, soft_f16_div,
+                        f16_div_pre, f16_div_post);
+}
+
 float32 QEMU_FLATTEN
 float32_div(float32 a, float32 b, float_status *s)
 {
@@ -1890,7 +2129,8 @@ float64_div(float64 a, float64 b, float_status *s)
  * value `a' by the corresponding value `b'.
  */
 
-bfloat16 bfloat16_div(bfloat16 a, bfloat16 b, float_status *status)
+static bfloat16 QEMU_SOFTFLOAT_ATTR
+soft_bf16_div(bfloat16 a, bfloat16 b, float_status *status)
 {
     FloatParts pa = bfloat16_unpack_canonical(a, status);
     FloatParts pb = bfloat16_unpack_canonical(b, status);
@@ -1899,6 +2139,13 @@ bfloat16 bfloat16_div(bfloat16 a, bfloat16 b, float_status *status)
     return bfloat16_round_pack_canonical(pr, status);
 }
 
+bfloat16 QEMU_FLATTEN
+bfloat16_div(bfloat16 a, bfloat16 b, float_status *s)
+{
+    return bfloat16_gen2(a, b, s, hard_f32_div, soft_bf16_div,
+                         bf16_div_pre, bf16_div_post);
+}
+
 /*
  * Float to Float conversions
  *
@@ -1954,24 +2201,60 @@ static FloatParts float_to_float(FloatParts a, const FloatFmt *dstf,
 float32 float16_to_float32(float16 a, bool ieee, float_status *s)
 {
     const FloatFmt *fmt16 = ieee ? &float16_params : &float16_params_ahp;
-    FloatParts p = float16a_unpack_canonical(a, s, fmt16);
-    FloatParts pr = float_to_float(p, &float32_params, s);
+    FloatParts p, pr;
+
+    /*
+     * Widening is exact, and zeros and normals mean the same in the
+     * alternative format.
+     */
+    if (likely(f16_is_zon(a))) {
+        return f16_to_host(a).s;
+    }
+    p = float16a_unpack_canonical(a, s, fmt16);
+    pr = float_to_float(p, &float32_params, s);
     return float32_round_pack_canonical(pr, s);
 }
 
 float64 float16_to_float64(float16 a, bool ieee, float_status *s)
 {
     const FloatFmt *fmt16 = ieee ? &float16_params : &float16_params_ahp;
-    FloatParts p = float16a_unpack_canonical(a, s, fmt16);
-    FloatParts pr = float_to_float(p, &float64_params, s);
+    FloatParts p, pr;
+
+    if (likely(f16_is_zon(a))) {
+        union_float64 ud;
+        ud.h = f16_to_host(a).h;
+        return ud.s;
+    }
+    p = float16a_unpack_canonical(a, s, fmt16);
+    pr = float_to_float(p, &float64_params, s);
     return float64_round_pack_canonical(pr, s);
 }
 
 float16 float32_to_float16(float32 a, bool ieee, float_status *s)
 {
     const FloatFmt *fmt16 = ieee ? &float16_params : &float16_params_ahp;
-    FloatParts p = float32_unpack_canonical(a, s);
-    FloatParts pr = float_to_float(p, fmt16, s);
+    FloatParts p, pr;
+    union_float32 ua;
+
+    ua.s = a;
+    /* The alternative format saturates instead of overflowing.  */
+    if (unlikely(!ieee || !can_use_fpu(s))) {
+        goto soft;
+    }
+    if (unlikely(!float32_is_zero_or_normal(a))) {
+        goto soft;
+    }
+    if (unlikely((float32_val(a) & 0x7fffffff) <= F16_MIN_NORMAL_F32)) {
+        if (!float32_is_zero(a)) {
+            goto soft;
+        }
+        return float16_set_sign(float16_zero, float32_is_neg(a));
+    }
+    return f16_round_host(ua, s);
+
+ soft:
+    p = float32_unpack_canonical(a, s);
+    pr = float_to_float(p, fmt16, s);
     return float16a_round_pack_canonical(pr, s, fmt16);
 }
 
@@ -2007,31 +2290,89 @@ float16 float64_to_float16(float64 a, bool ieee, float_status *s)
     return float16a_round_pack_canonical(pr, s, fmt16);
 }
 
-float32 float64_to_float32(float64 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_float64_to_float32(float64 a, float_status *s)
 {
     FloatParts p = float64_unpack_canonical(a, s);
     FloatParts pr = float_to_float(p, &float32_params, s);
     return float32_round_pack_canonical(pr, s);
 }
 
+float32 float64_to_float32(float64 a, float_status *s)
+{
+    union_float64 ua;
+    union_float32 ur;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+    if (unlikely(!float64_is_zero_or_normal(ua.s))) {
+        goto soft;
+    }
+
+    /* Narrowing can overflow or underflow, same as the 2-input ops.  */
+    ur.h = ua.h;
+    if (unlikely(f32_is_inf(ur))) {
+        s->float_exception_flags |= float_flag_overflow;
+    } else if (unlikely(fabsf(ur.h) <= FLT_MIN) && !float64_is_zero(ua.s)) {
+        goto soft;
+    }
+    return ur.s;
+
+ soft:
+    return soft_float64_to_float32(ua.s, s);
+}
+
 float32 bfloat16_to_float32(bfloat16 a, float_status *s)
 {
-    FloatParts p = bfloat16_unpack_canonical(a, s);
-    FloatParts pr = float_to_float(p, &float32_params, s);
+    FloatParts p, pr;
+
+    if (likely(bf16_is_zon(a))) {
+        return bf16_to_host(a).s;
+    }
+    p = bfloat16_unpack_canonical(a, s);
+    pr = float_to_float(p, &float32_params, s);
     return float32_round_pack_canonical(pr, s);
 }
 
 float64 bfloat16_to_float64(bfloat16 a, float_status *s)
 {
-    FloatParts p = bfloat16_unpack_canonical(a, s);
-    FloatParts pr = float_to_float(p, &float64_params, s);
+    FloatParts p, pr;
+
+    if (likely(bf16_is_zon(a))) {
+        union_float64 ud;
+        ud.h = bf16_to_host(a).h;
+        return ud.s;
+    }
+    p = bfloat16_unpack_canonical(a, s);
+    pr = float_to_float(p, &float64_params, s);
     return float64_round_pack_canonical(pr, s);
 }
 
 bfloat16 float32_to_bfloat16(float32 a, float_status *s)
 {
-    FloatParts p = float32_unpack_canonical(a, s);
-    FloatParts pr = float_to_float(p, &bfloat16_params, s);
+    FloatParts p, pr;
+    union_float32 ua;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+    if (unlikely(!float32_is_zero_or_normal(a))) {
+        goto soft;
+    }
+    if (unlikely((float32_val(a) & 0x7fffffff) <= BF16_MIN_NORMAL_F32)) {
+        if (!float32_is_zero(a)) {
+            goto soft;
+        }
+        return bfloat16_set_sign(bfloat16_zero, float32_is_neg(a));
+    }
+    return bf16_round_host(ua, s);
+
+ soft:
+    p = float32_unpack_canonical(a, s);
+    pr = float_to_float(p, &bfloat16_params, s);
     return bfloat16_round_pack_canonical(pr, s);
 }
 
@@ -2335,13 +2676,34 @@ int16_t float32_to_int16(float32 a, float_status *s)
     return float32_to_int16_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
+/*
+ * The hardfloat paths below only handle zero or normal inputs that fit in
+ * the integer type, so they never raise invalid.  Since can_use_fpu() has
+ * checked that inexact is already set and that rounding is to nearest
+ * even, which is also the host's rounding mode, the host conversion gives
+ * the same result and flags as softfloat.
+ */
 int32_t float32_to_int32(float32 a, float_status *s)
 {
+    union_float32 ua;
+
+    ua.s = a;
+    if (likely(can_use_fpu(s) && float32_is_zero_or_normal(ua.s) &&
+               fabsf(ua.h) < 0x1p31f)) {
+        return lrintf(ua.h);
+    }
     return float32_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
 int64_t float32_to_int64(float32 a, float_status *s)
 {
+    union_float32 ua;
+
+    ua.s = a;
+    if (likely(can_use_fpu(s) && float32_is_zero_or_normal(ua.s) &&
+               fabsf(ua.h) < 0x1p63f)) {
+        return llrintf(ua.h);
+    }
     return float32_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -2352,11 +2714,25 @@ int16_t float64_to_int16(float64 a, float_status *s)
 
 int32_t float64_to_int32(float64 a, float_status *s)
 {
+    union_float64 ua;
+
+    ua.s = a;
+    if (likely(can_use_fpu(s) && float64_is_zero_or_normal(ua.s) &&
+               fabs(ua.h) <= INT32_MAX)) {
+        return lrint(ua.h);
+    }
     return float64_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
 int64_t float64_to_int64(float64 a, float_status *s)
 {
+    union_float64 ua;
+
+    ua.s = a;
+    if (likely(can_use_fpu(s) && float64_is_zero_or_normal(ua.s) &&
+               fabs(ua.h) < 0x1p63)) {
+        return llrint(ua.h);
+    }
     return float64_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -2382,11 +2758,25 @@ int16_t float32_to_int16_round_to_zero(float32 a, float_status *s)
 
 int32_t float32_to_int32_round_to_zero(float32 a, float_status *s)
 {
+    union_float32 ua;
+
+    ua.s = a;
+    if (likely(can_use_fpu(s) && float32_is_zero_or_normal(ua.s) &&
+               fabsf(ua.h) < 0x1p31f)) {
+        return ua.h;
+    }
     return float32_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float32_to_int64_round_to_zero(float32 a, float_status *s)
 {
+    union_float32 ua;
+
+    ua.s = a;
+    if (likely(can_use_fpu(s) && float32_is_zero_or_normal(ua.s) &&
+               fabsf(ua.h) < 0x1p63f)) {
+        return ua.h;
+    }
     return float32_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -2397,11 +2787,25 @@ int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
 
 int32_t float64_to_int32_round_to_zero(float64 a, float_status *s)
 {
+    union_float64 ua;
+
+    ua.s = a;
+    if (likely(can_use_fpu(s) && float64_is_zero_or_normal(ua.s) &&
+               fabs(ua.h) < 0x1p31)) {
+        return ua.h;
+    }
     return float64_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float64_to_int64_round_to_zero(float64 a, float_status *s)
 {
+    union_float64 ua;
+
+    ua.s = a;
+    if (likely(can_use_fpu(s) && float64_is_zero_or_normal(ua.s) &&
+               fabs(ua.h) < 0x1p63)) {
+        return ua.h;
+    }
     return float64_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -2829,17 +3233,33 @@ float32 int16_to_float32_scalbn(int16_t a, int scale, float_status *status)
 
 float32 int64_to_float32(int64_t a, float_status *status)
 {
+    if (likely(can_use_fpu(status))) {
+        union_float32 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float32_scalbn(a, 0, status);
 }
 
 float32 int32_to_float32(int32_t a, float_status *status)
 {
+    if (likely(can_use_fpu(status))) {
+        union_float32 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float32_scalbn(a, 0, status);
 }
 
 float32 int16_to_float32(int16_t a, float_status *status)
 {
-    return int64_to_float32_scalbn(a, 0, status);
+    /* Exact, so no flags can be raised.  */
+    union_float32 ur;
+
+    ur.h = a;
+    return ur.s;
 }
 
 float64 int64_to_float64_scalbn(int64_t a, int scale, float_status *status)
@@ -2860,17 +3280,31 @@ float64 int16_to_float64_scalbn(int16_t a, int scale, float_status *status)
 
 float64 int64_to_float64(int64_t a, float_status *status)
 {
+    if (likely(can_use_fpu(status))) {
+        union_float64 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float64_scalbn(a, 0, status);
 }
 
 float64 int32_to_float64(int32_t a, float_status *status)
 {
-    return int64_to_float64_scalbn(a, 0, status);
+    /* Exact, so no flags can be raised.  */
+    union_float64 ur;
+
+    ur.h = a;
+    return ur.s;
 }
 
 float64 int16_to_float64(int16_t a, float_status *status)
 {
-    return int64_to_float64_scalbn(a, 0, status);
+    /* Exact, so no flags can be raised.  */
+    union_float64 ur;
+
+    ur.h = a;
+    return ur.s;
 }
 
 /*
@@ -2994,17 +3428,33 @@ float32 uint16_to_float32_scalbn(uint16_t a, int scale, float_status *status)
 
 float32 uint64_to_float32(uint64_t a, float_status *status)
 {
+    if (likely(can_use_fpu(status))) {
+        union_float32 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return uint64_to_float32_scalbn(a, 0, status);
 }
 
 float32 uint32_to_float32(uint32_t a, float_status *status)
 {
+    if (likely(can_use_fpu(status))) {
+        union_float32 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return uint64_to_float32_scalbn(a, 0, status);
 }
 
 float32 uint16_to_float32(uint16_t a, float_status *status)
 {
-    return uint64_to_float32_scalbn(a, 0, status);
+    /* Exact, so no flags can be raised.  */
+    union_float32 ur;
+
+    ur.h = a;
+    return ur.s;
 }
 
 float64 uint64_to_float64_scalbn(uint64_t a, int scale, float_status *status)
@@ -3025,17 +3475,31 @@ float64 uint16_to_float64_scalbn(uint16_t a, int scale, float_status *status)
 
 float64 uint64_to_float64(uint64_t a, float_status *status)
 {
+    if (likely(can_use_fpu(status))) {
+        union_float64 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return uint64_to_float64_scalbn(a, 0, status);
 }
 
 float64 uint32_to_float64(uint32_t a, float_status *status)
 {
-    return uint64_to_float64_scalbn(a, 0, status);
+    /* Exact, so no flags can be raised.  */
+    union_float64 ur;
+
+    ur.h = a;
+    return ur.s;
 }
 
 float64 uint16_to_float64(uint16_t a, float_status *status)
 {
-    return uint64_to_float64_scalbn(a, 0, status);
+    /* Exact, so no flags can be raised.  */
+    union_float64 ur;
+
+    ur.h = a;
+    return ur.s;
 }
 
 /*
@@ -3179,6 +3643,95 @@ MINMAX(16, max, false, false, false)
 MINMAX(16, maxnum, false, true, false)
 MINMAX(16, maxnummag, false, true, true)
 
+#undef MINMAX
+
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_f32_minmax(float32 a, float32 b, bool ismin, bool ieee, bool ismag,
+                float_status *s)
+{
+    FloatParts pa = float32_unpack_canonical(a, s);
+    FloatParts pb = float32_unpack_canonical(b, s);
+    FloatParts pr = minmax_floats(pa, pb, ismin, ieee, ismag, s);
+
+    return float32_round_pack_canonical(pr, s);
+}
+
+static float64 QEMU_SOFTFLOAT_ATTR
+soft_f64_minmax(float64 a, float64 b, bool ismin, bool ieee, bool ismag,
+                float_status *s)
+{
+    FloatParts pa = float64_unpack_canonical(a, s);
+    FloatParts pb = float64_unpack_canonical(b, s);
+    FloatParts pr = minmax_floats(pa, pb, ismin, ieee, ismag, s);
+
+    return float64_round_pack_canonical(pr, s);
+}
+
+/*
+ * Zero or normal inputs never raise flags and are returned unchanged, so
+ * they can be compared with the host FPU regardless of the rounding mode
+ * and flags.  Equal values, including zeroes of opposite signs, are left
+ * to softfloat, which picks by sign.
+ */
+static inline float32
+float32_minmax(float32 a, float32 b, bool ismin, bool ieee, bool ismag,
+               float_status *s)
+{
+    union_float32 ua, ub;
+
+    ua.s = a;
+    ub.s = b;
+    if (QEMU_NO_HARDFLOAT || unlikely(!f32_is_zon2(ua, ub))) {
+        goto soft;
+    }
+    if (ismag) {
+        float aa = fabsf(ua.h), ab = fabsf(ub.h);
+
+        if (aa != ab) {
+            return (aa < ab) ^ ismin ? b : a;
+        }
+    }
+    if (ua.h != ub.h) {
+        return (ua.h < ub.h) ^ ismin ? b : a;
+    }
+
+ soft:
+    return soft_f32_minmax(a, b, ismin, ieee, ismag, s);
+}
+
+static inline float64
+float64_minmax(float64 a, float64 b, bool ismin, bool ieee, bool ismag,
+               float_status *s)
+{
+    union_float64 ua, ub;
+
+    ua.s = a;
+    ub.s = b;
+    if (QEMU_NO_HARDFLOAT || unlikely(!f64_is_zon2(ua, ub))) {
+        goto soft;
+    }
+    if (ismag) {
+        double aa = fabs(ua.h), ab = fabs(ub.h);
+
+        if (aa != ab) {
+            return (aa < ab) ^ ismin ? b : a;
+        }
+    }
+    if (ua.h != ub.h) {
+        return (ua.h < ub.h) ^ ismin ? b : a;
+    }
+
+ soft:
+    return soft_f64_minmax(a, b, ismin, ieee, ismag, s);
+}
+
+#define MINMAX(sz, name, ismin, isiee, ismag)                           \
+float ## sz QEMU_FLATTEN                                                \
+float ## sz ## _ ## name(float ## sz a, float ## sz b, float_status *s) \
+{                                                                       \
+    return float ## sz ## _minmax(a, b, ismin, isiee, ismag, s);        \
+}
+
 MINMAX(32, min, true, false, false)
 MINMAX(32, minnum, true, true, false)
 MINMAX(32, minnummag, true, true, true)
@@ -3512,13 +4065,35 @@ static FloatParts sqrt_float(FloatParts a, float_status *s, const FloatFmt *p)
     return a;
 }
 
-float16 QEMU_FLATTEN float16_sqrt(float16 a, float_status *status)
+static float16 QEMU_SOFTFLOAT_ATTR
+soft_f16_sqrt(float16 a, float_status *status)
 {
     FloatParts pa = float16_unpack_canonical(a, status);
     FloatParts pr = sqrt_float(pa, status, &float16_params);
     return float16_round_pack_canonical(pr, status);
 }
 
+float16 QEMU_FLATTEN float16_sqrt(float16 a, float_status *s)
+{
+    union_float32 ur;
+
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+    if (unlikely(!f16_is_zon(a) || float16_is_neg(a))) {
+        goto soft;
+    }
+    if (float16_is_zero(a)) {
+        return a;
+    }
+    /* The root of a normal number is never tiny.  */
+    ur.h = sqrtf(f16_to_host(a).h);
+    return f16_round_host(ur, s);
+
+ soft:
+    return soft_f16_sqrt(a, s);
+}
+
 static float32 QEMU_SOFTFLOAT_ATTR
 soft_f32_sqrt(float32 a, float_status *status)
 {
@@ -3589,13 +4164,34 @@ float64 QEMU_FLATTEN float64_sqrt(float64 xa, float_status *s)
     return soft_f64_sqrt(ua.s, s);
 }
 
-bfloat16 QEMU_FLATTEN bfloat16_sqrt(bfloat16 a, float_status *status)
+static bfloat16 QEMU_SOFTFLOAT_ATTR
+soft_bf16_sqrt(bfloat16 a, float_status *status)
 {
     FloatParts pa = bfloat16_unpack_canonical(a, status);
     FloatParts pr = sqrt_float(pa, status, &bfloat16_params);
     return bfloat16_round_pack_canonical(pr, status);
 }
 
+bfloat16 QEMU_FLATTEN bfloat16_sqrt(bfloat16 a, float_status *s)
+{
+    union_float32 ur;
+
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+    if (unlikely(!bf16_is_zon(a) || bfloat16_is_neg(a))) {
+        goto soft;
+    }
+    if (bfloat16_is_zero(a)) {
+        return a;
+    }
+    ur.h = sqrtf(bf16_to_host(a).h);
+    return bf16_round_host(ur, s);
+
+ soft:
+    return soft_bf16_sqrt(a, s);
+}
+
 /*----------------------------------------------------------------------------
 | The pattern for a default generated NaN.
 *----------------------------------------------------------------------------*/
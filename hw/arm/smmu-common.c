@@ -65,6 +65,19 @@ SMMUIOTLBKey smmu_get_iotlb_key(uint16_t asid, uint64_t iova,
     return key;
 }
 
+static void smmu_iotlb_asid_free(gpointer data)
+{
+    SMMUIOTLBAsid *tlb = data;
+
+    g_hash_table_destroy(tlb->entries);
+    g_free(tlb);
+}
+
+static SMMUIOTLBAsid *smmu_iotlb_asid_lookup(SMMUState *bs, uint16_t asid)
+{
+    return g_hash_table_lookup(bs->iotlb, GUINT_TO_POINTER(asid));
+}
+
 SMMUTLBEntry *smmu_iotlb_lookup(SMMUState *bs, SMMUTransCfg *cfg,
                                 SMMUTransTableInfo *tt, hwaddr iova)
 {
@@ -72,19 +85,22 @@ SMMUTLBEntry *smmu_iotlb_lookup(SMMUState *bs, SMMUTransCfg *cfg,
     uint8_t inputsize = 64 - tt->tsz;
     uint8_t stride = tt->granule_sz - 3;
     uint8_t level = 4 - (inputsize - 4) / stride;
+    SMMUIOTLBAsid *tlb = smmu_iotlb_asid_lookup(bs, cfg->asid);
     SMMUTLBEntry *entry = NULL;
 
-    while (level <= 3) {
+    for (; tlb && level <= 3; level++) {
         uint64_t subpage_size = 1ULL << level_shift(level, tt->granule_sz);
         uint64_t mask = subpage_size - 1;
         SMMUIOTLBKey key;
 
+        if (!(tlb->levels & SMMU_IOTLB_LEVEL_BIT(tg, level))) {
+            continue;
+        }
         key = smmu_get_iotlb_key(cfg->asid, iova & ~mask, tg, level);
-        entry = g_hash_table_lookup(bs->iotlb, &key);
+        entry = g_hash_table_lookup(tlb->entries, &key);
         if (entry) {
             break;
         }
-        level++;
     }
 
     if (entry) {
@@ -107,72 +123,152 @@ void smmu_iotlb_insert(SMMUState *bs, SMMUTransCfg *cfg, SMMUTLBEntry *new)
 {
     SMMUIOTLBKey *key = g_new0(SMMUIOTLBKey, 1);
     uint8_t tg = (new->granule - 10) / 2;
+    SMMUIOTLBAsid *tlb;
 
-    if (g_hash_table_size(bs->iotlb) >= SMMU_IOTLB_MAX_SIZE) {
+    if (bs->iotlb_size >= SMMU_IOTLB_MAX_SIZE) {
         smmu_iotlb_inv_all(bs);
     }
 
+    tlb = smmu_iotlb_asid_lookup(bs, cfg->asid);
+    if (!tlb) {
+        tlb = g_new0(SMMUIOTLBAsid, 1);
+        tlb->entries = g_hash_table_new_full(smmu_iotlb_key_hash,
+                                             smmu_iotlb_key_equal,
+                                             g_free, g_free);
+        g_hash_table_insert(bs->iotlb, GUINT_TO_POINTER(cfg->asid), tlb);
+    }
+
     *key = smmu_get_iotlb_key(cfg->asid, new->entry.iova, tg, new->level);
     trace_smmu_iotlb_insert(cfg->asid, new->entry.iova, tg, new->level);
-    g_hash_table_insert(bs->iotlb, key, new);
+    if (g_hash_table_insert(tlb->entries, key, new)) {
+        bs->iotlb_size++;
+    }
+    tlb->levels |= SMMU_IOTLB_LEVEL_BIT(tg, new->level);
 }
 
 inline void smmu_iotlb_inv_all(SMMUState *s)
 {
     trace_smmu_iotlb_inv_all();
     g_hash_table_remove_all(s->iotlb);
+    s->iotlb_size = 0;
 }
 
-static gboolean smmu_hash_remove_by_asid(gpointer key, gpointer value,
-                                         gpointer user_data)
+inline void smmu_iotlb_inv_asid(SMMUState *s, uint16_t asid)
 {
-    uint16_t asid = *(uint16_t *)user_data;
-    SMMUIOTLBKey *iotlb_key = (SMMUIOTLBKey *)key;
+    SMMUIOTLBAsid *tlb = smmu_iotlb_asid_lookup(s, asid);
 
-    return SMMU_IOTLB_ASID(*iotlb_key) == asid;
+    trace_smmu_iotlb_inv_asid(asid);
+    if (tlb) {
+        s->iotlb_size -= g_hash_table_size(tlb->entries);
+        g_hash_table_remove(s->iotlb, GUINT_TO_POINTER(asid));
+    }
 }
 
-static gboolean smmu_hash_remove_by_asid_iova(gpointer key, gpointer value,
-                                              gpointer user_data)
+static gboolean smmu_hash_remove_by_iova(gpointer key, gpointer value,
+                                         gpointer user_data)
 {
     SMMUTLBEntry *iter = (SMMUTLBEntry *)value;
     IOMMUTLBEntry *entry = &iter->entry;
     SMMUIOTLBPageInvInfo *info = (SMMUIOTLBPageInvInfo *)user_data;
-    SMMUIOTLBKey iotlb_key = *(SMMUIOTLBKey *)key;
+    SMMUIOTLBKey *iotlb_key = (SMMUIOTLBKey *)key;
 
-    if (info->asid >= 0 && info->asid != SMMU_IOTLB_ASID(iotlb_key)) {
+    if (info->ttl &&
+        (iotlb_key->tg != info->tg || iotlb_key->level != info->ttl)) {
         return false;
     }
-    return ((info->iova & ~entry->addr_mask) == entry->iova) ||
-           ((entry->iova & ~info->mask) == info->iova);
+    return entry->iova <= info->end &&
+           entry->iova + entry->addr_mask >= info->iova;
 }
 
-inline void
-smmu_iotlb_inv_iova(SMMUState *s, int asid, dma_addr_t iova,
-                    uint8_t tg, uint64_t num_pages, uint8_t ttl)
+/*
+ * Remove the entries of one ASID that overlap the range in @user_data.
+ * Small ranges are handled by looking up each block that may be cached at
+ * the granule/level pairs present in the sub-table; for large ones it is
+ * cheaper to walk the entries.  Returns true if the sub-table is now
+ * empty, so that this can be used with g_hash_table_foreach_remove().
+ */
+static gboolean smmu_iotlb_inv_asid_range(gpointer key, gpointer value,
+                                          gpointer user_data)
 {
-    if (ttl && (num_pages == 1)) {
-        SMMUIOTLBKey key = smmu_get_iotlb_key(asid, iova, tg, ttl);
+    uint16_t asid = GPOINTER_TO_UINT(key);
+    SMMUIOTLBAsid *tlb = value;
+    SMMUIOTLBPageInvInfo *info = user_data;
+    guint size = g_hash_table_size(tlb->entries);
+    uint16_t levels = tlb->levels;
+    uint64_t probes = 0;
+    int bit;
+
+    if (info->ttl) {
+        levels &= SMMU_IOTLB_LEVEL_BIT(info->tg, info->ttl);
+    }
 
-        g_hash_table_remove(s->iotlb, &key);
-    } else {
-        /* if tg is not set we use 4KB range invalidation */
-        uint8_t granule = tg ? tg * 2 + 10 : 12;
+    for (bit = 0; bit < 16; bit++) {
+        if (levels & BIT(bit)) {
+            int shift = level_shift(bit % 4, (bit / 4) * 2 + 10);
 
-        SMMUIOTLBPageInvInfo info = {
-            .asid = asid, .iova = iova,
-            .mask = (num_pages * 1 << granule) - 1};
+            probes += (info->end >> shift) - (info->iova >> shift) + 1;
+        }
+    }
 
-        g_hash_table_foreach_remove(s->iotlb,
-                                    smmu_hash_remove_by_asid_iova,
-                                    &info);
+    if (probes <= size) {
+        for (bit = 0; bit < 16; bit++) {
+            int shift = level_shift(bit % 4, (bit / 4) * 2 + 10);
+            uint64_t addr = (info->iova >> shift) << shift;
+            uint64_t n = (info->end >> shift) - (info->iova >> shift) + 1;
+
+            if (!(levels & BIT(bit))) {
+                continue;
+            }
+            for (; n; n--, addr += 1ULL << shift) {
+                SMMUIOTLBKey iotlb_key = smmu_get_iotlb_key(asid, addr,
+                                                            bit / 4, bit % 4);
+
+                g_hash_table_remove(tlb->entries, &iotlb_key);
+            }
+        }
+    } else {
+        g_hash_table_foreach_remove(tlb->entries,
+                                    smmu_hash_remove_by_iova, info);
     }
+
+    info->removed += size - g_hash_table_size(tlb->entries);
+    return !g_hash_table_size(tlb->entries);
 }
 
-inline void smmu_iotlb_inv_asid(SMMUState *s, uint16_t asid)
+/*
+ * Invalidate @num_pages pages of granule @tg starting at @iova, in @asid or
+ * in all ASIDs if @asid is negative.  @ttl, if not zero, is the level of the
+ * leaf entries to invalidate.
+ */
+inline void
+smmu_iotlb_inv_iova(SMMUState *s, int asid, dma_addr_t iova,
+                    uint8_t tg, uint64_t num_pages, uint8_t ttl)
 {
-    trace_smmu_iotlb_inv_asid(asid);
-    g_hash_table_foreach_remove(s->iotlb, smmu_hash_remove_by_asid, &asid);
+    /* if tg is not set we use 4KB range invalidation */
+    uint8_t granule = tg ? tg * 2 + 10 : 12;
+    SMMUIOTLBPageInvInfo info = {
+        .iova = iova, .end = UINT64_MAX,
+        .tg = tg, .ttl = tg ? ttl : 0,
+    };
+
+    /* A range that runs past the top of the address space ends there */
+    if (num_pages <= (UINT64_MAX - iova) >> granule) {
+        info.end = iova + (num_pages << granule) - 1;
+    }
+
+    trace_smmu_iotlb_inv_iova(asid, iova, num_pages);
+    if (asid >= 0) {
+        SMMUIOTLBAsid *tlb = smmu_iotlb_asid_lookup(s, asid);
+
+        if (tlb && smmu_iotlb_inv_asid_range(GUINT_TO_POINTER(asid),
+                                             tlb, &info)) {
+            g_hash_table_remove(s->iotlb, GUINT_TO_POINTER(asid));
+        }
+    } else {
+        g_hash_table_foreach_remove(s->iotlb, smmu_iotlb_inv_asid_range,
+                                    &info);
+    }
+    s->iotlb_size -= info.removed;
 }
 
 /* VMSAv8-64 Translation */
@@ -508,8 +604,7 @@ static void smmu_base_realize(DeviceState *dev, Error **errp)
         return;
     }
     s->configs = g_hash_table_new_full(NULL, NULL, NULL, g_free);
-    s->iotlb = g_hash_table_new_full(smmu_iotlb_key_hash, smmu_iotlb_key_equal,
-                                     g_free, g_free);
+    s->iotlb = g_hash_table_new_full(NULL, NULL, NULL, smmu_iotlb_asid_free);
     s->smmu_pcibus_by_busptr = g_hash_table_new(NULL, NULL);
 
     if (s->primary_bus) {
@@ -525,6 +620,7 @@ static void smmu_base_reset(DeviceState *dev)
 
     g_hash_table_remove_all(s->configs);
     g_hash_table_remove_all(s->iotlb);
+    s->iotlb_size = 0;
 }
 
 static Property smmu_dev_properties[] = {
@@ -96,12 +96,24 @@ uint64_t iova_level_offset(uint64_t iova, int inputsize,
             MAKE_64BIT_MASK(0, gsz - 3);
 }
 
-#define SMMU_IOTLB_ASID(key) ((key).asid)
+/*
+ * IOTLB entries of a single ASID.  @levels has SMMU_IOTLB_LEVEL_BIT(tg, level)
+ * set for every granule/level pair inserted since the sub-table was
+ * created, so that lookups and invalidations only probe those keys.
+ */
+typedef struct SMMUIOTLBAsid {
+    GHashTable *entries;
+    uint16_t levels;
+} SMMUIOTLBAsid;
+
+#define SMMU_IOTLB_LEVEL_BIT(tg, level) BIT((tg) * 4 + (level))
 
 typedef struct SMMUIOTLBPageInvInfo {
-    int asid;
-    uint64_t iova;
-    uint64_t mask;
+    uint64_t iova;          /* first byte of the invalidated range */
+    uint64_t end;           /* last byte of the invalidated range */
+    uint8_t tg;
+    uint8_t ttl;            /* leaf level hint, or 0 */
+    unsigned int removed;   /* out: number of entries removed */
 } SMMUIOTLBPageInvInfo;
 
 #endif
@@ -800,7 +800,7 @@ static void smmuv3_notify_iova(IOMMUMemoryRegion *mr,
 {
     SMMUDevice *sdev = container_of(mr, SMMUDevice, iommu);
     IOMMUTLBEntry entry;
-    uint8_t granule = tg;
+    uint8_t granule = tg ? tg * 2 + 10 : 0;
 
     if (!tg) {
         SMMUEventInfo event = {.inval_ste_allowed = true};
@@ -824,7 +824,7 @@ static void smmuv3_notify_iova(IOMMUMemoryRegion *mr,
 
     entry.target_as = &address_space_memory;
     entry.iova = iova;
-    entry.addr_mask = num_pages * (1 << granule) - 1;
+    entry.addr_mask = (num_pages << granule) - 1;
     entry.perm = IOMMU_NONE;
 
     memory_region_notify_one(n, &entry);
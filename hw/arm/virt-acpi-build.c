@@ -464,7 +464,6 @@ build_gtdt(GArray *table_data, BIOSLinker *linker, VirtMachineState *vms)
 static void
 build_madt(GArray *table_data, BIOSLinker *linker, VirtMachineState *vms)
 {
-    VirtMachineClass *vmc = VIRT_MACHINE_GET_CLASS(vms);
     int madt_start = table_data->len;
     const MemMapEntry *memmap = vms->memmap;
     const int *irqmap = vms->irqmap;
@@ -526,7 +525,7 @@ build_madt(GArray *table_data, BIOSLinker *linker, VirtMachineState *vms)
                 cpu_to_le32(memmap[VIRT_HIGH_GIC_REDIST2].size);
         }
 
-        if (its_class_name() && !vmc->no_its) {
+        if (vms->msi_controller == VIRT_MSI_CTRL_ITS) {
             gic_its = acpi_data_push(table_data, sizeof *gic_its);
             gic_its->type = ACPI_APIC_GENERIC_TRANSLATOR;
             gic_its->length = sizeof(*gic_its);
@@ -657,7 +656,6 @@ struct AcpiBuildState {
 static
 void virt_acpi_build(VirtMachineState *vms, AcpiBuildTables *tables)
 {
-    VirtMachineClass *vmc = VIRT_MACHINE_GET_CLASS(vms);
     GArray *table_offsets;
     unsigned dsdt, xsdt;
     GArray *tables_blob = tables->table_data;
@@ -716,7 +714,7 @@ void virt_acpi_build(VirtMachineState *vms, AcpiBuildTables *tables)
                           ms->nvdimms_state, ms->ram_slots);
     }
 
-    if (its_class_name() && !vmc->no_its) {
+    if (vms->msi_controller == VIRT_MSI_CTRL_ITS) {
         acpi_add_table(table_offsets, tables_blob);
         build_iort(tables_blob, tables->linker, vms);
     }
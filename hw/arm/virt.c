@@ -587,7 +587,7 @@ static void create_its(VirtMachineState *vms)
     const char *itsclass = its_class_name();
     DeviceState *dev;
 
-    if (!itsclass) {
+    if (!itsclass || (!strcmp(itsclass, "arm-gicv3-its") && !vms->tcg_its)) {
         /* Do nothing if not supported */
         return;
     }
@@ -624,7 +624,7 @@ static void create_v2m(VirtMachineState *vms)
     vms->msi_controller = VIRT_MSI_CTRL_GICV2M;
 }
 
-static void create_gic(VirtMachineState *vms)
+static void create_gic(VirtMachineState *vms, MemoryRegion *mem)
 {
     MachineState *ms = MACHINE(vms);
     /* We create a standalone GIC */
@@ -665,6 +665,13 @@ static void create_gic(VirtMachineState *vms)
             qdev_prop_set_uint32(vms->gic, "redist-region-count[1]",
                 MIN(smp_cpus - redist0_count, redist1_capacity));
         }
+
+        if (!kvm_irqchip_in_kernel() && vms->its && vms->tcg_its) {
+            /* The emulated ITS needs LPI support in the redistributors */
+            object_property_set_link(OBJECT(vms->gic), "sysmem", OBJECT(mem),
+                                     &error_fatal);
+            qdev_prop_set_bit(vms->gic, "has-lpi", true);
+        }
     } else {
         if (!kvm_irqchip_in_kernel()) {
             qdev_prop_set_bit(vms->gic, "has-virtualization-extensions",
@@ -1911,7 +1918,7 @@ static void machvirt_init(MachineState *machine)
 
     virt_flash_fdt(vms, sysmem, secure_sysmem ?: sysmem);
 
-    create_gic(vms);
+    create_gic(vms, sysmem);
 
     fdt_add_pmu_nodes(vms);
 
@@ -2491,6 +2498,7 @@ static void virt_instance_init(Object *obj)
     } else {
         /* Default allows ITS instantiation */
         vms->its = true;
+        vms->tcg_its = !vmc->no_tcg_its;
         object_property_add_bool(obj, "its", virt_get_its,
                                  virt_set_its);
         object_property_set_description(obj, "its",
@@ -2553,8 +2561,12 @@ DEFINE_VIRT_MACHINE_AS_LATEST(5, 2)
 
 static void virt_machine_5_1_options(MachineClass *mc)
 {
+    VirtMachineClass *vmc = VIRT_MACHINE_CLASS(OBJECT_CLASS(mc));
+
     virt_machine_5_2_options(mc);
     compat_props_add(mc->compat_props, hw_compat_5_1, hw_compat_5_1_len);
+    /* The emulated ITS was introduced with 5.2 */
+    vmc->no_tcg_its = true;
 }
 DEFINE_VIRT_MACHINE(5, 1)
 
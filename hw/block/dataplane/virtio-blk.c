@@ -26,6 +26,24 @@
 #include "hw/virtio/virtio-bus.h"
 #include "qom/object_interfaces.h"
 
+/* Per-virtqueue state.  The host notifier of a virtqueue is handled in its
+ * AioContext, which is the only one that pops and pushes elements once the
+ * dataplane has started.  Requests are still submitted under the AioContext
+ * lock of the BlockBackend, because this block layer has no multi-queue
+ * support, and their completion callbacks run there.  Requests completed in
+ * another AioContext are handed back through @completed and pushed to the
+ * used ring, and the guest notified, by @bh in the virtqueue's AioContext.
+ */
+typedef struct {
+    VirtIOBlockDataPlane *s;
+    unsigned index;
+    AioContext *ctx;
+    QEMUBH *bh;
+
+    QemuMutex lock;         /* protects @completed */
+    QSIMPLEQ_HEAD(, VirtIOBlockReq) completed;
+} VirtIOBlockDataPlaneVq;
+
 struct VirtIOBlockDataPlane {
     bool starting;
     bool stopping;
@@ -41,8 +59,11 @@ struct VirtIOBlockDataPlane {
      * (because you don't own the file descriptor or handle; you just
      * use it).
      */
-    IOThread *iothread;
-    AioContext *ctx;
+    IOThread **iothreads;
+    unsigned num_iothreads;
+    AioContext *ctx;        /* AioContext of the BlockBackend */
+
+    VirtIOBlockDataPlaneVq *vqs;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
@@ -63,8 +84,11 @@ static void notify_guest_bh(void *opaque)
     unsigned long bitmap[BITS_TO_LONGS(nvqs)];
     unsigned j;
 
+    /* batch_notify_vqs may be updated by other iothreads with the lock held */
+    aio_context_acquire(s->ctx);
     memcpy(bitmap, s->batch_notify_vqs, sizeof(bitmap));
     memset(s->batch_notify_vqs, 0, sizeof(bitmap));
+    aio_context_release(s->ctx);
 
     for (j = 0; j < nvqs; j += BITS_PER_LONG) {
         unsigned long bits = bitmap[j / BITS_PER_LONG];
@@ -80,6 +104,52 @@ static void notify_guest_bh(void *opaque)
     }
 }
 
+/* Whether @vq may be pushed to from the current thread */
+bool virtio_blk_data_plane_in_vq_context(VirtIOBlockDataPlane *s,
+                                         VirtQueue *vq)
+{
+    return qemu_get_current_aio_context() ==
+           s->vqs[virtio_get_queue_index(vq)].ctx;
+}
+
+/* Hand a request that was completed in another AioContext back to the
+ * AioContext of its virtqueue.  The request must not be used afterwards.
+ */
+void virtio_blk_data_plane_complete(VirtIOBlockDataPlane *s,
+                                    VirtIOBlockReq *req)
+{
+    VirtIOBlockDataPlaneVq *dvq = &s->vqs[virtio_get_queue_index(req->vq)];
+
+    qemu_mutex_lock(&dvq->lock);
+    QSIMPLEQ_INSERT_TAIL(&dvq->completed, req, complete_next);
+    qemu_mutex_unlock(&dvq->lock);
+    qemu_bh_schedule(dvq->bh);
+}
+
+/* Context: BH in the AioContext of the virtqueue */
+static void virtio_blk_data_plane_complete_bh(void *opaque)
+{
+    VirtIOBlockDataPlaneVq *dvq = opaque;
+    VirtIOBlockDataPlane *s = dvq->s;
+    VirtQueue *vq = virtio_get_queue(s->vdev, dvq->index);
+    QSIMPLEQ_HEAD(, VirtIOBlockReq) reqs = QSIMPLEQ_HEAD_INITIALIZER(reqs);
+    VirtIOBlockReq *req, *next;
+    unsigned n = 0;
+
+    qemu_mutex_lock(&dvq->lock);
+    QSIMPLEQ_CONCAT(&reqs, &dvq->completed);
+    qemu_mutex_unlock(&dvq->lock);
+
+    QSIMPLEQ_FOREACH_SAFE(req, &reqs, complete_next, next) {
+        virtqueue_fill(vq, &req->elem, req->in_len, n++);
+        virtqueue_free_element(req);
+    }
+    if (n) {
+        virtqueue_flush(vq, n);
+        virtio_notify_irqfd(s->vdev, vq);
+    }
+}
+
 /* Context: QEMU global mutex held */
 bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
                                   VirtIOBlockDataPlane **dataplane,
@@ -88,10 +158,38 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    g_autofree IOThread **iothreads = NULL;
+    unsigned num_iothreads = 0;
+    unsigned i;
 
     *dataplane = NULL;
 
+    if (conf->iothread && conf->num_iothreads) {
+        error_setg(errp, "iothread and iothreads properties are mutually "
+                   "exclusive");
+        return false;
+    }
     if (conf->iothread) {
+        num_iothreads = 1;
+        iothreads = g_new(IOThread *, 1);
+        iothreads[0] = conf->iothread;
+    } else if (conf->num_iothreads) {
+        num_iothreads = conf->num_iothreads;
+        iothreads = g_new(IOThread *, num_iothreads);
+        for (i = 0; i < num_iothreads; i++) {
+            if (!conf->iothreads[i]) {
+                error_setg(errp, "iothreads[%u] is not set", i);
+                return false;
+            }
+            iothreads[i] = iothread_by_id(conf->iothreads[i]);
+            if (!iothreads[i]) {
+                error_setg(errp, "Cannot find iothread %s", conf->iothreads[i]);
+                return false;
+            }
+        }
+    }
+
+    if (num_iothreads) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -120,13 +218,33 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->vdev = vdev;
     s->conf = conf;
 
-    if (conf->iothread) {
-        s->iothread = conf->iothread;
-        object_ref(OBJECT(s->iothread));
-        s->ctx = iothread_get_aio_context(s->iothread);
+    /* The BlockBackend lives in the AioContext of the first iothread */
+    if (num_iothreads) {
+        s->num_iothreads = num_iothreads;
+        s->iothreads = g_steal_pointer(&iothreads);
+        for (i = 0; i < num_iothreads; i++) {
+            object_ref(OBJECT(s->iothreads[i]));
+        }
+        s->ctx = iothread_get_aio_context(s->iothreads[0]);
     } else {
         s->ctx = qemu_get_aio_context();
     }
+
+    /* Virtqueues are assigned to the iothreads round robin */
+    s->vqs = g_new0(VirtIOBlockDataPlaneVq, conf->num_queues);
+    for (i = 0; i < conf->num_queues; i++) {
+        VirtIOBlockDataPlaneVq *dvq = &s->vqs[i];
+
+        dvq->s = s;
+        dvq->index = i;
+        dvq->ctx = num_iothreads ?
+            iothread_get_aio_context(s->iothreads[i % num_iothreads]) :
+            s->ctx;
+        dvq->bh = aio_bh_new(dvq->ctx, virtio_blk_data_plane_complete_bh, dvq);
+        qemu_mutex_init(&dvq->lock);
+        QSIMPLEQ_INIT(&dvq->completed);
+    }
+
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
@@ -139,6 +257,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -148,9 +267,16 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
     assert(!vblk->dataplane_started);
     g_free(s->batch_notify_vqs);
     qemu_bh_delete(s->bh);
-    if (s->iothread) {
-        object_unref(OBJECT(s->iothread));
+    for (i = 0; i < s->conf->num_queues; i++) {
+        assert(QSIMPLEQ_EMPTY(&s->vqs[i].completed));
+        qemu_bh_delete(s->vqs[i].bh);
+        qemu_mutex_destroy(&s->vqs[i].lock);
+    }
+    for (i = 0; i < s->num_iothreads; i++) {
+        object_unref(OBJECT(s->iothreads[i]));
     }
+    g_free(s->iothreads);
+    g_free(s->vqs);
     g_free(s);
 }
 
@@ -231,14 +357,14 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(s->vqs[i].ctx);
+        virtio_queue_aio_set_host_notifier_handler(vq, s->vqs[i].ctx,
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(s->vqs[i].ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_guest_notifiers:
@@ -253,19 +379,105 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     return -ENOSYS;
 }
 
-/* Stop notifications for new requests from guest.
+typedef struct {
+    VirtIOBlockDataPlane *s;
+    AioContext *ctx;
+} VirtIOBlockDataPlaneStopData;
+
+/* Stop notifications for new requests from guest on the virtqueues that
+ * are handled in the AioContext of the current IOThread.
  *
  * Context: BH in IOThread
  */
 static void virtio_blk_data_plane_stop_bh(void *opaque)
 {
-    VirtIOBlockDataPlane *s = opaque;
+    VirtIOBlockDataPlaneStopData *data = opaque;
+    VirtIOBlockDataPlane *s = data->s;
     unsigned i;
 
     for (i = 0; i < s->conf->num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
+        if (s->vqs[i].ctx == data->ctx) {
+            virtio_queue_aio_set_host_notifier_handler(vq, data->ctx, NULL);
+        }
+    }
+}
+
+/* Push the requests that were completed in other AioContexts to the
+ * virtqueues that are handled in the AioContext of the current IOThread.
+ *
+ * Context: BH in IOThread
+ */
+static void virtio_blk_data_plane_flush_bh(void *opaque)
+{
+    VirtIOBlockDataPlaneStopData *data = opaque;
+    VirtIOBlockDataPlane *s = data->s;
+    unsigned i;
+
+    for (i = 0; i < s->conf->num_queues; i++) {
+        if (s->vqs[i].ctx == data->ctx) {
+            virtio_blk_data_plane_complete_bh(&s->vqs[i]);
+        }
+    }
+}
+
+/* Run @fn once in every AioContext that handles virtqueues.
+ *
+ * Context: QEMU global mutex held
+ */
+static void virtio_blk_data_plane_foreach_ctx(VirtIOBlockDataPlane *s,
+                                              QEMUBHFunc *fn)
+{
+    unsigned i, j;
+
+    for (i = 0; i < s->conf->num_queues; i++) {
+        VirtIOBlockDataPlaneStopData data = {
+            .s = s,
+            .ctx = s->vqs[i].ctx,
+        };
+
+        /* Only once per AioContext */
+        for (j = 0; j < i && s->vqs[j].ctx != s->vqs[i].ctx; j++) {
+            /* nothing */
+        }
+        if (j < i) {
+            continue;
+        }
+
+        aio_context_acquire(data.ctx);
+        aio_wait_bh_oneshot(data.ctx, fn, &data);
+        aio_context_release(data.ctx);
+    }
+}
+
+/* Stop processing virtqueues in iothreads other than the one of the
+ * BlockBackend while it is drained.  Notifications for the BlockBackend's
+ * own AioContext are disabled by the block layer.
+ */
+void virtio_blk_data_plane_drained_begin(VirtIOBlockDataPlane *s)
+{
+    unsigned i;
+
+    for (i = 0; i < s->num_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(s->iothreads[i]);
+
+        if (ctx != s->ctx) {
+            aio_disable_external(ctx);
+        }
+    }
+}
+
+void virtio_blk_data_plane_drained_end(VirtIOBlockDataPlane *s)
+{
+    unsigned i;
+
+    for (i = 0; i < s->num_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(s->iothreads[i]);
+
+        if (ctx != s->ctx) {
+            aio_enable_external(ctx);
+        }
     }
 }
 
@@ -292,8 +504,9 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    virtio_blk_data_plane_foreach_ctx(s, virtio_blk_data_plane_stop_bh);
+
     aio_context_acquire(s->ctx);
-    aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
     /* Drain and try to switch bs back to the QEMU main loop. If other users
      * keep the BlockBackend in the iothread, that's ok */
@@ -301,6 +514,9 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
 
     aio_context_release(s->ctx);
 
+    /* Requests completed while draining are still on their way back */
+    virtio_blk_data_plane_foreach_ctx(s, virtio_blk_data_plane_flush_bh);
+
     for (i = 0; i < nvqs; i++) {
         virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
         virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
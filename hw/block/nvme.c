@@ -22,7 +22,8 @@
  *              [pmrdev=<mem_backend_file_id>,] \
  *              max_ioqpairs=<N[optional]>, \
  *              aerl=<N[optional]>, aer_max_queued=<N[optional]>, \
- *              mdts=<N[optional]>
+ *              mdts=<N[optional]>, \
+ *              [iothread=<iothread_id>,] ioeventfd=<on|off[optional]>
  *
  * Note cmb_size_mb denotes size of CMB in MB. CMB is assumed to be at
  * offset 0 in BAR2 and supports only WDS, RDS and SQS for now.
@@ -48,11 +49,24 @@
  *   completion when there are no oustanding AERs. When the maximum number of
  *   enqueued events are reached, subsequent events will be dropped.
  *
+ * - `iothread`
+ *   Service the I/O submission and completion queues in the given IOThread
+ *   instead of the main loop. Admin queues are always serviced in the main
+ *   loop. Interrupts are sent through KVM irqfds when available.
+ *
+ * - `ioeventfd`
+ *   Use ioeventfd for I/O submission queue tail doorbells once the host has
+ *   set up shadow doorbells with the Doorbell Buffer Config command. The
+ *   tail is read from the shadow doorbell, so plain MMIO doorbell writes
+ *   keep going through the normal exit path before that. Defaults to on.
+ *
  */
 
 #include "qemu/osdep.h"
 #include "qemu/units.h"
 #include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "block/aio-wait.h"
 #include "hw/block/block.h"
 #include "hw/pci/msix.h"
 #include "hw/pci/pci.h"
@@ -63,10 +77,12 @@
 #include "qapi/visitor.h"
 #include "sysemu/hostmem.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/kvm.h"
 #include "exec/memory.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
 #include "qemu/cutils.h"
+#include "qemu/bitmap.h"
 #include "trace.h"
 #include "nvme.h"
 
@@ -79,6 +95,7 @@
 #define NVME_TEMPERATURE_WARNING 0x157
 #define NVME_TEMPERATURE_CRITICAL 0x175
 #define NVME_NUM_FW_SLOTS 1
+#define NVME_CQE_BATCH 64
 
 #define NVME_GUEST_ERR(trace, fmt, ...) \
     do { \
@@ -105,6 +122,8 @@ static const uint32_t nvme_feature_cap[NVME_FID_MAX] = {
     [NVME_TEMPERATURE_THRESHOLD]    = NVME_FEAT_CAP_CHANGE,
     [NVME_VOLATILE_WRITE_CACHE]     = NVME_FEAT_CAP_CHANGE,
     [NVME_NUMBER_OF_QUEUES]         = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_COALESCING]     = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_VECTOR_CONF]    = NVME_FEAT_CAP_CHANGE,
     [NVME_ASYNCHRONOUS_EVENT_CONF]  = NVME_FEAT_CAP_CHANGE,
     [NVME_TIMESTAMP]                = NVME_FEAT_CAP_CHANGE,
 };
@@ -184,6 +203,46 @@ static uint8_t nvme_sq_empty(NvmeSQueue *sq)
     return sq->head == sq->tail;
 }
 
+static void nvme_update_cq_head(NvmeCQueue *cq)
+{
+    uint32_t head = ldl_le_pci_dma(&cq->ctrl->parent_obj, cq->db_addr);
+
+    if (unlikely(head >= cq->size)) {
+        NVME_GUEST_ERR(pci_nvme_ub_db_shadow_invalid_cqhead,
+                       "shadow completion queue head beyond queue size,"
+                       " cqid=%"PRIu32", new_head=%"PRIu32", ignoring",
+                       cq->cqid, head);
+        return;
+    }
+
+    cq->head = head;
+}
+
+static void nvme_update_cq_eventidx(NvmeCQueue *cq)
+{
+    stl_le_pci_dma(&cq->ctrl->parent_obj, cq->ei_addr, cq->head);
+}
+
+static void nvme_update_sq_tail(NvmeSQueue *sq)
+{
+    uint32_t tail = ldl_le_pci_dma(&sq->ctrl->parent_obj, sq->db_addr);
+
+    if (unlikely(tail >= sq->size)) {
+        NVME_GUEST_ERR(pci_nvme_ub_db_shadow_invalid_sqtail,
+                       "shadow submission queue tail beyond queue size,"
+                       " sqid=%"PRIu32", new_tail=%"PRIu32", ignoring",
+                       sq->sqid, tail);
+        return;
+    }
+
+    sq->tail = tail;
+}
+
+static void nvme_update_sq_eventidx(NvmeSQueue *sq)
+{
+    stl_le_pci_dma(&sq->ctrl->parent_obj, sq->ei_addr, sq->tail);
+}
+
 static void nvme_irq_check(NvmeCtrl *n)
 {
     if (msix_enabled(&(n->parent_obj))) {
@@ -226,6 +285,249 @@ static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+/*
+ * I/O completion queues that are serviced in an IOThread do not raise
+ * interrupts directly, since that requires the BQL. Instead, they signal
+ * cq->irq_notifier, which is either bound to a KVM irqfd for the queue's
+ * MSI-X vector or handled in the main loop.
+ */
+static void nvme_irq_notifier_read(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, irq_notifier);
+    NvmeCtrl *n = cq->ctrl;
+
+    if (event_notifier_test_and_clear(e)) {
+        aio_context_acquire(n->ctx);
+        if (cq->tail != cq->head) {
+            nvme_irq_assert(n, cq);
+        }
+        aio_context_release(n->ctx);
+    }
+}
+
+static int nvme_vector_unmask(PCIDevice *pci_dev, unsigned vector,
+                              MSIMessage msg)
+{
+    NvmeCtrl *n = NVME(pci_dev);
+    int i, ret;
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        NvmeCQueue *cq = n->cq[i];
+
+        if (!cq || !cq->irqfd_enabled || cq->vector != vector) {
+            continue;
+        }
+
+        if (cq->msg.address != msg.address || cq->msg.data != msg.data) {
+            ret = kvm_irqchip_update_msi_route(kvm_state, cq->virq, msg,
+                                               pci_dev);
+            if (ret < 0) {
+                return ret;
+            }
+            kvm_irqchip_commit_routes(kvm_state);
+            cq->msg = msg;
+        }
+
+        if (!cq->irqfd_attached) {
+            ret = kvm_irqchip_add_irqfd_notifier_gsi(kvm_state,
+                                                     &cq->irq_notifier,
+                                                     NULL, cq->virq);
+            if (ret < 0) {
+                return ret;
+            }
+            cq->irqfd_attached = true;
+        }
+    }
+
+    return 0;
+}
+
+static void nvme_vector_mask(PCIDevice *pci_dev, unsigned vector)
+{
+    NvmeCtrl *n = NVME(pci_dev);
+    int i;
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        NvmeCQueue *cq = n->cq[i];
+
+        if (cq && cq->irqfd_attached && cq->vector == vector) {
+            kvm_irqchip_remove_irqfd_notifier_gsi(kvm_state,
+                                                  &cq->irq_notifier,
+                                                  cq->virq);
+            cq->irqfd_attached = false;
+        }
+    }
+}
+
+static void nvme_vector_poll(PCIDevice *pci_dev, unsigned vector_start,
+                             unsigned vector_end)
+{
+    NvmeCtrl *n = NVME(pci_dev);
+    int i;
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        NvmeCQueue *cq = n->cq[i];
+
+        if (!cq || !cq->irqfd_enabled ||
+            cq->vector < vector_start || cq->vector >= vector_end) {
+            continue;
+        }
+
+        if (msix_is_masked(pci_dev, cq->vector) &&
+            event_notifier_test_and_clear(&cq->irq_notifier)) {
+            msix_set_pending(pci_dev, cq->vector);
+        }
+    }
+}
+
+static int nvme_init_irqfd(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    PCIDevice *pci_dev = &n->parent_obj;
+    int ret;
+
+    ret = kvm_irqchip_add_msi_route(kvm_state, cq->vector, pci_dev);
+    if (ret < 0) {
+        return ret;
+    }
+    kvm_irqchip_commit_routes(kvm_state);
+
+    cq->virq = ret;
+    cq->msg = msix_get_message(pci_dev, cq->vector);
+    cq->irqfd_enabled = true;
+
+    /* Setting the notifiers attaches the irqfd if the vector is unmasked */
+    if (!n->msix_notifiers_set) {
+        ret = msix_set_vector_notifiers(pci_dev, nvme_vector_unmask,
+                                        nvme_vector_mask, nvme_vector_poll);
+        if (ret < 0) {
+            goto fail;
+        }
+        n->msix_notifiers_set = true;
+    } else if (!msix_is_masked(pci_dev, cq->vector)) {
+        ret = kvm_irqchip_add_irqfd_notifier_gsi(kvm_state, &cq->irq_notifier,
+                                                 NULL, cq->virq);
+        if (ret < 0) {
+            goto fail;
+        }
+        cq->irqfd_attached = true;
+    }
+
+    return 0;
+
+fail:
+    kvm_irqchip_release_virq(kvm_state, cq->virq);
+    cq->irqfd_enabled = false;
+    return ret;
+}
+
+static int nvme_init_irq_notifier(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    int ret;
+
+    ret = event_notifier_init(&cq->irq_notifier, 0);
+    if (ret < 0) {
+        return ret;
+    }
+    cq->irq_notifier_enabled = true;
+
+    if (msix_enabled(&n->parent_obj) && kvm_msi_via_irqfd_enabled()) {
+        ret = nvme_init_irqfd(n, cq);
+        if (ret == 0) {
+            return 0;
+        }
+        trace_pci_nvme_irqfd_unavailable(cq->cqid, ret);
+    }
+
+    event_notifier_set_handler(&cq->irq_notifier, nvme_irq_notifier_read);
+    return 0;
+}
+
+static void nvme_release_irq_notifier(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    if (cq->irqfd_enabled) {
+        if (cq->irqfd_attached) {
+            kvm_irqchip_remove_irqfd_notifier_gsi(kvm_state, &cq->irq_notifier,
+                                                  cq->virq);
+            cq->irqfd_attached = false;
+        }
+        kvm_irqchip_release_virq(kvm_state, cq->virq);
+        cq->irqfd_enabled = false;
+    } else {
+        event_notifier_set_handler(&cq->irq_notifier, NULL);
+    }
+
+    event_notifier_cleanup(&cq->irq_notifier);
+    cq->irq_notifier_enabled = false;
+}
+
+static void nvme_cq_raise_irq(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    if (cq->irq_notifier_enabled) {
+        event_notifier_set(&cq->irq_notifier);
+    } else {
+        nvme_irq_assert(n, cq);
+    }
+}
+
+static bool nvme_cq_coalescing(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    uint32_t intc = n->features.int_coalescing;
+
+    /* Completions for the admin vector are never coalesced */
+    if (!cq->coalesce_timer || cq->vector == n->admin_cq.vector) {
+        return false;
+    }
+
+    if (cq->vector < n->params.max_ioqpairs + 1 &&
+        test_bit(cq->vector, n->int_vector_cd)) {
+        return false;
+    }
+
+    return NVME_INTC_THR(intc) && NVME_INTC_TIME(intc);
+}
+
+static void nvme_cq_coalesce_timer(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+    NvmeCtrl *n = cq->ctrl;
+
+    aio_context_acquire(n->ctx);
+    cq->coalesced = 0;
+    if (cq->tail != cq->head) {
+        nvme_cq_raise_irq(n, cq);
+    }
+    aio_context_release(n->ctx);
+}
+
+/*
+ * Signal @posted new completion queue entries. With Interrupt Coalescing,
+ * the interrupt is held back until more than the aggregation threshold of
+ * entries is pending or the aggregation time has passed since the first.
+ */
+static void nvme_cq_notify(NvmeCtrl *n, NvmeCQueue *cq, uint32_t posted)
+{
+    uint32_t intc = n->features.int_coalescing;
+
+    if (nvme_cq_coalescing(n, cq)) {
+        cq->coalesced += posted;
+        if (cq->coalesced && cq->coalesced <= NVME_INTC_THR(intc)) {
+            if (!timer_pending(cq->coalesce_timer)) {
+                timer_mod(cq->coalesce_timer,
+                          qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                          NVME_INTC_TIME(intc) * 100 * SCALE_US);
+            }
+            trace_pci_nvme_irq_coalesced(cq->cqid, cq->coalesced);
+            return;
+        }
+    }
+
+    if (cq->coalesce_timer) {
+        timer_del(cq->coalesce_timer);
+    }
+    cq->coalesced = 0;
+    nvme_cq_raise_irq(n, cq);
+}
+
 static void nvme_req_clear(NvmeRequest *req)
 {
     req->ns = NULL;
@@ -452,18 +754,59 @@ static uint16_t nvme_map_dptr(NvmeCtrl *n, size_t len, NvmeRequest *req)
     return nvme_map_prp(n, prp1, prp2, len, req);
 }
 
+/*
+ * Write @nr consecutive entries starting at index @start with a single DMA.
+ * The entry size is fixed at 16 bytes (see id_ctrl.cqes), so they are
+ * contiguous in guest memory as long as they do not wrap around.
+ */
+static void nvme_write_cqes(NvmeCtrl *n, NvmeCQueue *cq, uint32_t start,
+                            NvmeCqe *cqes, int nr)
+{
+    if (nr) {
+        pci_dma_write(&n->parent_obj, cq->dma_addr + start * n->cqe_size,
+                      cqes, nr * sizeof(NvmeCqe));
+    }
+}
+
 static void nvme_post_cqes(void *opaque)
 {
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
+    NvmeCqe cqes[NVME_CQE_BATCH];
+    uint32_t start = cq->tail;
+    uint32_t posted = 0;
+    int nr = 0;
+
+    aio_context_acquire(n->ctx);
+
+    if (cq->db_addr) {
+        nvme_update_cq_head(cq);
+    }
 
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
-        hwaddr addr;
 
         if (nvme_cq_full(cq)) {
-            break;
+            if (!cq->db_addr) {
+                break;
+            }
+
+            /* The host cannot make room for entries it has not seen yet */
+            nvme_write_cqes(n, cq, start, cqes, nr);
+            start = cq->tail;
+            nr = 0;
+
+            /*
+             * Ask the host to ring the doorbell once it consumes an entry,
+             * then check whether it did so before seeing the event index.
+             */
+            nvme_update_cq_eventidx(cq);
+            smp_mb();
+            nvme_update_cq_head(cq);
+            if (nvme_cq_full(cq)) {
+                break;
+            }
         }
 
         QTAILQ_REMOVE(&cq->req_list, req, entry);
@@ -471,16 +814,26 @@ static void nvme_post_cqes(void *opaque)
         req->cqe.status = cpu_to_le16((req->status << 1) | cq->phase);
         req->cqe.sq_id = cpu_to_le16(sq->sqid);
         req->cqe.sq_head = cpu_to_le16(sq->head);
-        addr = cq->dma_addr + cq->tail * n->cqe_size;
+        cqes[nr++] = req->cqe;
         nvme_inc_cq_tail(cq);
-        pci_dma_write(&n->parent_obj, addr, (void *)&req->cqe,
-            sizeof(req->cqe));
         nvme_req_exit(req);
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
+        posted++;
+
+        /* Write out the batch when it is full or the queue wraps around */
+        if (nr == NVME_CQE_BATCH || cq->tail == 0) {
+            nvme_write_cqes(n, cq, start, cqes, nr);
+            start = cq->tail;
+            nr = 0;
+        }
     }
+    nvme_write_cqes(n, cq, start, cqes, nr);
+
     if (cq->tail != cq->head) {
-        nvme_irq_assert(n, cq);
+        nvme_cq_notify(n, cq, posted);
     }
+
+    aio_context_release(n->ctx);
 }
 
 static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
@@ -490,7 +843,7 @@ static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
                                           req->status);
     QTAILQ_REMOVE(&req->sq->out_req_list, req, entry);
     QTAILQ_INSERT_TAIL(&cq->req_list, req, entry);
-    timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+    qemu_bh_schedule(cq->bh);
 }
 
 static void nvme_process_aers(void *opaque)
@@ -600,10 +953,13 @@ static void nvme_rw_cb(void *opaque, int ret)
     NvmeRequest *req = opaque;
     NvmeSQueue *sq = req->sq;
     NvmeCtrl *n = sq->ctrl;
-    NvmeCQueue *cq = n->cq[sq->cqid];
+    NvmeCQueue *cq;
 
     trace_pci_nvme_rw_cb(nvme_cid(req));
 
+    aio_context_acquire(n->ctx);
+    cq = n->cq[sq->cqid];
+
     if (!ret) {
         block_acct_done(blk_get_stats(n->conf.blk), &req->acct);
         req->status = NVME_SUCCESS;
@@ -613,6 +969,7 @@ static void nvme_rw_cb(void *opaque, int ret)
     }
 
     nvme_enqueue_req_completion(cq, req);
+    aio_context_release(n->ctx);
 }
 
 static uint16_t nvme_flush(NvmeCtrl *n, NvmeRequest *req)
@@ -735,11 +1092,86 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeRequest *req)
     }
 }
 
+static void nvme_sq_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        nvme_process_sq(sq);
+    }
+}
+
+static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+    int ret;
+
+    ret = event_notifier_init(&sq->notifier, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    aio_set_event_notifier(n->ctx, &sq->notifier, true, nvme_sq_notifier,
+                           NULL);
+    memory_region_add_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3),
+                              NVME_DB_SIZE, false, 0, &sq->notifier);
+    sq->ioeventfd_enabled = true;
+
+    return 0;
+}
+
+static void nvme_sq_enable_dbbuf(NvmeCtrl *n, NvmeSQueue *sq)
+{
+    sq->db_addr = n->dbbuf_dbs + (sq->sqid << 3);
+    sq->ei_addr = n->dbbuf_eis + (sq->sqid << 3);
+
+    /* The tail written to the doorbell is lost, but the shadow has it */
+    if (n->params.ioeventfd && !sq->ioeventfd_enabled) {
+        nvme_init_sq_ioeventfd(sq);
+    }
+}
+
+/* Runs in the queue's AioContext, so its handlers cannot be running */
+static void nvme_sq_detach_bh(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+
+    if (sq->ioeventfd_enabled) {
+        aio_set_event_notifier(sq->ctrl->ctx, &sq->notifier, true, NULL,
+                               NULL);
+    }
+    qemu_bh_delete(sq->bh);
+    sq->bh = NULL;
+}
+
+/* Stop processing new commands from the queue */
+static void nvme_stop_sq(NvmeSQueue *sq, NvmeCtrl *n)
+{
+    if (!sq->bh) {
+        return;
+    }
+
+    if (sq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3),
+                                  NVME_DB_SIZE, false, 0, &sq->notifier);
+    }
+
+    if (sq->sqid && n->iothread) {
+        aio_wait_bh_oneshot(n->ctx, nvme_sq_detach_bh, sq);
+    } else {
+        nvme_sq_detach_bh(sq);
+    }
+
+    if (sq->ioeventfd_enabled) {
+        event_notifier_cleanup(&sq->notifier);
+        sq->ioeventfd_enabled = false;
+    }
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     n->sq[sq->sqid] = NULL;
-    timer_del(sq->timer);
-    timer_free(sq->timer);
+    nvme_stop_sq(sq, n);
     g_free(sq->io_req);
     if (sq->sqid) {
         g_free(sq);
@@ -762,11 +1194,12 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
     trace_pci_nvme_del_sq(qid);
 
     sq = n->sq[qid];
-    while (!QTAILQ_EMPTY(&sq->out_req_list)) {
-        r = QTAILQ_FIRST(&sq->out_req_list);
+    nvme_stop_sq(sq, n);
+    QTAILQ_FOREACH_SAFE(r, &sq->out_req_list, entry, next) {
         assert(r->aiocb);
-        blk_aio_cancel(r->aiocb);
+        blk_aio_cancel_async(r->aiocb);
     }
+    AIO_WAIT_WHILE(n->ctx, !QTAILQ_EMPTY(&sq->out_req_list));
     if (!nvme_check_cqid(n, sq->cqid)) {
         cq = n->cq[sq->cqid];
         QTAILQ_REMOVE(&cq->sq_list, sq, entry);
@@ -804,12 +1237,17 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         sq->io_req[i].sq = sq;
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
-    sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+    sq->bh = aio_bh_new(sqid ? n->ctx : iohandler_get_aio_context(),
+                        nvme_process_sq, sq);
 
     assert(n->cq[cqid]);
     cq = n->cq[cqid];
     QTAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
     n->sq[sqid] = sq;
+
+    if (sqid && n->dbbuf_enabled) {
+        nvme_sq_enable_dbbuf(n, sq);
+    }
 }
 
 static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeRequest *req)
@@ -1006,11 +1444,38 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
     }
 }
 
+static void nvme_cq_enable_dbbuf(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    cq->db_addr = n->dbbuf_dbs + (cq->cqid << 3) + (1 << 2);
+    cq->ei_addr = n->dbbuf_eis + (cq->cqid << 3) + (1 << 2);
+}
+
+/* Runs in the queue's AioContext, so its bottom half cannot be running */
+static void nvme_cq_detach_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    qemu_bh_delete(cq->bh);
+    cq->bh = NULL;
+
+    if (cq->coalesce_timer) {
+        timer_del(cq->coalesce_timer);
+        timer_free(cq->coalesce_timer);
+        cq->coalesce_timer = NULL;
+    }
+}
+
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     n->cq[cq->cqid] = NULL;
-    timer_del(cq->timer);
-    timer_free(cq->timer);
+    if (cq->cqid && n->iothread) {
+        aio_wait_bh_oneshot(n->ctx, nvme_cq_detach_bh, cq);
+    } else {
+        nvme_cq_detach_bh(cq);
+    }
+    if (cq->irq_notifier_enabled) {
+        nvme_release_irq_notifier(n, cq);
+    }
     msix_vector_unuse(&n->parent_obj, cq->vector);
     if (cq->cqid) {
         g_free(cq);
@@ -1057,7 +1522,18 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     QTAILQ_INIT(&cq->req_list);
     QTAILQ_INIT(&cq->sq_list);
     n->cq[cqid] = cq;
-    cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    cq->bh = aio_bh_new(cqid ? n->ctx : iohandler_get_aio_context(),
+                        nvme_post_cqes, cq);
+    cq->coalesced = 0;
+    if (cqid) {
+        cq->coalesce_timer = aio_timer_new(n->ctx, QEMU_CLOCK_VIRTUAL,
+                                           SCALE_NS, nvme_cq_coalesce_timer,
+                                           cq);
+    }
+
+    if (cqid && n->dbbuf_enabled) {
+        nvme_cq_enable_dbbuf(n, cq);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -1101,6 +1577,11 @@ static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
     cq = g_malloc0(sizeof(*cq));
     nvme_init_cq(cq, n, prp1, cqid, vector, qsize + 1,
         NVME_CQ_FLAGS_IEN(qflags));
+    if (n->iothread && NVME_CQ_FLAGS_IEN(qflags) &&
+        nvme_init_irq_notifier(n, cq) < 0) {
+        nvme_free_cq(cq, n);
+        return NVME_INTERNAL_DEV_ERROR;
+    }
 
     /*
      * It is only required to set qs_created when creating a completion queue;
@@ -1381,6 +1862,21 @@ static uint16_t nvme_get_feature(NvmeCtrl *n, NvmeRequest *req)
         goto out;
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         result = n->features.async_config;
+        goto out;
+    case NVME_INTERRUPT_COALESCING:
+        result = n->features.int_coalescing;
+        goto out;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        iv = dw11 & 0xffff;
+        if (iv >= n->params.max_ioqpairs + 1) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        result = iv;
+        if (iv == n->admin_cq.vector || test_bit(iv, n->int_vector_cd)) {
+            result |= NVME_INTVC_NOCOALESCING;
+        }
+
         goto out;
     case NVME_TIMESTAMP:
         return nvme_get_feature_timestamp(n, req);
@@ -1456,6 +1952,7 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
     uint32_t nsid = le32_to_cpu(cmd->nsid);
     uint8_t fid = NVME_GETSETFEAT_FID(dw10);
     uint8_t save = NVME_SETFEAT_SAVE(dw10);
+    uint16_t iv;
 
     trace_pci_nvme_setfeat(nvme_cid(req), fid, save, dw11);
 
@@ -1537,6 +2034,24 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
         req->cqe.result = cpu_to_le32((n->params.max_ioqpairs - 1) |
                                       ((n->params.max_ioqpairs - 1) << 16));
         break;
+    case NVME_INTERRUPT_COALESCING:
+        trace_pci_nvme_setfeat_int_coalescing(NVME_INTC_THR(dw11),
+                                              NVME_INTC_TIME(dw11));
+        n->features.int_coalescing = dw11 & 0xffff;
+        break;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        iv = dw11 & 0xffff;
+        if (iv >= n->params.max_ioqpairs + 1) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        /* The admin vector is never coalesced, so CD is ignored for it */
+        if (dw11 & NVME_INTVC_NOCOALESCING) {
+            set_bit(iv, n->int_vector_cd);
+        } else {
+            clear_bit(iv, n->int_vector_cd);
+        }
+        break;
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         n->features.async_config = dw11;
         break;
@@ -1567,6 +2082,45 @@ static uint16_t nvme_aer(NvmeCtrl *n, NvmeRequest *req)
     return NVME_NO_COMPLETE;
 }
 
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, NvmeRequest *req)
+{
+    uint64_t dbs_addr = le64_to_cpu(req->cmd.dptr.prp1);
+    uint64_t eis_addr = le64_to_cpu(req->cmd.dptr.prp2);
+    int i;
+
+    trace_pci_nvme_dbbuf_config(dbs_addr, eis_addr);
+
+    if (unlikely(!dbs_addr || !eis_addr ||
+                 (dbs_addr | eis_addr) & (n->page_size - 1))) {
+        trace_pci_nvme_err_invalid_dbbuf_addr(dbs_addr, eis_addr);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+    n->dbbuf_enabled = true;
+
+    /*
+     * Like host drivers, keep using the MMIO doorbells of the admin queue.
+     * I/O queues created later are set up in nvme_init_sq/nvme_init_cq.
+     */
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        NvmeSQueue *sq = n->sq[i];
+        NvmeCQueue *cq = n->cq[i];
+
+        if (cq) {
+            nvme_cq_enable_dbbuf(n, cq);
+            stl_le_pci_dma(&n->parent_obj, cq->db_addr, cq->head);
+        }
+        if (sq) {
+            nvme_sq_enable_dbbuf(n, sq);
+            stl_le_pci_dma(&n->parent_obj, sq->db_addr, sq->tail);
+        }
+    }
+
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
 {
     trace_pci_nvme_admin_cmd(nvme_cid(req), nvme_sqid(req), req->cmd.opcode);
@@ -1592,6 +2146,8 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
         return nvme_get_feature(n, req);
     case NVME_ADM_CMD_ASYNC_EV_REQ:
         return nvme_aer(n, req);
+    case NVME_ADM_CMD_DBBUF_CONFIG:
+        return nvme_dbbuf_config(n, req);
     default:
         trace_pci_nvme_err_invalid_admin_opc(req->cmd.opcode);
         return NVME_INVALID_OPCODE | NVME_DNR;
@@ -1602,40 +2158,79 @@ static void nvme_process_sq(void *opaque)
 {
     NvmeSQueue *sq = opaque;
     NvmeCtrl *n = sq->ctrl;
-    NvmeCQueue *cq = n->cq[sq->cqid];
+    NvmeCQueue *cq;
 
     uint16_t status;
     hwaddr addr;
     NvmeCmd cmd;
     NvmeRequest *req;
+    uint32_t tail;
+
+    aio_context_acquire(n->ctx);
+    cq = n->cq[sq->cqid];
+
+    if (sq->db_addr) {
+        nvme_update_sq_tail(sq);
+    }
 
-    while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
-        addr = sq->dma_addr + sq->head * n->sqe_size;
-        nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd));
-        nvme_inc_sq_head(sq);
+    for (;;) {
+        while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
+            addr = sq->dma_addr + sq->head * n->sqe_size;
+            nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd));
+            nvme_inc_sq_head(sq);
 
-        req = QTAILQ_FIRST(&sq->req_list);
-        QTAILQ_REMOVE(&sq->req_list, req, entry);
-        QTAILQ_INSERT_TAIL(&sq->out_req_list, req, entry);
-        nvme_req_clear(req);
-        req->cqe.cid = cmd.cid;
-        memcpy(&req->cmd, &cmd, sizeof(NvmeCmd));
+            req = QTAILQ_FIRST(&sq->req_list);
+            QTAILQ_REMOVE(&sq->req_list, req, entry);
+            QTAILQ_INSERT_TAIL(&sq->out_req_list, req, entry);
+            nvme_req_clear(req);
+            req->cqe.cid = cmd.cid;
+            memcpy(&req->cmd, &cmd, sizeof(NvmeCmd));
 
-        status = sq->sqid ? nvme_io_cmd(n, req) :
-            nvme_admin_cmd(n, req);
-        if (status != NVME_NO_COMPLETE) {
-            req->status = status;
-            nvme_enqueue_req_completion(cq, req);
+            status = sq->sqid ? nvme_io_cmd(n, req) :
+                nvme_admin_cmd(n, req);
+            if (status != NVME_NO_COMPLETE) {
+                req->status = status;
+                nvme_enqueue_req_completion(cq, req);
+            }
+        }
+
+        if (!sq->db_addr) {
+            break;
+        }
+
+        /*
+         * Ask the host to ring the doorbell for anything it submits after
+         * the tail we have seen, then pick up entries that raced with that.
+         */
+        tail = sq->tail;
+        nvme_update_sq_eventidx(sq);
+        smp_mb();
+        nvme_update_sq_tail(sq);
+        if (sq->tail == tail || QTAILQ_EMPTY(&sq->req_list)) {
+            break;
         }
     }
+
+    aio_context_release(n->ctx);
 }
 
 static void nvme_clear_ctrl(NvmeCtrl *n)
 {
     int i;
 
+    for (i = 0; i < n->params.max_ioqpairs + 1; i++) {
+        if (n->sq[i] != NULL) {
+            nvme_stop_sq(n->sq[i], n);
+        }
+    }
+
     blk_drain(n->conf.blk);
 
+    if (n->msix_notifiers_set) {
+        msix_unset_vector_notifiers(&n->parent_obj);
+        n->msix_notifiers_set = false;
+    }
+
     for (i = 0; i < n->params.max_ioqpairs + 1; i++) {
         if (n->sq[i] != NULL) {
             nvme_free_sq(n->sq[i], n);
@@ -1656,6 +2251,11 @@ static void nvme_clear_ctrl(NvmeCtrl *n)
     n->aer_queued = 0;
     n->outstanding_aers = 0;
     n->qs_created = false;
+    n->dbbuf_enabled = false;
+    n->dbbuf_dbs = 0;
+    n->dbbuf_eis = 0;
+    n->features.int_coalescing = 0;
+    bitmap_zero(n->int_vector_cd, n->params.max_ioqpairs + 1);
 
     blk_flush(n->conf.blk);
     n->bar.cc = 0;
@@ -2023,9 +2623,9 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         if (start_sqs) {
             NvmeSQueue *sq;
             QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
-                timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+                qemu_bh_schedule(sq->bh);
             }
-            timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+            qemu_bh_schedule(cq->bh);
         }
 
         if (cq->tail == cq->head) {
@@ -2073,7 +2673,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         trace_pci_nvme_mmio_doorbell_sq(sq->sqid, new_tail);
 
         sq->tail = new_tail;
-        timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+        qemu_bh_schedule(sq->bh);
     }
 }
 
@@ -2084,11 +2684,13 @@ static void nvme_mmio_write(void *opaque, hwaddr addr, uint64_t data,
 
     trace_pci_nvme_mmio_write(addr, data);
 
+    aio_context_acquire(n->ctx);
     if (addr < sizeof(n->bar)) {
         nvme_write_bar(n, addr, data, size);
     } else {
         nvme_process_db(n, addr, data);
     }
+    aio_context_release(n->ctx);
 }
 
 static const MemoryRegionOps nvme_mmio_ops = {
@@ -2188,6 +2790,7 @@ static void nvme_init_state(NvmeCtrl *n)
     n->features.temp_thresh_hi = NVME_TEMPERATURE_WARNING;
     n->starttime_ms = qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL);
     n->aer_reqs = g_new0(NvmeRequest *, n->params.aerl + 1);
+    n->int_vector_cd = bitmap_new(n->params.max_ioqpairs + 1);
 }
 
 static void nvme_init_blk(NvmeCtrl *n, Error **errp)
@@ -2199,6 +2802,23 @@ static void nvme_init_blk(NvmeCtrl *n, Error **errp)
                                   false, errp);
 }
 
+static void nvme_init_ctx(NvmeCtrl *n, Error **errp)
+{
+    AioContext *old_ctx;
+
+    if (!n->iothread) {
+        n->ctx = qemu_get_aio_context();
+        return;
+    }
+
+    n->ctx = iothread_get_aio_context(n->iothread);
+
+    old_ctx = blk_get_aio_context(n->conf.blk);
+    aio_context_acquire(old_ctx);
+    blk_set_aio_context(n->conf.blk, n->ctx, errp);
+    aio_context_release(old_ctx);
+}
+
 static void nvme_init_namespace(NvmeCtrl *n, NvmeNamespace *ns, Error **errp)
 {
     int64_t bs_size;
@@ -2332,7 +2952,7 @@ static void nvme_init_ctrl(NvmeCtrl *n, PCIDevice *pci_dev)
     id->ieee[2] = 0xb3;
     id->mdts = n->params.mdts;
     id->ver = cpu_to_le32(NVME_SPEC_VER);
-    id->oacs = cpu_to_le16(0);
+    id->oacs = cpu_to_le16(NVME_OACS_DBBUF);
 
     /*
      * Because the controller always completes the Abort command immediately,
@@ -2402,6 +3022,12 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
         return;
     }
 
+    nvme_init_ctx(n, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+
     nvme_init_pci(n, pci_dev, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
@@ -2423,11 +3049,18 @@ static void nvme_exit(PCIDevice *pci_dev)
 {
     NvmeCtrl *n = NVME(pci_dev);
 
+    aio_context_acquire(n->ctx);
     nvme_clear_ctrl(n);
+    if (n->iothread) {
+        blk_set_aio_context(n->conf.blk, qemu_get_aio_context(), NULL);
+    }
+    aio_context_release(n->ctx);
+
     g_free(n->namespaces);
     g_free(n->cq);
     g_free(n->sq);
     g_free(n->aer_reqs);
+    g_free(n->int_vector_cd);
 
     if (n->params.cmb_size_mb) {
         g_free(n->cmbuf);
@@ -2443,6 +3076,8 @@ static Property nvme_props[] = {
     DEFINE_BLOCK_PROPERTIES(NvmeCtrl, conf),
     DEFINE_PROP_LINK("pmrdev", NvmeCtrl, pmrdev, TYPE_MEMORY_BACKEND,
                      HostMemoryBackend *),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_STRING("serial", NvmeCtrl, params.serial),
     DEFINE_PROP_UINT32("cmb_size_mb", NvmeCtrl, params.cmb_size_mb, 0),
     DEFINE_PROP_UINT32("num_queues", NvmeCtrl, params.num_queues, 0),
@@ -2451,6 +3086,7 @@ static Property nvme_props[] = {
     DEFINE_PROP_UINT8("aerl", NvmeCtrl, params.aerl, 3),
     DEFINE_PROP_UINT32("aer_max_queued", NvmeCtrl, params.aer_max_queued, 64),
     DEFINE_PROP_UINT8("mdts", NvmeCtrl, params.mdts, 7),
+    DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, params.ioeventfd, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -2,6 +2,9 @@
 #define HW_NVME_H
 
 #include "block/nvme.h"
+#include "hw/pci/msi.h"
+#include "qemu/event_notifier.h"
+#include "sysemu/iothread.h"
 
 typedef struct NvmeParams {
     char     *serial;
@@ -12,6 +15,7 @@ typedef struct NvmeParams {
     uint8_t  aerl;
     uint32_t aer_max_queued;
     uint8_t  mdts;
+    bool     ioeventfd;
 } NvmeParams;
 
 typedef struct NvmeAsyncEvent {
@@ -40,7 +44,11 @@ typedef struct NvmeSQueue {
     uint32_t    tail;
     uint32_t    size;
     uint64_t    dma_addr;
-    QEMUTimer   *timer;
+    QEMUBH      *bh;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
+    EventNotifier notifier;
+    bool        ioeventfd_enabled;
     NvmeRequest *io_req;
     QTAILQ_HEAD(, NvmeRequest) req_list;
     QTAILQ_HEAD(, NvmeRequest) out_req_list;
@@ -57,7 +65,17 @@ typedef struct NvmeCQueue {
     uint32_t    vector;
     uint32_t    size;
     uint64_t    dma_addr;
-    QEMUTimer   *timer;
+    QEMUBH      *bh;
+    QEMUTimer   *coalesce_timer;
+    uint32_t    coalesced;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
+    EventNotifier irq_notifier;
+    bool        irq_notifier_enabled;
+    bool        irqfd_enabled;
+    bool        irqfd_attached;
+    int         virq;
+    MSIMessage  msg;
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
     QTAILQ_HEAD(, NvmeRequest) req_list;
 } NvmeCQueue;
@@ -87,6 +105,7 @@ typedef struct NvmeFeatureVal {
         uint16_t temp_thresh_low;
     };
     uint32_t    async_config;
+    uint32_t    int_coalescing;
 } NvmeFeatureVal;
 
 typedef struct NvmeCtrl {
@@ -116,6 +135,13 @@ typedef struct NvmeCtrl {
     uint16_t    temperature;
 
     HostMemoryBackend *pmrdev;
+    IOThread    *iothread;
+    AioContext  *ctx;
+
+    bool        dbbuf_enabled;
+    uint64_t    dbbuf_dbs;
+    uint64_t    dbbuf_eis;
+    bool        msix_notifiers_set;
 
     uint8_t     aer_mask;
     NvmeRequest **aer_reqs;
@@ -129,6 +155,7 @@ typedef struct NvmeCtrl {
     NvmeCQueue      admin_cq;
     NvmeIdCtrl      id_ctrl;
     NvmeFeatureVal  features;
+    unsigned long   *int_vector_cd;     /* Interrupt Vector Config CD bits */
 } NvmeCtrl;
 
 /* calculate the number of LBAs that the namespace can accomodate */
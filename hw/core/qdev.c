@@ -784,6 +784,36 @@ static void qdev_class_add_property(DeviceClass *klass, Property *prop)
                                           prop->info->description);
 }
 
+static void get_alias_arraylen(Object *obj, Visitor *v, const char *name,
+                               void *opaque, Error **errp)
+{
+    object_property_get(OBJECT(opaque), name, v, errp);
+}
+
+/*
+ * Setting the length of an array property creates the element properties
+ * on the target device only.  Alias them as well, so that the elements
+ * can be set on the source like the length.
+ */
+static void set_alias_arraylen(Object *obj, Visitor *v, const char *name,
+                               void *opaque, Error **errp)
+{
+    Object *target = opaque;
+    const char *arrayname = name + strlen(PROP_ARRAY_LEN_PREFIX);
+    uint32_t len, i;
+
+    if (!object_property_set(target, name, v, errp)) {
+        return;
+    }
+
+    len = object_property_get_uint(target, name, &error_abort);
+    for (i = 0; i < len; i++) {
+        g_autofree char *propname = g_strdup_printf("%s[%u]", arrayname, i);
+
+        object_property_add_alias(obj, propname, target, propname);
+    }
+}
+
 void qdev_alias_all_properties(DeviceState *target, Object *source)
 {
     ObjectClass *class;
@@ -794,6 +824,12 @@ void qdev_alias_all_properties(DeviceState *target, Object *source)
         DeviceClass *dc = DEVICE_CLASS(class);
 
         for (prop = dc->props_; prop && prop->name; prop++) {
+            if (prop->info == &qdev_prop_arraylen) {
+                object_property_add(source, prop->name, prop->info->name,
+                                    get_alias_arraylen, set_alias_arraylen,
+                                    NULL, target);
+                continue;
+            }
             object_property_add_alias(source, prop->name,
                                       OBJECT(target), prop->name);
         }
@@ -19,29 +19,107 @@
 #include "qapi/error.h"
 #include "qemu/module.h"
 #include "hw/sysbus.h"
+#include "sysemu/runstate.h"
 #include "hw/intc/arm_gicv3.h"
 #include "gicv3_internal.h"
 
-static bool irqbetter(GICv3CPUState *cs, int irq, uint8_t prio)
+/* Return the bitmap of interrupts filed at priority @prio for this CPU */
+static unsigned long *hpp_bucket(GICv3CPUState *cs, uint8_t prio)
 {
-    /* Return true if this IRQ at this priority should take
-     * precedence over the current recorded highest priority
-     * pending interrupt for this CPU. We also return true if
-     * the current recorded highest priority pending interrupt
-     * is the same as this one (a property which the calling code
-     * relies on).
-     */
-    if (prio < cs->hppi.prio) {
-        return true;
+    return cs->hpp_bmp + prio * BITS_TO_LONGS(cs->gic->num_irq);
+}
+
+static void hpp_file(GICv3CPUState *cs, int irq, uint8_t prio)
+{
+    set_bit(irq, hpp_bucket(cs, prio));
+    if (cs->hpp_count[prio]++ == 0) {
+        set_bit(prio, cs->hpp_prio);
+    }
+    cs->hpp_dirty = true;
+}
+
+static void hpp_unfile(GICv3CPUState *cs, int irq, uint8_t prio)
+{
+    clear_bit(irq, hpp_bucket(cs, prio));
+    if (--cs->hpp_count[prio] == 0) {
+        clear_bit(prio, cs->hpp_prio);
+    }
+    cs->hpp_dirty = true;
+}
+
+/* Move SGI or PPI @irq to priority @prio in this CPU's filed interrupts,
+ * where a priority of 0xff means it is not eligible to be signaled.
+ */
+static void gicr_refile(GICv3CPUState *cs, int irq, uint8_t prio)
+{
+    uint32_t bit = 1U << irq;
+
+    if (cs->hpp_private & bit) {
+        if (cs->hpp_private_prio[irq] == prio) {
+            return;
+        }
+        hpp_unfile(cs, irq, cs->hpp_private_prio[irq]);
+        cs->hpp_private &= ~bit;
+    }
+    if (prio != 0xff) {
+        hpp_file(cs, irq, prio);
+        cs->hpp_private_prio[irq] = prio;
+        cs->hpp_private |= bit;
+    }
+}
+
+/* Move SPI @irq to priority @prio in the filed interrupts of @cs, where
+ * a NULL @cs or a priority of 0xff means it is not eligible to be signaled
+ * to any CPU.
+ */
+static void gicd_refile(GICv3State *s, int irq, GICv3CPUState *cs,
+                        uint8_t prio)
+{
+    if (gic_bmp_test_bit(irq, s->hpp_spi_filed)) {
+        if (s->hpp_spi_target[irq] == cs && s->hpp_spi_prio[irq] == prio) {
+            return;
+        }
+        hpp_unfile(s->hpp_spi_target[irq], irq, s->hpp_spi_prio[irq]);
+        gic_bmp_clear_bit(irq, s->hpp_spi_filed);
+    }
+    if (cs && prio != 0xff) {
+        hpp_file(cs, irq, prio);
+        s->hpp_spi_target[irq] = cs;
+        s->hpp_spi_prio[irq] = prio;
+        gic_bmp_set_bit(irq, s->hpp_spi_filed);
     }
+}
+
+/* Recompute the highest priority pending interrupt for this CPU from
+ * its filed interrupts and its best LPI.
+ */
+static void hpp_recalc(GICv3CPUState *cs)
+{
+    int prio = find_first_bit(cs->hpp_prio, GICV3_PRIO_LEVELS);
+
     /* If multiple pending interrupts have the same priority then it is an
      * IMPDEF choice which of them to signal to the CPU. We choose to
      * signal the one with the lowest interrupt number.
      */
-    if (prio == cs->hppi.prio && irq <= cs->hppi.irq) {
-        return true;
+    cs->hppi.prio = 0xff;
+    if (prio < GICV3_PRIO_LEVELS) {
+        cs->hppi.irq = find_first_bit(hpp_bucket(cs, prio), cs->gic->num_irq);
+        cs->hppi.prio = prio;
+    }
+
+    /* LPIs are always Group 1 NS, and their interrupt numbers are above
+     * any SPI's, so an LPI only wins if its priority is strictly higher.
+     */
+    if (cs->hpplpi.prio < cs->hppi.prio &&
+        (cs->gic->gicd_ctlr & GICD_CTLR_EN_GRP1NS)) {
+        cs->hppi.irq = cs->hpplpi.irq;
+        cs->hppi.prio = cs->hpplpi.prio;
+    }
+
+    if (cs->hppi.prio != 0xff) {
+        cs->hppi.grp = gicv3_irq_group(cs->gic, cs, cs->hppi.irq);
     }
-    return false;
+    cs->hpp_dirty = false;
 }
 
 static uint32_t gicd_int_pending(GICv3State *s, int irq)
@@ -135,51 +213,25 @@ static uint32_t gicr_int_pending(GICv3CPUState *cs)
  */
 static void gicv3_redist_update_noirqset(GICv3CPUState *cs)
 {
-    /* Find the highest priority pending interrupt among the
-     * redistributor interrupts (SGIs and PPIs).
+    /* Refile the redistributor interrupts (SGIs and PPIs) which are
+     * eligible to be signaled to the CPU interface, or were the last
+     * time we looked, and then pick the best of everything filed for
+     * this CPU. We always recompute hppi here, because a change of
+     * group does not refile the interrupt but can change hppi.grp, and
+     * the best LPI is not filed.
      */
-    bool seenbetter = false;
-    uint8_t prio;
-    int i;
-    uint32_t pend;
+    uint32_t pend = gicr_int_pending(cs);
+    uint32_t todo = pend | cs->hpp_private;
 
-    /* Find out which redistributor interrupts are eligible to be
-     * signaled to the CPU interface.
-     */
-    pend = gicr_int_pending(cs);
-
-    if (pend) {
-        for (i = 0; i < GIC_INTERNAL; i++) {
-            if (!(pend & (1 << i))) {
-                continue;
-            }
-            prio = cs->gicr_ipriorityr[i];
-            if (irqbetter(cs, i, prio)) {
-                cs->hppi.irq = i;
-                cs->hppi.prio = prio;
-                seenbetter = true;
-            }
-        }
-    }
+    while (todo) {
+        int i = ctz32(todo);
 
-    if (seenbetter) {
-        cs->hppi.grp = gicv3_irq_group(cs->gic, cs, cs->hppi.irq);
+        todo &= todo - 1;
+        gicr_refile(cs, i,
+                    (pend & (1U << i)) ? cs->gicr_ipriorityr[i] : 0xff);
     }
 
-    /* If the best interrupt we just found would preempt whatever
-     * was the previous best interrupt before this update, then
-     * we know it's definitely the best one now.
-     * If we didn't find an interrupt that would preempt the previous
-     * best, and the previous best is outside our range (or there was no
-     * previous pending interrupt at all), then that is still valid, and
-     * we leave it as the best.
-     * Otherwise, we need to do a full update (because the previous best
-     * interrupt has reduced in priority and any other interrupt could
-     * now be the new best one).
-     */
-    if (!seenbetter && cs->hppi.prio != 0xff && cs->hppi.irq < GIC_INTERNAL) {
-        gicv3_full_update_noirqset(cs->gic);
-    }
+    hpp_recalc(cs);
 }
 
 /* Update the GIC status after state in a redistributor or
@@ -199,65 +251,44 @@ void gicv3_redist_update(GICv3CPUState *cs)
 static void gicv3_update_noirqset(GICv3State *s, int start, int len)
 {
     int i;
-    uint8_t prio;
     uint32_t pend = 0;
 
     assert(start >= GIC_INTERNAL);
     assert(len > 0);
 
-    for (i = 0; i < s->num_cpu; i++) {
-        s->cpu[i].seenbetter = false;
-    }
-
-    /* Find the highest priority pending interrupt in this range. */
+    /* Refile each interrupt in the range according to whether it is
+     * now eligible to be signaled, and to which CPU at what priority.
+     */
     for (i = start; i < start + len; i++) {
-        GICv3CPUState *cs;
+        GICv3CPUState *cs = NULL;
+        uint8_t prio = 0xff;
 
         if (i == start || (i & 0x1f) == 0) {
             /* Calculate the next 32 bits worth of pending status */
             pend = gicd_int_pending(s, i & ~0x1f);
         }
 
-        if (!(pend & (1 << (i & 0x1f)))) {
-            continue;
-        }
-        cs = s->gicd_irouter_target[i];
-        if (!cs) {
-            /* Interrupts targeting no implemented CPU should remain pending
-             * and not be forwarded to any CPU.
+        if (pend & (1 << (i & 0x1f))) {
+            /* Interrupts targeting no implemented CPU (a NULL target)
+             * should remain pending and not be forwarded to any CPU.
              */
-            continue;
-        }
-        prio = s->gicd_ipriority[i];
-        if (irqbetter(cs, i, prio)) {
-            cs->hppi.irq = i;
-            cs->hppi.prio = prio;
-            cs->seenbetter = true;
+            cs = s->gicd_irouter_target[i];
+            prio = s->gicd_ipriority[i];
         }
+        gicd_refile(s, i, cs, prio);
     }
 
-    /* If the best interrupt we just found would preempt whatever
-     * was the previous best interrupt before this update, then
-     * we know it's definitely the best one now.
-     * If we didn't find an interrupt that would preempt the previous
-     * best, and the previous best is outside our range (or there was
-     * no previous pending interrupt at all), then that
-     * is still valid, and we leave it as the best.
-     * Otherwise, we need to do a full update (because the previous best
-     * interrupt has reduced in priority and any other interrupt could
-     * now be the new best one).
+    /* Only CPUs whose filed interrupts changed can have a new best
+     * interrupt. The exception is a change of group of the current best
+     * interrupt, which doesn't refile it but may change hppi.grp.
      */
     for (i = 0; i < s->num_cpu; i++) {
         GICv3CPUState *cs = &s->cpu[i];
 
-        if (cs->seenbetter) {
-            cs->hppi.grp = gicv3_irq_group(cs->gic, cs, cs->hppi.irq);
-        }
-
-        if (!cs->seenbetter && cs->hppi.prio != 0xff &&
-            cs->hppi.irq >= start && cs->hppi.irq < start + len) {
-            gicv3_full_update_noirqset(s);
-            break;
+        if (cs->hpp_dirty ||
+            (cs->hppi.prio != 0xff &&
+             cs->hppi.irq >= start && cs->hppi.irq < start + len)) {
+            hpp_recalc(cs);
         }
     }
 }
@@ -279,17 +310,10 @@ void gicv3_full_update_noirqset(GICv3State *s)
      */
     int i;
 
-    for (i = 0; i < s->num_cpu; i++) {
-        s->cpu[i].hppi.prio = 0xff;
+    if (s->num_irq > GIC_INTERNAL) {
+        gicv3_update_noirqset(s, GIC_INTERNAL, s->num_irq - GIC_INTERNAL);
     }
 
-    /* Note that we can guarantee that these functions will not
-     * recursively call back into gicv3_full_update(), because
-     * at each point the "previous best" is always outside the
-     * range we ask them to update.
-     */
-    gicv3_update_noirqset(s, GIC_INTERNAL, s->num_irq - GIC_INTERNAL);
-
     for (i = 0; i < s->num_cpu; i++) {
         gicv3_redist_update_noirqset(&s->cpu[i]);
     }
@@ -319,6 +343,7 @@ static void gicv3_set_irq(void *opaque, int irq, int level)
      */
     GICv3State *s = opaque;
 
+    gicv3_lock(s);
     if (irq < (s->num_irq - GIC_INTERNAL)) {
         /* external interrupt (SPI) */
         gicv3_dist_set_irq(s, irq + GIC_INTERNAL, level);
@@ -336,16 +361,64 @@ static void gicv3_set_irq(void *opaque, int irq, int level)
         assert(irq >= GIC_NR_SGIS);
         gicv3_redist_set_irq(&s->cpu[cpu], irq, level);
     }
+    gicv3_unlock(s);
 }
 
 static void arm_gicv3_post_load(GICv3State *s)
 {
+    int i, line;
+
+    /* Reload the cached LPI state from the tables in guest memory */
+    for (i = 0; i < s->num_cpu; i++) {
+        gicv3_redist_lpi_post_load(&s->cpu[i]);
+    }
+    /* Repopulate the cache of GICv3CPUState pointers for target CPUs.
+     * This must come first, because it determines which CPU each SPI
+     * is filed for below.
+     */
+    gicv3_cache_all_target_cpustates(s);
     /* Recalculate our cached idea of the current highest priority
      * pending interrupt, but don't set IRQ or FIQ lines.
      */
     gicv3_full_update_noirqset(s);
-    /* Repopulate the cache of GICv3CPUState pointers for target CPUs */
-    gicv3_cache_all_target_cpustates(s);
+    /* The CPUs' interrupt lines were migrated with the CPUs */
+    for (i = 0; i < s->num_cpu; i++) {
+        for (line = 0; line < GICV3_NUM_LINES; line++) {
+            s->cpu[i].line_level[line] = -1;
+        }
+    }
+}
+
+static void arm_gicv3_vm_state_change(void *opaque, int running,
+                                      RunState state)
+{
+    GICv3State *s = opaque;
+    int i;
+
+    /* The LPI pending tables in guest memory are only brought up to
+     * date when the VM stops, so that they are saved along with the
+     * rest of its memory.
+     */
+    if (running) {
+        return;
+    }
+
+    gicv3_lock(s);
+    for (i = 0; i < s->num_cpu; i++) {
+        gicv3_redist_lpi_flush(&s->cpu[i]);
+    }
+    gicv3_unlock(s);
+}
+
+static void arm_gicv3_reset(DeviceState *dev)
+{
+    GICv3State *s = ARM_GICV3(dev);
+    ARMGICv3Class *agc = ARM_GICV3_GET_CLASS(s);
+
+    agc->parent_reset(dev);
+
+    /* Unfile everything that was pending before the reset */
+    gicv3_full_update_noirqset(s);
 }
 
 static const MemoryRegionOps gic_ops[] = {
@@ -367,6 +440,7 @@ static void arm_gic_realize(DeviceState *dev, Error **errp)
     GICv3State *s = ARM_GICV3(dev);
     ARMGICv3Class *agc = ARM_GICV3_GET_CLASS(s);
     Error *local_err = NULL;
+    int i;
 
     agc->parent_realize(dev, &local_err);
     if (local_err) {
@@ -386,6 +460,22 @@ static void arm_gic_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    for (i = 0; i < s->num_cpu; i++) {
+        s->cpu[i].hpp_bmp = g_new0(unsigned long, GICV3_PRIO_LEVELS *
+                                   BITS_TO_LONGS(s->num_irq));
+    }
+
+    /* The distributor and CPU interface do their own locking. The
+     * redistributors stay under the BQL, because enabling and disabling
+     * LPIs accesses the LPI tables in guest memory.
+     */
+    qemu_rec_mutex_init(&s->lock);
+    memory_region_clear_global_locking(&s->iomem_dist);
+
+    if (s->lpi_enable) {
+        qemu_add_vm_change_state_handler(arm_gicv3_vm_state_change, s);
+    }
+
     gicv3_init_cpuif(s);
 }
 
@@ -397,6 +487,7 @@ static void arm_gicv3_class_init(ObjectClass *klass, void *data)
 
     agcc->post_load = arm_gicv3_post_load;
     device_class_set_parent_realize(dc, arm_gic_realize, &agc->parent_realize);
+    device_class_set_parent_reset(dc, arm_gicv3_reset, &agc->parent_reset);
 }
 
 static const TypeInfo arm_gicv3_info = {
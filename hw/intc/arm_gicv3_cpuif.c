@@ -33,6 +33,86 @@ static GICv3CPUState *icc_cs_from_env(CPUARMState *env)
     return env->gicv3state;
 }
 
+static qemu_irq gicv3_line_irq(GICv3CPUState *cs, int line)
+{
+    switch (line) {
+    case GICV3_LINE_IRQ:
+        return cs->parent_irq;
+    case GICV3_LINE_FIQ:
+        return cs->parent_fiq;
+    case GICV3_LINE_VIRQ:
+        return cs->parent_virq;
+    case GICV3_LINE_VFIQ:
+        return cs->parent_vfiq;
+    case GICV3_LINE_MAINT:
+        return cs->maintenance_irq;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void gicv3_set_line(GICv3CPUState *cs, int line, int level)
+{
+    /* Record the new level of an outbound line; it is passed on to the
+     * CPU by gicv3_unlock(). Setting the line here would need the BQL,
+     * which we can't take while holding the GIC lock, and for the
+     * maintenance interrupt it would re-enter the GIC.
+     */
+    if (cs->line_level[line] == level) {
+        return;
+    }
+    qatomic_set(&cs->line_level[line], level);
+    qatomic_or(&cs->lines_dirty, 1U << line);
+    cs->gic->lines_dirty = true;
+}
+
+static void gicv3_update_lines(GICv3State *s)
+{
+    bool bql = qemu_mutex_iothread_locked();
+    int i;
+
+    /* The CPU's interrupt lines, and cpu_interrupt() behind them, still
+     * need the BQL; only the register accesses themselves are done
+     * without it.  It is only taken when a line actually changed.
+     */
+    if (!bql) {
+        qemu_mutex_lock_iothread();
+    }
+    /* Several threads may get here for the same change. Since each of
+     * them sets the lines to their latest levels under the BQL, the last
+     * one to run leaves every line at its final level.
+     */
+    for (i = 0; i < s->num_cpu; i++) {
+        GICv3CPUState *cs = &s->cpu[i];
+        unsigned int dirty = qatomic_xchg(&cs->lines_dirty, 0);
+
+        while (dirty) {
+            int line = ctz32(dirty);
+            int level = qatomic_read(&cs->line_level[line]);
+
+            dirty &= dirty - 1;
+            if (level >= 0) {
+                qemu_set_irq(gicv3_line_irq(cs, line), level);
+            }
+        }
+    }
+    if (!bql) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
+void gicv3_unlock(GICv3State *s)
+{
+    bool update = s->lines_dirty;
+
+    s->lines_dirty = false;
+    qemu_rec_mutex_unlock(&s->lock);
+
+    if (update) {
+        gicv3_update_lines(s);
+    }
+}
+
 static bool gicv3_use_ns_bank(CPUARMState *env)
 {
     /* Return true if we should use the NonSecure bank for a banked GIC
@@ -382,18 +462,15 @@ static void gicv3_cpuif_virt_update(GICv3CPUState *cs)
      * maintenance interrupts, following a change to the state
      * of the CPU interface relevant to virtual interrupts.
      *
-     * CAUTION: this function will call qemu_set_irq() on the
-     * CPU maintenance IRQ line, which is typically wired up
-     * to the GIC as a per-CPU interrupt. This means that it
-     * will recursively call back into the GIC code via
-     * gicv3_redist_set_irq() and thus into the CPU interface code's
-     * gicv3_cpuif_update(). It is therefore important that this
-     * function is only called as the final action of a CPU interface
-     * register write implementation, after all the GIC state
-     * fields have been updated. gicv3_cpuif_update() also must
-     * not cause this function to be called, but that happens
-     * naturally as a result of there being no architectural
-     * linkage between the physical and virtual GIC logic.
+     * The CPU maintenance IRQ line is typically wired up to the GIC
+     * as a per-CPU interrupt, so setting it calls back into the GIC
+     * code via gicv3_redist_set_irq() and thus into the CPU interface
+     * code's gicv3_cpuif_update(). This happens from gicv3_unlock(),
+     * once the register write implementation that called us has
+     * finished updating the GIC state. gicv3_cpuif_update() must not
+     * cause this function to be called, but that happens naturally as
+     * a result of there being no architectural linkage between the
+     * physical and virtual GIC logic.
      */
     int idx;
     int irqlevel = 0;
@@ -422,9 +499,9 @@ static void gicv3_cpuif_virt_update(GICv3CPUState *cs)
     trace_gicv3_cpuif_virt_set_irqs(gicv3_redist_affid(cs), fiqlevel,
                                     irqlevel, maintlevel);
 
-    qemu_set_irq(cs->parent_vfiq, fiqlevel);
-    qemu_set_irq(cs->parent_virq, irqlevel);
-    qemu_set_irq(cs->maintenance_irq, maintlevel);
+    gicv3_set_line(cs, GICV3_LINE_VFIQ, fiqlevel);
+    gicv3_set_line(cs, GICV3_LINE_VIRQ, irqlevel);
+    gicv3_set_line(cs, GICV3_LINE_MAINT, maintlevel);
 }
 
 static uint64_t icv_ap_read(CPUARMState *env, const ARMCPRegInfo *ri)
@@ -779,8 +856,6 @@ void gicv3_cpuif_update(GICv3CPUState *cs)
     ARMCPU *cpu = ARM_CPU(cs->cpu);
     CPUARMState *env = &cpu->env;
 
-    g_assert(qemu_mutex_iothread_locked());
-
     trace_gicv3_cpuif_update(gicv3_redist_affid(cs), cs->hppi.irq,
                              cs->hppi.grp, cs->hppi.prio);
 
@@ -821,8 +896,8 @@ void gicv3_cpuif_update(GICv3CPUState *cs)
 
     trace_gicv3_cpuif_set_irqs(gicv3_redist_affid(cs), fiqlevel, irqlevel);
 
-    qemu_set_irq(cs->parent_fiq, fiqlevel);
-    qemu_set_irq(cs->parent_irq, irqlevel);
+    gicv3_set_line(cs, GICV3_LINE_FIQ, fiqlevel);
+    gicv3_set_line(cs, GICV3_LINE_IRQ, irqlevel);
 }
 
 static uint64_t icc_pmr_read(CPUARMState *env, const ARMCPRegInfo *ri)
@@ -893,7 +968,10 @@ static void icc_activate_irq(GICv3CPUState *cs, int irq)
 
     cs->icc_apr[cs->hppi.grp][regno] |= (1 << regbit);
 
-    if (irq < GIC_INTERNAL) {
+    if (irq >= GICV3_LPI_INTID_START) {
+        /* LPIs have no active state: acknowledging one just clears it */
+        gicv3_redist_process_lpi(cs, irq, 0);
+    } else if (irq < GIC_INTERNAL) {
         cs->gicr_iactiver0 = deposit32(cs->gicr_iactiver0, irq, 1, 1);
         cs->gicr_ipendr0 = deposit32(cs->gicr_ipendr0, irq, 1, 0);
         gicv3_redist_update(cs);
@@ -1106,6 +1184,10 @@ static int icc_highest_active_group(GICv3CPUState *cs)
 
 static void icc_deactivate_irq(GICv3CPUState *cs, int irq)
 {
+    if (irq >= GICV3_LPI_INTID_START) {
+        /* LPIs have no active state, so there is nothing to deactivate */
+        return;
+    }
     if (irq < GIC_INTERNAL) {
         cs->gicr_iactiver0 = deposit32(cs->gicr_iactiver0, irq, 1, 0);
         gicv3_redist_update(cs);
@@ -1327,7 +1409,8 @@ static void icc_eoir_write(CPUARMState *env, const ARMCPRegInfo *ri,
         }
     }
 
-    if (irq >= cs->gic->num_irq) {
+    if (irq >= cs->gic->num_irq &&
+        !(cs->gic->lpi_enable && irq >= GICV3_LPI_INTID_START)) {
         /* This handles two cases:
          * 1. If software writes the ID of a spurious interrupt [ie 1020-1023]
          * to the GICC_EOIR, the GIC ignores that write.
@@ -1335,6 +1418,7 @@ static void icc_eoir_write(CPUARMState *env, const ARMCPRegInfo *ri,
          * this must be a subcase of "value written does not match the last
          * valid interrupt value read from the Interrupt Acknowledge
          * register" and so this is UNPREDICTABLE. We choose to ignore it.
+         * LPIs only need the priority drop, which is done below.
          */
         return;
     }
@@ -2031,6 +2115,7 @@ static CPAccessResult gicv3_irq_access(CPUARMState *env,
 static void icc_reset(CPUARMState *env, const ARMCPRegInfo *ri)
 {
     GICv3CPUState *cs = icc_cs_from_env(env);
+    int i;
 
     cs->icc_ctlr_el1[GICV3_S] = ICC_CTLR_EL1_A3V |
         (1 << ICC_CTLR_EL1_IDBITS_SHIFT) |
@@ -2054,184 +2139,251 @@ static void icc_reset(CPUARMState *env, const ARMCPRegInfo *ri)
     cs->ich_vmcr_el2 = ICH_VMCR_EL2_VFIQEN |
         ((icv_min_vbpr(cs) + 1) << ICH_VMCR_EL2_VBPR1_SHIFT) |
         (icv_min_vbpr(cs) << ICH_VMCR_EL2_VBPR0_SHIFT);
+
+    /* The CPU's reset has lowered its interrupt lines behind our back */
+    for (i = 0; i < GICV3_NUM_LINES; i++) {
+        cs->line_level[i] = -1;
+    }
+}
+
+/* The CPU interface registers are marked ARM_CP_NO_BQL, so that
+ * acknowledging interrupts and sending SGIs doesn't serialize all the
+ * vCPUs on the BQL. Instead these wrappers take the GIC lock around the
+ * real accessors, which all expect to be called with it held.
+ */
+#define GICV3_LOCKED_READFN(fn)                                         \
+    static uint64_t locked_##fn(CPUARMState *env, const ARMCPRegInfo *ri) \
+    {                                                                   \
+        GICv3State *s = icc_cs_from_env(env)->gic;                      \
+        uint64_t value;                                                 \
+                                                                        \
+        gicv3_lock(s);                                                  \
+        value = fn(env, ri);                                            \
+        gicv3_unlock(s);                                                \
+        return value;                                                   \
+    }
+
+#define GICV3_LOCKED_WRITEFN(fn)                                        \
+    static void locked_##fn(CPUARMState *env, const ARMCPRegInfo *ri,   \
+                            uint64_t value)                             \
+    {                                                                   \
+        GICv3State *s = icc_cs_from_env(env)->gic;                      \
+                                                                        \
+        gicv3_lock(s);                                                  \
+        fn(env, ri, value);                                             \
+        gicv3_unlock(s);                                                \
+    }
+
+GICV3_LOCKED_READFN(icc_ap_read)
+GICV3_LOCKED_READFN(icc_bpr_read)
+GICV3_LOCKED_READFN(icc_ctlr_el1_read)
+GICV3_LOCKED_READFN(icc_ctlr_el3_read)
+GICV3_LOCKED_READFN(icc_hppir0_read)
+GICV3_LOCKED_READFN(icc_hppir1_read)
+GICV3_LOCKED_READFN(icc_iar0_read)
+GICV3_LOCKED_READFN(icc_iar1_read)
+GICV3_LOCKED_READFN(icc_igrpen1_el3_read)
+GICV3_LOCKED_READFN(icc_igrpen_read)
+GICV3_LOCKED_READFN(icc_pmr_read)
+GICV3_LOCKED_READFN(icc_rpr_read)
+GICV3_LOCKED_WRITEFN(icc_ap_write)
+GICV3_LOCKED_WRITEFN(icc_asgi1r_write)
+GICV3_LOCKED_WRITEFN(icc_bpr_write)
+GICV3_LOCKED_WRITEFN(icc_ctlr_el1_write)
+GICV3_LOCKED_WRITEFN(icc_ctlr_el3_write)
+GICV3_LOCKED_WRITEFN(icc_dir_write)
+GICV3_LOCKED_WRITEFN(icc_eoir_write)
+GICV3_LOCKED_WRITEFN(icc_igrpen1_el3_write)
+GICV3_LOCKED_WRITEFN(icc_igrpen_write)
+GICV3_LOCKED_WRITEFN(icc_pmr_write)
+GICV3_LOCKED_WRITEFN(icc_sgi0r_write)
+GICV3_LOCKED_WRITEFN(icc_sgi1r_write)
+
+static void locked_icc_reset(CPUARMState *env, const ARMCPRegInfo *ri)
+{
+    GICv3State *s = icc_cs_from_env(env)->gic;
+
+    gicv3_lock(s);
+    icc_reset(env, ri);
+    gicv3_unlock(s);
 }
 
 static const ARMCPRegInfo gicv3_cpuif_reginfo[] = {
     { .name = "ICC_PMR_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 4, .crm = 6, .opc2 = 0,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_irqfiq_access,
-      .readfn = icc_pmr_read,
-      .writefn = icc_pmr_write,
+      .readfn = locked_icc_pmr_read,
+      .writefn = locked_icc_pmr_write,
       /* We hang the whole cpu interface reset routine off here
        * rather than parcelling it out into one little function
        * per register
        */
-      .resetfn = icc_reset,
+      .resetfn = locked_icc_reset,
     },
     { .name = "ICC_IAR0_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 8, .opc2 = 0,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_R, .accessfn = gicv3_fiq_access,
-      .readfn = icc_iar0_read,
+      .readfn = locked_icc_iar0_read,
     },
     { .name = "ICC_EOIR0_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 8, .opc2 = 1,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_W, .accessfn = gicv3_fiq_access,
-      .writefn = icc_eoir_write,
+      .writefn = locked_icc_eoir_write,
     },
     { .name = "ICC_HPPIR0_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 8, .opc2 = 2,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_R, .accessfn = gicv3_fiq_access,
-      .readfn = icc_hppir0_read,
+      .readfn = locked_icc_hppir0_read,
     },
     { .name = "ICC_BPR0_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 8, .opc2 = 3,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_fiq_access,
-      .readfn = icc_bpr_read,
-      .writefn = icc_bpr_write,
+      .readfn = locked_icc_bpr_read,
+      .writefn = locked_icc_bpr_write,
     },
     { .name = "ICC_AP0R0_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 8, .opc2 = 4,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_fiq_access,
-      .readfn = icc_ap_read,
-      .writefn = icc_ap_write,
+      .readfn = locked_icc_ap_read,
+      .writefn = locked_icc_ap_write,
     },
     { .name = "ICC_AP0R1_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 8, .opc2 = 5,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_fiq_access,
-      .readfn = icc_ap_read,
-      .writefn = icc_ap_write,
+      .readfn = locked_icc_ap_read,
+      .writefn = locked_icc_ap_write,
     },
     { .name = "ICC_AP0R2_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 8, .opc2 = 6,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_fiq_access,
-      .readfn = icc_ap_read,
-      .writefn = icc_ap_write,
+      .readfn = locked_icc_ap_read,
+      .writefn = locked_icc_ap_write,
     },
     { .name = "ICC_AP0R3_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 8, .opc2 = 7,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_fiq_access,
-      .readfn = icc_ap_read,
-      .writefn = icc_ap_write,
+      .readfn = locked_icc_ap_read,
+      .writefn = locked_icc_ap_write,
     },
     /* All the ICC_AP1R*_EL1 registers are banked */
     { .name = "ICC_AP1R0_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 9, .opc2 = 0,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_irq_access,
-      .readfn = icc_ap_read,
-      .writefn = icc_ap_write,
+      .readfn = locked_icc_ap_read,
+      .writefn = locked_icc_ap_write,
     },
     { .name = "ICC_AP1R1_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 9, .opc2 = 1,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_irq_access,
-      .readfn = icc_ap_read,
-      .writefn = icc_ap_write,
+      .readfn = locked_icc_ap_read,
+      .writefn = locked_icc_ap_write,
     },
     { .name = "ICC_AP1R2_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 9, .opc2 = 2,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_irq_access,
-      .readfn = icc_ap_read,
-      .writefn = icc_ap_write,
+      .readfn = locked_icc_ap_read,
+      .writefn = locked_icc_ap_write,
     },
     { .name = "ICC_AP1R3_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 9, .opc2 = 3,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_irq_access,
-      .readfn = icc_ap_read,
-      .writefn = icc_ap_write,
+      .readfn = locked_icc_ap_read,
+      .writefn = locked_icc_ap_write,
     },
     { .name = "ICC_DIR_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 11, .opc2 = 1,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_W, .accessfn = gicv3_dir_access,
-      .writefn = icc_dir_write,
+      .writefn = locked_icc_dir_write,
     },
     { .name = "ICC_RPR_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 11, .opc2 = 3,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_R, .accessfn = gicv3_irqfiq_access,
-      .readfn = icc_rpr_read,
+      .readfn = locked_icc_rpr_read,
     },
     { .name = "ICC_SGI1R_EL1", .state = ARM_CP_STATE_AA64,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 11, .opc2 = 5,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_W, .accessfn = gicv3_sgi_access,
-      .writefn = icc_sgi1r_write,
+      .writefn = locked_icc_sgi1r_write,
     },
     { .name = "ICC_SGI1R",
       .cp = 15, .opc1 = 0, .crm = 12,
-      .type = ARM_CP_64BIT | ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_64BIT | ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_W, .accessfn = gicv3_sgi_access,
-      .writefn = icc_sgi1r_write,
+      .writefn = locked_icc_sgi1r_write,
     },
     { .name = "ICC_ASGI1R_EL1", .state = ARM_CP_STATE_AA64,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 11, .opc2 = 6,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_W, .accessfn = gicv3_sgi_access,
-      .writefn = icc_asgi1r_write,
+      .writefn = locked_icc_asgi1r_write,
     },
     { .name = "ICC_ASGI1R",
       .cp = 15, .opc1 = 1, .crm = 12,
-      .type = ARM_CP_64BIT | ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_64BIT | ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_W, .accessfn = gicv3_sgi_access,
-      .writefn = icc_asgi1r_write,
+      .writefn = locked_icc_asgi1r_write,
     },
     { .name = "ICC_SGI0R_EL1", .state = ARM_CP_STATE_AA64,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 11, .opc2 = 7,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_W, .accessfn = gicv3_sgi_access,
-      .writefn = icc_sgi0r_write,
+      .writefn = locked_icc_sgi0r_write,
     },
     { .name = "ICC_SGI0R",
       .cp = 15, .opc1 = 2, .crm = 12,
-      .type = ARM_CP_64BIT | ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_64BIT | ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_W, .accessfn = gicv3_sgi_access,
-      .writefn = icc_sgi0r_write,
+      .writefn = locked_icc_sgi0r_write,
     },
     { .name = "ICC_IAR1_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 12, .opc2 = 0,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_R, .accessfn = gicv3_irq_access,
-      .readfn = icc_iar1_read,
+      .readfn = locked_icc_iar1_read,
     },
     { .name = "ICC_EOIR1_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 12, .opc2 = 1,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_W, .accessfn = gicv3_irq_access,
-      .writefn = icc_eoir_write,
+      .writefn = locked_icc_eoir_write,
     },
     { .name = "ICC_HPPIR1_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 12, .opc2 = 2,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_R, .accessfn = gicv3_irq_access,
-      .readfn = icc_hppir1_read,
+      .readfn = locked_icc_hppir1_read,
     },
     /* This register is banked */
     { .name = "ICC_BPR1_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 12, .opc2 = 3,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_irq_access,
-      .readfn = icc_bpr_read,
-      .writefn = icc_bpr_write,
+      .readfn = locked_icc_bpr_read,
+      .writefn = locked_icc_bpr_write,
     },
     /* This register is banked */
     { .name = "ICC_CTLR_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 12, .opc2 = 4,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_irqfiq_access,
-      .readfn = icc_ctlr_el1_read,
-      .writefn = icc_ctlr_el1_write,
+      .readfn = locked_icc_ctlr_el1_read,
+      .writefn = locked_icc_ctlr_el1_write,
     },
     { .name = "ICC_SRE_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 12, .opc2 = 5,
@@ -2246,18 +2398,18 @@ static const ARMCPRegInfo gicv3_cpuif_reginfo[] = {
     },
     { .name = "ICC_IGRPEN0_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 12, .opc2 = 6,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_fiq_access,
-      .readfn = icc_igrpen_read,
-      .writefn = icc_igrpen_write,
+      .readfn = locked_icc_igrpen_read,
+      .writefn = locked_icc_igrpen_write,
     },
     /* This register is banked */
     { .name = "ICC_IGRPEN1_EL1", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 0, .crn = 12, .crm = 12, .opc2 = 7,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL1_RW, .accessfn = gicv3_irq_access,
-      .readfn = icc_igrpen_read,
-      .writefn = icc_igrpen_write,
+      .readfn = locked_icc_igrpen_read,
+      .writefn = locked_icc_igrpen_write,
     },
     { .name = "ICC_SRE_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 9, .opc2 = 5,
@@ -2270,10 +2422,10 @@ static const ARMCPRegInfo gicv3_cpuif_reginfo[] = {
     },
     { .name = "ICC_CTLR_EL3", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 6, .crn = 12, .crm = 12, .opc2 = 4,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL3_RW,
-      .readfn = icc_ctlr_el3_read,
-      .writefn = icc_ctlr_el3_write,
+      .readfn = locked_icc_ctlr_el3_read,
+      .writefn = locked_icc_ctlr_el3_write,
     },
     { .name = "ICC_SRE_EL3", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 6, .crn = 12, .crm = 12, .opc2 = 5,
@@ -2286,10 +2438,10 @@ static const ARMCPRegInfo gicv3_cpuif_reginfo[] = {
     },
     { .name = "ICC_IGRPEN1_EL3", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 6, .crn = 12, .crm = 12, .opc2 = 7,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL3_RW,
-      .readfn = icc_igrpen1_el3_read,
-      .writefn = icc_igrpen1_el3_write,
+      .readfn = locked_icc_igrpen1_el3_read,
+      .writefn = locked_icc_igrpen1_el3_write,
     },
     REGINFO_SENTINEL
 };
@@ -2488,58 +2640,71 @@ static uint64_t ich_elrsr_read(CPUARMState *env, const ARMCPRegInfo *ri)
     return value;
 }
 
+GICV3_LOCKED_READFN(ich_ap_read)
+GICV3_LOCKED_READFN(ich_eisr_read)
+GICV3_LOCKED_READFN(ich_elrsr_read)
+GICV3_LOCKED_READFN(ich_hcr_read)
+GICV3_LOCKED_READFN(ich_lr_read)
+GICV3_LOCKED_READFN(ich_misr_read)
+GICV3_LOCKED_READFN(ich_vmcr_read)
+GICV3_LOCKED_READFN(ich_vtr_read)
+GICV3_LOCKED_WRITEFN(ich_ap_write)
+GICV3_LOCKED_WRITEFN(ich_hcr_write)
+GICV3_LOCKED_WRITEFN(ich_lr_write)
+GICV3_LOCKED_WRITEFN(ich_vmcr_write)
+
 static const ARMCPRegInfo gicv3_cpuif_hcr_reginfo[] = {
     { .name = "ICH_AP0R0_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 8, .opc2 = 0,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_RW,
-      .readfn = ich_ap_read,
-      .writefn = ich_ap_write,
+      .readfn = locked_ich_ap_read,
+      .writefn = locked_ich_ap_write,
     },
     { .name = "ICH_AP1R0_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 9, .opc2 = 0,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_RW,
-      .readfn = ich_ap_read,
-      .writefn = ich_ap_write,
+      .readfn = locked_ich_ap_read,
+      .writefn = locked_ich_ap_write,
     },
     { .name = "ICH_HCR_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 11, .opc2 = 0,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_RW,
-      .readfn = ich_hcr_read,
-      .writefn = ich_hcr_write,
+      .readfn = locked_ich_hcr_read,
+      .writefn = locked_ich_hcr_write,
     },
     { .name = "ICH_VTR_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 11, .opc2 = 1,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_R,
-      .readfn = ich_vtr_read,
+      .readfn = locked_ich_vtr_read,
     },
     { .name = "ICH_MISR_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 11, .opc2 = 2,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_R,
-      .readfn = ich_misr_read,
+      .readfn = locked_ich_misr_read,
     },
     { .name = "ICH_EISR_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 11, .opc2 = 3,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_R,
-      .readfn = ich_eisr_read,
+      .readfn = locked_ich_eisr_read,
     },
     { .name = "ICH_ELRSR_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 11, .opc2 = 5,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_R,
-      .readfn = ich_elrsr_read,
+      .readfn = locked_ich_elrsr_read,
     },
     { .name = "ICH_VMCR_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 11, .opc2 = 7,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_RW,
-      .readfn = ich_vmcr_read,
-      .writefn = ich_vmcr_write,
+      .readfn = locked_ich_vmcr_read,
+      .writefn = locked_ich_vmcr_write,
     },
     REGINFO_SENTINEL
 };
@@ -2547,17 +2712,17 @@ static const ARMCPRegInfo gicv3_cpuif_hcr_reginfo[] = {
 static const ARMCPRegInfo gicv3_cpuif_ich_apxr1_reginfo[] = {
     { .name = "ICH_AP0R1_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 8, .opc2 = 1,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_RW,
-      .readfn = ich_ap_read,
-      .writefn = ich_ap_write,
+      .readfn = locked_ich_ap_read,
+      .writefn = locked_ich_ap_write,
     },
     { .name = "ICH_AP1R1_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 9, .opc2 = 1,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_RW,
-      .readfn = ich_ap_read,
-      .writefn = ich_ap_write,
+      .readfn = locked_ich_ap_read,
+      .writefn = locked_ich_ap_write,
     },
     REGINFO_SENTINEL
 };
@@ -2565,31 +2730,31 @@ static const ARMCPRegInfo gicv3_cpuif_ich_apxr1_reginfo[] = {
 static const ARMCPRegInfo gicv3_cpuif_ich_apxr23_reginfo[] = {
     { .name = "ICH_AP0R2_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 8, .opc2 = 2,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_RW,
-      .readfn = ich_ap_read,
-      .writefn = ich_ap_write,
+      .readfn = locked_ich_ap_read,
+      .writefn = locked_ich_ap_write,
     },
     { .name = "ICH_AP0R3_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 8, .opc2 = 3,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_RW,
-      .readfn = ich_ap_read,
-      .writefn = ich_ap_write,
+      .readfn = locked_ich_ap_read,
+      .writefn = locked_ich_ap_write,
     },
     { .name = "ICH_AP1R2_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 9, .opc2 = 2,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_RW,
-      .readfn = ich_ap_read,
-      .writefn = ich_ap_write,
+      .readfn = locked_ich_ap_read,
+      .writefn = locked_ich_ap_write,
     },
     { .name = "ICH_AP1R3_EL2", .state = ARM_CP_STATE_BOTH,
       .opc0 = 3, .opc1 = 4, .crn = 12, .crm = 9, .opc2 = 3,
-      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
       .access = PL2_RW,
-      .readfn = ich_ap_read,
-      .writefn = ich_ap_write,
+      .readfn = locked_ich_ap_read,
+      .writefn = locked_ich_ap_write,
     },
     REGINFO_SENTINEL
 };
@@ -2598,7 +2763,9 @@ static void gicv3_cpuif_el_change_hook(ARMCPU *cpu, void *opaque)
 {
     GICv3CPUState *cs = opaque;
 
+    gicv3_lock(cs->gic);
     gicv3_cpuif_update(cs);
+    gicv3_unlock(cs->gic);
 }
 
 void gicv3_init_cpuif(GICv3State *s)
@@ -2649,18 +2816,18 @@ void gicv3_init_cpuif(GICv3State *s)
                     { .name = "ICH_LRn_EL2", .state = ARM_CP_STATE_BOTH,
                       .opc0 = 3, .opc1 = 4, .crn = 12,
                       .crm = 12 + (j >> 3), .opc2 = j & 7,
-                      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+                      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
                       .access = PL2_RW,
-                      .readfn = ich_lr_read,
-                      .writefn = ich_lr_write,
+                      .readfn = locked_ich_lr_read,
+                      .writefn = locked_ich_lr_write,
                     },
                     { .name = "ICH_LRCn_EL2", .state = ARM_CP_STATE_AA32,
                       .cp = 15, .opc1 = 4, .crn = 12,
                       .crm = 14 + (j >> 3), .opc2 = j & 7,
-                      .type = ARM_CP_IO | ARM_CP_NO_RAW,
+                      .type = ARM_CP_IO | ARM_CP_NO_RAW | ARM_CP_NO_BQL,
                       .access = PL2_RW,
-                      .readfn = ich_lr_read,
-                      .writefn = ich_lr_write,
+                      .readfn = locked_ich_lr_read,
+                      .writefn = locked_ich_lr_write,
                     },
                     REGINFO_SENTINEL
                 };
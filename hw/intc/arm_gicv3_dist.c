@@ -371,7 +371,7 @@ static MemTxResult gicd_readl(GICv3State *s, hwaddr offset,
          * A3V == 1 (non-zero values of Affinity level 3 supported)
          * IDbits == 0xf (we support 16-bit interrupt identifiers)
          * DVIS == 0 (Direct virtual LPI injection not supported)
-         * LPIS == 0 (LPIs not supported)
+         * LPIS == 1 if LPIs are supported (has-lpi property)
          * MBIS == 0 (message-based SPIs not supported)
          * SecurityExtn == 1 if security extns supported
          * CPUNumber == 0 since for us ARE is always 1
@@ -386,7 +386,10 @@ static MemTxResult gicd_readl(GICv3State *s, hwaddr offset,
         bool sec_extn = !(s->gicd_ctlr & GICD_CTLR_DS);
 
         *data = (1 << 25) | (1 << 24) | (sec_extn << 10) |
-            (0xf << 19) | itlinesnumber;
+            (GICD_TYPER_IDBITS << 19) | itlinesnumber;
+        if (s->lpi_enable) {
+            *data |= GICD_TYPER_LPIS;
+        }
         return MEMTX_OK;
     }
     case GICD_IIDR:
@@ -801,6 +804,7 @@ MemTxResult gicv3_dist_read(void *opaque, hwaddr offset, uint64_t *data,
     GICv3State *s = (GICv3State *)opaque;
     MemTxResult r;
 
+    gicv3_lock(s);
     switch (size) {
     case 1:
         r = gicd_readb(s, offset, data, attrs);
@@ -818,6 +822,7 @@ MemTxResult gicv3_dist_read(void *opaque, hwaddr offset, uint64_t *data,
         r = MEMTX_ERROR;
         break;
     }
+    gicv3_unlock(s);
 
     if (r == MEMTX_ERROR) {
         qemu_log_mask(LOG_GUEST_ERROR,
@@ -843,6 +848,7 @@ MemTxResult gicv3_dist_write(void *opaque, hwaddr offset, uint64_t data,
     GICv3State *s = (GICv3State *)opaque;
     MemTxResult r;
 
+    gicv3_lock(s);
     switch (size) {
     case 1:
         r = gicd_writeb(s, offset, data, attrs);
@@ -860,6 +866,7 @@ MemTxResult gicv3_dist_write(void *opaque, hwaddr offset, uint64_t data,
         r = MEMTX_ERROR;
         break;
     }
+    gicv3_unlock(s);
 
     if (r == MEMTX_ERROR) {
         qemu_log_mask(LOG_GUEST_ERROR,
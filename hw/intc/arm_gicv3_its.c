@@ -0,0 +1,813 @@
+/*
+ * ITS emulation for a GICv3-based system
+ *
+ * This code is licensed under the GPL, version 2 or (at your option)
+ * any later version.
+ */
+
+/* This is the emulated counterpart of arm_gicv3_its_kvm.c, for use
+ * with the emulated GICv3 when it is configured with LPI support.
+ *
+ * Only physical LPIs are supported. Commands are processed synchronously
+ * as soon as the guest advances GITS_CWRITER, so GITS_CTLR.Quiescent
+ * always reads as 1 and SYNC has nothing to wait for. A command that
+ * cannot be read from the queue stalls it (GITS_CREADR.Stalled) until the
+ * guest writes GITS_CWRITER with Retry set. A translated MSI is made
+ * pending in the target redistributor, which caches the LPI state.
+ *
+ * The format of the device, collection and interrupt translation tables
+ * is IMPLEMENTATION DEFINED. All our entries are 8 bytes, little-endian:
+ *  device table entry:     [0] Valid, [5:1] EventID bits - 1,
+ *                          [49:6] ITT address bits [51:8]
+ *  collection table entry: [0] Valid, [16:1] target redistributor
+ *                          (processor number, as GITS_TYPER.PTA == 0)
+ *  interrupt translation
+ *  table entry:            [0] Valid, [16:1] pINTID, [32:17] ICID
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/module.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "hw/qdev-properties.h"
+#include "hw/intc/arm_gicv3.h"
+#include "hw/intc/arm_gicv3_its_common.h"
+#include "gicv3_internal.h"
+#include "trace.h"
+#include "qom/object.h"
+
+#define TYPE_ARM_GICV3_ITS "arm-gicv3-its"
+typedef struct GICv3ITSClass GICv3ITSClass;
+/* This is reusing the GICv3ITSState typedef from ARM_GICV3_ITS_COMMON */
+DECLARE_OBJ_CHECKERS(GICv3ITSState, GICv3ITSClass,
+                     ARM_GICV3_ITS, TYPE_ARM_GICV3_ITS)
+
+struct GICv3ITSClass {
+    GICv3ITSCommonClass parent_class;
+    void (*parent_reset)(DeviceState *dev);
+};
+
+/* Properties of our implementation */
+#define ITS_CMD_SIZE         32
+#define ITS_ENTRY_SIZE       8   /* size of all our table entries */
+#define ITS_IDBITS           16  /* EventID bits */
+#define ITS_DEVBITS          16  /* DeviceID bits */
+
+/* GITS_BASER<n> indexes for the tables we implement */
+#define ITS_BASER_DEVICE     0
+#define ITS_BASER_COLLECTION 1
+#define ITS_BASER_NUM_TABLES 2
+
+#define GITS_CTLR_ENABLED            (1U << 0)
+#define GITS_CTLR_QUIESCENT          (1U << 31)
+
+#define GITS_TYPER_PHYSICAL          (1ULL << 0)
+#define GITS_TYPER_ITT_ENTRY_SIZE_SHIFT 4
+#define GITS_TYPER_IDBITS_SHIFT      8
+#define GITS_TYPER_DEVBITS_SHIFT     13
+
+#define GITS_CBASER_VALID            (1ULL << 63)
+#define GITS_CBASER_ADDR_MASK        (0xffffffffffULL << 12)
+#define GITS_CBASER_SIZE_MASK        0xff
+#define GITS_CBASER_RW_MASK          (GITS_CBASER_VALID | (7ULL << 59) | \
+                                      (7ULL << 53) | GITS_CBASER_ADDR_MASK | \
+                                      (3U << 10) | GITS_CBASER_SIZE_MASK)
+
+#define GITS_CQ_OFFSET_MASK          (0x7fffULL << 5)
+#define GITS_CREADR_STALLED          (1ULL << 0)
+#define GITS_CWRITER_RETRY           (1ULL << 0)
+
+#define GITS_BASER_VALID             (1ULL << 63)
+#define GITS_BASER_INDIRECT          (1ULL << 62)
+#define GITS_BASER_TYPE_SHIFT        56
+#define GITS_BASER_TYPE_DEVICE       1ULL
+#define GITS_BASER_TYPE_COLLECTION   4ULL
+#define GITS_BASER_ENTRY_SIZE_SHIFT  48
+#define GITS_BASER_ADDR_MASK         (0xfffffffffULL << 12)
+#define GITS_BASER_PAGESIZE_SHIFT    8
+#define GITS_BASER_SIZE_MASK         0xff
+#define GITS_BASER_RW_MASK           (GITS_BASER_VALID | GITS_BASER_INDIRECT | \
+                                      (7ULL << 59) | (7ULL << 53) | \
+                                      GITS_BASER_ADDR_MASK | (3U << 10) | \
+                                      (3U << GITS_BASER_PAGESIZE_SHIFT) | \
+                                      GITS_BASER_SIZE_MASK)
+
+/* Level 1 entries of two-level tables */
+#define ITS_L1E_VALID                (1ULL << 63)
+#define ITS_L1E_ADDR_MASK            (0xffffffffffULL << 12)
+
+#define ITS_DTE_VALID                (1ULL << 0)
+#define ITS_DTE_SIZE_SHIFT           1
+#define ITS_DTE_SIZE_LENGTH          5
+#define ITS_DTE_ITT_SHIFT            6
+#define ITS_DTE_ITT_LENGTH           44
+
+#define ITS_CTE_VALID                (1ULL << 0)
+#define ITS_CTE_RDBASE_SHIFT         1
+#define ITS_CTE_RDBASE_LENGTH        16
+
+#define ITS_ITE_VALID                (1ULL << 0)
+#define ITS_ITE_INTID_SHIFT          1
+#define ITS_ITE_INTID_LENGTH         16
+#define ITS_ITE_ICID_SHIFT           17
+#define ITS_ITE_ICID_LENGTH          16
+
+/* ITS commands */
+#define GITS_CMD_MOVI                0x01
+#define GITS_CMD_INT                 0x03
+#define GITS_CMD_CLEAR               0x04
+#define GITS_CMD_SYNC                0x05
+#define GITS_CMD_MAPD                0x08
+#define GITS_CMD_MAPC                0x09
+#define GITS_CMD_MAPTI               0x0a
+#define GITS_CMD_MAPI                0x0b
+#define GITS_CMD_INV                 0x0c
+#define GITS_CMD_INVALL              0x0d
+#define GITS_CMD_MOVALL              0x0e
+#define GITS_CMD_DISCARD             0x0f
+
+static AddressSpace *its_as(GICv3ITSState *s)
+{
+    return &s->gicv3->dma_as;
+}
+
+static uint64_t its_typer(void)
+{
+    /* For our implementation:
+     *  Physical == 1 (physical LPIs supported)
+     *  ITT_entry_size == ITS_ENTRY_SIZE - 1
+     *  IDbits, Devbits == 16 bit EventIDs and DeviceIDs
+     *  PTA == 0 (target addresses are processor numbers)
+     *  HCC == 0 (collections are always held in memory)
+     *  CIL == 0 (16 bit collection IDs)
+     */
+    return GITS_TYPER_PHYSICAL |
+        ((uint64_t)(ITS_ENTRY_SIZE - 1) << GITS_TYPER_ITT_ENTRY_SIZE_SHIFT) |
+        ((uint64_t)(ITS_IDBITS - 1) << GITS_TYPER_IDBITS_SHIFT) |
+        ((uint64_t)(ITS_DEVBITS - 1) << GITS_TYPER_DEVBITS_SHIFT);
+}
+
+static uint64_t its_baser_page_size(uint64_t baser)
+{
+    switch (extract64(baser, GITS_BASER_PAGESIZE_SHIFT, 2)) {
+    case 0:
+        return 4 * KiB;
+    case 1:
+        return 16 * KiB;
+    default:
+        /* The reserved encoding behaves like 64KB for us */
+        return 64 * KiB;
+    }
+}
+
+static bool its_table_entry_addr(GICv3ITSState *s, int n, uint32_t id,
+                                 hwaddr *addr)
+{
+    /* Find the guest address of entry @id of the table described by
+     * GITS_BASER<n>. Returns false if the table isn't valid or doesn't
+     * have an entry for @id.
+     */
+    uint64_t baser = s->baser[n];
+    uint64_t pagesz = its_baser_page_size(baser);
+    uint64_t tablesz = ((baser & GITS_BASER_SIZE_MASK) + 1) * pagesz;
+    hwaddr base = baser & GITS_BASER_ADDR_MASK & ~(pagesz - 1);
+    uint64_t per_page, l1e;
+
+    if (!(baser & GITS_BASER_VALID)) {
+        return false;
+    }
+
+    if (!(baser & GITS_BASER_INDIRECT)) {
+        if ((uint64_t)id * ITS_ENTRY_SIZE >= tablesz) {
+            return false;
+        }
+        *addr = base + (uint64_t)id * ITS_ENTRY_SIZE;
+        return true;
+    }
+
+    /* Two-level table: the level 1 table is an array of 8 byte pointers
+     * to pages of entries, which the guest allocates as needed.
+     */
+    per_page = pagesz / ITS_ENTRY_SIZE;
+    if ((id / per_page) * 8 >= tablesz) {
+        return false;
+    }
+    l1e = address_space_ldq_le(its_as(s), base + (id / per_page) * 8,
+                               MEMTXATTRS_UNSPECIFIED, NULL);
+    if (!(l1e & ITS_L1E_VALID)) {
+        return false;
+    }
+    *addr = (l1e & ITS_L1E_ADDR_MASK & ~(pagesz - 1)) +
+        (id % per_page) * ITS_ENTRY_SIZE;
+    return true;
+}
+
+static bool its_read_entry(GICv3ITSState *s, int n, uint32_t id,
+                           uint64_t *entry)
+{
+    hwaddr addr;
+
+    if (!its_table_entry_addr(s, n, id, &addr)) {
+        return false;
+    }
+    *entry = address_space_ldq_le(its_as(s), addr,
+                                  MEMTXATTRS_UNSPECIFIED, NULL);
+    return true;
+}
+
+static bool its_write_entry(GICv3ITSState *s, int n, uint32_t id,
+                            uint64_t entry)
+{
+    hwaddr addr;
+
+    if (!its_table_entry_addr(s, n, id, &addr)) {
+        return false;
+    }
+    address_space_stq_le(its_as(s), addr, entry,
+                         MEMTXATTRS_UNSPECIFIED, NULL);
+    return true;
+}
+
+static bool its_ite_addr(GICv3ITSState *s, uint32_t devid, uint32_t eventid,
+                         hwaddr *addr)
+{
+    /* Find the guest address of the ITE for @eventid of device @devid.
+     * Returns false if the device isn't mapped or the event is out of
+     * range for it.
+     */
+    uint64_t dte;
+
+    if (!its_read_entry(s, ITS_BASER_DEVICE, devid, &dte) ||
+        !(dte & ITS_DTE_VALID)) {
+        return false;
+    }
+    if (eventid >> (extract64(dte, ITS_DTE_SIZE_SHIFT,
+                              ITS_DTE_SIZE_LENGTH) + 1)) {
+        return false;
+    }
+    *addr = (extract64(dte, ITS_DTE_ITT_SHIFT, ITS_DTE_ITT_LENGTH) << 8) +
+        (uint64_t)eventid * ITS_ENTRY_SIZE;
+    return true;
+}
+
+static bool its_read_ite(GICv3ITSState *s, uint32_t devid, uint32_t eventid,
+                         uint64_t *ite)
+{
+    /* Returns false unless there is a valid mapping for the event */
+    hwaddr addr;
+
+    if (!its_ite_addr(s, devid, eventid, &addr)) {
+        return false;
+    }
+    *ite = address_space_ldq_le(its_as(s), addr, MEMTXATTRS_UNSPECIFIED, NULL);
+    return *ite & ITS_ITE_VALID;
+}
+
+static GICv3CPUState *its_rdbase_target(GICv3ITSState *s, uint64_t rdbase)
+{
+    if (rdbase >= s->gicv3->num_cpu) {
+        return NULL;
+    }
+    return &s->gicv3->cpu[rdbase];
+}
+
+static GICv3CPUState *its_collection_target(GICv3ITSState *s, uint32_t icid)
+{
+    uint64_t cte;
+
+    if (!its_read_entry(s, ITS_BASER_COLLECTION, icid, &cte) ||
+        !(cte & ITS_CTE_VALID)) {
+        return NULL;
+    }
+    return its_rdbase_target(s, extract64(cte, ITS_CTE_RDBASE_SHIFT,
+                                          ITS_CTE_RDBASE_LENGTH));
+}
+
+static int its_ite_intid(uint64_t ite)
+{
+    return extract64(ite, ITS_ITE_INTID_SHIFT, ITS_ITE_INTID_LENGTH);
+}
+
+static GICv3CPUState *its_ite_target(GICv3ITSState *s, uint64_t ite)
+{
+    return its_collection_target(s, extract64(ite, ITS_ITE_ICID_SHIFT,
+                                              ITS_ITE_ICID_LENGTH));
+}
+
+static void its_cmd_mapd(GICv3ITSState *s, const uint64_t *cmd)
+{
+    uint32_t devid = extract64(cmd[0], 32, 32);
+    int size = extract64(cmd[1], 0, 5);
+    uint64_t itt_addr = extract64(cmd[2], 8, 44);
+    bool valid = extract64(cmd[2], 63, 1);
+    uint64_t dte = 0;
+
+    if (valid) {
+        if (size + 1 > ITS_IDBITS) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: EventID size %d out of range\n",
+                          __func__, size + 1);
+            return;
+        }
+        dte = ITS_DTE_VALID |
+            deposit64(0, ITS_DTE_SIZE_SHIFT, ITS_DTE_SIZE_LENGTH, size) |
+            deposit64(0, ITS_DTE_ITT_SHIFT, ITS_DTE_ITT_LENGTH, itt_addr);
+    }
+
+    if (!its_write_entry(s, ITS_BASER_DEVICE, devid, dte)) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: no device table entry for DeviceID 0x%x\n",
+                      __func__, devid);
+    }
+}
+
+static void its_cmd_mapc(GICv3ITSState *s, const uint64_t *cmd)
+{
+    uint32_t icid = extract64(cmd[2], 0, 16);
+    uint64_t rdbase = extract64(cmd[2], 16, 36);
+    bool valid = extract64(cmd[2], 63, 1);
+    uint64_t cte = 0;
+
+    if (valid) {
+        if (!its_rdbase_target(s, rdbase)) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: invalid target redistributor 0x%" PRIx64 "\n",
+                          __func__, rdbase);
+            return;
+        }
+        cte = ITS_CTE_VALID |
+            deposit64(0, ITS_CTE_RDBASE_SHIFT, ITS_CTE_RDBASE_LENGTH, rdbase);
+    }
+
+    if (!its_write_entry(s, ITS_BASER_COLLECTION, icid, cte)) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: no collection table entry for ICID 0x%x\n",
+                      __func__, icid);
+    }
+}
+
+static void its_cmd_mapti(GICv3ITSState *s, const uint64_t *cmd, bool mapi)
+{
+    uint32_t devid = extract64(cmd[0], 32, 32);
+    uint32_t eventid = extract64(cmd[1], 0, 32);
+    uint32_t intid = mapi ? eventid : extract64(cmd[1], 32, 32);
+    uint32_t icid = extract64(cmd[2], 0, 16);
+    uint64_t ite;
+    hwaddr addr;
+
+    if (intid < GICV3_LPI_INTID_START || intid >> (GICD_TYPER_IDBITS + 1)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: invalid LPI %u\n",
+                      __func__, intid);
+        return;
+    }
+    if (!its_ite_addr(s, devid, eventid, &addr)) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: DeviceID 0x%x EventID 0x%x not mappable\n",
+                      __func__, devid, eventid);
+        return;
+    }
+
+    ite = ITS_ITE_VALID |
+        deposit64(0, ITS_ITE_INTID_SHIFT, ITS_ITE_INTID_LENGTH, intid) |
+        deposit64(0, ITS_ITE_ICID_SHIFT, ITS_ITE_ICID_LENGTH, icid);
+    address_space_stq_le(its_as(s), addr, ite, MEMTXATTRS_UNSPECIFIED, NULL);
+}
+
+static void its_cmd_event(GICv3ITSState *s, const uint64_t *cmd, int cmdid)
+{
+    /* INT, CLEAR, DISCARD, INV and MOVI all act on one mapped event */
+    uint32_t devid = extract64(cmd[0], 32, 32);
+    uint32_t eventid = extract64(cmd[1], 0, 32);
+    GICv3CPUState *cs = NULL, *dest;
+    uint64_t ite;
+    hwaddr addr;
+
+    if (its_read_ite(s, devid, eventid, &ite)) {
+        cs = its_ite_target(s, ite);
+    }
+    if (!cs) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: command 0x%x for unmapped DeviceID 0x%x "
+                      "EventID 0x%x\n", __func__, cmdid, devid, eventid);
+        return;
+    }
+
+    switch (cmdid) {
+    case GITS_CMD_INT:
+        gicv3_redist_process_lpi(cs, its_ite_intid(ite), 1);
+        break;
+    case GITS_CMD_CLEAR:
+        gicv3_redist_process_lpi(cs, its_ite_intid(ite), 0);
+        break;
+    case GITS_CMD_DISCARD:
+        gicv3_redist_process_lpi(cs, its_ite_intid(ite), 0);
+        its_ite_addr(s, devid, eventid, &addr);
+        address_space_stq_le(its_as(s), addr, 0,
+                             MEMTXATTRS_UNSPECIFIED, NULL);
+        break;
+    case GITS_CMD_INV:
+        gicv3_redist_inv_lpi(cs, its_ite_intid(ite));
+        break;
+    case GITS_CMD_MOVI:
+    {
+        uint32_t icid = extract64(cmd[2], 0, 16);
+
+        dest = its_collection_target(s, icid);
+        if (!dest) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: MOVI to unmapped ICID 0x%x\n", __func__, icid);
+            return;
+        }
+        ite = deposit64(ite, ITS_ITE_ICID_SHIFT, ITS_ITE_ICID_LENGTH, icid);
+        its_ite_addr(s, devid, eventid, &addr);
+        address_space_stq_le(its_as(s), addr, ite,
+                             MEMTXATTRS_UNSPECIFIED, NULL);
+        gicv3_redist_mov_lpi(cs, dest, its_ite_intid(ite));
+        break;
+    }
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void its_process_cmd(GICv3ITSState *s, const uint64_t *cmd)
+{
+    int cmdid = extract64(cmd[0], 0, 8);
+    GICv3CPUState *cs, *dest;
+
+    trace_gicv3_its_cmd(cmdid, cmd[0], cmd[1], cmd[2], cmd[3]);
+
+    switch (cmdid) {
+    case GITS_CMD_MAPD:
+        its_cmd_mapd(s, cmd);
+        break;
+    case GITS_CMD_MAPC:
+        its_cmd_mapc(s, cmd);
+        break;
+    case GITS_CMD_MAPTI:
+        its_cmd_mapti(s, cmd, false);
+        break;
+    case GITS_CMD_MAPI:
+        its_cmd_mapti(s, cmd, true);
+        break;
+    case GITS_CMD_INT:
+    case GITS_CMD_CLEAR:
+    case GITS_CMD_DISCARD:
+    case GITS_CMD_INV:
+    case GITS_CMD_MOVI:
+        its_cmd_event(s, cmd, cmdid);
+        break;
+    case GITS_CMD_INVALL:
+        cs = its_collection_target(s, extract64(cmd[2], 0, 16));
+        if (cs) {
+            gicv3_redist_inv_all_lpis(cs);
+        }
+        break;
+    case GITS_CMD_MOVALL:
+        cs = its_rdbase_target(s, extract64(cmd[2], 16, 36));
+        dest = its_rdbase_target(s, extract64(cmd[3], 16, 36));
+        if (cs && dest) {
+            gicv3_redist_movall_lpis(cs, dest);
+        }
+        break;
+    case GITS_CMD_SYNC:
+        /* All our commands complete synchronously */
+        break;
+    default:
+        qemu_log_mask(LOG_UNIMP, "%s: unimplemented ITS command 0x%x\n",
+                      __func__, cmdid);
+        break;
+    }
+}
+
+static void its_process_cmdq(GICv3ITSState *s)
+{
+    /* Process commands from GITS_CREADR up to GITS_CWRITER */
+    uint64_t qsize = ((s->cbaser & GITS_CBASER_SIZE_MASK) + 1) * 4 * KiB;
+    hwaddr base = s->cbaser & GITS_CBASER_ADDR_MASK;
+
+    if (!(s->ctlr & GITS_CTLR_ENABLED) || !(s->cbaser & GITS_CBASER_VALID) ||
+        (s->creadr & GITS_CREADR_STALLED)) {
+        return;
+    }
+
+    if (s->cwriter >= qsize) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: GITS_CWRITER 0x%" PRIx64 " beyond command queue\n",
+                      __func__, s->cwriter);
+        return;
+    }
+
+    while (s->creadr != s->cwriter) {
+        uint64_t cmd[ITS_CMD_SIZE / 8];
+        MemTxResult res;
+        int i;
+
+        res = address_space_read(its_as(s), base + s->creadr,
+                                 MEMTXATTRS_UNSPECIFIED, cmd, sizeof(cmd));
+        if (res != MEMTX_OK) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: could not read command at 0x%" HWADDR_PRIx
+                          ", stalling\n", __func__, base + s->creadr);
+            trace_gicv3_its_cmdq_stall(s->creadr);
+            s->creadr |= GITS_CREADR_STALLED;
+            return;
+        }
+        for (i = 0; i < ARRAY_SIZE(cmd); i++) {
+            cmd[i] = le64_to_cpu(cmd[i]);
+        }
+        gicv3_lock(s->gicv3);
+        its_process_cmd(s, cmd);
+        gicv3_unlock(s->gicv3);
+
+        s->creadr = (s->creadr + ITS_CMD_SIZE) % qsize;
+    }
+}
+
+static int gicv3_its_send_msi(GICv3ITSState *s, uint32_t data, uint16_t devid)
+{
+    /* Translate a write of EventID @data to GITS_TRANSLATER by @devid */
+    GICv3CPUState *cs = NULL;
+    uint64_t ite;
+
+    if (!(s->ctlr & GITS_CTLR_ENABLED)) {
+        return -EIO;
+    }
+
+    if (its_read_ite(s, devid, data, &ite)) {
+        cs = its_ite_target(s, ite);
+    }
+    if (!cs) {
+        return -EINVAL;
+    }
+
+    trace_gicv3_its_translate(devid, data, its_ite_intid(ite),
+                              gicv3_redist_affid(cs));
+    gicv3_lock(s->gicv3);
+    gicv3_redist_process_lpi(cs, its_ite_intid(ite), 1);
+    gicv3_unlock(s->gicv3);
+    return 1;
+}
+
+static MemTxResult its_readll(GICv3ITSState *s, hwaddr offset,
+                              uint64_t *data)
+{
+    switch (offset) {
+    case GITS_TYPER:
+        *data = its_typer();
+        return MEMTX_OK;
+    case GITS_CBASER:
+        *data = s->cbaser;
+        return MEMTX_OK;
+    case GITS_CWRITER:
+        *data = s->cwriter;
+        return MEMTX_OK;
+    case GITS_CREADR:
+        *data = s->creadr;
+        return MEMTX_OK;
+    case GITS_BASER ... GITS_BASER + 0x3f:
+        *data = s->baser[(offset - GITS_BASER) / 8];
+        return MEMTX_OK;
+    default:
+        return MEMTX_ERROR;
+    }
+}
+
+static MemTxResult its_writell(GICv3ITSState *s, hwaddr offset,
+                               uint64_t value)
+{
+    switch (offset) {
+    case GITS_CBASER:
+        /* Writes while the ITS is enabled are UNPREDICTABLE; ignore them */
+        if (!(s->ctlr & GITS_CTLR_ENABLED)) {
+            s->cbaser = value & GITS_CBASER_RW_MASK;
+            s->creadr = 0;
+        }
+        return MEMTX_OK;
+    case GITS_CWRITER:
+        s->cwriter = value & GITS_CQ_OFFSET_MASK;
+        if (value & GITS_CWRITER_RETRY) {
+            s->creadr &= ~GITS_CREADR_STALLED;
+        }
+        its_process_cmdq(s);
+        return MEMTX_OK;
+    case GITS_BASER ... GITS_BASER + 0x3f:
+    {
+        int n = (offset - GITS_BASER) / 8;
+
+        /* Only the first two are implemented, the rest are RAZ/WI.
+         * Writes while the ITS is enabled are UNPREDICTABLE; ignore them.
+         */
+        if (n < ITS_BASER_NUM_TABLES && !(s->ctlr & GITS_CTLR_ENABLED)) {
+            s->baser[n] = (s->baser[n] & ~GITS_BASER_RW_MASK) |
+                (value & GITS_BASER_RW_MASK);
+        }
+        return MEMTX_OK;
+    }
+    case GITS_TYPER:
+    case GITS_CREADR:
+        /* RO registers, ignore the write */
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: invalid guest write to RO register at offset "
+                      TARGET_FMT_plx "\n", __func__, offset);
+        return MEMTX_OK;
+    default:
+        return MEMTX_ERROR;
+    }
+}
+
+static MemTxResult its_readl(GICv3ITSState *s, hwaddr offset,
+                             uint64_t *data)
+{
+    uint64_t value;
+    MemTxResult r;
+
+    switch (offset) {
+    case GITS_CTLR:
+        *data = s->ctlr | GITS_CTLR_QUIESCENT;
+        return MEMTX_OK;
+    case GITS_IIDR:
+        *data = s->iidr;
+        return MEMTX_OK;
+    case GITS_IDREGS ... GITS_IDREGS + 0x2f:
+        *data = gicv3_idreg(offset - GITS_IDREGS);
+        return MEMTX_OK;
+    default:
+        /* The remaining registers are 64 bits wide */
+        r = its_readll(s, offset & ~7ULL, &value);
+        if (r == MEMTX_OK) {
+            *data = extract64(value, (offset & 4) * 8, 32);
+        }
+        return r;
+    }
+}
+
+static MemTxResult its_writel(GICv3ITSState *s, hwaddr offset,
+                              uint64_t value)
+{
+    uint64_t old;
+
+    switch (offset) {
+    case GITS_CTLR:
+        if (value & GITS_CTLR_ENABLED) {
+            s->ctlr |= GITS_CTLR_ENABLED;
+            its_process_cmdq(s);
+        } else {
+            s->ctlr &= ~GITS_CTLR_ENABLED;
+        }
+        return MEMTX_OK;
+    case GITS_IIDR:
+    case GITS_IDREGS ... GITS_IDREGS + 0x2f:
+        /* RO registers, ignore the write */
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: invalid guest write to RO register at offset "
+                      TARGET_FMT_plx "\n", __func__, offset);
+        return MEMTX_OK;
+    default:
+        /* The remaining registers are 64 bits wide */
+        if (its_readll(s, offset & ~7ULL, &old) != MEMTX_OK) {
+            return MEMTX_ERROR;
+        }
+        return its_writell(s, offset & ~7ULL,
+                           deposit64(old, (offset & 4) * 8, 32, value));
+    }
+}
+
+static MemTxResult gicv3_its_read(void *opaque, hwaddr offset, uint64_t *data,
+                                  unsigned size, MemTxAttrs attrs)
+{
+    GICv3ITSState *s = opaque;
+    MemTxResult r;
+
+    switch (size) {
+    case 4:
+        r = its_readl(s, offset, data);
+        break;
+    case 8:
+        r = its_readll(s, offset, data);
+        break;
+    default:
+        r = MEMTX_ERROR;
+        break;
+    }
+
+    if (r == MEMTX_ERROR) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: invalid guest read at offset " TARGET_FMT_plx
+                      " size %u\n", __func__, offset, size);
+        trace_gicv3_its_badread(offset, size);
+        /* As for the GIC, reserved registers are RAZ/WI */
+        r = MEMTX_OK;
+        *data = 0;
+    } else {
+        trace_gicv3_its_read(offset, *data, size);
+    }
+    return r;
+}
+
+static MemTxResult gicv3_its_write(void *opaque, hwaddr offset, uint64_t data,
+                                   unsigned size, MemTxAttrs attrs)
+{
+    GICv3ITSState *s = opaque;
+    MemTxResult r;
+
+    switch (size) {
+    case 4:
+        r = its_writel(s, offset, data);
+        break;
+    case 8:
+        r = its_writell(s, offset, data);
+        break;
+    default:
+        r = MEMTX_ERROR;
+        break;
+    }
+
+    if (r == MEMTX_ERROR) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: invalid guest write at offset " TARGET_FMT_plx
+                      " size %u\n", __func__, offset, size);
+        trace_gicv3_its_badwrite(offset, data, size);
+        r = MEMTX_OK;
+    } else {
+        trace_gicv3_its_write(offset, data, size);
+    }
+    return r;
+}
+
+static const MemoryRegionOps gicv3_its_control_ops = {
+    .read_with_attrs = gicv3_its_read,
+    .write_with_attrs = gicv3_its_write,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 8,
+    .impl.min_access_size = 4,
+    .impl.max_access_size = 8,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+};
+
+static void gicv3_arm_its_realize(DeviceState *dev, Error **errp)
+{
+    GICv3ITSState *s = ARM_GICV3_ITS_COMMON(dev);
+
+    if (!s->gicv3) {
+        error_setg(errp, "parent-gicv3 link not set");
+        return;
+    }
+    if (!s->gicv3->lpi_enable) {
+        error_setg(errp, "the GICv3 must be configured with has-lpi=on "
+                   "to be used with an ITS");
+        return;
+    }
+
+    gicv3_its_init_mmio(s, &gicv3_its_control_ops);
+}
+
+static void gicv3_its_reset(DeviceState *dev)
+{
+    GICv3ITSState *s = ARM_GICV3_ITS_COMMON(dev);
+    GICv3ITSClass *c = ARM_GICV3_ITS_GET_CLASS(s);
+
+    c->parent_reset(dev);
+
+    s->iidr = gicv3_iidr();
+    s->baser[ITS_BASER_DEVICE] =
+        (GITS_BASER_TYPE_DEVICE << GITS_BASER_TYPE_SHIFT) |
+        ((uint64_t)(ITS_ENTRY_SIZE - 1) << GITS_BASER_ENTRY_SIZE_SHIFT);
+    s->baser[ITS_BASER_COLLECTION] =
+        (GITS_BASER_TYPE_COLLECTION << GITS_BASER_TYPE_SHIFT) |
+        ((uint64_t)(ITS_ENTRY_SIZE - 1) << GITS_BASER_ENTRY_SIZE_SHIFT);
+}
+
+static Property gicv3_its_props[] = {
+    DEFINE_PROP_LINK("parent-gicv3", GICv3ITSState, gicv3, TYPE_ARM_GICV3,
+                     GICv3State *),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void gicv3_its_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    GICv3ITSCommonClass *icc = ARM_GICV3_ITS_COMMON_CLASS(klass);
+    GICv3ITSClass *ic = ARM_GICV3_ITS_CLASS(klass);
+
+    dc->realize = gicv3_arm_its_realize;
+    device_class_set_props(dc, gicv3_its_props);
+    device_class_set_parent_reset(dc, gicv3_its_reset, &ic->parent_reset);
+    icc->send_msi = gicv3_its_send_msi;
+}
+
+static const TypeInfo gicv3_its_info = {
+    .name = TYPE_ARM_GICV3_ITS,
+    .parent = TYPE_ARM_GICV3_ITS_COMMON,
+    .instance_size = sizeof(GICv3ITSState),
+    .class_init = gicv3_its_class_init,
+    .class_size = sizeof(GICv3ITSClass),
+};
+
+static void gicv3_its_register_types(void)
+{
+    type_register_static(&gicv3_its_info);
+}
+
+type_init(gicv3_its_register_types)
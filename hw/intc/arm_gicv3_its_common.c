@@ -77,7 +77,7 @@ static MemTxResult gicv3_its_trans_write(void *opaque, hwaddr offset,
                                          uint64_t value, unsigned size,
                                          MemTxAttrs attrs)
 {
-    if (offset == 0x0040 && ((size == 2) || (size == 4))) {
+    if (offset == GITS_TRANSLATER && ((size == 2) || (size == 4))) {
         GICv3ITSState *s = ARM_GICV3_ITS_COMMON(opaque);
         GICv3ITSCommonClass *c = ARM_GICV3_ITS_COMMON_GET_CLASS(s);
         int ret = c->send_msi(s, le64_to_cpu(value), attrs.requester_id);
@@ -11,6 +11,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/log.h"
+#include "qemu/bitmap.h"
 #include "trace.h"
 #include "gicv3_internal.h"
 
@@ -100,6 +101,145 @@ static void gicr_write_ipriorityr(GICv3CPUState *cs, MemTxAttrs attrs, int irq,
     cs->gicr_ipriorityr[irq] = value;
 }
 
+static uint32_t gicr_lpi_nr(GICv3CPUState *cs)
+{
+    /* Return the number of LPIs covered by the LPI configuration table,
+     * which is limited by both GICR_PROPBASER.IDbits and our own
+     * GICD_TYPER.IDbits.
+     */
+    int idbits = MIN(cs->gicr_propbaser & GICR_PROPBASER_IDBITS_MASK,
+                     GICD_TYPER_IDBITS);
+
+    if ((1U << (idbits + 1)) <= GICV3_LPI_INTID_START) {
+        return 0;
+    }
+    return (1U << (idbits + 1)) - GICV3_LPI_INTID_START;
+}
+
+static hwaddr gicr_lpi_cfg_addr(GICv3CPUState *cs, int lpi)
+{
+    /* The configuration table has no entries for non-LPI interrupt IDs */
+    return (cs->gicr_propbaser & GICR_PROPBASER_ADDR_MASK) + lpi;
+}
+
+static hwaddr gicr_lpi_pending_addr(GICv3CPUState *cs, int lpi)
+{
+    /* The pending table has a bit for every interrupt ID; the first
+     * 1KB, which covers the non-LPI interrupt IDs, is IMPDEF.
+     */
+    return (cs->gicr_pendbaser & GICR_PENDBASER_ADDR_MASK) +
+        (GICV3_LPI_INTID_START + lpi) / 8;
+}
+
+static void gicr_update_hpplpi(GICv3CPUState *cs)
+{
+    /* Recalculate the highest priority pending enabled LPI from scratch */
+    unsigned long lpi;
+
+    cs->hpplpi.prio = 0xff;
+
+    for (lpi = find_first_bit(cs->lpi_pending, cs->lpi_nr);
+         lpi < cs->lpi_nr;
+         lpi = find_next_bit(cs->lpi_pending, cs->lpi_nr, lpi + 1)) {
+        uint8_t cfg = cs->lpi_cfg[lpi];
+
+        /* Strictly better only, so that on equal priorities we keep the
+         * lowest interrupt number, as for the other interrupts.
+         */
+        if ((cfg & LPI_CTE_ENABLED) &&
+            (cfg & LPI_PRIORITY_MASK) < cs->hpplpi.prio) {
+            cs->hpplpi.irq = lpi + GICV3_LPI_INTID_START;
+            cs->hpplpi.prio = cfg & LPI_PRIORITY_MASK;
+            cs->hpplpi.grp = GICV3_G1NS;
+        }
+    }
+}
+
+static void gicr_lpi_cache_free(GICv3CPUState *cs)
+{
+    g_free(cs->lpi_cfg);
+    cs->lpi_cfg = NULL;
+    g_free(cs->lpi_pending);
+    cs->lpi_pending = NULL;
+    cs->lpi_nr = 0;
+    cs->hpplpi.prio = 0xff;
+}
+
+static void gicr_lpi_cache_load(GICv3CPUState *cs, bool load_pending)
+{
+    /* Fill the LPI cache from the tables in guest memory. If @load_pending
+     * is false the pending table is known to be all zeroes.
+     */
+    AddressSpace *as = &cs->gic->dma_as;
+
+    gicr_lpi_cache_free(cs);
+
+    cs->lpi_nr = gicr_lpi_nr(cs);
+    if (!cs->lpi_nr) {
+        return;
+    }
+
+    cs->lpi_cfg = g_malloc(cs->lpi_nr);
+    cs->lpi_pending = bitmap_new(cs->lpi_nr);
+
+    address_space_read(as, gicr_lpi_cfg_addr(cs, 0), MEMTXATTRS_UNSPECIFIED,
+                       cs->lpi_cfg, cs->lpi_nr);
+    if (load_pending) {
+        unsigned long *buf = bitmap_new(cs->lpi_nr);
+
+        address_space_read(as, gicr_lpi_pending_addr(cs, 0),
+                           MEMTXATTRS_UNSPECIFIED, buf, cs->lpi_nr / 8);
+        bitmap_from_le(cs->lpi_pending, buf, cs->lpi_nr);
+        g_free(buf);
+    }
+
+    gicr_update_hpplpi(cs);
+}
+
+static void gicr_lpi_cache_flush(GICv3CPUState *cs)
+{
+    /* Write the cached pending state back to the pending table in guest
+     * memory. We don't write it through as LPIs change state, because
+     * acknowledging an LPI happens without the BQL and must not go to
+     * guest memory, which might not be RAM.
+     */
+    unsigned long *buf;
+
+    if (!cs->lpi_nr) {
+        return;
+    }
+
+    buf = bitmap_new(cs->lpi_nr);
+    bitmap_to_le(buf, cs->lpi_pending, cs->lpi_nr);
+    address_space_write(&cs->gic->dma_as, gicr_lpi_pending_addr(cs, 0),
+                        MEMTXATTRS_UNSPECIFIED, buf, cs->lpi_nr / 8);
+    g_free(buf);
+}
+
+static void gicr_write_ctlr_enable_lpis(GICv3CPUState *cs, bool enable)
+{
+    if (enable == !!(cs->gicr_ctlr & GICR_CTLR_ENABLE_LPIS)) {
+        return;
+    }
+
+    trace_gicv3_redist_enable_lpis(gicv3_redist_affid(cs), enable);
+
+    if (enable) {
+        cs->gicr_ctlr |= GICR_CTLR_ENABLE_LPIS;
+        gicr_lpi_cache_load(cs, !(cs->gicr_pendbaser & GICR_PENDBASER_PTZ));
+        /* PTZ only describes the table at the time LPIs are enabled */
+        cs->gicr_pendbaser &= ~GICR_PENDBASER_PTZ;
+    } else {
+        /* We allow LPIs to be disabled again, leaving their pending
+         * state in the pending table.
+         */
+        gicr_lpi_cache_flush(cs);
+        cs->gicr_ctlr &= ~GICR_CTLR_ENABLE_LPIS;
+        gicr_lpi_cache_free(cs);
+    }
+    gicv3_redist_update(cs);
+}
+
 static MemTxResult gicr_readb(GICv3CPUState *cs, hwaddr offset,
                               uint64_t *data, MemTxAttrs attrs)
 {
@@ -160,7 +300,7 @@ static MemTxResult gicr_readl(GICv3CPUState *cs, hwaddr offset,
         *data = extract64(cs->gicr_pendbaser, 0, 32);
         return MEMTX_OK;
     case GICR_PENDBASER + 4:
-        *data = extract64(cs->gicr_pendbaser, 32, 32);
+        *data = extract64(cs->gicr_pendbaser & ~GICR_PENDBASER_PTZ, 32, 32);
         return MEMTX_OK;
     case GICR_IGROUPR0:
         if (!attrs.secure && !(cs->gic->gicd_ctlr & GICD_CTLR_DS)) {
@@ -248,10 +388,13 @@ static MemTxResult gicr_writel(GICv3CPUState *cs, hwaddr offset,
     case GICR_CTLR:
         /* For our implementation, GICR_TYPER.DPGS is 0 and so all
          * the DPG bits are RAZ/WI. We don't do anything asynchronously,
-         * so UWP and RWP are RAZ/WI. And GICR_TYPER.LPIS is 0 (we don't
-         * implement LPIs) so Enable_LPIs is RES0. So there are no writable
-         * bits for us.
+         * so UWP and RWP are RAZ/WI. Enable_LPIs is the only writable
+         * bit, and only if we implement LPIs (GICR_TYPER.PLPIS == 1);
+         * otherwise it is RES0.
          */
+        if (cs->gic->lpi_enable) {
+            gicr_write_ctlr_enable_lpis(cs, value & GICR_CTLR_ENABLE_LPIS);
+        }
         return MEMTX_OK;
     case GICR_STATUSR:
         /* RAZ/WI for our implementation */
@@ -275,17 +418,21 @@ static MemTxResult gicr_writel(GICv3CPUState *cs, hwaddr offset,
         cs->gicr_waker = value;
         return MEMTX_OK;
     case GICR_PROPBASER:
-        cs->gicr_propbaser = deposit64(cs->gicr_propbaser, 0, 32, value);
-        return MEMTX_OK;
     case GICR_PROPBASER + 4:
-        cs->gicr_propbaser = deposit64(cs->gicr_propbaser, 32, 32, value);
-        return MEMTX_OK;
     case GICR_PENDBASER:
-        cs->gicr_pendbaser = deposit64(cs->gicr_pendbaser, 0, 32, value);
-        return MEMTX_OK;
     case GICR_PENDBASER + 4:
-        cs->gicr_pendbaser = deposit64(cs->gicr_pendbaser, 32, 32, value);
+    {
+        /* Changing the table addresses while LPIs are enabled is
+         * UNPREDICTABLE; we choose to ignore the write.
+         */
+        uint64_t *reg = offset < GICR_PENDBASER ? &cs->gicr_propbaser
+                                                : &cs->gicr_pendbaser;
+
+        if (!(cs->gicr_ctlr & GICR_CTLR_ENABLE_LPIS)) {
+            *reg = deposit64(*reg, (offset & 4) * 8, 32, value);
+        }
         return MEMTX_OK;
+    }
     case GICR_IGROUPR0:
         if (!attrs.secure && !(cs->gic->gicd_ctlr & GICD_CTLR_DS)) {
             return MEMTX_OK;
@@ -385,7 +532,7 @@ static MemTxResult gicr_readll(GICv3CPUState *cs, hwaddr offset,
         *data = cs->gicr_propbaser;
         return MEMTX_OK;
     case GICR_PENDBASER:
-        *data = cs->gicr_pendbaser;
+        *data = cs->gicr_pendbaser & ~GICR_PENDBASER_PTZ;
         return MEMTX_OK;
     default:
         return MEMTX_ERROR;
@@ -397,10 +544,14 @@ static MemTxResult gicr_writell(GICv3CPUState *cs, hwaddr offset,
 {
     switch (offset) {
     case GICR_PROPBASER:
-        cs->gicr_propbaser = value;
+        if (!(cs->gicr_ctlr & GICR_CTLR_ENABLE_LPIS)) {
+            cs->gicr_propbaser = value;
+        }
         return MEMTX_OK;
     case GICR_PENDBASER:
-        cs->gicr_pendbaser = value;
+        if (!(cs->gicr_ctlr & GICR_CTLR_ENABLE_LPIS)) {
+            cs->gicr_pendbaser = value;
+        }
         return MEMTX_OK;
     case GICR_TYPER:
         /* RO register, ignore the write */
@@ -435,6 +586,7 @@ MemTxResult gicv3_redist_read(void *opaque, hwaddr offset, uint64_t *data,
 
     cs = &s->cpu[cpuidx];
 
+    gicv3_lock(s);
     switch (size) {
     case 1:
         r = gicr_readb(cs, offset, data, attrs);
@@ -449,6 +601,7 @@ MemTxResult gicv3_redist_read(void *opaque, hwaddr offset, uint64_t *data,
         r = MEMTX_ERROR;
         break;
     }
+    gicv3_unlock(s);
 
     if (r == MEMTX_ERROR) {
         qemu_log_mask(LOG_GUEST_ERROR,
@@ -492,6 +645,7 @@ MemTxResult gicv3_redist_write(void *opaque, hwaddr offset, uint64_t data,
 
     cs = &s->cpu[cpuidx];
 
+    gicv3_lock(s);
     switch (size) {
     case 1:
         r = gicr_writeb(cs, offset, data, attrs);
@@ -506,6 +660,7 @@ MemTxResult gicv3_redist_write(void *opaque, hwaddr offset, uint64_t data,
         r = MEMTX_ERROR;
         break;
     }
+    gicv3_unlock(s);
 
     if (r == MEMTX_ERROR) {
         qemu_log_mask(LOG_GUEST_ERROR,
@@ -579,3 +734,127 @@ void gicv3_redist_send_sgi(GICv3CPUState *cs, int grp, int irq, bool ns)
     cs->gicr_ipendr0 = deposit32(cs->gicr_ipendr0, irq, 1, 1);
     gicv3_redist_update(cs);
 }
+
+void gicv3_redist_process_lpi(GICv3CPUState *cs, int irq, int level)
+{
+    /* Update redistributor state for a change in the pending state of
+     * an LPI: set by the ITS or cleared by acknowledging it.
+     */
+    int lpi = irq - GICV3_LPI_INTID_START;
+    uint8_t cfg, prio;
+
+    if (!(cs->gicr_ctlr & GICR_CTLR_ENABLE_LPIS) ||
+        lpi < 0 || lpi >= cs->lpi_nr) {
+        /* LPIs outside the configured range are never made pending */
+        return;
+    }
+
+    if (level == test_bit(lpi, cs->lpi_pending)) {
+        return;
+    }
+
+    trace_gicv3_redist_process_lpi(gicv3_redist_affid(cs), irq, level);
+
+    if (level) {
+        set_bit(lpi, cs->lpi_pending);
+    } else {
+        clear_bit(lpi, cs->lpi_pending);
+    }
+
+    cfg = cs->lpi_cfg[lpi];
+    prio = cfg & LPI_PRIORITY_MASK;
+    if (level) {
+        /* A newly pending LPI can only ever become the best one */
+        if ((cfg & LPI_CTE_ENABLED) &&
+            (prio < cs->hpplpi.prio ||
+             (prio == cs->hpplpi.prio && irq < cs->hpplpi.irq))) {
+            cs->hpplpi.irq = irq;
+            cs->hpplpi.prio = prio;
+            cs->hpplpi.grp = GICV3_G1NS;
+        }
+    } else if (cs->hpplpi.prio != 0xff && cs->hpplpi.irq == irq) {
+        gicr_update_hpplpi(cs);
+    }
+
+    gicv3_redist_update(cs);
+}
+
+void gicv3_redist_inv_lpi(GICv3CPUState *cs, int irq)
+{
+    int lpi = irq - GICV3_LPI_INTID_START;
+    uint8_t cfg;
+
+    if (!(cs->gicr_ctlr & GICR_CTLR_ENABLE_LPIS) ||
+        lpi < 0 || lpi >= cs->lpi_nr) {
+        return;
+    }
+
+    cfg = address_space_ldub(&cs->gic->dma_as, gicr_lpi_cfg_addr(cs, lpi),
+                             MEMTXATTRS_UNSPECIFIED, NULL);
+    if (cfg == cs->lpi_cfg[lpi]) {
+        return;
+    }
+    cs->lpi_cfg[lpi] = cfg;
+
+    /* The configuration of a non-pending LPI doesn't affect anything yet */
+    if (test_bit(lpi, cs->lpi_pending)) {
+        gicr_update_hpplpi(cs);
+        gicv3_redist_update(cs);
+    }
+}
+
+void gicv3_redist_inv_all_lpis(GICv3CPUState *cs)
+{
+    if (!(cs->gicr_ctlr & GICR_CTLR_ENABLE_LPIS) || !cs->lpi_nr) {
+        return;
+    }
+
+    address_space_read(&cs->gic->dma_as, gicr_lpi_cfg_addr(cs, 0),
+                       MEMTXATTRS_UNSPECIFIED, cs->lpi_cfg, cs->lpi_nr);
+    gicr_update_hpplpi(cs);
+    gicv3_redist_update(cs);
+}
+
+void gicv3_redist_mov_lpi(GICv3CPUState *src, GICv3CPUState *dest, int irq)
+{
+    int lpi = irq - GICV3_LPI_INTID_START;
+
+    if (src == dest || !(src->gicr_ctlr & GICR_CTLR_ENABLE_LPIS) ||
+        lpi < 0 || lpi >= src->lpi_nr || !test_bit(lpi, src->lpi_pending)) {
+        return;
+    }
+
+    gicv3_redist_process_lpi(src, irq, 0);
+    gicv3_redist_process_lpi(dest, irq, 1);
+}
+
+void gicv3_redist_movall_lpis(GICv3CPUState *src, GICv3CPUState *dest)
+{
+    unsigned long lpi;
+
+    if (src == dest || !(src->gicr_ctlr & GICR_CTLR_ENABLE_LPIS)) {
+        return;
+    }
+
+    for (lpi = find_first_bit(src->lpi_pending, src->lpi_nr);
+         lpi < src->lpi_nr;
+         lpi = find_next_bit(src->lpi_pending, src->lpi_nr, lpi + 1)) {
+        gicv3_redist_mov_lpi(src, dest, lpi + GICV3_LPI_INTID_START);
+    }
+}
+
+void gicv3_redist_lpi_post_load(GICv3CPUState *cs)
+{
+    if (cs->gicr_ctlr & GICR_CTLR_ENABLE_LPIS) {
+        gicr_lpi_cache_load(cs, true);
+    } else {
+        gicr_lpi_cache_free(cs);
+    }
+}
+
+void gicv3_redist_lpi_flush(GICv3CPUState *cs)
+{
+    if (cs->gicr_ctlr & GICR_CTLR_ENABLE_LPIS) {
+        gicr_lpi_cache_flush(cs);
+    }
+}
@@ -67,6 +67,10 @@
 #define GICD_CTLR_E1NWF             (1U << 7)
 #define GICD_CTLR_RWP               (1U << 31)
 
+/* GICD_TYPER fields */
+#define GICD_TYPER_IDBITS           0xf  /* 16 bit interrupt identifiers */
+#define GICD_TYPER_LPIS             (1U << 17)
+
 /*
  * Redistributor frame offsets from RD_base
  */
@@ -134,6 +138,10 @@
 #define GICR_PENDBASER_SHAREABILITY_MASK       (3U << 10)
 #define GICR_PENDBASER_CACHEABILITY_MASK       (7U << 7)
 
+/* Fields of an LPI configuration table entry */
+#define LPI_CTE_ENABLED          (1U << 0)
+#define LPI_PRIORITY_MASK        0xfc
+
 #define ICC_CTLR_EL1_CBPR           (1U << 0)
 #define ICC_CTLR_EL1_EOIMODE        (1U << 1)
 #define ICC_CTLR_EL1_PMHE           (1U << 6)
@@ -246,6 +254,30 @@
 
 /* Functions internal to the emulated GICv3 */
 
+/**
+ * gicv3_lock:
+ * @s: GICv3State
+ *
+ * Take the lock protecting the emulated GIC's state. The lock may be
+ * taken with or without the BQL held, but the BQL must not be taken
+ * while holding it. It is recursive, so that the GIC can be re-entered
+ * via an access to guest memory or an interrupt line.
+ */
+static inline void gicv3_lock(GICv3State *s)
+{
+    qemu_rec_mutex_lock(&s->lock);
+}
+
+/**
+ * gicv3_unlock:
+ * @s: GICv3State
+ *
+ * Drop the GIC lock, and then tell the CPUs about any changes to their
+ * interrupt lines that were made while it was held. This takes the BQL
+ * if it isn't already held, but only if some line actually changed.
+ */
+void gicv3_unlock(GICv3State *s);
+
 /**
  * gicv3_redist_update:
  * @cs: GICv3CPUState for this redistributor
@@ -299,6 +331,72 @@ void gicv3_redist_set_irq(GICv3CPUState *cs, int irq, int level);
 void gicv3_redist_send_sgi(GICv3CPUState *cs, int grp, int irq, bool ns);
 void gicv3_init_cpuif(GICv3State *s);
 
+/**
+ * gicv3_redist_process_lpi:
+ * @cs: GICv3CPUState for the target redistributor
+ * @irq: LPI interrupt ID
+ * @level: new pending state of the LPI
+ *
+ * Set or clear the pending state of an LPI, for instance because the ITS
+ * translated an MSI to it or because the CPU acknowledged it. Requests
+ * for LPIs which are out of range or when LPIs are disabled are ignored.
+ */
+void gicv3_redist_process_lpi(GICv3CPUState *cs, int irq, int level);
+
+/**
+ * gicv3_redist_inv_lpi:
+ * @cs: GICv3CPUState for the redistributor
+ * @irq: LPI interrupt ID
+ *
+ * Reload the configuration of @irq from the LPI configuration table.
+ */
+void gicv3_redist_inv_lpi(GICv3CPUState *cs, int irq);
+
+/**
+ * gicv3_redist_inv_all_lpis:
+ * @cs: GICv3CPUState for the redistributor
+ *
+ * Reload the configuration of all LPIs from the LPI configuration table.
+ */
+void gicv3_redist_inv_all_lpis(GICv3CPUState *cs);
+
+/**
+ * gicv3_redist_mov_lpi:
+ * @src: GICv3CPUState for the redistributor the LPI currently targets
+ * @dest: GICv3CPUState for the redistributor the LPI is moved to
+ * @irq: LPI interrupt ID
+ *
+ * Move the pending state of an LPI from one redistributor to another.
+ */
+void gicv3_redist_mov_lpi(GICv3CPUState *src, GICv3CPUState *dest, int irq);
+
+/**
+ * gicv3_redist_movall_lpis:
+ * @src: GICv3CPUState for the redistributor the LPIs currently target
+ * @dest: GICv3CPUState for the redistributor the LPIs are moved to
+ *
+ * Move the pending state of all LPIs from one redistributor to another.
+ */
+void gicv3_redist_movall_lpis(GICv3CPUState *src, GICv3CPUState *dest);
+
+/**
+ * gicv3_redist_lpi_post_load:
+ * @cs: GICv3CPUState for the redistributor
+ *
+ * Rebuild the cached LPI state from guest memory after an incoming
+ * migration has loaded new register state.
+ */
+void gicv3_redist_lpi_post_load(GICv3CPUState *cs);
+
+/**
+ * gicv3_redist_lpi_flush:
+ * @cs: GICv3CPUState for the redistributor
+ *
+ * Write the cached LPI pending state back to the pending table in
+ * guest memory, e.g. before the VM's memory is saved.
+ */
+void gicv3_redist_lpi_flush(GICv3CPUState *cs);
+
 /**
  * gicv3_cpuif_update:
  * @cs: GICv3CPUState for the CPU to update
@@ -306,7 +404,8 @@ void gicv3_init_cpuif(GICv3State *s);
  * Recalculate whether to assert the IRQ or FIQ lines after a change
  * to the current highest priority pending interrupt, the CPU's
  * current running priority or the CPU's current exception level or
- * security state.
+ * security state. Must be called with the GIC lock held; the lines
+ * are updated by gicv3_unlock().
  */
 void gicv3_cpuif_update(GICv3CPUState *cs);
 
@@ -344,6 +443,10 @@ static inline int gicv3_irq_group(GICv3State *s, GICv3CPUState *cs, int irq)
 {
     bool grpbit, grpmodbit;
 
+    if (irq >= GICV3_LPI_INTID_START) {
+        /* LPIs are always Non-secure Group 1 */
+        return GICV3_G1NS;
+    }
     if (irq < GIC_INTERNAL) {
         grpbit = extract32(cs->gicr_igroupr0, irq, 1);
         grpmodbit = extract32(cs->gicr_igrpmodr0, irq, 1);
@@ -19,6 +19,7 @@
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
 #include "net/checksum.h"
+#include "net/gso.h"
 #include "net/tap.h"
 #include "qemu/error-report.h"
 #include "qemu/timer.h"
@@ -44,6 +45,7 @@
 #include "hw/pci/pci.h"
 #include "net_rx_pkt.h"
 #include "hw/virtio/vhost.h"
+#include "block/aio-wait.h"
 
 #define VIRTIO_NET_VM_VERSION    11
 
@@ -54,6 +56,12 @@
 #define VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE 256
 #define VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE 256
 
+/*
+ * Scatter-gather entries per pooled virtqueue element: enough for a 64k
+ * packet in 4k pages plus the virtio-net header.
+ */
+#define VIRTIO_NET_ELEM_POOL_MAX_SG 20
+
 /* for now, only allow larger queues; with virtio-1, guest can downsize */
 #define VIRTIO_NET_RX_QUEUE_MIN_SIZE VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE
 #define VIRTIO_NET_TX_QUEUE_MIN_SIZE VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE
@@ -156,6 +164,28 @@ static void virtio_net_get_config(VirtIODevice *vdev, uint8_t *config)
     }
 }
 
+/*
+ * Keep the IOThreads away from the queues while the main loop changes
+ * state that the datapath uses, for example the receive filter.
+ */
+static void virtio_net_dataplane_acquire(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < n->net_conf.num_iothreads; i++) {
+        aio_context_acquire(iothread_get_aio_context(n->iothreads[i]));
+    }
+}
+
+static void virtio_net_dataplane_release(VirtIONet *n)
+{
+    int i;
+
+    for (i = n->net_conf.num_iothreads - 1; i >= 0; i--) {
+        aio_context_release(iothread_get_aio_context(n->iothreads[i]));
+    }
+}
+
 static void virtio_net_set_config(VirtIODevice *vdev, const uint8_t *config)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -167,7 +197,9 @@ static void virtio_net_set_config(VirtIODevice *vdev, const uint8_t *config)
     if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_CTRL_MAC_ADDR) &&
         !virtio_vdev_has_feature(vdev, VIRTIO_F_VERSION_1) &&
         memcmp(netcfg.mac, n->mac, ETH_ALEN)) {
+        virtio_net_dataplane_acquire(n);
         memcpy(n->mac, netcfg.mac, ETH_ALEN);
+        virtio_net_dataplane_release(n);
         qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
     }
 
@@ -338,14 +370,28 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
+/* Queues that run in an IOThread interrupt the guest through irqfds */
+static void virtio_net_notify(VirtIONet *n, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    if (n->dataplane_started) {
+        virtio_notify_irqfd(vdev, vq);
+    } else {
+        virtio_notify(vdev, vq);
+    }
+}
+
 static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify(VIRTIO_NET(vdev), vq);
     }
 }
 
+static void virtio_net_dataplane_status(VirtIONet *n, uint8_t status);
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -355,6 +401,12 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
+    virtio_net_dataplane_status(n, status);
+
+    /* The IOThreads look after the queues themselves */
+    if (n->dataplane_started) {
+        return;
+    }
 
     for (i = 0; i < n->max_queues; i++) {
         NetClientState *ncs = qemu_get_subqueue(n->nic, i);
@@ -710,20 +762,23 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
     virtio_add_feature(&features, VIRTIO_NET_F_MAC);
 
     if (!peer_has_vnet_hdr(n)) {
-        virtio_clear_feature(&features, VIRTIO_NET_F_CSUM);
-        virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO4);
-        virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO6);
-        virtio_clear_feature(&features, VIRTIO_NET_F_HOST_ECN);
+        /* Transmit offloads can be done in software, see net/gso.c */
+        if (!n->sw_offload) {
+            virtio_clear_feature(&features, VIRTIO_NET_F_CSUM);
+            virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO4);
+            virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO6);
+            virtio_clear_feature(&features, VIRTIO_NET_F_HOST_ECN);
+            virtio_clear_feature(&features, VIRTIO_NET_F_HOST_UFO);
+        }
 
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_CSUM);
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO4);
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO6);
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_ECN);
+        virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_UFO);
 
         virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
-    }
-
-    if (!peer_has_vnet_hdr(n) || !peer_has_ufo(n)) {
+    } else if (!peer_has_ufo(n)) {
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_UFO);
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_UFO);
     }
@@ -1375,6 +1430,7 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         iov2 = iov = g_memdup(elem->out_sg, sizeof(struct iovec) * elem->out_num);
         s = iov_to_buf(iov, iov_cnt, 0, &ctrl, sizeof(ctrl));
         iov_discard_front(&iov, &iov_cnt, sizeof(ctrl));
+        virtio_net_dataplane_acquire(n);
         if (s != sizeof(ctrl)) {
             status = VIRTIO_NET_ERR;
         } else if (ctrl.class == VIRTIO_NET_CTRL_RX) {
@@ -1390,6 +1446,7 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         } else if (ctrl.class == VIRTIO_NET_CTRL_GUEST_OFFLOADS) {
             status = virtio_net_handle_offloads(n, ctrl.cmd, iov, iov_cnt);
         }
+        virtio_net_dataplane_release(n);
 
         s = iov_from_buf(elem->in_sg, elem->in_num, 0, &status, sizeof(status));
         assert(s == sizeof(status));
@@ -1615,7 +1672,7 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     unsigned int index = nc->queue_index, new_index = index;
-    struct NetRxPkt *pkt = n->rx_pkt;
+    struct NetRxPkt *pkt = virtio_net_get_subqueue(nc)->rx_pkt;
     uint8_t net_hash_type;
     uint32_t hash;
     bool isip4, isip6, isudp, istcp;
@@ -1663,6 +1720,39 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
     return (index == new_index) ? -1 : new_index;
 }
 
+typedef struct VirtIONetRxSteered {
+    QSLIST_ENTRY(VirtIONetRxSteered) next;
+    size_t size;
+    uint8_t buf[];
+} VirtIONetRxSteered;
+
+/*
+ * Hand a packet over to the IOThread of @q, whose queue cannot be touched
+ * from here.  Packets are dropped when too many are in flight, or later if
+ * the guest has not posted receive buffers; there is no way to push back
+ * on the sender as in qemu_flush_queued_packets().
+ */
+static ssize_t virtio_net_rx_steer(VirtIONetQueue *q, const uint8_t *buf,
+                                   size_t size)
+{
+    VirtIONetRxSteered *pkt;
+
+    if (qatomic_fetch_inc(&q->rx_steered_count) >=
+        q->n->net_conf.rx_queue_size) {
+        qatomic_dec(&q->rx_steered_count);
+        trace_virtio_net_rx_steer_drop(q->n,
+                                       vq2q(virtio_get_queue_index(q->rx_vq)));
+        return size;
+    }
+
+    pkt = g_malloc(sizeof(*pkt) + size);
+    pkt->size = size;
+    memcpy(pkt->buf, buf, size);
+    QSLIST_INSERT_HEAD_ATOMIC(&q->rx_steered, pkt, next);
+    qemu_bh_schedule(q->rx_steer_bh);
+    return size;
+}
+
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                       size_t size, bool no_rss)
 {
@@ -1682,6 +1772,11 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
         int index = virtio_net_process_rss(nc, buf, size);
         if (index >= 0) {
             NetClientState *nc2 = qemu_get_subqueue(n->nic, index);
+            VirtIONetQueue *q2 = virtio_net_get_subqueue(nc2);
+
+            if (n->dataplane_started && q2->ctx != q->ctx) {
+                return virtio_net_rx_steer(q2, buf, size);
+            }
             return virtio_net_receive_rcu(nc2, buf, size, true);
         }
     }
@@ -1721,7 +1816,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             virtio_error(vdev,
                          "virtio-net receive queue contains no in buffers");
             virtqueue_detach_element(q->rx_vq, elem, 0);
-            g_free(elem);
+            virtqueue_free_element(elem);
             return -1;
         }
 
@@ -1758,13 +1853,13 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
          * Otherwise, drop it. */
         if (!n->mergeable_rx_bufs && offset < size) {
             virtqueue_unpop(q->rx_vq, elem, total);
-            g_free(elem);
+            virtqueue_free_element(elem);
             return size;
         }
 
         /* signal other side */
-        virtqueue_fill(q->rx_vq, elem, total, i++);
-        g_free(elem);
+        virtqueue_fill(q->rx_vq, elem, total, q->rx_batch_pending + i++);
+        virtqueue_free_element(elem);
     }
 
     if (mhdr_cnt) {
@@ -1774,12 +1869,84 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                      &mhdr.num_buffers, sizeof mhdr.num_buffers);
     }
 
-    virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    if (n->rx_batch_depth[q->iothread_index]) {
+        q->rx_batch_pending += i;
+    } else {
+        virtqueue_flush(q->rx_vq, i);
+        virtio_net_notify(n, q->rx_vq);
+    }
 
     return size;
 }
 
+static void virtio_net_receive_batch_begin(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
+    n->rx_batch_depth[q->iothread_index]++;
+}
+
+/*
+ * Publish all packets received since virtio_net_receive_batch_begin().
+ * RSS may have steered them to any queue of the same IOThread, not just
+ * the one of @nc; packets for other IOThreads are handed over through
+ * virtio_net_rx_steer() instead.
+ */
+static void virtio_net_receive_batch_end(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    unsigned int index = virtio_net_get_subqueue(nc)->iothread_index;
+    int i;
+
+    assert(n->rx_batch_depth[index] > 0);
+    if (--n->rx_batch_depth[index]) {
+        return;
+    }
+
+    for (i = 0; i < n->max_queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (q->iothread_index == index && q->rx_batch_pending) {
+            virtqueue_flush(q->rx_vq, q->rx_batch_pending);
+            virtio_net_notify(n, q->rx_vq);
+            q->rx_batch_pending = 0;
+        }
+    }
+}
+
+/* Deliver packets from virtio_net_rx_steer() in the IOThread of @q */
+static void virtio_net_rx_steer_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+    NetClientState *nc =
+        qemu_get_subqueue(n->nic, vq2q(virtio_get_queue_index(q->rx_vq)));
+    QSLIST_HEAD(, VirtIONetRxSteered) pkts, ordered;
+    VirtIONetRxSteered *pkt;
+
+    /* Packets were pushed in LIFO order, put them back in arrival order */
+    QSLIST_MOVE_ATOMIC(&pkts, &q->rx_steered);
+    QSLIST_INIT(&ordered);
+    while ((pkt = QSLIST_FIRST(&pkts))) {
+        QSLIST_REMOVE_HEAD(&pkts, next);
+        QSLIST_INSERT_HEAD(&ordered, pkt, next);
+    }
+
+    aio_context_acquire(q->ctx);
+    virtio_net_receive_batch_begin(nc);
+    WITH_RCU_READ_LOCK_GUARD() {
+        while ((pkt = QSLIST_FIRST(&ordered))) {
+            QSLIST_REMOVE_HEAD(&ordered, next);
+            virtio_net_receive_rcu(nc, pkt->buf, pkt->size, true);
+            qatomic_dec(&q->rx_steered_count);
+            g_free(pkt);
+        }
+    }
+    virtio_net_receive_batch_end(nc);
+    aio_context_release(q->ctx);
+}
+
 static ssize_t virtio_net_do_receive(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
@@ -2399,12 +2566,11 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(n, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_free_element(q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2412,13 +2578,122 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+
+/* Maximum number of packets taken from the TX virtqueue at once */
+#define VIRTIO_NET_TX_BATCH 64
+
+/*
+ * The peer does not take a vnet header, but the guest may have asked for
+ * offloads; let net_gso_sendv() do them.
+ */
+static int virtio_net_tx_elem_sw_offload(VirtIONetQueue *q,
+                                         VirtQueueElement *elem)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    struct iovec sg[VIRTQUEUE_MAX_SIZE];
+    struct virtio_net_hdr hdr;
+    unsigned int out_num;
+    ssize_t ret;
+
+    if (iov_to_buf(elem->out_sg, elem->out_num, 0, &hdr, sizeof(hdr)) <
+        sizeof(hdr)) {
+        virtio_error(vdev, "virtio-net header incorrect");
+        virtqueue_detach_element(q->tx_vq, elem, 0);
+        virtqueue_free_element(elem);
+        return -EINVAL;
+    }
+    virtio_net_hdr_swap(vdev, &hdr);
+
+    out_num = iov_copy(sg, ARRAY_SIZE(sg), elem->out_sg, elem->out_num,
+                       n->guest_hdr_len, -1);
+    ret = net_gso_sendv(qemu_get_subqueue(n->nic, queue_index), &hdr,
+                        sg, out_num, virtio_net_tx_complete);
+    return ret == 0 ? -EBUSY : 0;
+}
+
+/*
+ * Send the packet in @elem.  Returns 0 if the packet was sent or dropped
+ * and @elem can be returned to the guest, -EBUSY if the backend queued it
+ * and will call virtio_net_tx_complete(), or -EINVAL if the element is
+ * malformed, in which case it has been detached and freed.
+ */
+static int virtio_net_tx_elem(VirtIONetQueue *q, VirtQueueElement *elem)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    ssize_t ret;
+    unsigned int out_num;
+    struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
+    /* guest_hdr_len is the size of the hash report header at most */
+    struct virtio_net_hdr_v1_hash mhdr;
+
+    out_num = elem->out_num;
+    out_sg = elem->out_sg;
+    if (out_num < 1) {
+        virtio_error(vdev, "virtio-net header not in first element");
+        virtqueue_detach_element(q->tx_vq, elem, 0);
+        virtqueue_free_element(elem);
+        return -EINVAL;
+    }
+
+    if (!n->has_vnet_hdr &&
+        virtio_vdev_has_feature(vdev, VIRTIO_NET_F_CSUM)) {
+        return virtio_net_tx_elem_sw_offload(q, elem);
+    }
+
+    if (n->has_vnet_hdr) {
+        if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
+            n->guest_hdr_len) {
+            virtio_error(vdev, "virtio-net header incorrect");
+            virtqueue_detach_element(q->tx_vq, elem, 0);
+            virtqueue_free_element(elem);
+            return -EINVAL;
+        }
+        if (n->needs_vnet_hdr_swap) {
+            virtio_net_hdr_swap(vdev, (void *) &mhdr);
+            sg2[0].iov_base = &mhdr;
+            sg2[0].iov_len = n->guest_hdr_len;
+            out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
+                               out_sg, out_num,
+                               n->guest_hdr_len, -1);
+            if (out_num == VIRTQUEUE_MAX_SIZE) {
+                return 0;
+            }
+            out_num += 1;
+            out_sg = sg2;
+        }
+    }
+    /*
+     * If host wants to see the guest header as is, we can
+     * pass it on unchanged. Otherwise, copy just the parts
+     * that host is interested in.
+     */
+    assert(n->host_hdr_len <= n->guest_hdr_len);
+    if (n->host_hdr_len != n->guest_hdr_len) {
+        unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
+                                   out_sg, out_num,
+                                   0, n->host_hdr_len);
+        sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
+                         out_sg, out_num,
+                         n->guest_hdr_len, -1);
+        out_num = sg_num;
+        out_sg = sg;
+    }
+
+    ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
+                                  out_sg, out_num, virtio_net_tx_complete);
+    return ret == 0 ? -EBUSY : 0;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
-    VirtQueueElement *elem;
+    VirtQueueElement *elems[VIRTIO_NET_TX_BATCH];
     int32_t num_packets = 0;
-    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -2429,78 +2704,52 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
     }
 
     for (;;) {
-        ssize_t ret;
-        unsigned int out_num;
-        struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
-        struct virtio_net_hdr_mrg_rxbuf mhdr;
-
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
+        unsigned int i, j, nr;
+        int ret = 0;
+
+        nr = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                 (void **)elems,
+                                 MIN(VIRTIO_NET_TX_BATCH,
+                                     n->tx_burst - num_packets));
+        if (!nr) {
             break;
         }
 
-        out_num = elem->out_num;
-        out_sg = elem->out_sg;
-        if (out_num < 1) {
-            virtio_error(vdev, "virtio-net header not in first element");
-            virtqueue_detach_element(q->tx_vq, elem, 0);
-            g_free(elem);
-            return -EINVAL;
+        for (i = 0; i < nr; i++) {
+            ret = virtio_net_tx_elem(q, elems[i]);
+            if (ret < 0) {
+                break;
+            }
         }
 
-        if (n->has_vnet_hdr) {
-            if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
-                n->guest_hdr_len) {
-                virtio_error(vdev, "virtio-net header incorrect");
-                virtqueue_detach_element(q->tx_vq, elem, 0);
-                g_free(elem);
-                return -EINVAL;
-            }
-            if (n->needs_vnet_hdr_swap) {
-                virtio_net_hdr_swap(vdev, (void *) &mhdr);
-                sg2[0].iov_base = &mhdr;
-                sg2[0].iov_len = n->guest_hdr_len;
-                out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
-                                   out_sg, out_num,
-                                   n->guest_hdr_len, -1);
-                if (out_num == VIRTQUEUE_MAX_SIZE) {
-                    goto drop;
-                }
-                out_num += 1;
-                out_sg = sg2;
+        /* Complete everything that was sent with a single notification */
+        if (i) {
+            virtqueue_push_batch(q->tx_vq, elems, NULL, i);
+            virtio_net_notify(n, q->tx_vq);
+            for (j = 0; j < i; j++) {
+                virtqueue_free_element(elems[j]);
             }
+            num_packets += i;
         }
-        /*
-         * If host wants to see the guest header as is, we can
-         * pass it on unchanged. Otherwise, copy just the parts
-         * that host is interested in.
-         */
-        assert(n->host_hdr_len <= n->guest_hdr_len);
-        if (n->host_hdr_len != n->guest_hdr_len) {
-            unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
-                                       out_sg, out_num,
-                                       0, n->host_hdr_len);
-            sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
-                             out_sg, out_num,
-                             n->guest_hdr_len, -1);
-            out_num = sg_num;
-            out_sg = sg;
-        }
-
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
-        if (ret == 0) {
+
+        if (ret == -EBUSY) {
+            /* Give back what was popped after the queued packet */
+            for (j = nr - 1; j > i; j--) {
+                virtqueue_unpop(q->tx_vq, elems[j], 0);
+                virtqueue_free_element(elems[j]);
+            }
             virtio_queue_set_notification(q->tx_vq, 0);
-            q->async_tx.elem = elem;
+            q->async_tx.elem = elems[i];
             return -EBUSY;
+        } else if (ret < 0) {
+            for (j = i + 1; j < nr; j++) {
+                virtqueue_detach_element(q->tx_vq, elems[j], 0);
+                virtqueue_free_element(elems[j]);
+            }
+            return ret;
         }
 
-drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
-
-        if (++num_packets >= n->tx_burst) {
+        if (num_packets >= n->tx_burst) {
             break;
         }
     }
@@ -2632,6 +2881,283 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+/* Dataplane */
+
+static bool virtio_net_dataplane_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    aio_context_acquire(q->ctx);
+    virtio_net_handle_rx(vdev, vq);
+    aio_context_release(q->ctx);
+
+    /*
+     * New buffers only matter if packets are queued, and those are
+     * delivered right away.  Don't keep polling for more.
+     */
+    return false;
+}
+
+static bool virtio_net_dataplane_handle_tx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    aio_context_acquire(q->ctx);
+    virtio_net_handle_tx_bh(vdev, vq);
+    aio_context_release(q->ctx);
+    return true;
+}
+
+static void virtio_net_dataplane_tx_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    aio_context_acquire(q->ctx);
+    virtio_net_tx_bh(q);
+    aio_context_release(q->ctx);
+}
+
+typedef struct {
+    VirtIONet *n;
+    AioContext *ctx;
+    int queues;
+} VirtIONetDataPlaneStopData;
+
+/*
+ * Stop taking packets from the guest and the backend on the queues that
+ * run in the current IOThread.
+ *
+ * Context: BH in IOThread
+ */
+static void virtio_net_dataplane_stop_bh(void *opaque)
+{
+    VirtIONetDataPlaneStopData *data = opaque;
+    VirtIONet *n = data->n;
+    int i;
+
+    for (i = 0; i < data->queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (q->ctx == data->ctx) {
+            virtio_queue_aio_set_host_notifier_handler(q->rx_vq, q->ctx, NULL);
+            virtio_queue_aio_set_host_notifier_handler(q->tx_vq, q->ctx, NULL);
+            qemu_set_aio_context(qemu_get_subqueue(n->nic, i)->peer, NULL);
+        }
+    }
+}
+
+/*
+ * Delete the BHs of the queues that run in the current IOThread.  Only
+ * safe once no IOThread can steer packets to them anymore.
+ *
+ * Context: BH in IOThread
+ */
+static void virtio_net_dataplane_delete_bh(void *opaque)
+{
+    VirtIONetDataPlaneStopData *data = opaque;
+    VirtIONet *n = data->n;
+    int i;
+
+    for (i = 0; i < data->queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (q->ctx == data->ctx) {
+            qemu_bh_delete(q->tx_bh);
+            q->tx_bh = NULL;
+            qemu_bh_delete(q->rx_steer_bh);
+            q->rx_steer_bh = NULL;
+        }
+    }
+}
+
+/*
+ * Run @fn in every IOThread that has queues.
+ *
+ * Context: QEMU global mutex held
+ */
+static void virtio_net_dataplane_run(VirtIONet *n, int queues, QEMUBHFunc *fn)
+{
+    int i, j;
+
+    for (i = 0; i < MIN(queues, n->net_conf.num_iothreads); i++) {
+        VirtIONetDataPlaneStopData data = {
+            .n = n,
+            .ctx = iothread_get_aio_context(n->iothreads[i]),
+            .queues = queues,
+        };
+
+        /* Only once per AioContext */
+        for (j = 0; j < i && n->iothreads[j] != n->iothreads[i]; j++) {
+            /* nothing */
+        }
+        if (j < i) {
+            continue;
+        }
+
+        aio_context_acquire(data.ctx);
+        aio_wait_bh_oneshot(data.ctx, fn, &data);
+        aio_context_release(data.ctx);
+    }
+}
+
+/*
+ * Move the queue pairs and their backends to the IOThreads.  Without
+ * irqfds and ioeventfds, or with net filters, which expect to run in the
+ * main loop, the device keeps running in the main loop.
+ */
+static void virtio_net_dataplane_start(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int nvqs = queues * 2;
+    int i, r;
+
+    for (i = 0; i < queues; i++) {
+        NetClientState *nc = qemu_get_subqueue(n->nic, i);
+
+        if (!QTAILQ_EMPTY(&nc->filters) ||
+            (nc->peer && !QTAILQ_EMPTY(&nc->peer->filters))) {
+            error_report("virtio-net: iothreads cannot be used with net "
+                         "filters, falling back on the main loop");
+            return;
+        }
+    }
+
+    /* Masked vectors are handled by tearing down their irqfd */
+    vdev->use_guest_notifier_mask = false;
+    r = k->set_guest_notifiers(qbus->parent, nvqs, true);
+    if (r != 0) {
+        error_report("virtio-net failed to set guest notifier (%d), "
+                     "ensure -accel kvm is set.", r);
+        goto fail_guest_notifiers;
+    }
+
+    r = virtio_device_grab_ioeventfd(vdev);
+    if (r < 0) {
+        error_report("virtio-net failed to grab ioeventfd (%d)", r);
+        goto fail_grab_ioeventfd;
+    }
+
+    for (i = 0; i < nvqs; i++) {
+        r = virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, true);
+        if (r != 0) {
+            error_report("virtio-net failed to set host notifier (%d)", r);
+            while (i--) {
+                virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+                virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+            }
+            goto fail_host_notifiers;
+        }
+    }
+
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = aio_bh_new(q->ctx, virtio_net_dataplane_tx_bh, q);
+        q->rx_steer_bh = aio_bh_new(q->ctx, virtio_net_rx_steer_bh, q);
+    }
+
+    n->dataplane_started = true;
+    trace_virtio_net_dataplane_start(n, queues);
+
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        /* Kick right away to process what is already in the vrings */
+        event_notifier_set(virtio_queue_get_host_notifier(q->rx_vq));
+        event_notifier_set(virtio_queue_get_host_notifier(q->tx_vq));
+
+        aio_context_acquire(q->ctx);
+        virtio_queue_aio_set_host_notifier_handler(q->rx_vq, q->ctx,
+                virtio_net_dataplane_handle_rx);
+        virtio_queue_aio_set_host_notifier_handler(q->tx_vq, q->ctx,
+                virtio_net_dataplane_handle_tx);
+        qemu_set_aio_context(qemu_get_subqueue(n->nic, i)->peer, q->ctx);
+        if (q->tx_waiting) {
+            qemu_bh_schedule(q->tx_bh);
+        }
+        aio_context_release(q->ctx);
+    }
+    return;
+
+fail_host_notifiers:
+    virtio_device_release_ioeventfd(vdev);
+fail_grab_ioeventfd:
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+fail_guest_notifiers:
+    vdev->use_guest_notifier_mask = true;
+    error_report("virtio-net: falling back on the main loop");
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_dataplane_stop(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int nvqs = queues * 2;
+    int i;
+
+    trace_virtio_net_dataplane_stop(n);
+
+    /*
+     * Two passes: a queue's steering BH can only go away once no other
+     * IOThread receives packets anymore.
+     */
+    virtio_net_dataplane_run(n, queues, virtio_net_dataplane_stop_bh);
+    virtio_net_dataplane_run(n, queues, virtio_net_dataplane_delete_bh);
+    n->dataplane_started = false;
+
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        VirtIONetRxSteered *pkt;
+
+        /* tx_waiting is still set if the BH was pending */
+        q->tx_bh = qemu_bh_new(virtio_net_tx_bh, q);
+
+        while ((pkt = QSLIST_FIRST(&q->rx_steered))) {
+            QSLIST_REMOVE_HEAD(&q->rx_steered, next);
+            g_free(pkt);
+        }
+        q->rx_steered_count = 0;
+    }
+
+    for (i = 0; i < nvqs; i++) {
+        virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+        virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+    }
+    virtio_device_release_ioeventfd(vdev);
+
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+    vdev->use_guest_notifier_mask = true;
+}
+
+static void virtio_net_dataplane_status(VirtIONet *n, uint8_t status)
+{
+    bool start;
+
+    if (!n->net_conf.num_iothreads) {
+        return;
+    }
+
+    start = virtio_net_started(n, status) && !n->vhost_started;
+    if (start == n->dataplane_started) {
+        return;
+    }
+
+    if (start) {
+        virtio_net_dataplane_start(n);
+    } else {
+        virtio_net_dataplane_stop(n);
+    }
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -2653,6 +3179,20 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
         n->vqs[index].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[index]);
     }
 
+    virtio_queue_enable_element_pool(n->vqs[index].rx_vq,
+                                     sizeof(VirtQueueElement),
+                                     VIRTIO_NET_ELEM_POOL_MAX_SG);
+    virtio_queue_enable_element_pool(n->vqs[index].tx_vq,
+                                     sizeof(VirtQueueElement),
+                                     VIRTIO_NET_ELEM_POOL_MAX_SG);
+
+    if (n->net_conf.num_iothreads) {
+        n->vqs[index].iothread_index = index % n->net_conf.num_iothreads;
+        n->vqs[index].ctx = iothread_get_aio_context(
+            n->iothreads[n->vqs[index].iothread_index]);
+    }
+    net_rx_pkt_init(&n->vqs[index].rx_pkt, false);
+
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
 }
@@ -2675,6 +3215,8 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
         q->tx_bh = NULL;
     }
     q->tx_waiting = 0;
+    net_rx_pkt_uninit(q->rx_pkt);
+    q->rx_pkt = NULL;
     virtio_del_queue(vdev, index * 2 + 1);
 }
 
@@ -3057,6 +3599,8 @@ static NetClientInfo net_virtio_info = {
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
+    .receive_batch_begin = virtio_net_receive_batch_begin,
+    .receive_batch_end = virtio_net_receive_batch_end,
 };
 
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
@@ -3255,6 +3799,63 @@ out:
     }
 }
 
+/* Look up the IOThreads that queue pairs are assigned to, round robin */
+static bool virtio_net_init_iothreads(VirtIONet *n, Error **errp)
+{
+    BusState *qbus = qdev_get_parent_bus(DEVICE(n));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    g_autofree IOThread **iothreads = NULL;
+    int i;
+
+    if (!n->net_conf.num_iothreads) {
+        return true;
+    }
+
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp, "device is incompatible with iothreads "
+                   "(transport does not support notifiers)");
+        return false;
+    }
+    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+        error_setg(errp, "tx=timer is not supported with iothreads");
+        return false;
+    }
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "guest_rsc_ext is not supported with iothreads");
+        return false;
+    }
+
+    for (i = 0; i < n->nic_conf.peers.queues; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (peer && (!peer->info->set_aio_context || get_vhost_net(peer))) {
+            error_setg(errp, "netdev '%s' cannot be used with iothreads",
+                       peer->name);
+            return false;
+        }
+    }
+
+    iothreads = g_new(IOThread *, n->net_conf.num_iothreads);
+    for (i = 0; i < n->net_conf.num_iothreads; i++) {
+        if (!n->net_conf.iothreads[i]) {
+            error_setg(errp, "iothreads[%d] is not set", i);
+            return false;
+        }
+        iothreads[i] = iothread_by_id(n->net_conf.iothreads[i]);
+        if (!iothreads[i]) {
+            error_setg(errp, "Cannot find iothread %s",
+                       n->net_conf.iothreads[i]);
+            return false;
+        }
+    }
+
+    for (i = 0; i < n->net_conf.num_iothreads; i++) {
+        object_ref(OBJECT(iothreads[i]));
+    }
+    n->iothreads = g_steal_pointer(&iothreads);
+    return true;
+}
+
 static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
@@ -3288,6 +3889,10 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         n->host_features |= (1ULL << VIRTIO_NET_F_SPEED_DUPLEX);
     }
 
+    if (!virtio_net_init_iothreads(n, errp)) {
+        return;
+    }
+
     if (n->failover) {
         n->primary_listener.should_be_hidden =
             virtio_net_primary_should_be_hidden;
@@ -3337,6 +3942,8 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         return;
     }
     n->vqs = g_malloc0(sizeof(VirtIONetQueue) * n->max_queues);
+    n->rx_batch_depth = g_new0(unsigned int,
+                               MAX(n->net_conf.num_iothreads, 1));
     n->curr_queues = 1;
     n->tx_timeout = n->net_conf.txtimer;
 
@@ -3401,8 +4008,6 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 
     QTAILQ_INIT(&n->rsc_chains);
     n->qdev = dev;
-
-    net_rx_pkt_init(&n->rx_pkt, false);
 }
 
 static void virtio_net_device_unrealize(DeviceState *dev)
@@ -3441,7 +4046,12 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
-    net_rx_pkt_uninit(n->rx_pkt);
+    g_free(n->rx_batch_depth);
+    for (i = 0; i < n->net_conf.num_iothreads; i++) {
+        object_unref(OBJECT(n->iothreads[i]));
+    }
+    g_free(n->iothreads);
+    n->iothreads = NULL;
     virtio_cleanup(vdev);
 }
 
@@ -3459,6 +4069,14 @@ static void virtio_net_instance_init(Object *obj)
                                   DEVICE(n));
 }
 
+static void virtio_net_instance_finalize(Object *obj)
+{
+    VirtIONet *n = VIRTIO_NET(obj);
+
+    /* The array elements are released together with their properties */
+    g_free(n->net_conf.iothreads);
+}
+
 static int virtio_net_pre_save(void *opaque)
 {
     VirtIONet *n = opaque;
@@ -3566,6 +4184,9 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_BOOL("sw-offload", VirtIONet, sw_offload, true),
+    DEFINE_PROP_ARRAY("iothreads", VirtIONet, net_conf.num_iothreads,
+                      net_conf.iothreads, qdev_prop_string, char *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -3599,6 +4220,7 @@ static const TypeInfo virtio_net_info = {
     .parent = TYPE_VIRTIO_DEVICE,
     .instance_size = sizeof(VirtIONet),
     .instance_init = virtio_net_instance_init,
+    .instance_finalize = virtio_net_instance_finalize,
     .class_init = virtio_net_class_init,
 };
 
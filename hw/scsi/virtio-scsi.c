@@ -61,7 +61,7 @@ void virtio_scsi_free_req(VirtIOSCSIReq *req)
 {
     qemu_iovec_destroy(&req->resp_iov);
     qemu_sglist_destroy(&req->qsgl);
-    g_free(req);
+    virtqueue_free_element(req);
 }
 
 static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
@@ -923,7 +923,10 @@ static void virtio_scsi_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOSCSI *s = VIRTIO_SCSI(dev);
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
     Error *err = NULL;
+    unsigned int max_sg;
+    int i;
 
     virtio_scsi_common_realize(dev,
                                virtio_scsi_handle_ctrl,
@@ -935,6 +938,15 @@ static void virtio_scsi_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    /* Room for seg_max data segments plus the request and response headers */
+    max_sg = (vs->conf.seg_max_adjust ? vs->conf.virtqueue_size - 2 : 128 - 2)
+             + 2;
+    for (i = 0; i < vs->conf.num_queues; i++) {
+        virtio_queue_enable_element_pool(vs->cmd_vqs[i],
+                                         sizeof(VirtIOSCSIReq) + vs->cdb_size,
+                                         max_sg);
+    }
+
     scsi_bus_new(&s->bus, sizeof(s->bus), dev,
                  &virtio_scsi_scsi_info, vdev->bus_name);
     /* override default SCSI bus hotplug-handler, with virtio-scsi's one */
@@ -124,6 +124,12 @@ static gint interval_cmp(gconstpointer a, gconstpointer b, gpointer user_data)
     }
 }
 
+/* Invalidate the translations cached by all endpoints */
+static inline void virtio_iommu_iotlb_flush(VirtIOIOMMU *s)
+{
+    s->iotlb_gen++;
+}
+
 static void virtio_iommu_detach_endpoint_from_domain(VirtIOIOMMUEndpoint *ep)
 {
     if (!ep->domain) {
@@ -267,6 +273,7 @@ static int virtio_iommu_attach(VirtIOIOMMU *s,
     QLIST_INSERT_HEAD(&domain->endpoint_list, ep, next);
 
     ep->domain = domain;
+    virtio_iommu_iotlb_flush(s);
 
     return VIRTIO_IOMMU_S_OK;
 }
@@ -293,6 +300,7 @@ static int virtio_iommu_detach(VirtIOIOMMU *s,
     }
 
     virtio_iommu_detach_endpoint_from_domain(ep);
+    virtio_iommu_iotlb_flush(s);
 
     if (QLIST_EMPTY(&domain->endpoint_list)) {
         g_tree_remove(s->domains, GUINT_TO_POINTER(domain->id));
@@ -375,6 +383,7 @@ static int virtio_iommu_unmap(VirtIOIOMMU *s,
             ret = VIRTIO_IOMMU_S_RANGE;
             break;
         }
+        virtio_iommu_iotlb_flush(s);
     }
     return ret;
 }
@@ -478,21 +487,28 @@ static int virtio_iommu_handle_probe(VirtIOIOMMU *s,
     return ret ? ret : virtio_iommu_probe(s, &req, buf);
 }
 
+/*
+ * Requests are completed in batches: the used ring is updated and the
+ * guest notified once for all the requests that were available, rather
+ * than once per request.
+ */
 static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOIOMMU *s = VIRTIO_IOMMU(vdev);
     struct virtio_iommu_req_head head;
-    struct virtio_iommu_req_tail tail = {};
-    size_t output_size = sizeof(tail), sz;
     VirtQueueElement *elem;
-    unsigned int iov_cnt;
+    unsigned int iov_cnt, done = 0;
     struct iovec *iov;
-    void *buf = NULL;
+    size_t sz;
 
     for (;;) {
+        struct virtio_iommu_req_tail tail = {};
+        size_t output_size = sizeof(tail);
+        void *buf = NULL;
+
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
-            return;
+            break;
         }
 
         if (iov_size(elem->in_sg, elem->in_num) < sizeof(tail) ||
@@ -546,11 +562,15 @@ out:
                           buf ? buf : &tail, output_size);
         assert(sz == output_size);
 
-        virtqueue_push(vq, elem, sz);
-        virtio_notify(vdev, vq);
+        virtqueue_fill(vq, elem, sz, done++);
         g_free(elem);
         g_free(buf);
     }
+
+    if (done) {
+        virtqueue_flush(vq, done);
+        virtio_notify(vdev, vq);
+    }
 }
 
 static void virtio_iommu_report_fault(VirtIOIOMMU *viommu, uint8_t reason,
@@ -604,9 +624,11 @@ static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
     VirtIOIOMMUMapping *mapping_value;
     VirtIOIOMMU *s = sdev->viommu;
     bool read_fault, write_fault;
+    VirtIOIOMMUTLBEntry *tlb;
     VirtIOIOMMUEndpoint *ep;
     uint32_t sid, flags;
     bool bypass_allowed;
+    uint64_t page_mask;
     bool found;
     int i;
 
@@ -621,6 +643,10 @@ static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
         .perm = IOMMU_NONE,
     };
 
+    page_mask = entry.addr_mask;
+    tlb = &sdev->iotlb[(addr >> ctz32(s->config.page_size_mask)) %
+                       VIOMMU_IOTLB_SIZE];
+
     bypass_allowed = virtio_vdev_has_feature(&s->parent_obj,
                                              VIRTIO_IOMMU_F_BYPASS);
 
@@ -629,6 +655,15 @@ static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
     trace_virtio_iommu_translate(mr->parent_obj.name, sid, addr, flag);
     qemu_mutex_lock(&s->mutex);
 
+    if (tlb->gen == s->iotlb_gen && tlb->iova == (addr & ~page_mask) &&
+        !((flag & IOMMU_RO) && !(tlb->flags & VIRTIO_IOMMU_MAP_F_READ)) &&
+        !((flag & IOMMU_WO) && !(tlb->flags & VIRTIO_IOMMU_MAP_F_WRITE))) {
+        entry.translated_addr = tlb->translated_addr + (addr & page_mask);
+        entry.perm = flag;
+        trace_virtio_iommu_translate_out(addr, entry.translated_addr, sid);
+        goto unlock;
+    }
+
     ep = g_tree_lookup(s->endpoints, GUINT_TO_POINTER(sid));
     if (!ep) {
         if (!bypass_allowed) {
@@ -707,6 +742,26 @@ static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
     entry.perm = flag;
     trace_virtio_iommu_translate_out(addr, entry.translated_addr, sid);
 
+    /*
+     * Cache the translation if the whole page is mapped and none of it is
+     * reserved, so that a hit can skip all of the checks above.
+     */
+    if (mapping_key->low > (addr & ~page_mask) ||
+        mapping_key->high < (addr | page_mask)) {
+        goto unlock;
+    }
+    for (i = 0; i < s->nb_reserved_regions; i++) {
+        ReservedRegion *reg = &s->reserved_regions[i];
+
+        if (reg->low <= (addr | page_mask) && reg->high >= (addr & ~page_mask)) {
+            goto unlock;
+        }
+    }
+    tlb->iova = addr & ~page_mask;
+    tlb->translated_addr = entry.translated_addr & ~page_mask;
+    tlb->flags = mapping_value->flags;
+    tlb->gen = s->iotlb_gen;
+
 unlock:
     qemu_mutex_unlock(&s->mutex);
     return entry;
@@ -785,6 +840,8 @@ static void virtio_iommu_device_realize(DeviceState *dev, Error **errp)
     virtio_add_feature(&s->features, VIRTIO_IOMMU_F_PROBE);
 
     qemu_mutex_init(&s->mutex);
+    /* cached entries start out with gen 0, i.e. invalid */
+    s->iotlb_gen = 1;
 
     s->as_by_busptr = g_hash_table_new_full(NULL, NULL, NULL, g_free);
 
@@ -819,6 +876,7 @@ static void virtio_iommu_device_reset(VirtIODevice *vdev)
 
     trace_virtio_iommu_device_reset();
 
+    virtio_iommu_iotlb_flush(s);
     if (s->domains) {
         g_tree_destroy(s->domains);
     }
@@ -923,6 +981,7 @@ static int iommu_post_load(void *opaque, int version_id)
     VirtIOIOMMU *s = opaque;
 
     g_tree_foreach(s->domains, reconstruct_endpoints, s);
+    virtio_iommu_iotlb_flush(s);
     return 0;
 }
 
@@ -131,6 +131,33 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /* Cache of popped elements, see virtio_queue_enable_element_pool() */
+    VirtQueueElementPool *elem_pool;
+};
+
+/*
+ * Elements are popped by one thread at a time, but may be freed from any
+ * thread, e.g. when a request completes in an IOThread.  Freed elements are
+ * pushed atomically onto @returned and moved to @free by the popping side
+ * once @free runs empty, so neither side needs a lock.
+ */
+typedef struct VirtQueueElementPoolEntry {
+    QSLIST_ENTRY(VirtQueueElementPoolEntry) next;
+} VirtQueueElementPoolEntry;
+
+struct VirtQueueElementPool {
+    /*
+     * One reference for the VirtQueue, one for each allocated slot and a
+     * temporary one while virtqueue_free_element() returns a slot
+     */
+    unsigned int refcnt;
+    /* Set when the VirtQueue is gone; slots are then freed when returned */
+    bool dead;
+    size_t elem_size;
+    size_t slot_size;
+    QSLIST_HEAD(, VirtQueueElementPoolEntry) free;
+    QSLIST_HEAD(, VirtQueueElementPoolEntry) returned;
 };
 
 static void virtio_free_region_cache(VRingMemoryRegionCaches *caches)
@@ -738,7 +765,8 @@ void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
 {
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        virtqueue_packed_rewind(vq, 1);
+        /* A chain of direct descriptors occupies ndescs ring slots */
+        virtqueue_packed_rewind(vq, elem->ndescs);
     } else {
         virtqueue_split_rewind(vq, 1);
     }
@@ -919,6 +947,31 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+/* virtqueue_push_batch:
+ * @vq: The #VirtQueue
+ * @elems: Elements to return to the guest
+ * @lens: Number of bytes written to each element, or NULL if none were
+ * @n: Number of elements
+ *
+ * Return @n elements to the guest, publishing them with a single update of
+ * the used index.  The caller still has to notify the guest.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *lens, unsigned int n)
+{
+    unsigned int i;
+
+    if (!n) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < n; i++) {
+        virtqueue_fill(vq, elems[i], lens ? lens[i] : 0, i);
+    }
+    virtqueue_flush(vq, n);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1388,9 +1441,143 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+static void virtqueue_element_pool_unref(VirtQueueElementPool *pool)
+{
+    if (qatomic_fetch_dec(&pool->refcnt) == 1) {
+        g_free(pool);
+    }
+}
+
+/* Release the element pool of @vq.  Elements that are still in flight are
+ * freed when they are returned.
+ *
+ * Called with the virtqueue quiesced.
+ */
+static void virtqueue_element_pool_release(VirtQueue *vq)
+{
+    VirtQueueElementPool *pool = vq->elem_pool;
+    VirtQueueElementPoolEntry *e, *next;
+
+    if (!pool) {
+        return;
+    }
+    vq->elem_pool = NULL;
+
+    qatomic_set(&pool->dead, true);
+    smp_mb();
+    QSLIST_FOREACH_SAFE(e, &pool->free, next, next) {
+        g_free(e);
+        virtqueue_element_pool_unref(pool);
+    }
+    QSLIST_MOVE_ATOMIC(&pool->free, &pool->returned);
+    QSLIST_FOREACH_SAFE(e, &pool->free, next, next) {
+        g_free(e);
+        virtqueue_element_pool_unref(pool);
+    }
+    virtqueue_element_pool_unref(pool);
+}
+
+/* virtio_queue_enable_element_pool:
+ * @vq: The #VirtQueue
+ * @sz: Size that the device passes to virtqueue_pop()
+ * @max_sg: Number of scatter-gather entries to reserve in each element
+ *
+ * Recycle the elements popped from @vq instead of allocating each of them
+ * with g_malloc().  Elements of a different size or with more than @max_sg
+ * entries are still allocated individually.
+ *
+ * All elements popped from @vq must then be freed with
+ * virtqueue_free_element() instead of g_free().
+ */
+void virtio_queue_enable_element_pool(VirtQueue *vq, size_t sz,
+                                      unsigned int max_sg)
+{
+    VirtQueueElementPool *pool;
+
+    assert(sz >= sizeof(VirtQueueElement));
+    virtqueue_element_pool_release(vq);
+
+    pool = g_new0(VirtQueueElementPool, 1);
+    pool->refcnt = 1;
+    pool->elem_size = sz;
+    pool->slot_size =
+        QEMU_ALIGN_UP(QEMU_ALIGN_UP(sz, __alignof__(hwaddr)) +
+                      max_sg * sizeof(hwaddr),
+                      __alignof__(struct iovec)) +
+        max_sg * sizeof(struct iovec);
+    QSLIST_INIT(&pool->free);
+    QSLIST_INIT(&pool->returned);
+    vq->elem_pool = pool;
+}
+
+/* virtqueue_free_element:
+ * @elem: Element returned by virtqueue_pop() or qemu_get_virtqueue_element()
+ *
+ * Free @elem, returning it to the element pool it was allocated from.  This
+ * may be called from any thread.
+ */
+void virtqueue_free_element(void *elem)
+{
+    VirtQueueElement *e = elem;
+    VirtQueueElementPool *pool;
+
+    if (!e) {
+        return;
+    }
+
+    pool = e->pool;
+    if (!pool) {
+        g_free(e);
+        return;
+    }
+
+    /*
+     * Once @e is on the returned list, a concurrent
+     * virtqueue_element_pool_release() may free it and drop its reference
+     * to the pool, so hold one of our own until we are done.
+     */
+    qatomic_inc(&pool->refcnt);
+    QSLIST_INSERT_HEAD_ATOMIC(&pool->returned,
+                              (VirtQueueElementPoolEntry *)e, next);
+
+    /*
+     * Pairs with the barrier in virtqueue_element_pool_release(): either
+     * it sees @e on the returned list, or we see that the pool is dead
+     * and drain the list ourselves.
+     */
+    smp_mb();
+    if (qatomic_read(&pool->dead)) {
+        QSLIST_HEAD(, VirtQueueElementPoolEntry) list;
+        VirtQueueElementPoolEntry *entry, *next;
+
+        QSLIST_MOVE_ATOMIC(&list, &pool->returned);
+        QSLIST_FOREACH_SAFE(entry, &list, next, next) {
+            g_free(entry);
+            virtqueue_element_pool_unref(pool);
+        }
+    }
+    virtqueue_element_pool_unref(pool);
+}
+
+static VirtQueueElement *virtqueue_element_pool_get(VirtQueueElementPool *pool)
+{
+    VirtQueueElementPoolEntry *e;
+
+    if (QSLIST_EMPTY(&pool->free)) {
+        QSLIST_MOVE_ATOMIC(&pool->free, &pool->returned);
+    }
+    e = QSLIST_FIRST(&pool->free);
+    if (e) {
+        QSLIST_REMOVE_HEAD(&pool->free, next);
+    }
+    return (VirtQueueElement *)e;
+}
+
+static void *virtqueue_alloc_element(VirtQueue *vq, size_t sz,
+                                     unsigned out_num, unsigned in_num)
 {
     VirtQueueElement *elem;
+    VirtQueueElementPool *pool = vq ? vq->elem_pool : NULL;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
@@ -1399,8 +1586,19 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
-    trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    if (pool && (sz != pool->elem_size || out_sg_end > pool->slot_size)) {
+        pool = NULL;
+    }
+
+    elem = pool ? virtqueue_element_pool_get(pool) : NULL;
+    if (!elem) {
+        elem = g_malloc(pool ? pool->slot_size : out_sg_end);
+        trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+        if (pool) {
+            qatomic_inc(&pool->refcnt);
+        }
+    }
+    elem->pool = pool;
     elem->out_num = out_num;
     elem->in_num = in_num;
     elem->in_addr = (void *)elem + in_addr_ofs;
@@ -1410,10 +1608,33 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/* Called within rcu_read_lock().  */
+static VRingMemoryRegionCaches *virtqueue_pop_get_caches(VirtQueue *vq,
+                                                         size_t desc_size)
 {
-    unsigned int i, head, max;
-    VRingMemoryRegionCaches *caches;
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+
+    if (!caches) {
+        virtio_error(vq->vdev, "Region caches not initialized");
+        return NULL;
+    }
+
+    if (caches->desc.len < vq->vring.num * desc_size) {
+        virtio_error(vq->vdev, "Cannot map descriptor ring");
+        return NULL;
+    }
+
+    return caches;
+}
+
+/* Map the descriptor chain starting at @head into a new element.
+ *
+ * Called within rcu_read_lock().  */
+static VirtQueueElement *virtqueue_split_pop_head(VirtQueue *vq,
+                                                  VRingMemoryRegionCaches *caches,
+                                                  unsigned int head, size_t sz)
+{
+    unsigned int i, max;
     MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1425,45 +1646,12 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
     max = vq->vring.num;
-
-    if (vq->inuse >= vq->vring.num) {
-        virtio_error(vdev, "Virtqueue size exceeded");
-        goto done;
-    }
-
-    if (!virtqueue_get_head(vq, vq->last_avail_idx++, &head)) {
-        goto done;
-    }
-
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
-    if (caches->desc.len < max * sizeof(VRingDesc)) {
-        virtio_error(vdev, "Cannot map descriptor ring");
-        goto done;
-    }
-
     desc_cache = &caches->desc;
     vring_split_desc_read(vdev, &desc, desc_cache, i);
     if (desc.flags & VRING_DESC_F_INDIRECT) {
@@ -1522,7 +1710,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1547,10 +1735,97 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    VRingMemoryRegionCaches *caches;
+    unsigned int head;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /* Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads(). */
+    smp_rmb();
+
+    if (vq->inuse >= vq->vring.num) {
+        virtio_error(vq->vdev, "Virtqueue size exceeded");
+        return NULL;
+    }
+
+    if (!virtqueue_get_head(vq, vq->last_avail_idx++, &head)) {
+        return NULL;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    caches = virtqueue_pop_get_caches(vq, sizeof(VRingDesc));
+    if (!caches) {
+        return NULL;
+    }
+
+    return virtqueue_split_pop_head(vq, caches, head, sz);
+}
+
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int n)
 {
-    unsigned int i, max;
     VRingMemoryRegionCaches *caches;
+    unsigned int count = 0;
+    uint16_t start = vq->last_avail_idx;
+    int num_heads;
+
+    RCU_READ_LOCK_GUARD();
+
+    /* Read the avail index only once for the whole batch */
+    num_heads = virtqueue_num_heads(vq, vq->last_avail_idx);
+    if (num_heads <= 0) {
+        return 0;
+    }
+    n = MIN(n, num_heads);
+
+    caches = virtqueue_pop_get_caches(vq, sizeof(VRingDesc));
+    if (!caches) {
+        return 0;
+    }
+
+    while (count < n) {
+        unsigned int head;
+
+        if (vq->inuse >= vq->vring.num) {
+            virtio_error(vq->vdev, "Virtqueue size exceeded");
+            break;
+        }
+
+        if (!virtqueue_get_head(vq, vq->last_avail_idx++, &head)) {
+            break;
+        }
+
+        elems[count] = virtqueue_split_pop_head(vq, caches, head, sz);
+        if (!elems[count]) {
+            break;
+        }
+        count++;
+    }
+
+    if (vq->last_avail_idx != start &&
+        virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    return count;
+}
+
+/* Map the next available descriptor chain into a new element.
+ *
+ * Called within rcu_read_lock().  */
+static VirtQueueElement *virtqueue_packed_pop_desc(VirtQueue *vq,
+                                                   VRingMemoryRegionCaches *caches,
+                                                   size_t sz)
+{
+    unsigned int i, max;
     MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1563,34 +1838,12 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     uint16_t id;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_packed_empty_rcu(vq)) {
-        goto done;
-    }
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
     max = vq->vring.num;
-
-    if (vq->inuse >= vq->vring.num) {
-        virtio_error(vdev, "Virtqueue size exceeded");
-        goto done;
-    }
-
     i = vq->last_avail_idx;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
-    if (caches->desc.len < max * sizeof(VRingDesc)) {
-        virtio_error(vdev, "Cannot map descriptor ring");
-        goto done;
-    }
-
     desc_cache = &caches->desc;
     vring_packed_desc_read(vdev, &desc, desc_cache, i, true);
     id = desc.id;
@@ -1648,7 +1901,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1682,6 +1935,69 @@ err_undo_map:
     goto done;
 }
 
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+{
+    VRingMemoryRegionCaches *caches;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_packed_empty_rcu(vq)) {
+        return NULL;
+    }
+
+    if (vq->inuse >= vq->vring.num) {
+        virtio_error(vq->vdev, "Virtqueue size exceeded");
+        return NULL;
+    }
+
+    caches = virtqueue_pop_get_caches(vq, sizeof(VRingDesc));
+    if (!caches) {
+        return NULL;
+    }
+
+    return virtqueue_packed_pop_desc(vq, caches, sz);
+}
+
+static unsigned int virtqueue_packed_pop_batch(VirtQueue *vq, size_t sz,
+                                               void **elems, unsigned int n)
+{
+    VRingMemoryRegionCaches *caches;
+    unsigned int count = 0;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_packed_empty_rcu(vq)) {
+        return 0;
+    }
+
+    caches = virtqueue_pop_get_caches(vq, sizeof(VRingDesc));
+    if (!caches) {
+        return 0;
+    }
+
+    /*
+     * Packed rings have no avail index, so availability is still checked
+     * descriptor by descriptor, but the region caches are only looked up
+     * once.
+     */
+    while (count < n) {
+        if (count && virtio_queue_packed_empty_rcu(vq)) {
+            break;
+        }
+
+        if (vq->inuse >= vq->vring.num) {
+            virtio_error(vq->vdev, "Virtqueue size exceeded");
+            break;
+        }
+
+        elems[count] = virtqueue_packed_pop_desc(vq, caches, sz);
+        if (!elems[count]) {
+            break;
+        }
+        count++;
+    }
+
+    return count;
+}
+
 void *virtqueue_pop(VirtQueue *vq, size_t sz)
 {
     if (virtio_device_disabled(vq->vdev)) {
@@ -1695,6 +2011,32 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 }
 
+/* virtqueue_pop_batch:
+ * @vq: The #VirtQueue
+ * @sz: Size of each element, as for virtqueue_pop()
+ * @elems: Array that receives the popped elements
+ * @n: Maximum number of elements to pop
+ *
+ * Pop up to @n elements at once.  This is equivalent to calling
+ * virtqueue_pop() until it fails or @n elements have been popped, but the
+ * avail index and the ring's memory region caches are only looked up once.
+ *
+ * Returns the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz,
+                                 void **elems, unsigned int n)
+{
+    if (virtio_device_disabled(vq->vdev) || !n) {
+        return 0;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return virtqueue_packed_pop_batch(vq, sz, elems, n);
+    } else {
+        return virtqueue_split_pop_batch(vq, sz, elems, n);
+    }
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -1828,7 +2170,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(NULL, sz, data.out_num, data.in_num);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2425,6 +2767,7 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_aio_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    virtqueue_element_pool_release(vq);
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -93,6 +93,17 @@ struct BlockAcctStats {
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
 };
 
+/*
+ * Timing of the requests that pass through a single block node, as opposed
+ * to BlockAcctStats which covers the requests of a BlockBackend.
+ */
+typedef struct BlockNodeTiming {
+    QemuMutex lock;
+    uint64_t nr_ops[BLOCK_MAX_IOTYPE];
+    uint64_t total_time_ns[BLOCK_MAX_IOTYPE];
+    BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+} BlockNodeTiming;
+
 typedef struct BlockAcctCookie {
     int64_t bytes;
     int64_t start_time_ns;
@@ -119,5 +130,9 @@ double block_acct_queue_depth(BlockAcctTimedStats *stats,
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
+BlockNodeTiming *block_node_timing_new(uint64List *boundaries);
+void block_node_timing_free(BlockNodeTiming *timing);
+void block_node_timing_account(BlockNodeTiming *timing,
+                               enum BlockAcctType type, int64_t latency_ns);
 
 #endif
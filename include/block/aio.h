@@ -55,6 +55,24 @@ struct ThreadPool;
 struct LinuxAioState;
 struct LuringState;
 
+#ifdef CONFIG_LINUX_IO_URING
+typedef struct CqeHandler CqeHandler;
+typedef void CqeHandlerCb(CqeHandler *cqe_handler);
+
+/* Completion of a request submitted with aio_add_sqe() */
+struct CqeHandler {
+    /* Called by aio_poll() when the request has completed */
+    CqeHandlerCb *cb;
+
+    /* res and flags fields of the cqe, valid when cb is called */
+    int cqe_res;
+    uint32_t cqe_flags;
+
+    /* Used internally, do not access */
+    QSIMPLEQ_ENTRY(CqeHandler) next;
+};
+#endif
+
 /* Is polling disabled? */
 bool aio_poll_disabled(AioContext *ctx);
 
@@ -103,6 +121,17 @@ typedef struct {
      * Returns: true if ->wait() should be called, false otherwise.
      */
     bool (*need_wait)(AioContext *ctx);
+
+    /*
+     * dispatch:
+     * @ctx: the AioContext
+     *
+     * Invoke completion callbacks for requests that ->wait() found to be
+     * finished, other than file descriptor readiness.  May be NULL.
+     *
+     * Returns: true if progress was made, false otherwise.
+     */
+    bool (*dispatch)(AioContext *ctx);
 } FDMonOps;
 
 /*
@@ -196,6 +225,9 @@ struct AioContext {
      */
     struct ThreadPool *thread_pool;
 
+    /* Maximum number of worker threads in thread_pool */
+    int64_t thread_pool_max;
+
 #ifdef CONFIG_LINUX_AIO
     /*
      * State for native Linux AIO.  Uses aio_context_acquire/release for
@@ -213,6 +245,15 @@ struct AioContext {
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+
+    /* AioHandlers that are not re-armed while external clients are disabled */
+    AioHandlerList deferred_aio_handlers;
+
+    /* Completed aio_add_sqe() requests, see fdmon-io_uring.c */
+    QSIMPLEQ_HEAD(, CqeHandler) cqe_handler_ready_list;
+
+    /* aio_add_sqe() requests whose cb has not been called yet */
+    unsigned cqe_handlers_in_flight;
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -491,6 +532,40 @@ struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+#ifdef CONFIG_LINUX_IO_URING
+/**
+ * aio_has_io_uring:
+ * @ctx: the aio context
+ *
+ * Return true if @ctx monitors file descriptors with io_uring, which means
+ * that aio_add_sqe() can be used from its home thread.
+ */
+bool aio_has_io_uring(AioContext *ctx);
+
+/**
+ * aio_add_sqe:
+ * @prep_sqe: fills in the io_uring request
+ * @opaque: argument for @prep_sqe
+ * @cqe_handler: completion handler, must stay valid until @cb is called
+ *
+ * Queue an io_uring request on the ring that the current thread's
+ * AioContext uses for file descriptor monitoring.  The request is submitted
+ * by the next aio_poll(), together with any other pending requests, and
+ * @cqe_handler->cb is invoked from aio_poll() once it has completed.
+ *
+ * The number of requests in flight is limited so that their completions
+ * always fit in the ring.  Returns false without queueing the request if
+ * the limit has been reached; the caller must then submit it some other
+ * way or retry after one of its requests has completed.  @cqe_handler->cb
+ * can always resubmit its own request.
+ *
+ * Must only be called if aio_has_io_uring() is true for the current
+ * AioContext.
+ */
+bool aio_add_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                 void *opaque, CqeHandler *cqe_handler);
+#endif
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -704,6 +779,30 @@ void aio_context_destroy(AioContext *ctx);
 /* Used internally, do not call outside AioContext code */
 void aio_context_use_g_source(AioContext *ctx);
 
+/* Userspace polling statistics of one handler of an AioContext */
+typedef struct AioPollStats {
+    int fd;
+    bool polling;           /* is the handler currently polled? */
+    int64_t poll_ns;        /* polling time of the handler in nanoseconds */
+    uint64_t hits;          /* events seen by polling */
+    uint64_t misses;        /* events reported by the file descriptor */
+    int64_t avg_latency_ns; /* moving average of the time until an event */
+} AioPollStats;
+
+typedef void AioPollStatsFn(void *opaque, const AioPollStats *stats);
+
+/**
+ * aio_context_foreach_poll_stats:
+ * @ctx: the aio context
+ * @fn: function to call for each handler that supports polling
+ * @opaque: opaque argument for @fn
+ *
+ * Report the polling statistics of the handlers of @ctx.  Must be called
+ * from the home thread of @ctx.
+ */
+void aio_context_foreach_poll_stats(AioContext *ctx, AioPollStatsFn *fn,
+                                    void *opaque);
+
 /**
  * aio_context_set_poll_params:
  * @ctx: the aio context
@@ -717,4 +816,17 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_set_thread_pool_params:
+ * @ctx: the aio context
+ * @max: maximum number of worker threads in the context's thread pool
+ *
+ * If the thread pool already exists, no more than @max threads are started
+ * from now on.  When @max is lowered, threads above the new limit are not
+ * stopped right away: like any other worker, each exits once it has been
+ * idle for 10 seconds.
+ */
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t max,
+                                        Error **errp);
+
 #endif
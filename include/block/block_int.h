@@ -818,6 +818,23 @@ struct BdrvChild {
     QLIST_ENTRY(BdrvChild) next_parent;
 };
 
+/*
+ * Cache of block-status results for a protocol node, see
+ * block/block-status-cache.c.
+ */
+typedef struct BdrvBlockStatusCache {
+    QemuMutex lock;
+    /* Non-overlapping cached extents, sorted by offset.  Protected by lock. */
+    GTree *entries;
+    /* Bumped whenever extents are invalidated.  Accessed with atomic ops. */
+    unsigned gen;
+    /*
+     * true if holes may be cached, i.e. no other user shares the WRITE
+     * permission on this node.  Accessed with atomic ops.
+     */
+    bool cache_zero;
+} BdrvBlockStatusCache;
+
 /*
  * Note: the function bdrv_append() copies and swaps contents of
  * BlockDriverStates, so if you add new fields to this struct, please
@@ -990,6 +1007,15 @@ struct BlockDriverState {
 
     /* BdrvChild links to this node may never be frozen */
     bool never_freeze;
+
+    /* Cached block-status results, only used for protocol nodes */
+    BdrvBlockStatusCache bsc;
+
+    /*
+     * Read/write request timing, NULL unless enabled with
+     * block-node-timing-set.  Only changed in a drained section.
+     */
+    BlockNodeTiming *timing;
 };
 
 struct BlockBackendRootState {
@@ -1282,6 +1308,18 @@ void bdrv_root_unref_child(BdrvChild *child);
 
 void bdrv_get_cumulative_perm(BlockDriverState *bs, uint64_t *perm,
                               uint64_t *shared_perm);
+unsigned bdrv_graph_generation(void);
+
+void bdrv_bsc_init(BlockDriverState *bs);
+void bdrv_bsc_cleanup(BlockDriverState *bs);
+unsigned bdrv_bsc_generation(BlockDriverState *bs);
+bool bdrv_bsc_lookup(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                     int64_t *pnum, int *ret);
+void bdrv_bsc_fill(BlockDriverState *bs, unsigned gen,
+                   int64_t offset, int64_t bytes, int ret);
+void bdrv_bsc_invalidate_range(BlockDriverState *bs,
+                               int64_t offset, int64_t bytes);
+void bdrv_bsc_invalidate_all(BlockDriverState *bs);
 
 /**
  * Sets a BdrvChild's permissions.  Avoid if the parent is a BDS; use
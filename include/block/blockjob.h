@@ -149,6 +149,15 @@ void block_job_set_speed(BlockJob *job, int64_t speed, Error **errp);
  */
 BlockJobInfo *block_job_query(BlockJob *job, Error **errp);
 
+/**
+ * block_job_query_io_stats:
+ * @job: The job to get statistics for.
+ * @info: The information returned by block_job_query() for @job.
+ *
+ * Add copy performance statistics to @info if the job type provides them.
+ */
+void block_job_query_io_stats(BlockJob *job, BlockJobInfo *info);
+
 /**
  * block_job_iostatus_reset:
  * @job: The job whose I/O status should be reset.
@@ -52,6 +52,12 @@ struct BlockJobDriver {
      * besides job->blk to the new AioContext.
      */
     void (*attached_aio_context)(BlockJob *job, AioContext *new_context);
+
+    /*
+     * If the callback is not NULL, it is called by query-block-jobs to fill
+     * in copy performance statistics for the job.
+     */
+    void (*query_io_stats)(BlockJob *job, BlockJobIoStats *stats);
 };
 
 /**
@@ -20,6 +20,9 @@
 
 #include "block/block.h"
 
+#define THREAD_POOL_MAX_THREADS_DEFAULT 64
+#define THREAD_POOL_MAX_THREADS_LIMIT   256
+
 typedef int ThreadPoolFunc(void *opaque);
 
 typedef struct ThreadPool ThreadPool;
@@ -27,6 +30,9 @@ typedef struct ThreadPool ThreadPool;
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
 
+/* Apply the AioContext's thread pool parameters to an existing pool */
+void thread_pool_update_params(ThreadPool *pool, struct AioContext *ctx);
+
 BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg,
         BlockCompletionFunc *cb, void *opaque);
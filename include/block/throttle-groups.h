@@ -29,6 +29,12 @@
 #include "block/block_int.h"
 #include "qom/object.h"
 
+/* A request of a ThrottleGroupMember that is waiting in throttled_reqs */
+typedef struct ThrottleGroupWaiter {
+    int64_t start_ns;
+    QTAILQ_ENTRY(ThrottleGroupWaiter) next;
+} ThrottleGroupWaiter;
+
 /* The ThrottleGroupMember structure indicates membership in a ThrottleGroup
  * and holds related data.
  */
@@ -57,6 +63,11 @@ typedef struct ThrottleGroupMember {
     unsigned       pending_reqs[2];
     QLIST_ENTRY(ThrottleGroupMember) round_robin;
 
+    /* Scheduling class of the member's requests, and the requests that are
+     * waiting in throttled_reqs, oldest first. */
+    ThrottleGroupPriority priority;
+    QTAILQ_HEAD(, ThrottleGroupWaiter) waiters[2];
+
 } ThrottleGroupMember;
 
 #define TYPE_THROTTLE_GROUP "throttle-group"
@@ -69,6 +80,8 @@ void throttle_group_unref(ThrottleState *ts);
 
 void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg);
 void throttle_group_get_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg);
+void throttle_group_set_priority(ThrottleGroupMember *tgm,
+                                 ThrottleGroupPriority priority);
 
 void throttle_group_register_tgm(ThrottleGroupMember *tgm,
                                 const char *groupname,
@@ -79,6 +92,9 @@ void throttle_group_restart_tgm(ThrottleGroupMember *tgm);
 void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm,
                                                         unsigned int bytes,
                                                         bool is_write);
+int64_t throttle_group_latency_start(ThrottleGroupMember *tgm);
+void throttle_group_account_latency(ThrottleGroupMember *tgm,
+                                    int64_t start_ns);
 void throttle_group_attach_aio_context(ThrottleGroupMember *tgm,
                                        AioContext *new_context);
 void throttle_group_detach_aio_context(ThrottleGroupMember *tgm);
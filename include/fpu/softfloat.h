@@ -102,6 +102,15 @@ typedef enum {
 *----------------------------------------------------------------------------*/
 void float_raise(uint8_t flags, float_status *status);
 
+/*----------------------------------------------------------------------------
+| Return true if `status' allows an operation to be computed with the host
+| FPU, as the hardfloat fast paths do: the inexact flag is already set,
+| rounding is to nearest even, and hardfloat is not disabled for this build.
+| The caller must still leave denormal, infinite and NaN inputs, and results
+| that may be tiny, to softfloat.
+*----------------------------------------------------------------------------*/
+bool float_host_fpu_usable(const float_status *status);
+
 /*----------------------------------------------------------------------------
 | If `a' is denormal and we are in flush-to-zero mode then set the
 | input-denormal exception and return zero. Otherwise just return the value.
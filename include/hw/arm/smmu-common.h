@@ -111,7 +111,8 @@ struct SMMUState {
 
     GHashTable *smmu_pcibus_by_busptr;
     GHashTable *configs; /* cache for configuration data */
-    GHashTable *iotlb;
+    GHashTable *iotlb; /* SMMUIOTLBAsid sub-tables indexed by ASID */
+    unsigned int iotlb_size; /* number of entries in all sub-tables */
     SMMUPciBus *smmu_pcibus_by_bus_num[SMMU_PCI_BUS_MAX];
     PCIBus *pci_bus;
     QLIST_HEAD(, SMMUDevice) devices_with_notifiers;
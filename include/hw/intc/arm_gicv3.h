@@ -27,6 +27,7 @@ struct ARMGICv3Class {
     /*< public >*/
 
     DeviceRealize parent_realize;
+    DeviceReset parent_reset;
 };
 
 #endif
@@ -26,16 +26,23 @@
 
 #include "hw/sysbus.h"
 #include "hw/intc/arm_gic_common.h"
+#include "qemu/bitmap.h"
+#include "qemu/thread.h"
 #include "qom/object.h"
 
 /*
  * Maximum number of possible interrupts, determined by the GIC architecture.
- * Note that this does not include LPIs. When implemented, these should be
- * dealt with separately.
+ * Note that this does not include LPIs, which are dealt with separately.
  */
 #define GICV3_MAXIRQ 1020
 #define GICV3_MAXSPI (GICV3_MAXIRQ - GIC_INTERNAL)
 
+/* LPIs are numbered from 8192 up */
+#define GICV3_LPI_INTID_START 8192
+
+/* Number of distinct interrupt priority values */
+#define GICV3_PRIO_LEVELS 256
+
 #define GICV3_REDIST_SIZE 0x20000
 
 /* Number of SGI target-list bits */
@@ -140,6 +147,16 @@ typedef struct GICv3CPUState GICv3CPUState;
 #define GICV3_S 0
 #define GICV3_NS 1
 
+/* Outbound interrupt lines from the CPU interface to the CPU, used to
+ * index GICv3CPUState::line_level[]
+ */
+#define GICV3_LINE_IRQ 0
+#define GICV3_LINE_FIQ 1
+#define GICV3_LINE_VIRQ 2
+#define GICV3_LINE_VFIQ 3
+#define GICV3_LINE_MAINT 4
+#define GICV3_NUM_LINES 5
+
 typedef struct {
     int irq;
     uint8_t prio;
@@ -203,8 +220,46 @@ struct GICv3CPUState {
      * real state above; it doesn't need to be migrated.
      */
     PendingIrq hppi;
-    /* This is temporary working state, to avoid a malloc in gicv3_update() */
-    bool seenbetter;
+
+    /* LPI state. The LPI configuration and pending tables live in guest
+     * memory; while LPIs are enabled we keep a copy of the part of them
+     * which covers the LPIs we implement, so that looking for the highest
+     * priority pending LPI doesn't have to go to guest memory. The pending
+     * state is only written back to the guest's table when LPIs are
+     * disabled or the VM stops, and changes to the configuration table
+     * only take effect after an invalidation, as the architecture permits.
+     * Like hppi, this is rebuilt from guest memory after migration.
+     */
+    uint32_t lpi_nr;            /* number of LPIs covered by the cache */
+    uint8_t *lpi_cfg;           /* LPI configuration bytes */
+    unsigned long *lpi_pending; /* LPI pending bits */
+    /* Highest priority pending enabled LPI (cached, like hppi) */
+    PendingIrq hpplpi;
+
+    /* The SGIs, PPIs and SPIs which are eligible to be signaled to this
+     * CPU, filed by priority so that hppi can be found without looking
+     * at every interrupt. hpp_bmp holds a bitmap of s->num_irq bits for
+     * each priority; hpp_count[] counts the bits set in each of them and
+     * hpp_prio has a bit set for each priority whose count is nonzero.
+     * Priority 0xff can never be signaled, so it is never filed.
+     * Like hppi, this is cached state and isn't migrated.
+     */
+    unsigned long *hpp_bmp;
+    uint16_t hpp_count[GICV3_PRIO_LEVELS];
+    DECLARE_BITMAP(hpp_prio, GICV3_PRIO_LEVELS);
+    /* Which SGIs and PPIs are filed, and at what priority */
+    uint32_t hpp_private;
+    uint8_t hpp_private_prio[GIC_INTERNAL];
+    /* Set when the filed interrupts change and hppi must be recomputed */
+    bool hpp_dirty;
+
+    /* Levels of the outbound interrupt lines, as last computed by the
+     * CPU interface, or -1 if the CPU's view of the line is not known.
+     * The lines themselves are only set once the GIC lock has been
+     * dropped; lines_dirty has a bit set for each line to be updated.
+     */
+    int line_level[GICV3_NUM_LINES];
+    unsigned int lines_dirty;
 };
 
 struct GICv3State {
@@ -223,10 +278,23 @@ struct GICv3State {
     bool security_extn;
     bool irq_reset_nonsecure;
     bool gicd_no_migration_shift_bug;
+    bool lpi_enable;
+
+    /* Memory the LPI tables and ITS tables live in (emulated GIC only) */
+    MemoryRegion *dma;
+    AddressSpace dma_as;
 
     int dev_fd; /* kvm device fd if backed by kvm vgic support */
     Error *migration_blocker;
 
+    /* The emulated GIC's state is protected by this lock rather than by
+     * the BQL, so that vCPUs can use the CPU interface and distributor
+     * concurrently. It is taken after the BQL when both are needed.
+     * lines_dirty is set when some CPU's outbound lines need updating.
+     */
+    QemuRecMutex lock;
+    bool lines_dirty;
+
     /* Distributor */
 
     /* for a GIC with the security extensions the NS banked version of this
@@ -247,6 +315,13 @@ struct GICv3State {
      * in the IROUTER registers
      */
     GICv3CPUState *gicd_irouter_target[GICV3_MAXIRQ];
+    /* Where each SPI is filed in the per-CPU hpp_bmp (see GICv3CPUState);
+     * hpp_spi_target[] and hpp_spi_prio[] are only valid for the SPIs
+     * whose bit is set in hpp_spi_filed.
+     */
+    GIC_DECLARE_BITMAP(hpp_spi_filed);
+    GICv3CPUState *hpp_spi_target[GICV3_MAXIRQ];
+    uint8_t hpp_spi_prio[GICV3_MAXIRQ];
     uint32_t gicd_nsacr[DIV_ROUND_UP(GICV3_MAXIRQ, 16)];
 
     GICv3CPUState *cpu;
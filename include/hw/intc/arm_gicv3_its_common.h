@@ -31,10 +31,14 @@
 
 #define GITS_CTLR        0x0
 #define GITS_IIDR        0x4
+#define GITS_TYPER       0x8
 #define GITS_CBASER      0x80
 #define GITS_CWRITER     0x88
 #define GITS_CREADR      0x90
 #define GITS_BASER       0x100
+#define GITS_IDREGS      0xFFD0
+
+#define GITS_TRANSLATER  0x0040
 
 struct GICv3ITSState {
     SysBusDevice parent_obj;
@@ -36,6 +36,8 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    uint32_t num_iothreads;
+    char **iothreads;   /* IDs of the iothreads that virtqueues are mapped to */
     char *serial;
     uint32_t request_merging;
     uint16_t num_queues;
@@ -79,6 +81,9 @@ typedef struct VirtIOBlockReq {
     struct VirtIOBlockReq *next;
     struct VirtIOBlockReq *mr_next;
     BlockAcctCookie acct;
+    /* Pushed to the used ring in the AioContext of the virtqueue */
+    bool push_pending;
+    QSIMPLEQ_ENTRY(VirtIOBlockReq) complete_next;
 } VirtIOBlockReq;
 
 #define VIRTIO_BLK_MAX_MERGE_REQS 32
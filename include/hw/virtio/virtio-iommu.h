@@ -31,12 +31,26 @@ OBJECT_DECLARE_SIMPLE_TYPE(VirtIOIOMMU, VIRTIO_IOMMU)
 
 #define TYPE_VIRTIO_IOMMU_MEMORY_REGION "virtio-iommu-memory-region"
 
+#define VIOMMU_IOTLB_SIZE 64
+
+/*
+ * Cached translation of one page of an endpoint.  Valid only while @gen
+ * matches VirtIOIOMMU.iotlb_gen.
+ */
+typedef struct VirtIOIOMMUTLBEntry {
+    uint64_t iova;              /* page aligned */
+    uint64_t translated_addr;
+    uint64_t gen;
+    uint32_t flags;             /* VIRTIO_IOMMU_MAP_F_* of the mapping */
+} VirtIOIOMMUTLBEntry;
+
 typedef struct IOMMUDevice {
     void         *viommu;
     PCIBus       *bus;
     int           devfn;
     IOMMUMemoryRegion  iommu_mr;
     AddressSpace  as;
+    VirtIOIOMMUTLBEntry iotlb[VIOMMU_IOTLB_SIZE];
 } IOMMUDevice;
 
 typedef struct IOMMUPciBus {
@@ -58,6 +72,7 @@ struct VirtIOIOMMU {
     GTree *domains;
     QemuMutex mutex;
     GTree *endpoints;
+    uint64_t iotlb_gen; /* bumped whenever cached translations go stale */
 };
 
 #endif
@@ -19,6 +19,7 @@
 #include "hw/virtio/virtio.h"
 #include "net/announce.h"
 #include "qemu/option_int.h"
+#include "sysemu/iothread.h"
 #include "qom/object.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
@@ -45,6 +46,8 @@ typedef struct virtio_net_conf
     char *duplex_str;
     uint8_t duplex;
     char *primary_id_str;
+    uint32_t num_iothreads;
+    char **iothreads;   /* IDs of the iothreads that queue pairs are mapped to */
 } virtio_net_conf;
 
 /* Coalesced packets type & status */
@@ -148,6 +151,16 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* Used ring entries filled during a receive batch but not flushed yet */
+    unsigned int rx_batch_pending;
+    /* IOThread that runs the queue pair while the dataplane is started */
+    unsigned int iothread_index;
+    AioContext *ctx;
+    /* Packets that RSS steered to this queue from another IOThread */
+    QSLIST_HEAD(, VirtIONetRxSteered) rx_steered;
+    unsigned int rx_steered_count;
+    QEMUBH *rx_steer_bh;
+    struct NetRxPkt *rx_pkt;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -163,6 +176,11 @@ struct VirtIONet {
     QTAILQ_HEAD(, VirtioNetRscChain) rsc_chains;
     uint32_t tx_timeout;
     int32_t tx_burst;
+    /*
+     * Nesting level of receive batches per IOThread (or just one without
+     * iothreads), see virtio_net_receive_batch_end()
+     */
+    unsigned int *rx_batch_depth;
     uint32_t has_vnet_hdr;
     size_t host_hdr_len;
     size_t guest_hdr_len;
@@ -202,6 +220,8 @@ struct VirtIONet {
     AnnounceTimer announce_timer;
     bool needs_vnet_hdr_swap;
     bool mtu_bypass_backend;
+    /* Offer host offloads even if the peer does not take a vnet header */
+    bool sw_offload;
     QemuOpts *primary_device_opts;
     QDict *primary_device_dict;
     DeviceState *primary_dev;
@@ -213,7 +233,8 @@ struct VirtIONet {
     DeviceListener primary_listener;
     Notifier migration_state;
     VirtioNetRssData rss_data;
-    struct NetRxPkt *rx_pkt;
+    IOThread **iothreads;
+    bool dataplane_started;
 };
 
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
@@ -47,6 +47,7 @@ size_t virtio_feature_get_config_size(VirtIOFeature *features,
                                       uint64_t host_features);
 
 typedef struct VirtQueue VirtQueue;
+typedef struct VirtQueueElementPool VirtQueueElementPool;
 
 #define VIRTQUEUE_MAX_SIZE 1024
 
@@ -61,6 +62,8 @@ typedef struct VirtQueueElement
     hwaddr *out_addr;
     struct iovec *in_sg;
     struct iovec *out_sg;
+    /* private: pool the element was allocated from, or NULL */
+    VirtQueueElementPool *pool;
 } VirtQueueElement;
 
 #define VIRTIO_QUEUE_MAX 1024
@@ -186,6 +189,8 @@ void virtio_delete_queue(VirtQueue *vq);
 
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len);
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *lens, unsigned int n);
 void virtqueue_flush(VirtQueue *vq, unsigned int count);
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len);
@@ -197,6 +202,11 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+void virtqueue_free_element(void *elem);
+void virtio_queue_enable_element_pool(VirtQueue *vq, size_t sz,
+                                      unsigned int max_sg);
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz,
+                                 void **elems, unsigned int n);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -0,0 +1,37 @@
+/*
+ * Software segmentation and checksum offload
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_NET_GSO_H
+#define QEMU_NET_GSO_H
+
+#include "net/net.h"
+#include "standard-headers/linux/virtio_net.h"
+
+/**
+ * net_gso_sendv:
+ * @nc: the client to send from
+ * @hdr: the offloads requested for the packet, in host byte order
+ * @iov: the Ethernet frame, without virtio-net header
+ * @iovcnt: number of elements in @iov
+ * @sent_cb: completion callback, see qemu_sendv_packet_async()
+ *
+ * Send a frame on behalf of a guest that was told the backend supports
+ * checksum offload and TSO/UFO, to a peer that does not take a vnet
+ * header.  The checksum is filled in and frames larger than
+ * @hdr->gso_size are split into TCP segments or IP fragments, which
+ * are sent one by one.  Only the last of them is sent with @sent_cb.
+ *
+ * The frame is not modified.  Malformed frames are dropped.
+ *
+ * Returns: the result of qemu_sendv_packet_async() for the last frame
+ * that was sent, i.e. 0 if it was queued and @sent_cb will be called.
+ */
+ssize_t net_gso_sendv(NetClientState *nc, const struct virtio_net_hdr *hdr,
+                      const struct iovec *iov, int iovcnt,
+                      NetPacketSent *sent_cb);
+
+#endif /* QEMU_NET_GSO_H */
@@ -122,6 +122,23 @@ bool qemu_in_coroutine(void);
  */
 bool qemu_coroutine_entered(Coroutine *co);
 
+/**
+ * Increase the coroutine pool size
+ *
+ * Callers that can have many coroutines in flight at the same time, e.g. one
+ * per request of a device queue, should add their expected number of
+ * coroutines here so that terminated coroutines are recycled instead of
+ * being freed and reallocated.  The pool size is shared by all threads.
+ */
+void qemu_coroutine_inc_pool_size(unsigned int additional_pool_size);
+
+/**
+ * Decrease the coroutine pool size
+ *
+ * Undo a previous qemu_coroutine_inc_pool_size() call.
+ */
+void qemu_coroutine_dec_pool_size(unsigned int removing_pool_size);
+
 /**
  * Provides a mutex that can be used to synchronise coroutines
  */
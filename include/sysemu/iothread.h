@@ -37,6 +37,9 @@ struct IOThread {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* Maximum number of thread pool workers */
+    int64_t thread_pool_max;
 };
 typedef struct IOThread IOThread;
 
@@ -16,7 +16,9 @@
 #include "qom/object_interfaces.h"
 #include "qemu/module.h"
 #include "block/aio.h"
+#include "block/aio-wait.h"
 #include "block/block.h"
+#include "block/thread-pool.h"
 #include "sysemu/iothread.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-misc.h"
@@ -113,6 +115,7 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
@@ -190,6 +193,16 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         return;
     }
 
+    aio_context_set_thread_pool_params(iothread->ctx,
+                                       iothread->thread_pool_max,
+                                       &local_error);
+    if (local_error) {
+        error_propagate(errp, local_error);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
     /* This assumes we are called from a thread with useful CPU affinity for us
      * to inherit.
      */
@@ -259,6 +272,37 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static void iothread_get_thread_pool_max(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_int64(v, name, &iothread->thread_pool_max, errp);
+}
+
+static void iothread_set_thread_pool_max(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    int64_t value;
+
+    if (!visit_type_int64(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value < 1 || value > THREAD_POOL_MAX_THREADS_LIMIT) {
+        error_setg(errp, "thread-pool-max value must be in range [1, %d]",
+                   THREAD_POOL_MAX_THREADS_LIMIT);
+        return;
+    }
+
+    iothread->thread_pool_max = value;
+
+    if (iothread->ctx) {
+        aio_context_set_thread_pool_params(iothread->ctx, value, errp);
+    }
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
@@ -276,6 +320,10 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add(klass, "thread-pool-max", "int",
+                              iothread_get_thread_pool_max,
+                              iothread_set_thread_pool_max,
+                              NULL, NULL);
 }
 
 static const TypeInfo iothread_info = {
@@ -308,9 +356,46 @@ AioContext *iothread_get_aio_context(IOThread *iothread)
     return iothread->ctx;
 }
 
+typedef struct {
+    IOThreadInfoList ***prev;
+    bool poll_stats;
+} QueryIOThreadsData;
+
+static void query_one_poll_handler(void *opaque, const AioPollStats *stats)
+{
+    IOThreadPollHandlerInfoList ***prev = opaque;
+    IOThreadPollHandlerInfoList *elem;
+    IOThreadPollHandlerInfo *info;
+
+    info = g_new0(IOThreadPollHandlerInfo, 1);
+    info->fd = stats->fd;
+    info->polling = stats->polling;
+    info->poll_ns = stats->poll_ns;
+    info->hits = stats->hits;
+    info->misses = stats->misses;
+    info->avg_latency_ns = stats->avg_latency_ns;
+
+    elem = g_new0(IOThreadPollHandlerInfoList, 1);
+    elem->value = info;
+
+    **prev = elem;
+    *prev = &elem->next;
+}
+
+/* Runs in the iothread, which owns the polling state of its handlers */
+static void query_poll_handlers_bh(void *opaque)
+{
+    IOThreadInfo *info = opaque;
+    IOThreadPollHandlerInfoList **prev = &info->poll_handlers;
+
+    aio_context_foreach_poll_stats(qemu_get_current_aio_context(),
+                                   query_one_poll_handler, &prev);
+    info->has_poll_handlers = !!info->poll_handlers;
+}
+
 static int query_one_iothread(Object *object, void *opaque)
 {
-    IOThreadInfoList ***prev = opaque;
+    QueryIOThreadsData *data = opaque;
     IOThreadInfoList *elem;
     IOThreadInfo *info;
     IOThread *iothread;
@@ -327,22 +412,33 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
 
+    if (data->poll_stats && iothread->ctx) {
+        aio_context_acquire(iothread->ctx);
+        aio_wait_bh_oneshot(iothread->ctx, query_poll_handlers_bh, info);
+        aio_context_release(iothread->ctx);
+    }
+
     elem = g_new0(IOThreadInfoList, 1);
     elem->value = info;
     elem->next = NULL;
 
-    **prev = elem;
-    *prev = &elem->next;
+    **data->prev = elem;
+    *data->prev = &elem->next;
     return 0;
 }
 
-IOThreadInfoList *qmp_query_iothreads(Error **errp)
+IOThreadInfoList *qmp_query_iothreads(bool has_poll_stats, bool poll_stats,
+                                      Error **errp)
 {
     IOThreadInfoList *head = NULL;
     IOThreadInfoList **prev = &head;
+    QueryIOThreadsData data = {
+        .prev = &prev,
+        .poll_stats = has_poll_stats && poll_stats,
+    };
     Object *container = object_get_objects_root();
 
-    object_child_foreach(container, query_one_iothread, &prev);
+    object_child_foreach(container, query_one_iothread, &data);
     return head;
 }
 
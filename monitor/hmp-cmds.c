@@ -1910,7 +1910,7 @@ void hmp_info_memory_devices(Monitor *mon, const QDict *qdict)
 
 void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
 {
-    IOThreadInfoList *info_list = qmp_query_iothreads(NULL);
+    IOThreadInfoList *info_list = qmp_query_iothreads(false, false, NULL);
     IOThreadInfoList *info;
     IOThreadInfo *value;
 
@@ -19,24 +19,44 @@
 #include "net/checksum.h"
 #include "net/eth.h"
 
+/*
+ * The one's complement sum does not depend on byte order (RFC 1071), so
+ * sum the buffer in 64-bit host-endian words, which the compiler can
+ * unroll and vectorize, and only fix up the byte order of the folded
+ * result.  The 64-bit accumulator cannot overflow for any int length.
+ */
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
-    uint32_t sum1 = 0, sum2 = 0;
+    uint64_t sum = 0;
+    uint32_t res;
     int i;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    for (i = 0; i + 8 <= len; i += 8) {
+        uint64_t w = ldq_he_p(buf + i);
+        sum += (w & 0xffffffff) + (w >> 32);
     }
     if (i < len) {
-        sum1 += (uint32_t)buf[i];
+        uint8_t tail[8] = { 0 };
+        uint64_t w;
+
+        memcpy(tail, buf + i, len - i);
+        w = ldq_he_p(tail);
+        sum += (w & 0xffffffff) + (w >> 32);
     }
 
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    res = (sum & 0xffff) + (sum >> 16);
+    res = (res & 0xffff) + (res >> 16);
+
+#ifndef HOST_WORDS_BIGENDIAN
+    res = bswap16(res);
+#endif
+    /* A chunk that starts at an odd offset has its bytes swapped */
     if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
+        res = bswap16(res);
     }
+    return res;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
@@ -0,0 +1,307 @@
+/*
+ * Software segmentation and checksum offload
+ *
+ * Guests that are offered checksum offload and TSO/UFO hand over frames
+ * of up to 64 KB whose checksum is left for the device to fill in.
+ * Backends that take a vnet header pass that work on to the host kernel;
+ * for all others it is done here, so that the guest still gets to send
+ * large frames and pays the per-packet cost of its network stack and of
+ * the virtqueue only once for all segments.
+ *
+ * Segments reference the payload in the original frame; only the headers
+ * are copied and fixed up for each of them.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/iov.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/gso.h"
+#include "trace.h"
+
+/* Longest L2 + L3 + L4 header that is handled, including options */
+#define NET_GSO_MAX_HDR_LEN 512
+
+/* IPv6 fragment header */
+#define NET_GSO_IP6_FRAG_HDR_LEN 8
+
+/* Identification of IPv6 fragments, which the guest does not provide */
+static uint32_t net_gso_ip6_frag_id;
+
+static ssize_t net_gso_drop(NetClientState *nc,
+                            const struct virtio_net_hdr *hdr,
+                            const struct iovec *iov, int iovcnt,
+                            const char *reason)
+{
+    trace_net_gso_drop(nc, hdr->gso_type, reason);
+    return iov_size(iov, iovcnt);
+}
+
+/* Fill in the checksum at csum_start + csum_offset */
+static ssize_t net_gso_send_csum(NetClientState *nc,
+                                 const struct virtio_net_hdr *hdr,
+                                 const struct iovec *iov, int iovcnt,
+                                 NetPacketSent *sent_cb)
+{
+    size_t size = iov_size(iov, iovcnt);
+    size_t csum_end = hdr->csum_start + hdr->csum_offset + sizeof(uint16_t);
+    uint8_t buf[NET_GSO_MAX_HDR_LEN];
+    g_autofree struct iovec *seg = NULL;
+    uint32_t sum;
+    int cnt;
+
+    if (csum_end > size || csum_end > sizeof(buf)) {
+        return net_gso_drop(nc, hdr, iov, iovcnt, "bad checksum offset");
+    }
+
+    /*
+     * The checksum field holds the pseudo-header sum, so it is simply
+     * summed with the rest of the data.
+     */
+    iov_to_buf(iov, iovcnt, 0, buf, csum_end);
+    sum = net_checksum_add_iov(iov, iovcnt, hdr->csum_start,
+                               size - hdr->csum_start, 0);
+    stw_be_p(buf + csum_end - sizeof(uint16_t),
+             net_checksum_finish_nozero(sum));
+
+    seg = g_new(struct iovec, iovcnt + 1);
+    seg[0].iov_base = buf;
+    seg[0].iov_len = csum_end;
+    cnt = iov_copy(&seg[1], iovcnt, iov, iovcnt, csum_end, -1);
+
+    return qemu_sendv_packet_async(nc, seg, cnt + 1, sent_cb);
+}
+
+static ssize_t net_gso_send_tcp(NetClientState *nc,
+                                const struct virtio_net_hdr *hdr,
+                                const struct iovec *iov, int iovcnt,
+                                NetPacketSent *sent_cb)
+{
+    size_t size = iov_size(iov, iovcnt);
+    bool isip4, isip6, isudp, istcp;
+    size_t l3off = 0, l4off = 0, l5off = 0;
+    eth_ip6_hdr_info ip6info;
+    eth_ip4_hdr_info ip4info;
+    eth_l4_hdr_info l4info;
+    uint8_t buf[NET_GSO_MAX_HDR_LEN];
+    g_autofree struct iovec *seg = NULL;
+    struct ip_header *ip;
+    struct ip6_header *ip6;
+    tcp_header *tcp;
+    size_t payload, mss, off;
+    uint32_t seq;
+    uint16_t ip_id, flags;
+    ssize_t ret;
+    int i;
+
+    eth_get_protocols(iov, iovcnt, &isip4, &isip6, &isudp, &istcp,
+                      &l3off, &l4off, &l5off, &ip6info, &ip4info, &l4info);
+    if (!istcp || l5off > size || l5off > sizeof(buf)) {
+        return net_gso_drop(nc, hdr, iov, iovcnt, "not a TCP frame");
+    }
+    if ((isip4 && l4off < l3off + sizeof(struct ip_header)) ||
+        l5off < l4off + sizeof(tcp_header)) {
+        return net_gso_drop(nc, hdr, iov, iovcnt, "bad header length");
+    }
+    if (!hdr->gso_size) {
+        return net_gso_drop(nc, hdr, iov, iovcnt, "no segment size");
+    }
+
+    iov_to_buf(iov, iovcnt, 0, buf, l5off);
+    ip = (struct ip_header *)(buf + l3off);
+    ip6 = (struct ip6_header *)(buf + l3off);
+    tcp = (tcp_header *)(buf + l4off);
+
+    seq = ldl_be_p(&tcp->th_seq);
+    flags = lduw_be_p(&tcp->th_offset_flags);
+    ip_id = isip4 ? lduw_be_p(&ip->ip_id) : 0;
+    payload = size - l5off;
+    mss = MIN(hdr->gso_size, UINT16_MAX - (l5off - l3off));
+
+    seg = g_new(struct iovec, iovcnt + 1);
+    seg[0].iov_base = buf;
+    seg[0].iov_len = l5off;
+
+    off = 0;
+    i = 0;
+    do {
+        size_t len = MIN(payload - off, mss);
+        bool last = off + len == payload;
+        uint16_t tcp_len = l5off - l4off + len;
+        uint16_t seg_flags = flags;
+        uint32_t sum, cso;
+        int cnt;
+
+        /* Like the Linux GSO code: CWR only once, FIN and PSH at the end */
+        if (i) {
+            seg_flags &= ~TH_CWR;
+        }
+        if (!last) {
+            seg_flags &= ~(TH_FIN | TH_PUSH);
+        }
+        stw_be_p(&tcp->th_offset_flags, seg_flags);
+        stl_be_p(&tcp->th_seq, seq + off);
+        stw_be_p(&tcp->th_sum, 0);
+
+        if (isip4) {
+            stw_be_p(&ip->ip_len, l4off - l3off + tcp_len);
+            stw_be_p(&ip->ip_id, ip_id + i);
+            eth_fix_ip4_checksum(ip, l4off - l3off);
+            sum = eth_calc_ip4_pseudo_hdr_csum(ip, tcp_len, &cso);
+        } else {
+            stw_be_p(&ip6->ip6_plen, l4off - l3off - sizeof(*ip6) + tcp_len);
+            sum = eth_calc_ip6_pseudo_hdr_csum(ip6, tcp_len, IP_PROTO_TCP,
+                                               &cso);
+        }
+        sum += net_checksum_add(l5off - l4off, (uint8_t *)tcp);
+        sum += net_checksum_add_iov(iov, iovcnt, l5off + off, len,
+                                    l5off - l4off);
+        stw_be_p(&tcp->th_sum, net_checksum_finish(sum));
+
+        cnt = iov_copy(&seg[1], iovcnt, iov, iovcnt, l5off + off, len);
+        ret = qemu_sendv_packet_async(nc, seg, cnt + 1,
+                                      last ? sent_cb : NULL);
+        off += len;
+        i++;
+    } while (off < payload);
+
+    return ret;
+}
+
+static ssize_t net_gso_send_udp(NetClientState *nc,
+                                const struct virtio_net_hdr *hdr,
+                                const struct iovec *iov, int iovcnt,
+                                NetPacketSent *sent_cb)
+{
+    size_t size = iov_size(iov, iovcnt);
+    bool isip4, isip6, isudp, istcp;
+    size_t l3off = 0, l4off = 0, l5off = 0;
+    eth_ip6_hdr_info ip6info;
+    eth_ip4_hdr_info ip4info;
+    eth_l4_hdr_info l4info;
+    uint8_t buf[NET_GSO_MAX_HDR_LEN];
+    uint8_t fbuf[NET_GSO_MAX_HDR_LEN + NET_GSO_IP6_FRAG_HDR_LEN];
+    g_autofree struct iovec *dgram = NULL;
+    g_autofree struct iovec *seg = NULL;
+    udp_header *udp;
+    size_t udp_len, frag, off, fhdr_len;
+    uint32_t sum, cso, frag_id = 0;
+    uint8_t *fh = NULL;
+    ssize_t ret;
+    int dcnt;
+
+    eth_get_protocols(iov, iovcnt, &isip4, &isip6, &isudp, &istcp,
+                      &l3off, &l4off, &l5off, &ip6info, &ip4info, &l4info);
+    if (!isudp || l5off > size || l5off > sizeof(buf)) {
+        return net_gso_drop(nc, hdr, iov, iovcnt, "not a UDP frame");
+    }
+    if (isip4 && l4off < l3off + sizeof(struct ip_header)) {
+        return net_gso_drop(nc, hdr, iov, iovcnt, "bad header length");
+    }
+    /* The fragment header would have to go after some extension headers */
+    if (isip6 && l4off != l3off + sizeof(struct ip6_header)) {
+        return net_gso_drop(nc, hdr, iov, iovcnt, "IPv6 extension headers");
+    }
+    udp_len = size - l4off;
+    frag = IP_FRAG_ALIGN_SIZE(hdr->gso_size);
+    if (!frag || l4off - l3off + udp_len > UINT16_MAX) {
+        return net_gso_drop(nc, hdr, iov, iovcnt, "bad datagram size");
+    }
+
+    /* Checksum the whole datagram, the fragments carry no UDP header */
+    iov_to_buf(iov, iovcnt, 0, buf, l5off);
+    udp = (udp_header *)(buf + l4off);
+    stw_be_p(&udp->uh_ulen, udp_len);
+    stw_be_p(&udp->uh_sum, 0);
+    if (isip4) {
+        sum = eth_calc_ip4_pseudo_hdr_csum((struct ip_header *)(buf + l3off),
+                                           udp_len, &cso);
+    } else {
+        sum = eth_calc_ip6_pseudo_hdr_csum((struct ip6_header *)(buf + l3off),
+                                           udp_len, IP_PROTO_UDP, &cso);
+    }
+    sum += net_checksum_add(sizeof(*udp), (uint8_t *)udp);
+    sum += net_checksum_add_iov(iov, iovcnt, l5off, size - l5off,
+                                sizeof(*udp));
+    stw_be_p(&udp->uh_sum, net_checksum_finish_nozero(sum));
+
+    dgram = g_new(struct iovec, iovcnt + 1);
+    dgram[0].iov_base = buf;
+    dgram[0].iov_len = l5off;
+    dcnt = iov_copy(&dgram[1], iovcnt, iov, iovcnt, l5off, -1) + 1;
+
+    if (udp_len <= frag) {
+        return qemu_sendv_packet_async(nc, dgram, dcnt, sent_cb);
+    }
+
+    memcpy(fbuf, buf, l4off);
+    fhdr_len = l4off;
+    if (isip4) {
+        struct ip_header *ip = (struct ip_header *)(fbuf + l3off);
+
+        stw_be_p(&ip->ip_off, 0);
+    } else {
+        struct ip6_header *ip6 = (struct ip6_header *)(fbuf + l3off);
+
+        ip6->ip6_nxt = IP6_FRAGMENT;
+        fh = fbuf + l4off;
+        fh[0] = IP_PROTO_UDP;
+        fh[1] = 0;
+        fhdr_len += NET_GSO_IP6_FRAG_HDR_LEN;
+        frag_id = qatomic_fetch_inc(&net_gso_ip6_frag_id);
+    }
+
+    seg = g_new(struct iovec, dcnt + 1);
+    seg[0].iov_base = fbuf;
+    seg[0].iov_len = fhdr_len;
+
+    off = 0;
+    do {
+        size_t len = MIN(udp_len - off, frag);
+        bool more = off + len < udp_len;
+        int cnt;
+
+        if (isip4) {
+            eth_setup_ip4_fragmentation(fbuf, l3off, fbuf + l3off,
+                                        l4off - l3off, len, off, more);
+            eth_fix_ip4_checksum(fbuf + l3off, l4off - l3off);
+        } else {
+            struct ip6_header *ip6 = (struct ip6_header *)(fbuf + l3off);
+
+            stw_be_p(&ip6->ip6_plen, NET_GSO_IP6_FRAG_HDR_LEN + len);
+            stw_be_p(fh + 2, off | more);
+            stl_be_p(fh + 4, frag_id);
+        }
+
+        cnt = iov_copy(&seg[1], dcnt, dgram, dcnt, l4off + off, len);
+        ret = qemu_sendv_packet_async(nc, seg, cnt + 1,
+                                      more ? NULL : sent_cb);
+        off += len;
+    } while (off < udp_len);
+
+    return ret;
+}
+
+ssize_t net_gso_sendv(NetClientState *nc, const struct virtio_net_hdr *hdr,
+                      const struct iovec *iov, int iovcnt,
+                      NetPacketSent *sent_cb)
+{
+    switch (hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) {
+    case VIRTIO_NET_HDR_GSO_NONE:
+        if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+            return net_gso_send_csum(nc, hdr, iov, iovcnt, sent_cb);
+        }
+        return qemu_sendv_packet_async(nc, iov, iovcnt, sent_cb);
+    case VIRTIO_NET_HDR_GSO_TCPV4:
+    case VIRTIO_NET_HDR_GSO_TCPV6:
+        return net_gso_send_tcp(nc, hdr, iov, iovcnt, sent_cb);
+    case VIRTIO_NET_HDR_GSO_UDP:
+        return net_gso_send_udp(nc, hdr, iov, iovcnt, sent_cb);
+    default:
+        return net_gso_drop(nc, hdr, iov, iovcnt, "unknown GSO type");
+    }
+}
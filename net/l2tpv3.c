@@ -449,7 +449,10 @@ static void net_l2tpv3_send(void *opaque)
         s->queue_head = (s->queue_head + count) % MAX_L2TPV3_MSGCNT;
         s->queue_depth += count;
     }
+
+    qemu_send_packet_batch_begin(&s->nc);
     net_l2tpv3_process_queue(s);
+    qemu_send_packet_batch_end(&s->nc);
 }
 
 static void destroy_vector(struct mmsghdr *msgvec, int count, int iovcount)
@@ -45,6 +45,7 @@
 #include "qemu/ctype.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
+#include "block/aio-wait.h"
 #include "qemu/option.h"
 #include "qapi/error.h"
 #include "qapi/opts-visitor.h"
@@ -523,6 +524,23 @@ int qemu_set_vnet_be(NetClientState *nc, bool is_be)
 #endif
 }
 
+/*
+ * Move the handlers of @nc, e.g. for its file descriptor, to @ctx, or back
+ * to the main loop if @ctx is NULL.  Must be called either from the thread
+ * that runs the handlers, or with the BQL and the AioContext held while the
+ * client's peer does not send packets to it.
+ */
+int qemu_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    if (!nc || !nc->info->set_aio_context) {
+        return -ENOSYS;
+    }
+
+    nc->info->set_aio_context(nc, ctx);
+    nc->ctx = ctx;
+    return 0;
+}
+
 int qemu_can_send_packet(NetClientState *sender)
 {
     int vm_running = runstate_is_running();
@@ -626,12 +644,35 @@ void qemu_flush_queued_packets(NetClientState *nc)
     qemu_flush_or_purge_queued_packets(nc, false);
 }
 
+/*
+ * Packets for a client that runs in an IOThread may only be queued from
+ * that IOThread, or with its AioContext held.
+ */
+static AioContext *qemu_net_peer_lock(NetClientState *sender)
+{
+    AioContext *ctx = sender->peer->ctx;
+
+    if (!ctx || in_aio_context_home_thread(ctx)) {
+        return NULL;
+    }
+    aio_context_acquire(ctx);
+    return ctx;
+}
+
+static void qemu_net_peer_unlock(AioContext *ctx)
+{
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
 static ssize_t qemu_send_packet_async_with_flags(NetClientState *sender,
                                                  unsigned flags,
                                                  const uint8_t *buf, int size,
                                                  NetPacketSent *sent_cb)
 {
     NetQueue *queue;
+    AioContext *ctx;
     int ret;
 
 #ifdef DEBUG_NET
@@ -643,22 +684,27 @@ static ssize_t qemu_send_packet_async_with_flags(NetClientState *sender,
         return size;
     }
 
+    ctx = qemu_net_peer_lock(sender);
+
     /* Let filters handle the packet first */
     ret = filter_receive(sender, NET_FILTER_DIRECTION_TX,
                          sender, flags, buf, size, sent_cb);
     if (ret) {
-        return ret;
+        goto out;
     }
 
     ret = filter_receive(sender->peer, NET_FILTER_DIRECTION_RX,
                          sender, flags, buf, size, sent_cb);
     if (ret) {
-        return ret;
+        goto out;
     }
 
     queue = sender->peer->incoming_queue;
 
-    return qemu_net_queue_send(queue, sender, flags, buf, size, sent_cb);
+    ret = qemu_net_queue_send(queue, sender, flags, buf, size, sent_cb);
+out:
+    qemu_net_peer_unlock(ctx);
+    return ret;
 }
 
 ssize_t qemu_send_packet_async(NetClientState *sender,
@@ -669,6 +715,30 @@ ssize_t qemu_send_packet_async(NetClientState *sender,
                                              buf, size, sent_cb);
 }
 
+/*
+ * Tell the peer that several packets are about to be sent in a row, so that
+ * it can defer per-packet work like guest notifications until
+ * qemu_send_packet_batch_end().  Calls must be balanced and must not span
+ * a return to the main loop.
+ */
+void qemu_send_packet_batch_begin(NetClientState *nc)
+{
+    NetClientState *peer = nc->peer;
+
+    if (peer && peer->info->receive_batch_begin) {
+        peer->info->receive_batch_begin(peer);
+    }
+}
+
+void qemu_send_packet_batch_end(NetClientState *nc)
+{
+    NetClientState *peer = nc->peer;
+
+    if (peer && peer->info->receive_batch_end) {
+        peer->info->receive_batch_end(peer);
+    }
+}
+
 ssize_t qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size)
 {
     return qemu_send_packet_async(nc, buf, size, NULL);
@@ -747,6 +817,7 @@ ssize_t qemu_sendv_packet_async(NetClientState *sender,
                                 NetPacketSent *sent_cb)
 {
     NetQueue *queue;
+    AioContext *ctx;
     size_t size = iov_size(iov, iovcnt);
     int ret;
 
@@ -758,24 +829,29 @@ ssize_t qemu_sendv_packet_async(NetClientState *sender,
         return size;
     }
 
+    ctx = qemu_net_peer_lock(sender);
+
     /* Let filters handle the packet first */
     ret = filter_receive_iov(sender, NET_FILTER_DIRECTION_TX, sender,
                              QEMU_NET_PACKET_FLAG_NONE, iov, iovcnt, sent_cb);
     if (ret) {
-        return ret;
+        goto out;
     }
 
     ret = filter_receive_iov(sender->peer, NET_FILTER_DIRECTION_RX, sender,
                              QEMU_NET_PACKET_FLAG_NONE, iov, iovcnt, sent_cb);
     if (ret) {
-        return ret;
+        goto out;
     }
 
     queue = sender->peer->incoming_queue;
 
-    return qemu_net_queue_send_iov(queue, sender,
-                                   QEMU_NET_PACKET_FLAG_NONE,
-                                   iov, iovcnt, sent_cb);
+    ret = qemu_net_queue_send_iov(queue, sender,
+                                  QEMU_NET_PACKET_FLAG_NONE,
+                                  iov, iovcnt, sent_cb);
+out:
+    qemu_net_peer_unlock(ctx);
+    return ret;
 }
 
 ssize_t
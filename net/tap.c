@@ -69,12 +69,21 @@ static void launch_script(const char *setup_script, const char *ifname,
 static void tap_send(void *opaque);
 static void tap_writable(void *opaque);
 
+static void tap_set_fd_handler(TAPState *s, AioContext *ctx)
+{
+    IOHandler *fd_read = s->read_poll && s->enabled ? tap_send : NULL;
+    IOHandler *fd_write = s->write_poll && s->enabled ? tap_writable : NULL;
+
+    if (ctx) {
+        aio_set_fd_handler(ctx, s->fd, false, fd_read, fd_write, NULL, s);
+    } else {
+        qemu_set_fd_handler(s->fd, fd_read, fd_write, s);
+    }
+}
+
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    tap_set_fd_handler(s, s->nc.ctx);
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -92,10 +101,19 @@ static void tap_write_poll(TAPState *s, bool enable)
 static void tap_writable(void *opaque)
 {
     TAPState *s = opaque;
+    AioContext *ctx = s->nc.ctx;
+
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
 
     tap_write_poll(s, false);
 
     qemu_flush_queued_packets(&s->nc);
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
 }
 
 static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt)
@@ -184,9 +202,17 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
+    AioContext *ctx = s->nc.ctx;
     int size;
     int packets = 0;
 
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
+
+    /* Notify the guest once for all packets read below */
+    qemu_send_packet_batch_begin(&s->nc);
+
     while (true) {
         uint8_t *buf = s->buf;
 
@@ -219,6 +245,12 @@ static void tap_send(void *opaque)
             break;
         }
     }
+
+    qemu_send_packet_batch_end(&s->nc);
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
 }
 
 static bool tap_has_ufo(NetClientState *nc)
@@ -337,6 +369,19 @@ static void tap_poll(NetClientState *nc, bool enable)
     tap_write_poll(s, enable);
 }
 
+/* Called before nc->ctx is updated to @ctx */
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (nc->ctx) {
+        aio_set_fd_handler(nc->ctx, s->fd, false, NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
+    tap_set_fd_handler(s, ctx);
+}
+
 int tap_get_fd(NetClientState *nc)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -362,6 +407,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_hdr_len = tap_set_vnet_hdr_len,
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
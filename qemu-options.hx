@@ -1133,6 +1133,13 @@ SRST
             supporting platforms, and 0 on other platforms. Setting it
             to 0 disables this feature.
 
+        ``backing-read-index``
+            Whether to index which layer of a read-only backing chain
+            provides the data for clusters that are unallocated in the
+            image, so that reads go directly to that layer instead of
+            looking it up in every layer of the chain (on/off; default:
+            off)
+
         ``pass-discard-request``
             Whether discard requests to the qcow2 device should be
             forwarded to the data source (on/off; default: on if
@@ -5095,7 +5102,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,thread-pool-max=thread-pool-max``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -5138,6 +5145,14 @@ SRST
         ::
 
             (qemu) qom-set /objects/iothread1 poll-max-ns 100000
+
+        The ``thread-pool-max`` parameter is the maximum number of worker
+        threads that the IOThread uses to offload blocking work such as
+        file I/O without native AIO or qcow2 compression.  Worker
+        threads are created by the IOThread and inherit its host CPU
+        affinity.  The default is 64, and it can be changed at run-time
+        with ``qom-set`` as well.  Lowering it does not stop threads
+        right away; surplus threads exit after being idle for 10 seconds.
 ERST
 
 
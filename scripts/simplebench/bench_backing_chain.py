@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+#
+# Benchmark cold reads through qcow2 backing chains of various depth, with
+# and without the backing-read-index option.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import json
+import shutil
+import subprocess
+import tempfile
+import simplebench
+
+
+image_size = 1024 * 1024 * 1024
+cluster_size = 65536
+
+
+def qemu_img_pipe(*args):
+    '''Run qemu-img and return its output'''
+    subp = subprocess.Popen(list(args),
+                            stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    exitcode = subp.wait()
+    if exitcode < 0:
+        sys.stderr.write('qemu-img received signal %i: %s\n'
+                         % (-exitcode, ' '.join(list(args))))
+    return subp.communicate()[0]
+
+
+def create_chain(qemu_img, qemu_io, base_dir, depth):
+    """Create a chain of @depth qcow2 images in @base_dir.
+
+    Every 16th cluster is allocated, and they are spread round-robin over
+    the layers, so the benchmark reads find their data in every layer.
+    Returns the file name of the top image.
+    """
+    backing = None
+    for i in range(depth):
+        img = os.path.join(base_dir, f'layer{i}.qcow2')
+        args = [qemu_img, 'create', '-f', 'qcow2', '-o',
+                f'cluster_size={cluster_size}']
+        if backing:
+            args += ['-b', backing, '-F', 'qcow2']
+        qemu_img_pipe(*args, img, str(image_size))
+
+        cmds = []
+        for offset in range(i * cluster_size * 16, image_size,
+                            depth * cluster_size * 16):
+            cmds += ['-c', f'write -P {i + 1} {offset} {cluster_size}']
+        subprocess.run([qemu_io, '-f', 'qcow2'] + cmds + [img],
+                       stdout=subprocess.DEVNULL, check=True)
+        backing = img
+
+    return backing
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    top = {
+        'driver': 'qcow2',
+        'backing-read-index': env['index'],
+        'file': {
+            'driver': 'file',
+            'filename': case['top']
+        }
+    }
+
+    count = image_size // (cluster_size * 16)
+    ret = qemu_img_pipe(env['qemu_img'], 'bench', '-n', '-t', 'none',
+                        '-c', str(count), '-d', '1', '-s', str(cluster_size),
+                        '-S', str(cluster_size * 16),
+                        'json:' + json.dumps(top))
+
+    if 'seconds' in ret:
+        ret_list = ret.split()
+        index = ret_list.index('seconds.')
+        return {'seconds': float(ret_list[index-1])}
+    else:
+        return {'error': 'qemu_img bench failed: ' + ret}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 3:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-img binary file> '
+              '<path to qemu-io binary file> [<directory for images>]')
+        exit(1)
+
+    qemu_img = sys.argv[1]
+    qemu_io = sys.argv[2]
+    base_dir = tempfile.mkdtemp(dir=sys.argv[3] if len(sys.argv) > 3
+                                else None)
+
+    # Test-cases are "rows" in benchmark resulting table, 'id' is a caption
+    # for the row, other fields are handled by bench_func.
+    test_cases = []
+    for depth in (1, 4, 16, 32):
+        chain_dir = os.path.join(base_dir, f'depth{depth}')
+        os.mkdir(chain_dir)
+        test_cases.append({
+            'id': f'<depth {depth}>',
+            'top': create_chain(qemu_img, qemu_io, chain_dir, depth)
+        })
+
+    # Test-envs are "columns" in benchmark resulting table, 'id is a caption
+    # for the column, other fields are handled by bench_func.
+    test_envs = [
+        {
+            'id': '<walk chain>',
+            'qemu_img': qemu_img,
+            'index': False
+        },
+        {
+            'id': '<backing-read-index>',
+            'qemu_img': qemu_img,
+            'index': True
+        },
+    ]
+
+    try:
+        result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                                   initial_run=False)
+        print(simplebench.ascii(result))
+    finally:
+        shutil.rmtree(base_dir)
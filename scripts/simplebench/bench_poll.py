@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+#
+# Benchmark iothread CPU usage against request latency for different
+# AioContext polling settings.
+#
+# A guest with two virtio-blk disks on null-co is started.  Both disks share
+# one iothread; the first one is meant to be kept busy by the guest, while
+# the second one stays mostly idle.  The guest image must run its benchmark
+# on boot, print the output of "fio --output-format=json" to the serial
+# console and power off.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import json
+import tempfile
+
+import simplebench
+
+sys.path.append(os.path.join(os.path.dirname(__file__), '..', '..', 'python'))
+from qemu.machine import QEMUMachine
+
+
+def thread_cpu_seconds(pid, tid):
+    """Return user + system CPU time consumed by a thread so far"""
+    with open('/proc/{}/task/{}/stat'.format(pid, tid)) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    # utime and stime are fields 14 and 15 of the stat line
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+
+def fio_mean_clat_us(output):
+    """Return the mean read completion latency of the first fio job"""
+    start = output.index('{')
+    res = json.loads(output[start:output.rindex('}') + 1])
+    return res['jobs'][0]['read']['clat_ns']['mean'] / 1000.0
+
+
+def bench_poll(qemu_binary, guest_image, poll_max_ns, metric):
+    """Boot the benchmark guest and measure one metric
+
+    metric -- 'cpu' for the CPU time of the iothread in seconds, 'latency'
+              for the mean completion latency reported by fio in
+              microseconds
+
+    Returns {'seconds': float} on success and {'error': str} on failure,
+    compatible with simplebench.
+    """
+    serial = tempfile.NamedTemporaryFile(suffix='.log')
+    args = [
+        '-machine', 'accel=kvm', '-m', '1G', '-nographic', '-no-shutdown',
+        '-object', 'iothread,id=iot0,poll-max-ns={}'.format(poll_max_ns),
+        '-drive', 'file={},if=virtio'.format(guest_image),
+        '-blockdev', 'null-co,node-name=busy,size=1G,read-zeroes=on',
+        '-blockdev', 'null-co,node-name=idle,size=1G,read-zeroes=on',
+        '-device', 'virtio-blk-pci,drive=busy,iothread=iot0',
+        '-device', 'virtio-blk-pci,drive=idle,iothread=iot0',
+        '-chardev', 'file,id=ser0,path={}'.format(serial.name),
+        '-serial', 'chardev:ser0',
+    ]
+
+    vm = QEMUMachine(qemu_binary, args=args)
+    try:
+        vm.launch()
+    except OSError as e:
+        return {'error': 'popen failed: ' + str(e)}
+
+    try:
+        tid = vm.qmp('query-iothreads')['return'][0]['thread-id']
+        pid = vm.get_pid()
+        vm.event_wait('SHUTDOWN', timeout=600)
+        cpu = thread_cpu_seconds(pid, tid)
+        stats = vm.qmp('query-iothreads', poll_stats=True)
+    finally:
+        vm.shutdown()
+
+    print('    poll handlers:', stats['return'][0].get('poll-handlers'))
+    if metric == 'cpu':
+        return {'seconds': cpu}
+
+    with open(serial.name) as f:
+        try:
+            return {'seconds': fio_mean_clat_us(f.read())}
+        except ValueError as e:
+            return {'error': 'no fio output: ' + str(e)}
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_poll(env['qemu_binary'], guest_image, env['poll_max_ns'],
+                      case['metric'])
+
+
+# Set these to turn this script into a real benchmark
+guest_image = '/path-to-guest-image-running-fio-on-boot'
+qemu_binary = '/path-to-qemu-binary'
+
+test_cases = [
+    {'id': 'iothread CPU (s)', 'metric': 'cpu'},
+    {'id': 'mean latency (us)', 'metric': 'latency'},
+]
+
+test_envs = [
+    {'id': 'no polling', 'qemu_binary': qemu_binary, 'poll_max_ns': 0},
+    {'id': 'poll 32us', 'qemu_binary': qemu_binary, 'poll_max_ns': 32768},
+    {'id': 'poll 256us', 'qemu_binary': qemu_binary, 'poll_max_ns': 262144},
+]
+
+if __name__ == '__main__':
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3)
+    print(simplebench.ascii(result))
@@ -2374,6 +2374,8 @@ static inline uint64_t cpreg_to_kvm_id(uint32_t cpregid)
  * NEWEL is for writes to registers that might change the exception
  * level - typically on older ARM chips. For those cases we need to
  * re-read the new el when recomputing the translation flags.
+ * NO_BQL is for IO registers whose read and write hooks do their own
+ * locking, so that they can be called without taking the iothread lock.
  */
 #define ARM_CP_SPECIAL           0x0001
 #define ARM_CP_CONST             0x0002
@@ -2396,10 +2398,11 @@ static inline uint64_t cpreg_to_kvm_id(uint32_t cpregid)
 #define ARM_CP_NO_GDB            0x4000
 #define ARM_CP_RAISES_EXC        0x8000
 #define ARM_CP_NEWEL             0x10000
+#define ARM_CP_NO_BQL            0x20000
 /* Used only as a terminator for ARMCPRegInfo lists */
 #define ARM_CP_SENTINEL          0xfffff
 /* Mask of only the flag bits in a type field */
-#define ARM_CP_FLAG_MASK         0x1f0ff
+#define ARM_CP_FLAG_MASK         0x3f0ff
 
 /* Valid values for ARMCPRegInfo state field, indicating which of
  * the AArch32 and AArch64 execution states this register is visible in.
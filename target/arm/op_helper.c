@@ -695,7 +695,7 @@ void HELPER(set_cp_reg)(CPUARMState *env, void *rip, uint32_t value)
 {
     const ARMCPRegInfo *ri = rip;
 
-    if (ri->type & ARM_CP_IO) {
+    if ((ri->type & (ARM_CP_IO | ARM_CP_NO_BQL)) == ARM_CP_IO) {
         qemu_mutex_lock_iothread();
         ri->writefn(env, ri, value);
         qemu_mutex_unlock_iothread();
@@ -709,7 +709,7 @@ uint32_t HELPER(get_cp_reg)(CPUARMState *env, void *rip)
     const ARMCPRegInfo *ri = rip;
     uint32_t res;
 
-    if (ri->type & ARM_CP_IO) {
+    if ((ri->type & (ARM_CP_IO | ARM_CP_NO_BQL)) == ARM_CP_IO) {
         qemu_mutex_lock_iothread();
         res = ri->readfn(env, ri);
         qemu_mutex_unlock_iothread();
@@ -724,7 +724,7 @@ void HELPER(set_cp_reg64)(CPUARMState *env, void *rip, uint64_t value)
 {
     const ARMCPRegInfo *ri = rip;
 
-    if (ri->type & ARM_CP_IO) {
+    if ((ri->type & (ARM_CP_IO | ARM_CP_NO_BQL)) == ARM_CP_IO) {
         qemu_mutex_lock_iothread();
         ri->writefn(env, ri, value);
         qemu_mutex_unlock_iothread();
@@ -738,7 +738,7 @@ uint64_t HELPER(get_cp_reg64)(CPUARMState *env, void *rip)
     const ARMCPRegInfo *ri = rip;
     uint64_t res;
 
-    if (ri->type & ARM_CP_IO) {
+    if ((ri->type & (ARM_CP_IO | ARM_CP_NO_BQL)) == ARM_CP_IO) {
         qemu_mutex_lock_iothread();
         res = ri->readfn(env, ri);
         qemu_mutex_unlock_iothread();
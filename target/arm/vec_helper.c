@@ -884,6 +884,86 @@ static float32 float32_rsqrts_nf(float32 op1, float32 op2, float_status *stat)
     return float32_div(op1, float32_two, stat);
 }
 
+/*
+ * Host FPU versions of the most common single and double precision
+ * vector operations.  They are used only when float_host_fpu_usable()
+ * allows it, and only for zero or normal inputs.  The inputs are
+ * checked in one pass, the operation done in a second and the results
+ * checked in a third, so that each loop is simple enough for the
+ * compiler to vectorize.  Overflow is flagged directly; a result that
+ * may be tiny sends the whole vector back to softfloat.
+ */
+typedef enum {
+    HOST_FADD,
+    HOST_FSUB,
+    HOST_FMUL,
+} HostFOp;
+
+#define DO_HOST_3OP(TYPE, HTYPE, UTYPE, FRAC)                               \
+static bool host_##TYPE##_3op(TYPE *d, TYPE *n, TYPE *m, intptr_t elts,    \
+                              HostFOp op, float_status *fpst)              \
+{                                                                          \
+    /* Magnitudes shifted left by one, to drop the sign bit.  */           \
+    const UTYPE inf = (UTYPE)-1 << (FRAC + 1);                             \
+    const UTYPE min_normal = (UTYPE)1 << (FRAC + 1);                       \
+    HTYPE *hn = (HTYPE *)n, *hm = (HTYPE *)m;                              \
+    HTYPE r[ARM_MAX_VQ * 16 / sizeof(TYPE)];                               \
+    UTYPE *ur = (UTYPE *)r;                                                \
+    bool bad = false, ovf = false;                                         \
+    intptr_t i;                                                            \
+                                                                           \
+    if (!float_host_fpu_usable(fpst)) {                                    \
+        return false;                                                      \
+    }                                                                      \
+    for (i = 0; i < elts; i++) {                                           \
+        UTYPE an = (UTYPE)(n[i] << 1), am = (UTYPE)(m[i] << 1);            \
+        bad |= (an != 0 && an < min_normal) || an >= inf;                  \
+        bad |= (am != 0 && am < min_normal) || am >= inf;                  \
+    }                                                                      \
+    if (bad) {                                                             \
+        return false;                                                      \
+    }                                                                      \
+    for (i = 0; i < elts; i++) {                                           \
+        switch (op) {                                                      \
+        case HOST_FADD:                                                    \
+            r[i] = hn[i] + hm[i];                                          \
+            break;                                                         \
+        case HOST_FSUB:                                                    \
+            r[i] = hn[i] - hm[i];                                          \
+            break;                                                         \
+        case HOST_FMUL:                                                    \
+            r[i] = hn[i] * hm[i];                                          \
+            break;                                                         \
+        }                                                                  \
+    }                                                                      \
+    for (i = 0; i < elts; i++) {                                           \
+        UTYPE ar = (UTYPE)(ur[i] << 1);                                    \
+        bool zero_ok;                                                      \
+                                                                           \
+        /* Zero results are exact if the inputs make them so.  */          \
+        if (op == HOST_FMUL) {                                             \
+            zero_ok = (UTYPE)(n[i] << 1) == 0 || (UTYPE)(m[i] << 1) == 0;  \
+        } else {                                                           \
+            zero_ok = (UTYPE)((n[i] | m[i]) << 1) == 0;                    \
+        }                                                                  \
+        bad |= ar <= min_normal && !zero_ok;                               \
+        ovf |= ar >= inf;                                                  \
+    }                                                                      \
+    if (bad) {                                                             \
+        return false;                                                      \
+    }                                                                      \
+    memcpy(d, r, elts * sizeof(TYPE));                                     \
+    if (ovf) {                                                             \
+        fpst->float_exception_flags |= float_flag_overflow;                \
+    }                                                                      \
+    return true;                                                           \
+}
+
+DO_HOST_3OP(float32, float, uint32_t, 23)
+DO_HOST_3OP(float64, double, uint64_t, 52)
+
+#undef DO_HOST_3OP
+
 #define DO_3OP(NAME, FUNC, TYPE) \
 void HELPER(NAME)(void *vd, void *vn, void *vm, void *stat, uint32_t desc) \
 {                                                                          \
@@ -895,17 +975,32 @@ void HELPER(NAME)(void *vd, void *vn, void *vm, void *stat, uint32_t desc) \
     clear_tail(d, oprsz, simd_maxsz(desc));                                \
 }
 
+#define DO_3OP_HOST(NAME, FUNC, TYPE, OP) \
+void HELPER(NAME)(void *vd, void *vn, void *vm, void *stat, uint32_t desc) \
+{                                                                          \
+    intptr_t i, oprsz = simd_oprsz(desc);                                  \
+    TYPE *d = vd, *n = vn, *m = vm;                                        \
+    if (!host_##TYPE##_3op(d, n, m, oprsz / sizeof(TYPE), OP, stat)) {     \
+        for (i = 0; i < oprsz / sizeof(TYPE); i++) {                       \
+            d[i] = FUNC(n[i], m[i], stat);                                 \
+        }                                                                  \
+    }                                                                      \
+    clear_tail(d, oprsz, simd_maxsz(desc));                                \
+}
+
 DO_3OP(gvec_fadd_h, float16_add, float16)
-DO_3OP(gvec_fadd_s, float32_add, float32)
-DO_3OP(gvec_fadd_d, float64_add, float64)
+DO_3OP_HOST(gvec_fadd_s, float32_add, float32, HOST_FADD)
+DO_3OP_HOST(gvec_fadd_d, float64_add, float64, HOST_FADD)
 
 DO_3OP(gvec_fsub_h, float16_sub, float16)
-DO_3OP(gvec_fsub_s, float32_sub, float32)
-DO_3OP(gvec_fsub_d, float64_sub, float64)
+DO_3OP_HOST(gvec_fsub_s, float32_sub, float32, HOST_FSUB)
+DO_3OP_HOST(gvec_fsub_d, float64_sub, float64, HOST_FSUB)
 
 DO_3OP(gvec_fmul_h, float16_mul, float16)
-DO_3OP(gvec_fmul_s, float32_mul, float32)
-DO_3OP(gvec_fmul_d, float64_mul, float64)
+DO_3OP_HOST(gvec_fmul_s, float32_mul, float32, HOST_FMUL)
+DO_3OP_HOST(gvec_fmul_d, float64_mul, float64, HOST_FMUL)
+
+#undef DO_3OP_HOST
 
 DO_3OP(gvec_ftsmul_h, float16_ftsmul, float16)
 DO_3OP(gvec_ftsmul_s, float32_ftsmul, float32)
@@ -1103,12 +1198,38 @@ void HELPER(NAME)(void *vd, void *vn, void *vm, void *stat, uint32_t desc) \
 }
 
 #define float16_nop(N, M, S) (M)
-#define float32_nop(N, M, S) (M)
-#define float64_nop(N, M, S) (M)
 
 DO_FMUL_IDX(gvec_fmul_idx_h, nop, float16, H2)
-DO_FMUL_IDX(gvec_fmul_idx_s, nop, float32, H4)
-DO_FMUL_IDX(gvec_fmul_idx_d, nop, float64, )
+
+/*
+ * Single and double precision: broadcast the indexed elements so that
+ * the host FPU version of the vector multiply can be used.
+ */
+#define DO_FMUL_IDX_HOST(NAME, TYPE, H)                                    \
+void HELPER(NAME)(void *vd, void *vn, void *vm, void *stat, uint32_t desc) \
+{                                                                          \
+    intptr_t i, j, oprsz = simd_oprsz(desc);                               \
+    intptr_t segment = MIN(16, oprsz) / sizeof(TYPE);                      \
+    intptr_t idx = simd_data(desc);                                        \
+    TYPE *d = vd, *n = vn, *m = vm;                                        \
+    TYPE mm[ARM_MAX_VQ * 16 / sizeof(TYPE)];                               \
+    for (i = 0; i < oprsz / sizeof(TYPE); i += segment) {                  \
+        for (j = 0; j < segment; j++) {                                    \
+            mm[i + j] = m[H(i + idx)];                                     \
+        }                                                                  \
+    }                                                                      \
+    if (!host_##TYPE##_3op(d, n, mm, oprsz / sizeof(TYPE), HOST_FMUL, stat)) { \
+        for (i = 0; i < oprsz / sizeof(TYPE); i++) {                       \
+            d[i] = TYPE##_mul(n[i], mm[i], stat);                          \
+        }                                                                  \
+    }                                                                      \
+    clear_tail(d, oprsz, simd_maxsz(desc));                                \
+}
+
+DO_FMUL_IDX_HOST(gvec_fmul_idx_s, float32, H4)
+DO_FMUL_IDX_HOST(gvec_fmul_idx_d, float64, )
+
+#undef DO_FMUL_IDX_HOST
 
 /*
  * Non-fused multiply-accumulate operations, for Neon. NB that unlike
@@ -1120,8 +1241,6 @@ DO_FMUL_IDX(gvec_fmls_nf_idx_h, sub, float16, H2)
 DO_FMUL_IDX(gvec_fmls_nf_idx_s, sub, float32, H4)
 
 #undef float16_nop
-#undef float32_nop
-#undef float64_nop
 #undef DO_FMUL_IDX
 
 #define DO_FMLA_IDX(NAME, TYPE, H)                                         \
@@ -33,6 +33,9 @@ enum op {
     OP_FMA,
     OP_SQRT,
     OP_CMP,
+    OP_MAX,
+    OP_CVT,
+    OP_FROM_INT,
     OP_MAX_NR,
 };
 
@@ -44,6 +47,9 @@ static const char * const op_names[] = {
     [OP_FMA] = "mulAdd",
     [OP_SQRT] = "sqrt",
     [OP_CMP] = "cmp",
+    [OP_MAX] = "maxNum",
+    [OP_CVT] = "cvt",
+    [OP_FROM_INT] = "fromInt64",
     [OP_MAX_NR] = NULL,
 };
 
@@ -235,6 +241,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_MAX:
+                    res.f = fmaxf(a, b);
+                    break;
+                case OP_CVT:
+                    res.d = a;
+                    break;
+                case OP_FROM_INT:
+                    res.f = (int64_t)random_ops[0];
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -270,6 +285,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_MAX:
+                    res.d = fmax(a, b);
+                    break;
+                case OP_CVT:
+                    res.f = a;
+                    break;
+                case OP_FROM_INT:
+                    res.d = (int64_t)random_ops[0];
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -305,6 +329,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float32_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MAX:
+                    res.f32 = float32_maxnum(a, b, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f64 = float32_to_float64(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.f32 = int64_to_float32(random_ops[0], &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -340,6 +373,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float64_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MAX:
+                    res.f64 = float64_maxnum(a, b, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f32 = float64_to_float32(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.f64 = int64_to_float64(random_ops[0], &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -377,6 +419,9 @@ GEN_BENCH_ALL_TYPES(mul, OP_MUL, 2)
 GEN_BENCH_ALL_TYPES(div, OP_DIV, 2)
 GEN_BENCH_ALL_TYPES(fma, OP_FMA, 3)
 GEN_BENCH_ALL_TYPES(cmp, OP_CMP, 2)
+GEN_BENCH_ALL_TYPES(max, OP_MAX, 2)
+GEN_BENCH_ALL_TYPES(cvt, OP_CVT, 1)
+GEN_BENCH_ALL_TYPES(from_int, OP_FROM_INT, 1)
 #undef GEN_BENCH_ALL_TYPES
 
 #define GEN_BENCH_ALL_TYPES_NO_NEG(name, op, n)                         \
@@ -407,6 +452,9 @@ static const bench_func_t bench_funcs[OP_MAX_NR][PREC_MAX_NR] = {
     GEN_BENCH_FUNCS(fma, OP_FMA),
     GEN_BENCH_FUNCS(sqrt, OP_SQRT),
     GEN_BENCH_FUNCS(cmp, OP_CMP),
+    GEN_BENCH_FUNCS(max, OP_MAX),
+    GEN_BENCH_FUNCS(cvt, OP_CVT),
+    GEN_BENCH_FUNCS(from_int, OP_FROM_INT),
 };
 
 #undef GEN_BENCH_FUNCS
@@ -0,0 +1,204 @@
+/*
+ * fp-test-half.c - check the float16 and bfloat16 fast paths
+ *
+ * Half precision and bfloat16 operations are computed in host single
+ * precision when the inexact flag is already set and rounding is to
+ * nearest even.  Testfloat has no bfloat16 support, so compare the
+ * results and flags of those paths against softfloat itself, which is
+ * used when inexact starts out clear.
+ *
+ * Widening to single precision takes its fast path whatever the status,
+ * so it is instead compared against the softfloat conversion it falls
+ * back to, which this file can call because it includes softfloat.c.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef HW_POISON_H
+#error Must define HW_POISON_H to work around TARGET_* poisoning
+#endif
+
+#include "../../fpu/softfloat.c"
+
+/* Second operands: a stride through all encodings, plus some specials */
+#define B_STRIDE 1021
+
+/* Step through float32 encodings for the narrowing conversions */
+#define F32_STRIDE 4099
+
+#define MAX_ERRORS 20
+
+typedef uint16_t (*op1_fn)(uint16_t a, float_status *s);
+typedef uint16_t (*op2_fn)(uint16_t a, uint16_t b, float_status *s);
+
+static const uint16_t specials[] = {
+    0x0000, 0x8000, 0x0001, 0x03ff, 0x0400, 0x3c00, 0xbc00, 0x7bff,
+    0x7c00, 0x7e00, 0x7f80, 0x7fc0, 0x0080, 0x007f, 0x3f80, 0x7f7f,
+};
+
+static float_status status_soft, status_fast;
+static unsigned long n_errors;
+
+static void check(const char *name, uint32_t a, uint32_t b,
+                  uint32_t soft, uint32_t fast)
+{
+    int soft_flags = status_soft.float_exception_flags | float_flag_inexact;
+    int fast_flags = status_fast.float_exception_flags;
+
+    if (soft == fast && soft_flags == fast_flags) {
+        return;
+    }
+    if (++n_errors <= MAX_ERRORS) {
+        fprintf(stderr, "%s 0x%08x 0x%08x: expected 0x%08x flags 0x%02x, "
+                "got 0x%08x flags 0x%02x\n",
+                name, a, b, soft, soft_flags, fast, fast_flags);
+    }
+}
+
+static void reset(void)
+{
+    status_soft.float_exception_flags = 0;
+    status_fast.float_exception_flags = float_flag_inexact;
+}
+
+static void test_op2(const char *name, op2_fn fn)
+{
+    uint32_t a, b;
+    int i;
+
+    for (a = 0; a <= UINT16_MAX; a++) {
+        for (b = 0; b <= UINT16_MAX; b += B_STRIDE) {
+            reset();
+            check(name, a, b, fn(a, b, &status_soft), fn(a, b, &status_fast));
+        }
+        for (i = 0; i < ARRAY_SIZE(specials); i++) {
+            b = specials[i];
+            reset();
+            check(name, a, b, fn(a, b, &status_soft), fn(a, b, &status_fast));
+        }
+    }
+}
+
+static void test_op1(const char *name, op1_fn fn)
+{
+    uint32_t a;
+
+    for (a = 0; a <= UINT16_MAX; a++) {
+        reset();
+        check(name, a, 0, fn(a, &status_soft), fn(a, &status_fast));
+    }
+}
+
+#define WRAP2(name, func)                                               \
+    static uint16_t name(uint16_t a, uint16_t b, float_status *s)       \
+    {                                                                   \
+        return func(a, b, s);                                           \
+    }
+
+WRAP2(f16_add, float16_add)
+WRAP2(f16_sub, float16_sub)
+WRAP2(f16_mul, float16_mul)
+WRAP2(f16_div, float16_div)
+WRAP2(bf16_add, bfloat16_add)
+WRAP2(bf16_sub, bfloat16_sub)
+WRAP2(bf16_mul, bfloat16_mul)
+WRAP2(bf16_div, bfloat16_div)
+
+#undef WRAP2
+
+static uint16_t f16_sqrt(uint16_t a, float_status *s)
+{
+    return float16_sqrt(a, s);
+}
+
+static uint16_t bf16_sqrt(uint16_t a, float_status *s)
+{
+    return bfloat16_sqrt(a, s);
+}
+
+static float32 ref_f16_to_f32(float16 a, bool ieee, float_status *s)
+{
+    const FloatFmt *fmt16 = ieee ? &float16_params : &float16_params_ahp;
+    FloatParts p = float16a_unpack_canonical(a, s, fmt16);
+    FloatParts pr = float_to_float(p, &float32_params, s);
+
+    return float32_round_pack_canonical(pr, s);
+}
+
+static float32 ref_bf16_to_f32(bfloat16 a, float_status *s)
+{
+    FloatParts p = bfloat16_unpack_canonical(a, s);
+    FloatParts pr = float_to_float(p, &float32_params, s);
+
+    return float32_round_pack_canonical(pr, s);
+}
+
+static void test_conversions(void)
+{
+    uint64_t i;
+    uint32_t a;
+
+    for (a = 0; a <= UINT16_MAX; a++) {
+        reset();
+        check("f16_to_f32", a, 0, ref_f16_to_f32(a, true, &status_soft),
+              float16_to_float32(a, true, &status_fast));
+        reset();
+        check("f16_to_f32_ahp", a, 0, ref_f16_to_f32(a, false, &status_soft),
+              float16_to_float32(a, false, &status_fast));
+        reset();
+        check("bf16_to_f32", a, 0, ref_bf16_to_f32(a, &status_soft),
+              bfloat16_to_float32(a, &status_fast));
+    }
+
+    for (i = 0; i <= UINT32_MAX; i += F32_STRIDE) {
+        a = i;
+        reset();
+        check("f32_to_f16", a, 0, float32_to_float16(a, true, &status_soft),
+              float32_to_float16(a, true, &status_fast));
+        reset();
+        check("f32_to_bf16", a, 0, float32_to_bfloat16(a, &status_soft),
+              float32_to_bfloat16(a, &status_fast));
+    }
+}
+
+static void run_tests(void)
+{
+    test_op2("f16_add", f16_add);
+    test_op2("f16_sub", f16_sub);
+    test_op2("f16_mul", f16_mul);
+    test_op2("f16_div", f16_div);
+    test_op1("f16_sqrt", f16_sqrt);
+    test_op2("bf16_add", bf16_add);
+    test_op2("bf16_sub", bf16_sub);
+    test_op2("bf16_mul", bf16_mul);
+    test_op2("bf16_div", bf16_div);
+    test_op1("bf16_sqrt", bf16_sqrt);
+    test_conversions();
+}
+
+int main(int argc, char *argv[])
+{
+    int pass;
+
+    /*
+     * Run once with the defaults and once as for Arm with FZ16 and
+     * default NaN set, which the fast paths must not be affected by.
+     */
+    for (pass = 0; pass < 2; pass++) {
+        set_float_rounding_mode(float_round_nearest_even, &status_soft);
+        set_float_detect_tininess(pass ? float_tininess_before_rounding
+                                       : float_tininess_after_rounding,
+                                  &status_soft);
+        set_flush_to_zero(pass, &status_soft);
+        set_flush_inputs_to_zero(pass, &status_soft);
+        set_default_nan_mode(pass, &status_soft);
+        status_fast = status_soft;
+        run_tests();
+    }
+
+    if (n_errors) {
+        fprintf(stderr, "%lu mismatches\n", n_errors);
+        return 1;
+    }
+    return 0;
+}
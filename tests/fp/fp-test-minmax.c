@@ -0,0 +1,200 @@
+/*
+ * fp-test-minmax.c - check the float32 and float64 min/max fast paths
+ *
+ * min, max, minnum, maxnum, minnummag and maxnummag compare zero or
+ * normal inputs on the host, in any rounding mode and whatever the flags.
+ * Testfloat has none of these operations, so compare the results and
+ * flags of the public functions against the softfloat implementation
+ * they fall back to, which this file can call because it includes
+ * softfloat.c itself.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef HW_POISON_H
+#error Must define HW_POISON_H to work around TARGET_* poisoning
+#endif
+
+#include "../../fpu/softfloat.c"
+
+/* Pseudo-random operands, besides the specials */
+#define N_RANDOM 256
+
+#define MAX_ERRORS 20
+
+static const uint32_t f32_specials[] = {
+    0x00000000, /* 0 */
+    0x00000001, /* smallest denormal */
+    0x007fffff, /* largest denormal */
+    0x00800000, /* smallest normal */
+    0x3f800000, /* 1 */
+    0x3f800001, /* 1 + ulp */
+    0x40000000, /* 2 */
+    0x7f7fffff, /* largest normal */
+    0x7f800000, /* inf */
+    0x7fc00000, /* default qNaN */
+    0x7fc00001, /* qNaN with payload */
+    0x7f800001, /* sNaN */
+    0x7fbfffff, /* sNaN with payload */
+};
+
+static const uint64_t f64_specials[] = {
+    0x0000000000000000ULL, /* 0 */
+    0x0000000000000001ULL, /* smallest denormal */
+    0x000fffffffffffffULL, /* largest denormal */
+    0x0010000000000000ULL, /* smallest normal */
+    0x3ff0000000000000ULL, /* 1 */
+    0x3ff0000000000001ULL, /* 1 + ulp */
+    0x4000000000000000ULL, /* 2 */
+    0x7fefffffffffffffULL, /* largest normal */
+    0x7ff0000000000000ULL, /* inf */
+    0x7ff8000000000000ULL, /* default qNaN */
+    0x7ff8000000000001ULL, /* qNaN with payload */
+    0x7ff0000000000001ULL, /* sNaN */
+    0x7ff7ffffffffffffULL, /* sNaN with payload */
+};
+
+/* Each operand is also used with the opposite sign */
+static uint32_t f32_ops[2 * (ARRAY_SIZE(f32_specials) + N_RANDOM)];
+static uint64_t f64_ops[2 * (ARRAY_SIZE(f64_specials) + N_RANDOM)];
+
+static float_status status_soft, status_fast;
+static unsigned long n_errors;
+
+typedef float32 (*f32_op2_fn)(float32 a, float32 b, float_status *s);
+typedef float64 (*f64_op2_fn)(float64 a, float64 b, float_status *s);
+
+typedef struct MinMaxOp {
+    const char *name;
+    f32_op2_fn f32;
+    f64_op2_fn f64;
+    bool ismin, ieee, ismag;
+} MinMaxOp;
+
+static const MinMaxOp ops[] = {
+    { "min", float32_min, float64_min, true, false, false },
+    { "max", float32_max, float64_max, false, false, false },
+    { "minnum", float32_minnum, float64_minnum, true, true, false },
+    { "maxnum", float32_maxnum, float64_maxnum, false, true, false },
+    { "minnummag", float32_minnummag, float64_minnummag, true, true, true },
+    { "maxnummag", float32_maxnummag, float64_maxnummag, false, true, true },
+};
+
+static void check(const char *name, int bits, uint64_t a, uint64_t b,
+                  uint64_t soft, uint64_t fast)
+{
+    int soft_flags = status_soft.float_exception_flags;
+    int fast_flags = status_fast.float_exception_flags;
+
+    if (soft == fast && soft_flags == fast_flags) {
+        return;
+    }
+    if (++n_errors <= MAX_ERRORS) {
+        fprintf(stderr, "f%d_%s 0x%" PRIx64 " 0x%" PRIx64 ": expected 0x%"
+                PRIx64 " flags 0x%02x, got 0x%" PRIx64 " flags 0x%02x\n",
+                bits, name, a, b, soft, soft_flags, fast, fast_flags);
+    }
+}
+
+static void init_operands(void)
+{
+    uint64_t seed = 0x0123456789abcdefULL;
+    int i, n;
+
+    for (n = 0; n < ARRAY_SIZE(f32_specials); n++) {
+        f32_ops[n] = f32_specials[n];
+        f64_ops[n] = f64_specials[n];
+    }
+    for (i = 0; i < N_RANDOM; i++, n++) {
+        /* Knuth's MMIX LCG */
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        f32_ops[n] = seed >> 32;
+        f64_ops[n] = seed ^ (seed << 29);
+    }
+    for (i = 0; i < n; i++) {
+        f32_ops[n + i] = f32_ops[i] ^ 0x80000000;
+        f64_ops[n + i] = f64_ops[i] ^ 0x8000000000000000ULL;
+    }
+}
+
+static void reset(void)
+{
+    status_soft.float_exception_flags = 0;
+    status_fast.float_exception_flags = 0;
+}
+
+static void test_f32(const MinMaxOp *op)
+{
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(f32_ops); i++) {
+        for (j = 0; j < ARRAY_SIZE(f32_ops); j++) {
+            float32 a = make_float32(f32_ops[i]);
+            float32 b = make_float32(f32_ops[j]);
+            float32 soft, fast;
+
+            reset();
+            soft = soft_f32_minmax(a, b, op->ismin, op->ieee, op->ismag,
+                                   &status_soft);
+            fast = op->f32(a, b, &status_fast);
+            check(op->name, 32, f32_ops[i], f32_ops[j],
+                  float32_val(soft), float32_val(fast));
+        }
+    }
+}
+
+static void test_f64(const MinMaxOp *op)
+{
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(f64_ops); i++) {
+        for (j = 0; j < ARRAY_SIZE(f64_ops); j++) {
+            float64 a = make_float64(f64_ops[i]);
+            float64 b = make_float64(f64_ops[j]);
+            float64 soft, fast;
+
+            reset();
+            soft = soft_f64_minmax(a, b, op->ismin, op->ieee, op->ismag,
+                                   &status_soft);
+            fast = op->f64(a, b, &status_fast);
+            check(op->name, 64, f64_ops[i], f64_ops[j],
+                  float64_val(soft), float64_val(fast));
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static const FloatRoundMode modes[] = {
+        float_round_nearest_even, float_round_down, float_round_to_zero,
+    };
+    int pass, i;
+
+    init_operands();
+
+    /*
+     * Run with the defaults in several rounding modes, then as for Arm
+     * with flush-to-zero and default NaN set.
+     */
+    for (pass = 0; pass < ARRAY_SIZE(modes) + 1; pass++) {
+        bool arm = pass == ARRAY_SIZE(modes);
+
+        set_float_rounding_mode(arm ? float_round_nearest_even : modes[pass],
+                                &status_soft);
+        set_flush_to_zero(arm, &status_soft);
+        set_flush_inputs_to_zero(arm, &status_soft);
+        set_default_nan_mode(arm, &status_soft);
+        status_fast = status_soft;
+
+        for (i = 0; i < ARRAY_SIZE(ops); i++) {
+            test_f32(&ops[i]);
+            test_f64(&ops[i]);
+        }
+    }
+
+    if (n_errors) {
+        fprintf(stderr, "%lu mismatches\n", n_errors);
+        return 1;
+    }
+    return 0;
+}
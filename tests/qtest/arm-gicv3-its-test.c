@@ -0,0 +1,212 @@
+/*
+ * QTest testcase for the emulated GICv3 ITS
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "libqtest.h"
+
+#define MACHINE             "-machine virt,gic-version=3 -cpu max -m 128M"
+
+/* Addresses on the virt board */
+#define ITS_BASE            0x08080000ULL
+#define GICR_BASE           0x080a0000ULL   /* RD_base frame of CPU 0 */
+#define RAM_BASE            0x40000000ULL
+#define RAM_SIZE            (128 * MiB)
+
+#define GICR_CTLR           0x0000
+#define GICR_CTLR_ENABLE_LPIS (1U << 0)
+#define GICR_PROPBASER      0x0070
+#define GICR_PENDBASER      0x0078
+
+#define GITS_CTLR           0x0000
+#define GITS_CTLR_ENABLED   (1U << 0)
+#define GITS_CBASER         0x0080
+#define GITS_CWRITER        0x0088
+#define GITS_CWRITER_RETRY  (1ULL << 0)
+#define GITS_CREADR         0x0090
+#define GITS_CREADR_STALLED (1ULL << 0)
+#define GITS_BASER          0x0100
+#define GITS_TRANSLATER     0x10040
+
+#define GITS_BASER_VALID    (1ULL << 63)
+#define GITS_CBASER_VALID   (1ULL << 63)
+
+#define GITS_CMD_SYNC       0x05
+#define GITS_CMD_MAPD       0x08
+#define GITS_CMD_MAPC       0x09
+#define GITS_CMD_MAPTI      0x0a
+#define ITS_CMD_SIZE        32
+
+/* Tables in guest RAM, all of them 64 KiB aligned */
+#define CMDQ_ADDR           (RAM_BASE + 0x010000)
+#define DEVICE_TABLE_ADDR   (RAM_BASE + 0x020000)
+#define COLL_TABLE_ADDR     (RAM_BASE + 0x030000)
+#define ITT_ADDR            (RAM_BASE + 0x040000)
+#define PROP_TABLE_ADDR     (RAM_BASE + 0x100000)
+#define PEND_TABLE_ADDR     (RAM_BASE + 0x200000)
+
+/* 16384 interrupt IDs, i.e. 8192 LPIs */
+#define LPI_IDBITS          13
+#define LPI_INTID_START     8192
+#define LPI_INTID           (LPI_INTID_START + 5)
+#define LPI_PRIORITY        0xa0
+#define LPI_ENABLED         (1 << 0)
+
+#define DEVICE_ID           0
+#define EVENT_ID            2
+#define COLLECTION_ID       3
+
+typedef struct ITSState {
+    QTestState *qts;
+    uint64_t cmdq;
+    uint64_t cwriter;
+} ITSState;
+
+static void its_write_cmd(ITSState *its, uint64_t dw0, uint64_t dw1,
+                          uint64_t dw2)
+{
+    uint64_t cmd[ITS_CMD_SIZE / 8] = {
+        cpu_to_le64(dw0), cpu_to_le64(dw1), cpu_to_le64(dw2), 0
+    };
+
+    qtest_memwrite(its->qts, its->cmdq + its->cwriter, cmd, sizeof(cmd));
+    its->cwriter += ITS_CMD_SIZE;
+}
+
+/* Queue one command and check that the ITS has processed it */
+static void its_cmd(ITSState *its, uint64_t dw0, uint64_t dw1, uint64_t dw2)
+{
+    its_write_cmd(its, dw0, dw1, dw2);
+    qtest_writeq(its->qts, ITS_BASE + GITS_CWRITER, its->cwriter);
+    g_assert_cmphex(qtest_readq(its->qts, ITS_BASE + GITS_CREADR), ==,
+                    its->cwriter);
+}
+
+static bool lpi_pending(ITSState *its, int intid)
+{
+    return qtest_readb(its->qts, PEND_TABLE_ADDR + intid / 8) &
+        (1 << (intid % 8));
+}
+
+static void its_init(ITSState *its)
+{
+    QTestState *qts = qtest_init(MACHINE);
+
+    its->qts = qts;
+    its->cmdq = CMDQ_ADDR;
+    its->cwriter = 0;
+
+    /* LPI configuration and pending tables for CPU 0 */
+    qtest_memset(qts, PROP_TABLE_ADDR, 0, 8 * KiB);
+    qtest_memset(qts, PEND_TABLE_ADDR, 0, 2 * KiB);
+    qtest_writeb(qts, PROP_TABLE_ADDR + LPI_INTID - LPI_INTID_START,
+                 LPI_PRIORITY | LPI_ENABLED);
+    qtest_writeq(qts, GICR_BASE + GICR_PROPBASER,
+                 PROP_TABLE_ADDR | LPI_IDBITS);
+    qtest_writeq(qts, GICR_BASE + GICR_PENDBASER, PEND_TABLE_ADDR);
+    qtest_writel(qts, GICR_BASE + GICR_CTLR, GICR_CTLR_ENABLE_LPIS);
+    g_assert_cmphex(qtest_readl(qts, GICR_BASE + GICR_CTLR), ==,
+                    GICR_CTLR_ENABLE_LPIS);
+
+    /* Flat one page device and collection tables, and a one page queue */
+    qtest_memset(qts, DEVICE_TABLE_ADDR, 0, 4 * KiB);
+    qtest_memset(qts, COLL_TABLE_ADDR, 0, 4 * KiB);
+    qtest_writeq(qts, ITS_BASE + GITS_BASER,
+                 GITS_BASER_VALID | DEVICE_TABLE_ADDR);
+    qtest_writeq(qts, ITS_BASE + GITS_BASER + 8,
+                 GITS_BASER_VALID | COLL_TABLE_ADDR);
+    qtest_writeq(qts, ITS_BASE + GITS_CBASER, GITS_CBASER_VALID | CMDQ_ADDR);
+    qtest_writel(qts, ITS_BASE + GITS_CTLR, GITS_CTLR_ENABLED);
+}
+
+static void test_its_translate(void)
+{
+    ITSState its;
+
+    its_init(&its);
+
+    /* MAPD with a two bit EventID and a valid ITT */
+    its_cmd(&its, GITS_CMD_MAPD | (uint64_t)DEVICE_ID << 32, 1,
+            1ULL << 63 | ITT_ADDR);
+    /* MAPC to the redistributor of CPU 0 */
+    its_cmd(&its, GITS_CMD_MAPC, 0, 1ULL << 63 | 0 << 16 | COLLECTION_ID);
+    its_cmd(&its, GITS_CMD_MAPTI | (uint64_t)DEVICE_ID << 32,
+            (uint64_t)LPI_INTID << 32 | EVENT_ID, COLLECTION_ID);
+    its_cmd(&its, GITS_CMD_SYNC, 0, 0);
+
+    /* An event that isn't mapped is dropped */
+    qtest_writel(its.qts, ITS_BASE + GITS_TRANSLATER, EVENT_ID + 1);
+    g_assert(!lpi_pending(&its, LPI_INTID));
+
+    /* qtest accesses have RequesterID 0, i.e. they come from DEVICE_ID */
+    qtest_writel(its.qts, ITS_BASE + GITS_TRANSLATER, EVENT_ID);
+    g_assert(lpi_pending(&its, LPI_INTID));
+    g_assert(!lpi_pending(&its, LPI_INTID - 1));
+    g_assert(!lpi_pending(&its, LPI_INTID + 1));
+
+    qtest_quit(its.qts);
+}
+
+static void test_its_stall(void)
+{
+    uint64_t cmdq = RAM_BASE + RAM_SIZE - 4 * KiB;
+    ITSState its;
+    int i;
+
+    its_init(&its);
+
+    /* A two page queue whose second page is beyond the end of RAM */
+    qtest_writel(its.qts, ITS_BASE + GITS_CTLR, 0);
+    qtest_writeq(its.qts, ITS_BASE + GITS_CBASER,
+                 GITS_CBASER_VALID | cmdq | 1);
+    qtest_writel(its.qts, ITS_BASE + GITS_CTLR, GITS_CTLR_ENABLED);
+    its.cmdq = cmdq;
+    for (i = 0; i < 4 * KiB / ITS_CMD_SIZE; i++) {
+        its_write_cmd(&its, GITS_CMD_SYNC, 0, 0);
+    }
+
+    /* The commands in RAM are processed, then the queue stalls */
+    qtest_writeq(its.qts, ITS_BASE + GITS_CWRITER, 4 * KiB + ITS_CMD_SIZE);
+    g_assert_cmphex(qtest_readq(its.qts, ITS_BASE + GITS_CREADR), ==,
+                    4 * KiB | GITS_CREADR_STALLED);
+
+    /* Advancing GITS_CWRITER does not restart a stalled queue */
+    qtest_writeq(its.qts, ITS_BASE + GITS_CWRITER, 4 * KiB + 2 * ITS_CMD_SIZE);
+    g_assert_cmphex(qtest_readq(its.qts, ITS_BASE + GITS_CREADR), ==,
+                    4 * KiB | GITS_CREADR_STALLED);
+
+    /* Retry reads the command again, which fails again */
+    qtest_writeq(its.qts, ITS_BASE + GITS_CWRITER,
+                 (4 * KiB + 2 * ITS_CMD_SIZE) | GITS_CWRITER_RETRY);
+    g_assert_cmphex(qtest_readq(its.qts, ITS_BASE + GITS_CWRITER), ==,
+                    4 * KiB + 2 * ITS_CMD_SIZE);
+    g_assert_cmphex(qtest_readq(its.qts, ITS_BASE + GITS_CREADR), ==,
+                    4 * KiB | GITS_CREADR_STALLED);
+
+    /* A new queue starts out empty and not stalled */
+    qtest_writel(its.qts, ITS_BASE + GITS_CTLR, 0);
+    qtest_writeq(its.qts, ITS_BASE + GITS_CBASER,
+                 GITS_CBASER_VALID | CMDQ_ADDR);
+    qtest_writeq(its.qts, ITS_BASE + GITS_CWRITER, 0);
+    qtest_writel(its.qts, ITS_BASE + GITS_CTLR, GITS_CTLR_ENABLED);
+    g_assert_cmphex(qtest_readq(its.qts, ITS_BASE + GITS_CREADR), ==, 0);
+    its.cmdq = CMDQ_ADDR;
+    its.cwriter = 0;
+    its_cmd(&its, GITS_CMD_SYNC, 0, 0);
+
+    qtest_quit(its.qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/arm/gicv3-its/translate", test_its_translate);
+    qtest_add_func("/arm/gicv3-its/stall", test_its_stall);
+
+    return g_test_run();
+}
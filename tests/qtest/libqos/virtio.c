@@ -244,11 +244,13 @@ void qvring_init(QTestState *qts, const QGuestAllocator *alloc, QVirtQueue *vq,
     vq->used = (uint64_t)((vq->avail + sizeof(uint16_t) * (3 + vq->size)
         + vq->align - 1) & ~(vq->align - 1));
 
-    for (i = 0; i < vq->size - 1; i++) {
+    /* The last descriptor chains to the first, see qvirtqueue_next_desc() */
+    for (i = 0; i < vq->size; i++) {
         /* vq->desc[i].addr */
         qvirtio_writeq(vq->vdev, qts, vq->desc + (16 * i), 0);
         /* vq->desc[i].next */
-        qvirtio_writew(vq->vdev, qts, vq->desc + (16 * i) + 14, i + 1);
+        qvirtio_writew(vq->vdev, qts, vq->desc + (16 * i) + 14,
+                       (i + 1) % vq->size);
     }
 
     /* vq->avail->flags */
@@ -315,6 +317,19 @@ void qvring_indirect_desc_add(QVirtioDevice *d, QTestState *qts,
     indirect->index++;
 }
 
+/*
+ * Return the descriptor at the free head and advance it.  Descriptors are
+ * handed out in ring order and reused once the head wraps, so at most
+ * vq->size of them may be in flight.
+ */
+static uint32_t qvirtqueue_next_desc(QVirtQueue *vq)
+{
+    uint32_t head = vq->free_head;
+
+    vq->free_head = (vq->free_head + 1) % vq->size;
+    return head;
+}
+
 uint32_t qvirtqueue_add(QTestState *qts, QVirtQueue *vq, uint64_t data,
                         uint32_t len, bool write, bool next)
 {
@@ -336,7 +351,7 @@ uint32_t qvirtqueue_add(QTestState *qts, QVirtQueue *vq, uint64_t data,
     /* vq->desc[vq->free_head].flags */
     qvirtio_writew(vq->vdev, qts, vq->desc + (16 * vq->free_head) + 12, flags);
 
-    return vq->free_head++; /* Return and increase, in this order */
+    return qvirtqueue_next_desc(vq);
 }
 
 uint32_t qvirtqueue_add_indirect(QTestState *qts, QVirtQueue *vq,
@@ -358,11 +373,15 @@ uint32_t qvirtqueue_add_indirect(QTestState *qts, QVirtQueue *vq,
     qvirtio_writew(vq->vdev, qts, vq->desc + (16 * vq->free_head) + 12,
                    VRING_DESC_F_INDIRECT);
 
-    return vq->free_head++; /* Return and increase, in this order */
+    return qvirtqueue_next_desc(vq);
 }
 
-void qvirtqueue_kick(QTestState *qts, QVirtioDevice *d, QVirtQueue *vq,
-                     uint32_t free_head)
+/*
+ * Make the @n descriptor chains starting at @heads available with a single
+ * update of the avail index, and notify the device once for all of them.
+ */
+void qvirtqueue_kick_batch(QTestState *qts, QVirtioDevice *d, QVirtQueue *vq,
+                           const uint32_t *heads, int n)
 {
     /* vq->avail->idx */
     uint16_t idx = qvirtio_readw(d, qts, vq->avail + 2);
@@ -370,24 +389,35 @@ void qvirtqueue_kick(QTestState *qts, QVirtioDevice *d, QVirtQueue *vq,
     uint16_t flags;
     /* vq->used->avail_event */
     uint16_t avail_event;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        uint16_t slot = (uint16_t)(idx + i) % vq->size;
 
-    /* vq->avail->ring[idx % vq->size] */
-    qvirtio_writew(d, qts, vq->avail + 4 + (2 * (idx % vq->size)), free_head);
+        /* vq->avail->ring[slot] */
+        qvirtio_writew(d, qts, vq->avail + 4 + (2 * slot), heads[i]);
+    }
     /* vq->avail->idx */
-    qvirtio_writew(d, qts, vq->avail + 2, idx + 1);
+    qvirtio_writew(d, qts, vq->avail + 2, idx + n);
 
     /* Must read after idx is updated */
     flags = qvirtio_readw(d, qts, vq->avail);
     avail_event = qvirtio_readw(d, qts, vq->used + 4 +
                                 sizeof(struct vring_used_elem) * vq->size);
 
-    /* < 1 because we add elements to avail queue one by one */
+    /* Notify if avail_event is among the @n entries just added */
     if ((flags & VRING_USED_F_NO_NOTIFY) == 0 &&
-                            (!vq->event || (uint16_t)(idx-avail_event) < 1)) {
+        (!vq->event || (uint16_t)(idx + n - avail_event - 1) < n)) {
         d->bus->virtqueue_kick(d, vq);
     }
 }
 
+void qvirtqueue_kick(QTestState *qts, QVirtioDevice *d, QVirtQueue *vq,
+                     uint32_t free_head)
+{
+    qvirtqueue_kick_batch(qts, d, vq, &free_head, 1);
+}
+
 /*
  * qvirtqueue_get_buf:
  * @desc_idx: A pointer that is filled with the vq->desc[] index, may be NULL
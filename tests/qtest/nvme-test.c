@@ -10,9 +10,26 @@
 #include "qemu/osdep.h"
 #include "qemu/module.h"
 #include "qemu/units.h"
+#include "qemu/bswap.h"
 #include "libqos/libqtest.h"
 #include "libqos/qgraph.h"
 #include "libqos/pci.h"
+#include "hw/pci/pci_regs.h"
+
+#define NVME_REG_CC         0x14
+#define NVME_REG_CSTS       0x1c
+#define NVME_REG_AQA        0x24
+#define NVME_REG_ASQ        0x28
+#define NVME_REG_ACQ        0x30
+#define NVME_REG_DBS        0x1000
+
+#define NVME_ADMIN_ENTRIES  8
+#define NVME_IO_ENTRIES     16
+#define NVME_IO_VECTOR      1
+#define NVME_MSI_DATA       0x5a5a5a5a
+
+#define NVME_ID_CTRL_OACS   256
+#define NVME_OACS_DBBUF     (1 << 8)
 
 typedef struct QNvme QNvme;
 
@@ -66,6 +83,379 @@ static void nvmetest_oob_cmb_test(void *obj, void *data, QGuestAllocator *alloc)
     g_assert_cmpint(qpci_io_readl(pdev, bar, cmb_bar_size - 1), !=, 0x44332211);
 }
 
+typedef struct QNvmeQueue {
+    uint16_t qid;
+    uint16_t entries;
+    uint64_t sq_addr;
+    uint64_t cq_addr;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint8_t phase;
+} QNvmeQueue;
+
+typedef struct QNvmeCtrl {
+    QPCIDevice *pdev;
+    QTestState *qts;
+    QGuestAllocator *alloc;
+    QPCIBar bar;
+    uint16_t cid;
+    QNvmeQueue admin;
+    QNvmeQueue io;
+} QNvmeCtrl;
+
+static void nvme_queue_init(QNvmeCtrl *c, QNvmeQueue *q, uint16_t qid,
+                            uint16_t entries)
+{
+    q->qid = qid;
+    q->entries = entries;
+    q->sq_addr = guest_alloc(c->alloc, entries * 64);
+    q->cq_addr = guest_alloc(c->alloc, entries * 16);
+    qtest_memset(c->qts, q->cq_addr, 0, entries * 16);
+    q->sq_tail = 0;
+    q->cq_head = 0;
+    q->phase = 1;
+}
+
+static void nvme_queue_free(QNvmeCtrl *c, QNvmeQueue *q)
+{
+    guest_free(c->alloc, q->sq_addr);
+    guest_free(c->alloc, q->cq_addr);
+}
+
+/* Write a command to the submission queue, without ringing the doorbell */
+static void nvme_push(QNvmeCtrl *c, QNvmeQueue *q, uint8_t opcode,
+                      uint32_t nsid, uint64_t prp1, uint64_t prp2,
+                      uint32_t cdw10, uint32_t cdw11, uint32_t cdw12)
+{
+    uint32_t cmd[16] = { 0 };
+    int i;
+
+    cmd[0] = opcode | (uint32_t)c->cid++ << 16;
+    cmd[1] = nsid;
+    cmd[6] = prp1;
+    cmd[7] = prp1 >> 32;
+    cmd[8] = prp2;
+    cmd[9] = prp2 >> 32;
+    cmd[10] = cdw10;
+    cmd[11] = cdw11;
+    cmd[12] = cdw12;
+    for (i = 0; i < ARRAY_SIZE(cmd); i++) {
+        cmd[i] = cpu_to_le32(cmd[i]);
+    }
+
+    qtest_memwrite(c->qts, q->sq_addr + q->sq_tail * 64, cmd, sizeof(cmd));
+    q->sq_tail = (q->sq_tail + 1) % q->entries;
+}
+
+static void nvme_ring_sq(QNvmeCtrl *c, QNvmeQueue *q)
+{
+    qpci_io_writel(c->pdev, c->bar, NVME_REG_DBS + q->qid * 8, q->sq_tail);
+}
+
+static void nvme_submit(QNvmeCtrl *c, QNvmeQueue *q, uint8_t opcode,
+                        uint32_t nsid, uint64_t prp1, uint32_t cdw10,
+                        uint32_t cdw11, uint32_t cdw12)
+{
+    nvme_push(c, q, opcode, nsid, prp1, 0, cdw10, cdw11, cdw12);
+    nvme_ring_sq(c, q);
+}
+
+/* Wait for the next completion queue entry and return its status */
+static uint16_t nvme_wait_cqe(QNvmeCtrl *c, QNvmeQueue *q)
+{
+    uint64_t addr = q->cq_addr + q->cq_head * 16;
+    gint64 end_time = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
+    uint16_t status;
+
+    for (;;) {
+        qtest_memread(c->qts, addr + 14, &status, sizeof(status));
+        status = le16_to_cpu(status);
+        if ((status & 1) == q->phase) {
+            break;
+        }
+        g_assert(g_get_monotonic_time() < end_time);
+        g_usleep(100);
+    }
+
+    q->cq_head++;
+    if (q->cq_head == q->entries) {
+        q->cq_head = 0;
+        q->phase = !q->phase;
+    }
+
+    return status >> 1;
+}
+
+static void nvme_ring_cq(QNvmeCtrl *c, QNvmeQueue *q)
+{
+    qpci_io_writel(c->pdev, c->bar, NVME_REG_DBS + q->qid * 8 + 4,
+                   q->cq_head);
+}
+
+static void nvme_admin_cmd(QNvmeCtrl *c, uint8_t opcode, uint64_t prp1,
+                           uint32_t cdw10, uint32_t cdw11)
+{
+    nvme_submit(c, &c->admin, opcode, 0, prp1, cdw10, cdw11, 0);
+    g_assert_cmphex(nvme_wait_cqe(c, &c->admin), ==, 0);
+    nvme_ring_cq(c, &c->admin);
+}
+
+static void nvme_read(QNvmeCtrl *c, uint64_t buf, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        nvme_submit(c, &c->io, 0x02, 1, buf, 0, 0, 0);
+    }
+    for (i = 0; i < count; i++) {
+        g_assert_cmphex(nvme_wait_cqe(c, &c->io), ==, 0);
+    }
+}
+
+/*
+ * Enable the controller and MSI-X, and create one I/O queue pair whose
+ * interrupts are written to guest memory at @msi_addr.
+ */
+static void nvme_ctrl_init(QNvmeCtrl *c, QNvme *nvme, QGuestAllocator *alloc,
+                           uint64_t msi_addr)
+{
+    QPCIDevice *pdev = &nvme->dev;
+    uint64_t off;
+    gint64 end_time;
+
+    c->pdev = pdev;
+    c->qts = pdev->bus->qts;
+    c->alloc = alloc;
+    c->cid = 0;
+
+    qpci_device_enable(pdev);
+    c->bar = qpci_iomap(pdev, 0, NULL);
+
+    nvme_queue_init(c, &c->admin, 0, NVME_ADMIN_ENTRIES);
+    qpci_io_writel(pdev, c->bar, NVME_REG_AQA,
+                   (NVME_ADMIN_ENTRIES - 1) << 16 | (NVME_ADMIN_ENTRIES - 1));
+    qpci_io_writel(pdev, c->bar, NVME_REG_ASQ, c->admin.sq_addr);
+    qpci_io_writel(pdev, c->bar, NVME_REG_ASQ + 4, c->admin.sq_addr >> 32);
+    qpci_io_writel(pdev, c->bar, NVME_REG_ACQ, c->admin.cq_addr);
+    qpci_io_writel(pdev, c->bar, NVME_REG_ACQ + 4, c->admin.cq_addr >> 32);
+
+    /* 16 byte CQEs, 64 byte SQEs, 4 KiB pages */
+    qpci_io_writel(pdev, c->bar, NVME_REG_CC, 4 << 20 | 6 << 16 | 1);
+    end_time = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
+    while (!(qpci_io_readl(pdev, c->bar, NVME_REG_CSTS) & 1)) {
+        g_assert(g_get_monotonic_time() < end_time);
+        g_usleep(100);
+    }
+
+    qtest_memset(c->qts, msi_addr, 0, 4);
+    qpci_msix_enable(pdev);
+    off = pdev->msix_table_off + NVME_IO_VECTOR * PCI_MSIX_ENTRY_SIZE;
+    qpci_io_writel(pdev, pdev->msix_table_bar,
+                   off + PCI_MSIX_ENTRY_LOWER_ADDR, msi_addr);
+    qpci_io_writel(pdev, pdev->msix_table_bar,
+                   off + PCI_MSIX_ENTRY_UPPER_ADDR, msi_addr >> 32);
+    qpci_io_writel(pdev, pdev->msix_table_bar,
+                   off + PCI_MSIX_ENTRY_DATA, NVME_MSI_DATA);
+    qpci_io_writel(pdev, pdev->msix_table_bar,
+                   off + PCI_MSIX_ENTRY_VECTOR_CTRL, 0);
+
+    nvme_queue_init(c, &c->io, 1, NVME_IO_ENTRIES);
+
+    /* Create I/O Completion Queue: IEN and PC set */
+    nvme_admin_cmd(c, 0x05, c->io.cq_addr,
+                   (NVME_IO_ENTRIES - 1) << 16 | c->io.qid,
+                   NVME_IO_VECTOR << 16 | 0x3);
+    /* Create I/O Submission Queue: PC set */
+    nvme_admin_cmd(c, 0x01, c->io.sq_addr,
+                   (NVME_IO_ENTRIES - 1) << 16 | c->io.qid,
+                   c->io.qid << 16 | 0x1);
+}
+
+static bool nvme_msi_fired(QNvmeCtrl *c, uint64_t msi_addr)
+{
+    uint32_t data;
+
+    /* MSI writes are little endian, independent of the target */
+    qtest_memread(c->qts, msi_addr, &data, sizeof(data));
+    qtest_memset(c->qts, msi_addr, 0, sizeof(data));
+    return le32_to_cpu(data) == NVME_MSI_DATA;
+}
+
+static void nvmetest_int_coalescing_test(void *obj, void *data,
+                                         QGuestAllocator *alloc)
+{
+    QNvmeCtrl c;
+    uint64_t msi_addr = guest_alloc(alloc, 4);
+    uint64_t buf = guest_alloc(alloc, 4096);
+
+    nvme_ctrl_init(&c, obj, alloc, msi_addr);
+
+    /* Without coalescing, every completion is signalled */
+    nvme_read(&c, buf, 1);
+    g_assert(nvme_msi_fired(&c, msi_addr));
+    nvme_ring_cq(&c, &c.io);
+
+    /* Aggregation threshold of 4 entries, aggregation time of 25.5 ms */
+    nvme_admin_cmd(&c, 0x09, 0, 0x08, 0xff << 8 | 3);
+
+    nvme_read(&c, buf, 2);
+    g_assert(!nvme_msi_fired(&c, msi_addr));
+    nvme_read(&c, buf, 2);
+    g_assert(nvme_msi_fired(&c, msi_addr));
+    nvme_ring_cq(&c, &c.io);
+
+    /* A lone completion is signalled when the aggregation time is over */
+    nvme_read(&c, buf, 1);
+    g_assert(!nvme_msi_fired(&c, msi_addr));
+    qtest_clock_step(c.qts, 25400 * 1000);
+    g_assert(!nvme_msi_fired(&c, msi_addr));
+    qtest_clock_step(c.qts, 100 * 1000);
+    g_assert(nvme_msi_fired(&c, msi_addr));
+    nvme_ring_cq(&c, &c.io);
+
+    /* Coalescing Disable in Interrupt Vector Configuration */
+    nvme_admin_cmd(&c, 0x09, 0, 0x09, 1 << 16 | NVME_IO_VECTOR);
+    nvme_read(&c, buf, 1);
+    g_assert(nvme_msi_fired(&c, msi_addr));
+    nvme_ring_cq(&c, &c.io);
+
+    nvme_queue_free(&c, &c.io);
+    nvme_queue_free(&c, &c.admin);
+    guest_free(alloc, buf);
+    guest_free(alloc, msi_addr);
+}
+
+static uint32_t nvme_shadow_read(QNvmeCtrl *c, uint64_t addr)
+{
+    uint32_t val;
+
+    qtest_memread(c->qts, addr, &val, sizeof(val));
+    return le32_to_cpu(val);
+}
+
+static void nvme_shadow_write(QNvmeCtrl *c, uint64_t addr, uint32_t val)
+{
+    val = cpu_to_le32(val);
+    qtest_memwrite(c->qts, addr, &val, sizeof(val));
+}
+
+/* Wait for the device to set the event index at @addr to @val */
+static void nvme_wait_eventidx(QNvmeCtrl *c, uint64_t addr, uint32_t val)
+{
+    gint64 end_time = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
+
+    while (nvme_shadow_read(c, addr) != val) {
+        g_assert(g_get_monotonic_time() < end_time);
+        g_usleep(100);
+    }
+}
+
+static void nvmetest_shadow_doorbell_test(void *obj, void *data,
+                                          QGuestAllocator *alloc)
+{
+    QNvmeCtrl c;
+    uint64_t msi_addr = guest_alloc(alloc, 4);
+    uint64_t buf = guest_alloc(alloc, 4096);
+    uint64_t dbs = guest_alloc(alloc, 4096);
+    uint64_t eis = guest_alloc(alloc, 4096);
+    uint64_t sq_db, cq_db, sq_ei, cq_ei;
+    uint16_t oacs, old_head;
+    int i;
+
+    nvme_ctrl_init(&c, obj, alloc, msi_addr);
+    sq_db = dbs + c.io.qid * 8;
+    cq_db = sq_db + 4;
+    sq_ei = eis + c.io.qid * 8;
+    cq_ei = sq_ei + 4;
+
+    /* Identify Controller reports Doorbell Buffer Config support */
+    nvme_admin_cmd(&c, 0x06, buf, 1, 0);
+    qtest_memread(c.qts, buf + NVME_ID_CTRL_OACS, &oacs, sizeof(oacs));
+    g_assert_cmphex(le16_to_cpu(oacs) & NVME_OACS_DBBUF, ==, NVME_OACS_DBBUF);
+
+    /* Doorbell Buffer Config fills in the shadows of existing queues */
+    g_assert_cmphex(dbs & 0xfff, ==, 0);
+    g_assert_cmphex(eis & 0xfff, ==, 0);
+    qtest_memset(c.qts, dbs, 0xff, 4096);
+    qtest_memset(c.qts, eis, 0, 4096);
+    nvme_push(&c, &c.admin, 0x7c, 0, dbs, eis, 0, 0, 0);
+    nvme_ring_sq(&c, &c.admin);
+    g_assert_cmphex(nvme_wait_cqe(&c, &c.admin), ==, 0);
+    nvme_ring_cq(&c, &c.admin);
+    g_assert_cmpuint(nvme_shadow_read(&c, sq_db), ==, c.io.sq_tail);
+    g_assert_cmpuint(nvme_shadow_read(&c, cq_db), ==, c.io.cq_head);
+
+    /* The device publishes the submission queue tail it has seen */
+    nvme_push(&c, &c.io, 0x02, 1, buf, 0, 0, 0, 0);
+    nvme_shadow_write(&c, sq_db, c.io.sq_tail);
+    nvme_ring_sq(&c, &c.io);
+    g_assert_cmphex(nvme_wait_cqe(&c, &c.io), ==, 0);
+    nvme_wait_eventidx(&c, sq_ei, c.io.sq_tail);
+
+    for (i = 0; i < 2; i++) {
+        nvme_push(&c, &c.io, 0x02, 1, buf, 0, 0, 0, 0);
+    }
+    nvme_shadow_write(&c, sq_db, c.io.sq_tail);
+    nvme_ring_sq(&c, &c.io);
+    for (i = 0; i < 2; i++) {
+        g_assert_cmphex(nvme_wait_cqe(&c, &c.io), ==, 0);
+    }
+    nvme_wait_eventidx(&c, sq_ei, c.io.sq_tail);
+
+    /*
+     * The completion queue head is only written to the shadow.  More
+     * entries than fit after the initial head must still be posted.
+     */
+    nvme_shadow_write(&c, cq_db, c.io.cq_head);
+    for (i = 0; i < NVME_IO_ENTRIES - 2; i++) {
+        nvme_push(&c, &c.io, 0x02, 1, buf, 0, 0, 0, 0);
+    }
+    nvme_shadow_write(&c, sq_db, c.io.sq_tail);
+    nvme_ring_sq(&c, &c.io);
+    for (i = 0; i < NVME_IO_ENTRIES - 2; i++) {
+        g_assert_cmphex(nvme_wait_cqe(&c, &c.io), ==, 0);
+    }
+
+    /*
+     * Fill the completion queue.  The device then asks for a doorbell
+     * write through the event index once it has another entry to post.
+     */
+    nvme_shadow_write(&c, cq_db, c.io.cq_head);
+    old_head = c.io.cq_head;
+    for (i = 0; i < NVME_IO_ENTRIES - 1; i++) {
+        nvme_push(&c, &c.io, 0x02, 1, buf, 0, 0, 0, 0);
+    }
+    nvme_shadow_write(&c, sq_db, c.io.sq_tail);
+    nvme_ring_sq(&c, &c.io);
+    for (i = 0; i < NVME_IO_ENTRIES - 1; i++) {
+        g_assert_cmphex(nvme_wait_cqe(&c, &c.io), ==, 0);
+    }
+    g_assert_cmpuint(nvme_shadow_read(&c, cq_ei), ==, 0);
+
+    nvme_push(&c, &c.io, 0x02, 1, buf, 0, 0, 0, 0);
+    nvme_shadow_write(&c, sq_db, c.io.sq_tail);
+    nvme_ring_sq(&c, &c.io);
+    nvme_wait_eventidx(&c, cq_ei, old_head);
+    nvme_wait_eventidx(&c, sq_ei, c.io.sq_tail);
+
+    nvme_shadow_write(&c, cq_db, c.io.cq_head);
+    nvme_ring_cq(&c, &c.io);
+    g_assert_cmphex(nvme_wait_cqe(&c, &c.io), ==, 0);
+
+    nvme_queue_free(&c, &c.io);
+    nvme_queue_free(&c, &c.admin);
+    guest_free(alloc, eis);
+    guest_free(alloc, dbs);
+    guest_free(alloc, buf);
+    guest_free(alloc, msi_addr);
+}
+
+static void *nvme_setup_iothread(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line, " -object iothread,id=thread0");
+    return arg;
+}
+
 static void nvme_register_nodes(void)
 {
     QOSGraphEdgeOptions opts = {
@@ -83,6 +473,14 @@ static void nvme_register_nodes(void)
     qos_add_test("oob-cmb-access", "nvme", nvmetest_oob_cmb_test, &(QOSGraphTestOptions) {
         .edge.extra_device_opts = "cmb_size_mb=2"
     });
+    qos_add_test("int-coalescing", "nvme", nvmetest_int_coalescing_test, NULL);
+    qos_add_test("shadow-doorbell", "nvme", nvmetest_shadow_doorbell_test,
+                 NULL);
+    qos_add_test("shadow-doorbell-iothread", "nvme",
+                 nvmetest_shadow_doorbell_test, &(QOSGraphTestOptions) {
+        .before = nvme_setup_iothread,
+        .edge.extra_device_opts = "iothread=thread0",
+    });
 }
 
 libqos_init(nvme_register_nodes);
@@ -0,0 +1,419 @@
+/*
+ * QTest testcase for the IOTLB invalidation of the SMMUv3
+ *
+ * Two edu devices sit behind the SMMU with different ASIDs but the same
+ * page tables.  Each check moves an IOVA to a new frame in the page tables
+ * without invalidating it, issues the invalidation command under test and
+ * then lets edu DMA to the IOVA: the data lands in the new frame if the
+ * IOTLB entry was dropped and in the old one if it survived.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "libqos/libqtest.h"
+#include "hw/pci/pci_regs.h"
+
+/* Addresses on the virt board with highmem=off */
+#define SMMU_BASE           0x09050000ULL
+#define PCIE_MMIO_BASE      0x10000000ULL
+#define PCIE_ECAM_BASE      0x3f000000ULL
+#define RAM_BASE            0x40000000ULL
+#define PAGE_SIZE           4096
+
+/* SMMUv3 registers and commands, see hw/arm/smmuv3-internal.h */
+#define SMMU_CR0            0x20
+#define SMMU_CR0ACK         0x24
+#define SMMU_GERROR         0x60
+#define SMMU_STRTAB_BASE    0x80
+#define SMMU_STRTAB_BASE_CFG 0x88
+#define SMMU_CMDQ_BASE      0x90
+#define SMMU_CMDQ_PROD      0x98
+#define SMMU_CMDQ_CONS      0x9c
+#define SMMU_CR0_SMMUEN     (1 << 0)
+#define SMMU_CR0_CMDQEN     (1 << 3)
+#define CMDQ_LOG2SIZE       8
+
+#define CMD_TLBI_NH_ALL     0x10
+#define CMD_TLBI_NH_ASID    0x11
+#define CMD_TLBI_NH_VA      0x12
+#define CMD_TLBI_NH_VAA     0x13
+#define CMD_TG_4K           1
+
+/* Guest memory layout */
+#define STRTAB_ADDR         (RAM_BASE + 0x0000)
+#define STRTAB_LOG2SIZE     5
+#define CD_ADDR(i)          (RAM_BASE + 0x1000 + (i) * 64)
+#define CMDQ_ADDR           (RAM_BASE + 0x2000)
+#define PT_L1_ADDR          (RAM_BASE + 0x10000)
+#define PT_L2_ADDR          (RAM_BASE + 0x11000)
+#define PT_L3_ADDR          (RAM_BASE + 0x12000)
+#define PAGE_OLD(i)         (RAM_BASE + 0x100000 + (i) * PAGE_SIZE)
+#define PAGE_NEW(i)         (RAM_BASE + 0x200000 + (i) * PAGE_SIZE)
+#define BLOCK_OLD           (RAM_BASE + 0x400000)
+#define BLOCK_NEW           (RAM_BASE + 0x600000)
+
+/*
+ * 4 KiB granule and a 39-bit input size, so the walk starts at level 1.
+ * NPAGES level 3 pages start at IOVA_PAGES and a level 2 block maps
+ * IOVA_BLOCK, all below the 28-bit DMA mask of edu.
+ */
+#define T0SZ                25
+#define IOVA_PAGES          0x400000ULL
+#define IOVA_BLOCK          0x800000ULL
+#define NPAGES              16
+#define PTE_TABLE           0x3ULL
+#define PTE_PAGE            (0x3ULL | (1ULL << 10))
+#define PTE_BLOCK           (0x1ULL | (1ULL << 10))
+
+/* Bit i of a mask stands for page i, BLOCK_BIT for the block */
+#define BLOCK_BIT           (1U << NPAGES)
+#define ALL_PAGES           (BLOCK_BIT - 1)
+#define ALL_ENTRIES         (ALL_PAGES | BLOCK_BIT)
+
+/* edu registers, see docs/specs/edu.txt */
+#define EDU_DMA_SRC         0x80
+#define EDU_DMA_DST         0x88
+#define EDU_DMA_CNT         0x90
+#define EDU_DMA_CMD         0x98
+#define EDU_DMA_RUN         0x1
+#define EDU_DMA_TO_PCI      0x2
+#define EDU_DMA_BUF         0x40000
+#define EDU_DMA_DELAY_NS    (200 * 1000 * 1000)
+#define EDU_BAR_SIZE        (1 * MiB)
+
+#define NDEVS               2
+#define EDU_SLOT(dev)       (2 + (dev))
+#define EDU_SID(dev)        (EDU_SLOT(dev) << 3)     /* bus 0, function 0 */
+#define EDU_BAR(dev)        (PCIE_MMIO_BASE + (dev) * EDU_BAR_SIZE)
+#define DEV_ASID(dev)       (1 + (dev))
+
+typedef struct SMMUTest {
+    QTestState *qts;
+    uint32_t cmdq_prod;
+} SMMUTest;
+
+static void edu_init(SMMUTest *t, int dev)
+{
+    uint64_t cfg = PCIE_ECAM_BASE + (EDU_SLOT(dev) << 15);
+
+    qtest_writel(t->qts, cfg + PCI_BASE_ADDRESS_0, EDU_BAR(dev));
+    qtest_writew(t->qts, cfg + PCI_COMMAND,
+                 PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+}
+
+/* Write 8 bytes from the (zeroed) buffer of edu @dev to @iova */
+static void edu_dma_write(SMMUTest *t, int dev, uint64_t iova)
+{
+    qtest_writeq(t->qts, EDU_BAR(dev) + EDU_DMA_SRC, EDU_DMA_BUF);
+    qtest_writeq(t->qts, EDU_BAR(dev) + EDU_DMA_DST, iova);
+    qtest_writeq(t->qts, EDU_BAR(dev) + EDU_DMA_CNT, 8);
+    qtest_writeq(t->qts, EDU_BAR(dev) + EDU_DMA_CMD,
+                 EDU_DMA_RUN | EDU_DMA_TO_PCI);
+    qtest_clock_step(t->qts, EDU_DMA_DELAY_NS);
+    g_assert_cmpint(qtest_readq(t->qts, EDU_BAR(dev) + EDU_DMA_CMD) &
+                    EDU_DMA_RUN, ==, 0);
+}
+
+static void smmu_cmd(SMMUTest *t, uint32_t w0, uint32_t w1,
+                     uint32_t w2, uint32_t w3)
+{
+    uint64_t entry = CMDQ_ADDR +
+                     (t->cmdq_prod & ((1 << CMDQ_LOG2SIZE) - 1)) * 16;
+
+    qtest_writel(t->qts, entry, w0);
+    qtest_writel(t->qts, entry + 4, w1);
+    qtest_writel(t->qts, entry + 8, w2);
+    qtest_writel(t->qts, entry + 12, w3);
+
+    /* The index carries a wrap bit above the entry index */
+    t->cmdq_prod = (t->cmdq_prod + 1) & ((2 << CMDQ_LOG2SIZE) - 1);
+    qtest_writel(t->qts, SMMU_BASE + SMMU_CMDQ_PROD, t->cmdq_prod);
+
+    g_assert_cmphex(qtest_readl(t->qts, SMMU_BASE + SMMU_CMDQ_CONS), ==,
+                    t->cmdq_prod);
+    g_assert_cmphex(qtest_readl(t->qts, SMMU_BASE + SMMU_GERROR), ==, 0);
+}
+
+/*
+ * Issue TLBI_NH_VA (@asid >= 0) or TLBI_NH_VAA for @iova.  With @tg set
+ * this is a range of (@num + 1) << @scale pages, with @ttl as level hint.
+ */
+static void smmu_tlbi_va(SMMUTest *t, int asid, uint64_t iova, int tg,
+                         int scale, int num, int ttl)
+{
+    uint32_t type = asid >= 0 ? CMD_TLBI_NH_VA : CMD_TLBI_NH_VAA;
+
+    smmu_cmd(t, type | num << 12 | scale << 20,
+             asid >= 0 ? asid << 16 : 0,
+             ttl << 8 | tg << 10 | (uint32_t)(iova & ~0xfffULL),
+             iova >> 32);
+}
+
+static void map_pages(SMMUTest *t, bool new)
+{
+    int i;
+
+    for (i = 0; i < NPAGES; i++) {
+        qtest_writeq(t->qts,
+                     PT_L3_ADDR + ((IOVA_PAGES >> 12) % 512 + i) * 8,
+                     (new ? PAGE_NEW(i) : PAGE_OLD(i)) | PTE_PAGE);
+    }
+    qtest_writeq(t->qts, PT_L2_ADDR + (IOVA_BLOCK >> 21) * 8,
+                 (new ? BLOCK_NEW : BLOCK_OLD) | PTE_BLOCK);
+}
+
+static void smmu_test_start(SMMUTest *t)
+{
+    int dev;
+
+    t->qts = qtest_initf("-machine virt,highmem=off,iommu=smmuv3 "
+                         "-device edu,addr=%02x.0 -device edu,addr=%02x.0",
+                         EDU_SLOT(0), EDU_SLOT(1));
+    t->cmdq_prod = 0;
+
+    /* Page tables shared by both devices */
+    qtest_memset(t->qts, PT_L1_ADDR, 0, 3 * PAGE_SIZE);
+    qtest_writeq(t->qts, PT_L1_ADDR, PT_L2_ADDR | PTE_TABLE);
+    qtest_writeq(t->qts, PT_L2_ADDR + (IOVA_PAGES >> 21) * 8,
+                 PT_L3_ADDR | PTE_TABLE);
+    map_pages(t, false);
+
+    /* A linear stream table with an S1 STE and a CD per device */
+    qtest_memset(t->qts, STRTAB_ADDR, 0, 64 << STRTAB_LOG2SIZE);
+    for (dev = 0; dev < NDEVS; dev++) {
+        uint64_t ste = STRTAB_ADDR + EDU_SID(dev) * 64;
+
+        qtest_memset(t->qts, CD_ADDR(dev), 0, 64);
+        /* T0SZ, TG0 = 4K, EPD1, V */
+        qtest_writel(t->qts, CD_ADDR(dev), T0SZ | 1U << 30 | 1U << 31);
+        /* IPS = 40 bits, AA64, R, A, ASID */
+        qtest_writel(t->qts, CD_ADDR(dev) + 4,
+                     2 | 1 << 9 | 1 << 13 | 1 << 14 | DEV_ASID(dev) << 16);
+        qtest_writeq(t->qts, CD_ADDR(dev) + 8, PT_L1_ADDR);
+
+        /* V, Config = S1 translate, S2 bypass */
+        qtest_writel(t->qts, ste, 1 | 5 << 1 | (uint32_t)CD_ADDR(dev));
+        qtest_writel(t->qts, ste + 4, CD_ADDR(dev) >> 32);
+
+        edu_init(t, dev);
+    }
+
+    qtest_writeq(t->qts, SMMU_BASE + SMMU_STRTAB_BASE, STRTAB_ADDR);
+    qtest_writel(t->qts, SMMU_BASE + SMMU_STRTAB_BASE_CFG, STRTAB_LOG2SIZE);
+    qtest_writeq(t->qts, SMMU_BASE + SMMU_CMDQ_BASE,
+                 CMDQ_ADDR | CMDQ_LOG2SIZE);
+    qtest_writel(t->qts, SMMU_BASE + SMMU_CMDQ_PROD, 0);
+    qtest_writel(t->qts, SMMU_BASE + SMMU_CMDQ_CONS, 0);
+    qtest_writel(t->qts, SMMU_BASE + SMMU_CR0,
+                 SMMU_CR0_SMMUEN | SMMU_CR0_CMDQEN);
+    g_assert_cmphex(qtest_readl(t->qts, SMMU_BASE + SMMU_CR0ACK), ==,
+                    SMMU_CR0_SMMUEN | SMMU_CR0_CMDQEN);
+}
+
+static void smmu_test_stop(SMMUTest *t)
+{
+    qtest_quit(t->qts);
+}
+
+/*
+ * Start from an empty IOTLB, cache the old translation of every page and
+ * of the block in both ASIDs, then point them all at their new frames
+ * without invalidating anything.
+ */
+static void warm_iotlb(SMMUTest *t)
+{
+    int dev, i;
+
+    smmu_cmd(t, CMD_TLBI_NH_ALL, 0, 0, 0);
+    map_pages(t, false);
+    for (dev = 0; dev < NDEVS; dev++) {
+        for (i = 0; i < NPAGES; i++) {
+            edu_dma_write(t, dev, IOVA_PAGES + i * PAGE_SIZE);
+        }
+        edu_dma_write(t, dev, IOVA_BLOCK);
+    }
+    map_pages(t, true);
+}
+
+/* Return whether a DMA to @iova reaches @new_pa rather than @old_pa */
+static bool dma_uses_new(SMMUTest *t, int dev, uint64_t iova,
+                         uint64_t old_pa, uint64_t new_pa)
+{
+    uint64_t old_val, new_val;
+
+    qtest_writeq(t->qts, old_pa, ~0ULL);
+    qtest_writeq(t->qts, new_pa, ~0ULL);
+    edu_dma_write(t, dev, iova);
+    old_val = qtest_readq(t->qts, old_pa);
+    new_val = qtest_readq(t->qts, new_pa);
+
+    g_assert((old_val == 0) != (new_val == 0));
+    return new_val == 0;
+}
+
+/* Check that exactly the entries in @mask are gone from the ASID of @dev */
+static void check_invalidated(SMMUTest *t, int dev, uint32_t mask)
+{
+    uint32_t invalidated = 0;
+    int i;
+
+    for (i = 0; i < NPAGES; i++) {
+        if (dma_uses_new(t, dev, IOVA_PAGES + i * PAGE_SIZE,
+                         PAGE_OLD(i), PAGE_NEW(i))) {
+            invalidated |= 1U << i;
+        }
+    }
+    if (dma_uses_new(t, dev, IOVA_BLOCK, BLOCK_OLD, BLOCK_NEW)) {
+        invalidated |= BLOCK_BIT;
+    }
+    g_assert_cmphex(invalidated, ==, mask);
+}
+
+#define PAGE_IOVA(i)        (IOVA_PAGES + (i) * PAGE_SIZE)
+#define PAGE_RANGE(a, b)    (((1U << ((b) + 1)) - 1) & ~((1U << (a)) - 1))
+
+/*
+ * Range invalidations that cover fewer pages than there are entries are
+ * done by probing the pages of the range, including ranges whose length
+ * is not a power of two.
+ */
+static void test_range_probe(void)
+{
+    SMMUTest t;
+
+    smmu_test_start(&t);
+
+    /* 3 pages */
+    warm_iotlb(&t);
+    smmu_tlbi_va(&t, DEV_ASID(0), PAGE_IOVA(3), CMD_TG_4K, 0, 2, 0);
+    check_invalidated(&t, 0, PAGE_RANGE(3, 5));
+    check_invalidated(&t, 1, 0);
+
+    /* 3 << 1 pages */
+    warm_iotlb(&t);
+    smmu_tlbi_va(&t, DEV_ASID(1), PAGE_IOVA(5), CMD_TG_4K, 1, 2, 0);
+    check_invalidated(&t, 0, 0);
+    check_invalidated(&t, 1, PAGE_RANGE(5, 10));
+
+    smmu_test_stop(&t);
+}
+
+/*
+ * Larger ranges walk the entries of the ASID instead, and must stop at
+ * both ends of the range just the same.
+ */
+static void test_range_walk(void)
+{
+    SMMUTest t;
+
+    smmu_test_start(&t);
+
+    /* 1 << 20 pages from page 8, beyond the block */
+    warm_iotlb(&t);
+    smmu_tlbi_va(&t, DEV_ASID(0), PAGE_IOVA(8), CMD_TG_4K, 20, 0, 0);
+    check_invalidated(&t, 0, PAGE_RANGE(8, NPAGES - 1) | BLOCK_BIT);
+    check_invalidated(&t, 1, 0);
+
+    /* 18 << 2 pages ending with page 5 */
+    warm_iotlb(&t);
+    smmu_tlbi_va(&t, DEV_ASID(1), PAGE_IOVA(5 - 71), CMD_TG_4K, 2, 17, 0);
+    check_invalidated(&t, 0, 0);
+    check_invalidated(&t, 1, PAGE_RANGE(0, 5));
+
+    smmu_test_stop(&t);
+}
+
+/*
+ * A TTL hint restricts the invalidation to leaf entries of that level,
+ * whether the range is probed or walked.  Without a granule, the 4K range
+ * still drops the block that contains it.
+ */
+static void test_ttl(void)
+{
+    SMMUTest t;
+
+    smmu_test_start(&t);
+
+    /* 16 MiB over the pages and the block: 8 level 2 probes */
+    warm_iotlb(&t);
+    smmu_tlbi_va(&t, DEV_ASID(0), IOVA_PAGES, CMD_TG_4K, 10, 3, 2);
+    check_invalidated(&t, 0, BLOCK_BIT);
+
+    /* The same range at level 3 has more pages than entries: walked */
+    warm_iotlb(&t);
+    smmu_tlbi_va(&t, DEV_ASID(0), IOVA_PAGES, CMD_TG_4K, 10, 3, 3);
+    check_invalidated(&t, 0, ALL_PAGES);
+
+    warm_iotlb(&t);
+    smmu_tlbi_va(&t, DEV_ASID(0), IOVA_BLOCK + 5 * PAGE_SIZE, 0, 0, 0, 0);
+    check_invalidated(&t, 0, BLOCK_BIT);
+    check_invalidated(&t, 1, 0);
+
+    smmu_test_stop(&t);
+}
+
+/* TLBI_NH_VAA applies to every ASID, TLBI_NH_VA only to its own */
+static void test_asids(void)
+{
+    SMMUTest t;
+
+    smmu_test_start(&t);
+
+    warm_iotlb(&t);
+    smmu_tlbi_va(&t, -1, PAGE_IOVA(7), CMD_TG_4K, 0, 1, 0);
+    check_invalidated(&t, 0, PAGE_RANGE(7, 8));
+    check_invalidated(&t, 1, PAGE_RANGE(7, 8));
+
+    warm_iotlb(&t);
+    smmu_tlbi_va(&t, -1, IOVA_PAGES, CMD_TG_4K, 20, 0, 0);
+    check_invalidated(&t, 0, ALL_ENTRIES);
+    check_invalidated(&t, 1, ALL_ENTRIES);
+
+    warm_iotlb(&t);
+    smmu_tlbi_va(&t, DEV_ASID(0), PAGE_IOVA(12), 0, 0, 0, 0);
+    check_invalidated(&t, 0, 1U << 12);
+    check_invalidated(&t, 1, 0);
+
+    warm_iotlb(&t);
+    smmu_cmd(&t, CMD_TLBI_NH_ASID, DEV_ASID(1) << 16, 0, 0);
+    check_invalidated(&t, 0, 0);
+    check_invalidated(&t, 1, ALL_ENTRIES);
+
+    smmu_test_stop(&t);
+}
+
+/*
+ * A range that runs past the top of the address space ends there rather
+ * than wrapping around to the entries at the bottom.
+ */
+static void test_range_wrap(void)
+{
+    uint64_t top = -(uint64_t)(16 * MiB);
+    SMMUTest t;
+
+    smmu_test_start(&t);
+
+    warm_iotlb(&t);
+    smmu_tlbi_va(&t, -1, top, CMD_TG_4K, 20, 31, 0);
+    smmu_tlbi_va(&t, DEV_ASID(0), top, CMD_TG_4K, 20, 31, 3);
+    check_invalidated(&t, 0, 0);
+    check_invalidated(&t, 1, 0);
+
+    smmu_test_stop(&t);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/smmuv3/tlbi/range-probe", test_range_probe);
+    qtest_add_func("/smmuv3/tlbi/range-walk", test_range_walk);
+    qtest_add_func("/smmuv3/tlbi/ttl", test_ttl);
+    qtest_add_func("/smmuv3/tlbi/asids", test_asids);
+    qtest_add_func("/smmuv3/tlbi/range-wrap", test_range_wrap);
+
+    return g_test_run();
+}
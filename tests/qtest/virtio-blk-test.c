@@ -766,6 +766,244 @@ static void resize(void *obj, void *data, QGuestAllocator *t_alloc)
 
 }
 
+/*
+ * Queue @n requests of @segs sectors each, with every sector in its own
+ * descriptor, make them available to the device at once and wait for all
+ * of them.  Request i covers the sectors from @sector + i * @segs.  Writes
+ * fill each sector with a byte derived from @seed and the sector number,
+ * reads check it.
+ */
+static void batch_rw(QVirtioDevice *dev, QGuestAllocator *alloc,
+                     QVirtQueue *vq, uint32_t type, int n, int segs,
+                     uint64_t sector, uint8_t seed)
+{
+    QTestState *qts = global_qtest;
+    g_autofree uint64_t *addrs = g_new(uint64_t, n);
+    g_autofree uint32_t *heads = g_new(uint32_t, n);
+    g_autofree char *data = g_malloc(segs * 512);
+    gint64 deadline;
+    uint32_t head;
+    int i, j, done;
+
+    g_assert_cmpint(n * (segs + 2), <=, vq->size);
+
+    for (i = 0; i < n; i++) {
+        uint64_t first = sector + i * segs;
+        QVirtioBlkReq req = {
+            .type = type,
+            .ioprio = 1,
+            .sector = first,
+            .data = data,
+        };
+
+        for (j = 0; j < segs; j++) {
+            memset(data + j * 512,
+                   type == VIRTIO_BLK_T_OUT ? (uint8_t)(seed + first + j) : 0,
+                   512);
+        }
+        addrs[i] = virtio_blk_request(alloc, dev, &req, segs * 512);
+
+        heads[i] = qvirtqueue_add(qts, vq, addrs[i], 16, false, true);
+        for (j = 0; j < segs; j++) {
+            qvirtqueue_add(qts, vq, addrs[i] + 16 + j * 512, 512,
+                           type == VIRTIO_BLK_T_IN, true);
+        }
+        qvirtqueue_add(qts, vq, addrs[i] + 16 + segs * 512, 1, true, false);
+    }
+    qvirtqueue_kick_batch(qts, dev, vq, heads, n);
+
+    /* Every request must complete exactly once */
+    deadline = g_get_monotonic_time() + QVIRTIO_BLK_TIMEOUT_US;
+    for (done = 0; done < n; done++) {
+        while (!qvirtqueue_get_buf(qts, vq, &head, NULL)) {
+            g_assert_cmpint(g_get_monotonic_time(), <, deadline);
+            qtest_clock_step(qts, 100);
+        }
+        for (i = 0; i < n && heads[i] != head; i++) {
+            /* nothing */
+        }
+        g_assert_cmpint(i, <, n);
+        heads[i] = UINT32_MAX;
+    }
+
+    for (i = 0; i < n; i++) {
+        uint64_t first = sector + i * segs;
+
+        g_assert_cmpint(readb(addrs[i] + 16 + segs * 512), ==,
+                        VIRTIO_BLK_S_OK);
+        if (type == VIRTIO_BLK_T_IN) {
+            memread(addrs[i] + 16, data, segs * 512);
+            for (j = 0; j < segs; j++) {
+                g_assert_cmpint((uint8_t)data[j * 512], ==,
+                                (uint8_t)(seed + first + j));
+                g_assert_cmpint((uint8_t)data[j * 512 + 511], ==,
+                                (uint8_t)(seed + first + j));
+            }
+        }
+        guest_free(alloc, addrs[i]);
+    }
+}
+
+/*
+ * virtio-blk pops requests in batches of 32.  Make more than that
+ * available at once, so that after a few rounds a batch crosses the end of
+ * the avail ring, the used ring and the descriptor table.
+ */
+static void batch_wrap(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QVirtQueue *vq;
+    uint64_t features;
+    int round;
+
+    /* Keep EVENT_IDX, avail_event is only written at the end of a batch */
+    features = qvirtio_get_features(dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                    (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                    (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+    vq = qvirtqueue_setup(dev, t_alloc, 0);
+    qvirtio_set_driver_ok(dev);
+
+    for (round = 0; round < 12; round++) {
+        batch_rw(dev, t_alloc, vq, VIRTIO_BLK_T_OUT, 48, 1, round * 48, 0);
+    }
+    for (round = 0; round < 12; round++) {
+        batch_rw(dev, t_alloc, vq, VIRTIO_BLK_T_IN, 48, 1, round * 48, 0);
+    }
+
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
+/*
+ * Popped elements are recycled through a per-queue pool.  Write with
+ * requests of one shape and read the data back with the other one, single
+ * sector requests or six sector requests, so that recycled elements change
+ * their number of in and out segments all the time.
+ */
+static void element_reuse(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QVirtQueue *vq;
+    uint64_t features;
+    int round;
+
+    features = qvirtio_get_features(dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                    (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                    (1u << VIRTIO_RING_F_EVENT_IDX) |
+                    (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+    vq = qvirtqueue_setup(dev, t_alloc, 0);
+    qvirtio_set_driver_ok(dev);
+
+    for (round = 0; round < 16; round++) {
+        int wsegs = round % 2 ? 6 : 1;
+        int rsegs = round % 2 ? 1 : 6;
+
+        batch_rw(dev, t_alloc, vq, VIRTIO_BLK_T_OUT, 24 / wsegs, wsegs,
+                 0, round);
+        batch_rw(dev, t_alloc, vq, VIRTIO_BLK_T_IN, 24 / rsegs, rsegs,
+                 0, round);
+    }
+
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
+/* Issue a single 512 byte request on @vq and return its status */
+static uint8_t multi_iothread_rw(QVirtioDevice *dev, QGuestAllocator *alloc,
+                                 QVirtQueue *vq, uint32_t type,
+                                 uint64_t sector, char *buf)
+{
+    QTestState *qts = global_qtest;
+    QVirtioBlkReq req = {
+        .type = type,
+        .ioprio = 1,
+        .sector = sector,
+        .data = g_malloc0(512),
+    };
+    uint64_t req_addr;
+    uint32_t free_head;
+    uint8_t status;
+
+    if (type == VIRTIO_BLK_T_OUT) {
+        memcpy(req.data, buf, 512);
+    }
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 16, 512, type == VIRTIO_BLK_T_IN, true);
+    qvirtqueue_add(qts, vq, req_addr + 528, 1, true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    status = readb(req_addr + 528);
+    if (type == VIRTIO_BLK_T_IN) {
+        memread(req_addr + 16, buf, 512);
+    }
+
+    guest_free(alloc, req_addr);
+    return status;
+}
+
+/*
+ * The two virtqueues are handled by different IOThreads, and only the first
+ * one is in the AioContext of the BlockBackend.  Write through each queue
+ * and read the data back through the other one.
+ */
+static void multi_iothread(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlkPCI *blk = obj;
+    QVirtioDevice *dev = &blk->pci_vdev.vdev;
+    QVirtQueue *vq[2];
+    uint64_t features;
+    char buf[512];
+    int i, round;
+
+    features = qvirtio_get_features(dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                    (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                    (1u << VIRTIO_RING_F_EVENT_IDX) |
+                    (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    for (i = 0; i < 2; i++) {
+        vq[i] = qvirtqueue_setup(dev, t_alloc, i);
+    }
+    qvirtio_set_driver_ok(dev);
+
+    /* More requests than a queue has entries, to wrap the used rings */
+    for (round = 0; round < 300; round++) {
+        for (i = 0; i < 2; i++) {
+            uint64_t sector = round % 8 * 2 + i;
+
+            memset(buf, 0, sizeof(buf));
+            snprintf(buf, sizeof(buf), "round %d queue %d", round, i);
+            g_assert_cmpint(multi_iothread_rw(dev, t_alloc, vq[i],
+                                              VIRTIO_BLK_T_OUT, sector, buf),
+                            ==, 0);
+        }
+        for (i = 0; i < 2; i++) {
+            uint64_t sector = round % 8 * 2 + i;
+            char expected[512] = "";
+
+            snprintf(expected, sizeof(expected), "round %d queue %d", round, i);
+            g_assert_cmpint(multi_iothread_rw(dev, t_alloc, vq[!i],
+                                              VIRTIO_BLK_T_IN, sector, buf),
+                            ==, 0);
+            g_assert_cmpstr(buf, ==, expected);
+        }
+    }
+
+    for (i = 0; i < 2; i++) {
+        qvirtqueue_cleanup(dev->bus, vq[i], t_alloc);
+    }
+}
+
 static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
 {
     char *tmp_path = drive_create();
@@ -790,6 +1028,8 @@ static void register_virtio_blk_test(void)
     qos_add_test("config", "virtio-blk", config, &opts);
     qos_add_test("basic", "virtio-blk", basic, &opts);
     qos_add_test("resize", "virtio-blk", resize, &opts);
+    qos_add_test("batch-wrap", "virtio-blk", batch_wrap, &opts);
+    qos_add_test("element-reuse", "virtio-blk", element_reuse, &opts);
 
     /* tests just for virtio-blk-pci */
     qos_add_test("msix", "virtio-blk-pci", msix, &opts);
@@ -797,6 +1037,13 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+
+    opts.edge.before_cmd_line = "-object iothread,id=iothread0 "
+                                "-object iothread,id=iothread1";
+    opts.edge.extra_device_opts = "num-queues=2,len-iothreads=2,"
+                                  "iothreads[0]=iothread0,"
+                                  "iothreads[1]=iothread1";
+    qos_add_test("multi-iothread", "virtio-blk-pci", multi_iothread, &opts);
 }
 
 libqos_init(register_virtio_blk_test);
@@ -0,0 +1,544 @@
+/*
+ * QTest testcase for virtio-iommu-pci
+ *
+ * An edu device sits behind the IOMMU, so that its DMA engine can check
+ * the translations.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "libqos/libqtest.h"
+#include "libqos/malloc.h"
+#include "libqos/pci.h"
+#include "libqos/virtio.h"
+#include "libqos/virtio-pci.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_ids.h"
+#include "standard-headers/linux/virtio_iommu.h"
+#include "standard-headers/linux/virtio_ring.h"
+
+#define IOMMU_SLOT          1
+#define IOMMU_DEVFN         QPCI_DEVFN(IOMMU_SLOT, 0)
+#define EDU_SLOT            2
+#define EDU_DEVFN           QPCI_DEVFN(EDU_SLOT, 0)
+#define EDU_ENDPOINT        EDU_DEVFN       /* bus 0 */
+#define DOMAIN_ID           1
+
+/* Addresses on the virt board with highmem=off */
+#define PCIE_MMIO_BASE      0x10000000ULL
+#define PCIE_MMIO_LIMIT     0x3eff0000ULL
+#define PCIE_PIO_BASE       0x3eff0000ULL
+#define PCIE_ECAM_BASE      0x3f000000ULL
+#define RAM_BASE            0x40000000ULL
+#define RAM_SIZE            (128 * MiB)
+#define PAGE_SIZE           4096
+
+/* edu registers, see docs/specs/edu.txt */
+#define EDU_DMA_SRC         0x80
+#define EDU_DMA_DST         0x88
+#define EDU_DMA_CNT         0x90
+#define EDU_DMA_CMD         0x98
+#define EDU_DMA_RUN         0x1
+#define EDU_DMA_TO_PCI      0x2
+#define EDU_DMA_BUF         0x40000
+#define EDU_DMA_DELAY_NS    (200 * 1000 * 1000)
+
+/* I/O virtual addresses, below the 28-bit DMA mask of edu */
+#define IOVA_SRC            0x100000ULL
+#define IOVA_DST            0x200000ULL
+
+#define TIMEOUT_US          (30 * 1000 * 1000)
+
+typedef struct IOMMUTest {
+    QTestState *qts;
+    QGuestAllocator alloc;
+    QPCIBus bus;
+    QVirtioPCIDevice *iommu;
+    QVirtQueue *vq;
+    QPCIDevice *edu;
+    QPCIBar edu_bar;
+} IOMMUTest;
+
+/* Generic PCIe host bridge of the virt board, with an ECAM window */
+static uint8_t ecam_pio_readb(QPCIBus *bus, uint32_t addr)
+{
+    return qtest_readb(bus->qts, PCIE_PIO_BASE + addr);
+}
+
+static uint16_t ecam_pio_readw(QPCIBus *bus, uint32_t addr)
+{
+    return qtest_readw(bus->qts, PCIE_PIO_BASE + addr);
+}
+
+static uint32_t ecam_pio_readl(QPCIBus *bus, uint32_t addr)
+{
+    return qtest_readl(bus->qts, PCIE_PIO_BASE + addr);
+}
+
+static uint64_t ecam_pio_readq(QPCIBus *bus, uint32_t addr)
+{
+    return qtest_readq(bus->qts, PCIE_PIO_BASE + addr);
+}
+
+static void ecam_pio_writeb(QPCIBus *bus, uint32_t addr, uint8_t val)
+{
+    qtest_writeb(bus->qts, PCIE_PIO_BASE + addr, val);
+}
+
+static void ecam_pio_writew(QPCIBus *bus, uint32_t addr, uint16_t val)
+{
+    qtest_writew(bus->qts, PCIE_PIO_BASE + addr, val);
+}
+
+static void ecam_pio_writel(QPCIBus *bus, uint32_t addr, uint32_t val)
+{
+    qtest_writel(bus->qts, PCIE_PIO_BASE + addr, val);
+}
+
+static void ecam_pio_writeq(QPCIBus *bus, uint32_t addr, uint64_t val)
+{
+    qtest_writeq(bus->qts, PCIE_PIO_BASE + addr, val);
+}
+
+static void ecam_memread(QPCIBus *bus, uint32_t addr, void *buf, size_t len)
+{
+    qtest_memread(bus->qts, addr, buf, len);
+}
+
+static void ecam_memwrite(QPCIBus *bus, uint32_t addr,
+                          const void *buf, size_t len)
+{
+    qtest_memwrite(bus->qts, addr, buf, len);
+}
+
+static uint64_t ecam_addr(int devfn, uint8_t offset)
+{
+    return PCIE_ECAM_BASE + (devfn << 12) + offset;
+}
+
+static uint8_t ecam_config_readb(QPCIBus *bus, int devfn, uint8_t offset)
+{
+    return qtest_readb(bus->qts, ecam_addr(devfn, offset));
+}
+
+static uint16_t ecam_config_readw(QPCIBus *bus, int devfn, uint8_t offset)
+{
+    return qtest_readw(bus->qts, ecam_addr(devfn, offset));
+}
+
+static uint32_t ecam_config_readl(QPCIBus *bus, int devfn, uint8_t offset)
+{
+    return qtest_readl(bus->qts, ecam_addr(devfn, offset));
+}
+
+static void ecam_config_writeb(QPCIBus *bus, int devfn, uint8_t offset,
+                               uint8_t value)
+{
+    qtest_writeb(bus->qts, ecam_addr(devfn, offset), value);
+}
+
+static void ecam_config_writew(QPCIBus *bus, int devfn, uint8_t offset,
+                               uint16_t value)
+{
+    qtest_writew(bus->qts, ecam_addr(devfn, offset), value);
+}
+
+static void ecam_config_writel(QPCIBus *bus, int devfn, uint8_t offset,
+                               uint32_t value)
+{
+    qtest_writel(bus->qts, ecam_addr(devfn, offset), value);
+}
+
+static void ecam_bus_init(QPCIBus *bus, QTestState *qts)
+{
+    bus->pio_readb = ecam_pio_readb;
+    bus->pio_readw = ecam_pio_readw;
+    bus->pio_readl = ecam_pio_readl;
+    bus->pio_readq = ecam_pio_readq;
+    bus->pio_writeb = ecam_pio_writeb;
+    bus->pio_writew = ecam_pio_writew;
+    bus->pio_writel = ecam_pio_writel;
+    bus->pio_writeq = ecam_pio_writeq;
+    bus->memread = ecam_memread;
+    bus->memwrite = ecam_memwrite;
+    bus->config_readb = ecam_config_readb;
+    bus->config_readw = ecam_config_readw;
+    bus->config_readl = ecam_config_readl;
+    bus->config_writeb = ecam_config_writeb;
+    bus->config_writew = ecam_config_writew;
+    bus->config_writel = ecam_config_writel;
+
+    bus->qts = qts;
+    bus->pio_alloc_ptr = 0x1000;
+    bus->mmio_alloc_ptr = PCIE_MMIO_BASE;
+    bus->mmio_limit = PCIE_MMIO_LIMIT;
+}
+
+static void iommu_test_start(IOMMUTest *t)
+{
+    QVirtioDevice *vdev;
+    QPCIAddress addr = { .devfn = IOMMU_DEVFN };
+    uint64_t features;
+
+    t->qts = qtest_initf("-machine virt,highmem=off "
+                         "-device virtio-iommu-pci,addr=%02x.0 "
+                         "-device edu,addr=%02x.0",
+                         IOMMU_SLOT, EDU_SLOT);
+    alloc_init(&t->alloc, 0, RAM_BASE, RAM_BASE + RAM_SIZE, PAGE_SIZE);
+    ecam_bus_init(&t->bus, t->qts);
+
+    t->iommu = virtio_pci_new(&t->bus, &addr);
+    g_assert_nonnull(t->iommu);
+    vdev = &t->iommu->vdev;
+    g_assert_cmpint(vdev->device_type, ==, VIRTIO_ID_IOMMU);
+
+    qvirtio_pci_device_enable(t->iommu);
+    qvirtio_start_device(vdev);
+    features = qvirtio_get_features(vdev);
+    g_assert(features & (1ull << VIRTIO_IOMMU_F_MAP_UNMAP));
+    features &= ~((1ull << VIRTIO_IOMMU_F_BYPASS) |
+                  (1ull << VIRTIO_RING_F_INDIRECT_DESC) |
+                  (1ull << VIRTIO_RING_F_EVENT_IDX));
+    qvirtio_set_features(vdev, features);
+    t->vq = qvirtqueue_setup(vdev, &t->alloc, 0);
+    qvirtio_set_driver_ok(vdev);
+
+    t->edu = qpci_device_find(&t->bus, EDU_DEVFN);
+    g_assert_nonnull(t->edu);
+    qpci_device_enable(t->edu);
+    t->edu_bar = qpci_iomap(t->edu, 0, NULL);
+}
+
+static void iommu_test_stop(IOMMUTest *t)
+{
+    qpci_iounmap(t->edu, t->edu_bar);
+    g_free(t->edu);
+    qvirtqueue_cleanup(t->iommu->vdev.bus, t->vq, &t->alloc);
+    qvirtio_pci_device_disable(t->iommu);
+    g_free(t->iommu->pdev);
+    g_free(t->iommu);
+    alloc_destroy(&t->alloc);
+    qtest_quit(t->qts);
+}
+
+typedef struct IOMMUReq {
+    uint64_t out, in;
+    size_t in_len;
+    uint32_t head;
+} IOMMUReq;
+
+/*
+ * Add the descriptors of a request to the queue, without making it
+ * available.  @req is the request without its tail, @in_len the size of
+ * the device-writable part.
+ */
+static void iommu_queue(IOMMUTest *t, IOMMUReq *r, const void *req,
+                        size_t out_len, size_t in_len)
+{
+    r->out = guest_alloc(&t->alloc, out_len);
+    r->in = guest_alloc(&t->alloc, in_len);
+    r->in_len = in_len;
+    qtest_memwrite(t->qts, r->out, req, out_len);
+    qtest_memset(t->qts, r->in, 0xff, in_len);
+
+    r->head = qvirtqueue_add(t->qts, t->vq, r->out, out_len, false, true);
+    qvirtqueue_add(t->qts, t->vq, r->in, in_len, true, false);
+}
+
+/* Return the status of a completed request, @len is its used length */
+static uint8_t iommu_status(IOMMUTest *t, IOMMUReq *r, uint32_t len)
+{
+    struct virtio_iommu_req_tail tail;
+
+    g_assert_cmpint(len, ==, r->in_len);
+    qtest_memread(t->qts, r->in + r->in_len - sizeof(tail),
+                  &tail, sizeof(tail));
+    guest_free(&t->alloc, r->out);
+    guest_free(&t->alloc, r->in);
+    return tail.status;
+}
+
+static uint8_t iommu_send(IOMMUTest *t, const void *req, size_t len)
+{
+    size_t tail_len = sizeof(struct virtio_iommu_req_tail);
+    uint32_t used_len;
+    IOMMUReq r;
+
+    iommu_queue(t, &r, req, len - tail_len, tail_len);
+    qvirtqueue_kick(t->qts, &t->iommu->vdev, t->vq, r.head);
+    qvirtio_wait_used_elem(t->qts, &t->iommu->vdev, t->vq, r.head, &used_len,
+                           TIMEOUT_US);
+    return iommu_status(t, &r, used_len);
+}
+
+static void fill_attach(struct virtio_iommu_req_attach *req,
+                        uint32_t domain, uint32_t endpoint)
+{
+    memset(req, 0, sizeof(*req));
+    req->head.type = VIRTIO_IOMMU_T_ATTACH;
+    req->domain = cpu_to_le32(domain);
+    req->endpoint = cpu_to_le32(endpoint);
+}
+
+static void fill_map(struct virtio_iommu_req_map *req, uint64_t start,
+                     uint64_t end, uint64_t phys, uint32_t flags)
+{
+    memset(req, 0, sizeof(*req));
+    req->head.type = VIRTIO_IOMMU_T_MAP;
+    req->domain = cpu_to_le32(DOMAIN_ID);
+    req->virt_start = cpu_to_le64(start);
+    req->virt_end = cpu_to_le64(end);
+    req->phys_start = cpu_to_le64(phys);
+    req->flags = cpu_to_le32(flags);
+}
+
+static void fill_unmap(struct virtio_iommu_req_unmap *req, uint64_t start,
+                       uint64_t end)
+{
+    memset(req, 0, sizeof(*req));
+    req->head.type = VIRTIO_IOMMU_T_UNMAP;
+    req->domain = cpu_to_le32(DOMAIN_ID);
+    req->virt_start = cpu_to_le64(start);
+    req->virt_end = cpu_to_le64(end);
+}
+
+static uint8_t iommu_attach(IOMMUTest *t, uint32_t endpoint)
+{
+    struct virtio_iommu_req_attach req;
+
+    fill_attach(&req, DOMAIN_ID, endpoint);
+    return iommu_send(t, &req, sizeof(req));
+}
+
+static uint8_t iommu_map(IOMMUTest *t, uint64_t start, uint64_t end,
+                         uint64_t phys, uint32_t flags)
+{
+    struct virtio_iommu_req_map req;
+
+    fill_map(&req, start, end, phys, flags);
+    return iommu_send(t, &req, sizeof(req));
+}
+
+static uint8_t iommu_unmap(IOMMUTest *t, uint64_t start, uint64_t end)
+{
+    struct virtio_iommu_req_unmap req;
+
+    fill_unmap(&req, start, end);
+    return iommu_send(t, &req, sizeof(req));
+}
+
+/* Copy @len bytes with the DMA engine of edu, between its buffer and @iova */
+static void edu_dma(IOMMUTest *t, uint64_t iova, uint32_t len, bool to_pci)
+{
+    qpci_io_writel(t->edu, t->edu_bar, EDU_DMA_SRC,
+                   to_pci ? EDU_DMA_BUF : iova);
+    qpci_io_writel(t->edu, t->edu_bar, EDU_DMA_DST,
+                   to_pci ? iova : EDU_DMA_BUF);
+    qpci_io_writel(t->edu, t->edu_bar, EDU_DMA_CNT, len);
+    qpci_io_writel(t->edu, t->edu_bar, EDU_DMA_CMD,
+                   EDU_DMA_RUN | (to_pci ? EDU_DMA_TO_PCI : 0));
+    qtest_clock_step(t->qts, EDU_DMA_DELAY_NS);
+    g_assert_cmpint(qpci_io_readl(t->edu, t->edu_bar, EDU_DMA_CMD) &
+                    EDU_DMA_RUN, ==, 0);
+}
+
+static void check_page(IOMMUTest *t, uint64_t addr, uint8_t pattern)
+{
+    g_autofree uint8_t *buf = g_malloc(PAGE_SIZE);
+    int i;
+
+    qtest_memread(t->qts, addr, buf, PAGE_SIZE);
+    for (i = 0; i < PAGE_SIZE; i++) {
+        g_assert_cmphex(buf[i], ==, pattern);
+    }
+}
+
+/*
+ * Adjacent MAP requests can each be unmapped, but an UNMAP that splits
+ * one of them fails.
+ */
+static void test_unmap_split(void)
+{
+    IOMMUTest t;
+    uint64_t phys;
+
+    iommu_test_start(&t);
+    phys = guest_alloc(&t.alloc, 2 * PAGE_SIZE);
+
+    g_assert_cmpint(iommu_attach(&t, EDU_ENDPOINT), ==, VIRTIO_IOMMU_S_OK);
+
+    /* Contiguous in both address spaces, with the same permissions */
+    g_assert_cmpint(iommu_map(&t, IOVA_SRC, IOVA_SRC + PAGE_SIZE - 1, phys,
+                              VIRTIO_IOMMU_MAP_F_READ), ==,
+                    VIRTIO_IOMMU_S_OK);
+    g_assert_cmpint(iommu_map(&t, IOVA_SRC + PAGE_SIZE,
+                              IOVA_SRC + 2 * PAGE_SIZE - 1, phys + PAGE_SIZE,
+                              VIRTIO_IOMMU_MAP_F_READ), ==,
+                    VIRTIO_IOMMU_S_OK);
+
+    /* Unmapping half of either request fails */
+    g_assert_cmpint(iommu_unmap(&t, IOVA_SRC, IOVA_SRC + PAGE_SIZE / 2 - 1),
+                    ==, VIRTIO_IOMMU_S_RANGE);
+    g_assert_cmpint(iommu_unmap(&t, IOVA_SRC + PAGE_SIZE + PAGE_SIZE / 2,
+                                IOVA_SRC + 2 * PAGE_SIZE - 1),
+                    ==, VIRTIO_IOMMU_S_RANGE);
+
+    /* Unmapping one of them leaves the other in place */
+    g_assert_cmpint(iommu_unmap(&t, IOVA_SRC + PAGE_SIZE,
+                                IOVA_SRC + 2 * PAGE_SIZE - 1),
+                    ==, VIRTIO_IOMMU_S_OK);
+    g_assert_cmpint(iommu_unmap(&t, IOVA_SRC, IOVA_SRC + PAGE_SIZE / 2 - 1),
+                    ==, VIRTIO_IOMMU_S_RANGE);
+
+    /* An UNMAP may cover several requests and unmapped space */
+    g_assert_cmpint(iommu_map(&t, IOVA_SRC + PAGE_SIZE,
+                              IOVA_SRC + 2 * PAGE_SIZE - 1, phys + PAGE_SIZE,
+                              VIRTIO_IOMMU_MAP_F_READ), ==,
+                    VIRTIO_IOMMU_S_OK);
+    g_assert_cmpint(iommu_unmap(&t, 0, IOVA_SRC + 4 * PAGE_SIZE - 1),
+                    ==, VIRTIO_IOMMU_S_OK);
+    g_assert_cmpint(iommu_unmap(&t, IOVA_SRC, IOVA_SRC + 2 * PAGE_SIZE - 1),
+                    ==, VIRTIO_IOMMU_S_OK);
+
+    iommu_test_stop(&t);
+}
+
+/*
+ * DMA through the IOMMU, checking that cached translations go away when
+ * the mapping changes and that they keep the permissions of the mapping.
+ */
+static void test_translate(void)
+{
+    IOMMUTest t;
+    uint64_t src1, src2, dst;
+
+    iommu_test_start(&t);
+    src1 = guest_alloc(&t.alloc, PAGE_SIZE);
+    src2 = guest_alloc(&t.alloc, PAGE_SIZE);
+    dst = guest_alloc(&t.alloc, PAGE_SIZE);
+    qtest_memset(t.qts, src1, 0xa5, PAGE_SIZE);
+    qtest_memset(t.qts, src2, 0x5a, PAGE_SIZE);
+    qtest_memset(t.qts, dst, 0, PAGE_SIZE);
+
+    g_assert_cmpint(iommu_attach(&t, EDU_ENDPOINT), ==, VIRTIO_IOMMU_S_OK);
+    g_assert_cmpint(iommu_map(&t, IOVA_SRC, IOVA_SRC + PAGE_SIZE - 1, src1,
+                              VIRTIO_IOMMU_MAP_F_READ), ==,
+                    VIRTIO_IOMMU_S_OK);
+    g_assert_cmpint(iommu_map(&t, IOVA_DST, IOVA_DST + PAGE_SIZE - 1, dst,
+                              VIRTIO_IOMMU_MAP_F_WRITE), ==,
+                    VIRTIO_IOMMU_S_OK);
+
+    edu_dma(&t, IOVA_SRC, PAGE_SIZE, false);
+    edu_dma(&t, IOVA_DST, PAGE_SIZE, true);
+    check_page(&t, dst, 0xa5);
+
+    /* Point IOVA_SRC somewhere else: the old translation must not be used */
+    g_assert_cmpint(iommu_unmap(&t, IOVA_SRC, IOVA_SRC + PAGE_SIZE - 1),
+                    ==, VIRTIO_IOMMU_S_OK);
+    g_assert_cmpint(iommu_map(&t, IOVA_SRC, IOVA_SRC + PAGE_SIZE - 1, src2,
+                              VIRTIO_IOMMU_MAP_F_READ), ==,
+                    VIRTIO_IOMMU_S_OK);
+    edu_dma(&t, IOVA_SRC, PAGE_SIZE, false);
+    edu_dma(&t, IOVA_DST, PAGE_SIZE, true);
+    check_page(&t, dst, 0x5a);
+
+    /* The cached read-only translation does not allow writes */
+    edu_dma(&t, IOVA_DST, PAGE_SIZE, false);
+    edu_dma(&t, IOVA_SRC, PAGE_SIZE, true);
+    check_page(&t, src2, 0x5a);
+
+    iommu_test_stop(&t);
+}
+
+/* Make a queued request available without notifying the device */
+static void iommu_make_available(IOMMUTest *t, IOMMUReq *r)
+{
+    uint16_t idx = qtest_readw(t->qts, t->vq->avail + 2);
+
+    qtest_writew(t->qts, t->vq->avail + 4 + 2 * (idx % t->vq->size), r->head);
+    qtest_writew(t->qts, t->vq->avail + 2, idx + 1);
+}
+
+/*
+ * Requests made available together are all completed by one notification,
+ * in order and each with its own status, including after a PROBE whose
+ * response is larger than a tail.
+ */
+static void test_batch(void)
+{
+    struct virtio_iommu_req_probe probe = {
+        .head.type = VIRTIO_IOMMU_T_PROBE,
+        .endpoint = cpu_to_le32(EDU_ENDPOINT),
+    };
+    size_t tail_len = sizeof(struct virtio_iommu_req_tail);
+    struct virtio_iommu_req_attach attach;
+    struct virtio_iommu_req_map map;
+    struct virtio_iommu_req_unmap split, unmap;
+    uint32_t probe_size, head, len;
+    uint8_t status[5];
+    uint16_t used_idx;
+    IOMMUReq r[5];
+    uint64_t phys;
+    IOMMUTest t;
+    int i;
+
+    iommu_test_start(&t);
+    phys = guest_alloc(&t.alloc, PAGE_SIZE);
+    probe_size = qvirtio_config_readl(&t.iommu->vdev,
+                                      offsetof(struct virtio_iommu_config,
+                                               probe_size));
+    g_assert_cmpint(probe_size, >, 0);
+
+    fill_attach(&attach, DOMAIN_ID, EDU_ENDPOINT);
+    fill_map(&map, IOVA_SRC, IOVA_SRC + PAGE_SIZE - 1, phys,
+             VIRTIO_IOMMU_MAP_F_READ);
+    fill_unmap(&split, IOVA_SRC, IOVA_SRC + PAGE_SIZE / 2 - 1);
+    fill_unmap(&unmap, IOVA_SRC, IOVA_SRC + PAGE_SIZE - 1);
+
+    iommu_queue(&t, &r[0], &attach, sizeof(attach) - tail_len, tail_len);
+    iommu_queue(&t, &r[1], &probe, sizeof(probe) - tail_len,
+                probe_size + tail_len);
+    iommu_queue(&t, &r[2], &map, sizeof(map) - tail_len, tail_len);
+    iommu_queue(&t, &r[3], &split, sizeof(split) - tail_len, tail_len);
+    iommu_queue(&t, &r[4], &unmap, sizeof(unmap) - tail_len, tail_len);
+
+    used_idx = qtest_readw(t.qts, t.vq->used + 2);
+    for (i = 0; i < ARRAY_SIZE(r) - 1; i++) {
+        iommu_make_available(&t, &r[i]);
+    }
+    g_assert_cmpint(qtest_readw(t.qts, t.vq->used + 2), ==, used_idx);
+
+    qvirtqueue_kick(t.qts, &t.iommu->vdev, t.vq, r[i].head);
+    g_assert_cmpint(qtest_readw(t.qts, t.vq->used + 2), ==,
+                    (uint16_t)(used_idx + ARRAY_SIZE(r)));
+    g_assert(t.iommu->vdev.bus->get_queue_isr_status(&t.iommu->vdev, t.vq));
+
+    for (i = 0; i < ARRAY_SIZE(r); i++) {
+        g_assert(qvirtqueue_get_buf(t.qts, t.vq, &head, &len));
+        g_assert_cmpint(head, ==, r[i].head);
+        status[i] = iommu_status(&t, &r[i], len);
+    }
+    g_assert(!qvirtqueue_get_buf(t.qts, t.vq, NULL, NULL));
+
+    g_assert_cmpint(status[0], ==, VIRTIO_IOMMU_S_OK);
+    g_assert_cmpint(status[1], ==, VIRTIO_IOMMU_S_OK);
+    g_assert_cmpint(status[2], ==, VIRTIO_IOMMU_S_OK);
+    g_assert_cmpint(status[3], ==, VIRTIO_IOMMU_S_RANGE);
+    g_assert_cmpint(status[4], ==, VIRTIO_IOMMU_S_OK);
+
+    iommu_test_stop(&t);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/virtio-iommu/unmap-split", test_unmap_split);
+    qtest_add_func("/virtio-iommu/translate", test_translate);
+    qtest_add_func("/virtio-iommu/batch", test_batch);
+
+    return g_test_run();
+}
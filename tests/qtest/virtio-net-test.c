@@ -17,6 +17,14 @@
 #include "libqos/qgraph.h"
 #include "libqos/virtio-net.h"
 
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_tun.h>
+#include "qemu/bswap.h"
+#endif
+
 #ifndef ETH_P_RARP
 #define ETH_P_RARP 0x8035
 #endif
@@ -313,6 +321,464 @@ static void *virtio_net_test_setup_nosocket(GString *cmd_line, void *arg)
     return arg;
 }
 
+#ifdef __linux__
+
+/*
+ * Multiqueue tests with a tap backend, which is the only one whose queue
+ * pairs can run in IOThreads.  The test creates the tap device itself and
+ * talks to it through a packet socket, so it needs CAP_NET_ADMIN.
+ */
+
+#define MQ_QUEUES       2
+#define MQ_RX_BUFS      64
+#define MQ_BUF_SIZE     2048
+#define MQ_FLOWS        32
+#define MQ_LINK_ROUNDS  8
+#define MQ_MAX_PACKETS  (MQ_FLOWS * (MQ_LINK_ROUNDS + 2))
+
+#define MQ_ETH_LEN      14
+#define MQ_IP_LEN       20
+#define MQ_UDP_LEN      8
+#define MQ_MAGIC        "qtest-mq"
+#define MQ_PAYLOAD_LEN  (sizeof(MQ_MAGIC) - 1 + 4)
+#define MQ_FRAME_LEN    (MQ_ETH_LEN + MQ_IP_LEN + MQ_UDP_LEN + MQ_PAYLOAD_LEN)
+#define MQ_HDR_LEN      sizeof(struct virtio_net_hdr_v1_hash)
+
+/* Spread the flows over both queues, not just by the lowest hash bit */
+static const uint16_t mq_rss_table[8] = { 0, 1, 1, 0, 1, 0, 0, 1 };
+
+static const uint8_t mq_rss_key[VIRTIO_NET_RSS_MAX_KEY_SIZE] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+typedef struct {
+    int tap_fd[MQ_QUEUES];
+    int packet_fd;
+} VirtioNetMQTap;
+
+typedef struct {
+    VirtioNetMQTap *tap;
+    QVirtioNet *net;
+    QGuestAllocator *alloc;
+    uint64_t *rx_buf[MQ_QUEUES];
+    unsigned int rx_count[MQ_QUEUES];
+    bool seen[MQ_MAX_PACKETS];
+} VirtioNetMQTest;
+
+static void virtio_net_mq_tap_cleanup(void *opaque)
+{
+    VirtioNetMQTap *tap = opaque;
+    int i;
+
+    qos_invalidate_command_line();
+    for (i = 0; i < MQ_QUEUES; i++) {
+        if (tap->tap_fd[i] >= 0) {
+            close(tap->tap_fd[i]);
+        }
+    }
+    if (tap->packet_fd >= 0) {
+        close(tap->packet_fd);
+    }
+    g_free(tap);
+}
+
+/* Create a multiqueue tap device with a vnet header, and bring it up */
+static bool virtio_net_mq_tap_open(VirtioNetMQTap *tap)
+{
+    struct ifreq ifr = {};
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ALL),
+    };
+    int i, sock, ret;
+
+    for (i = 0; i < MQ_QUEUES; i++) {
+        tap->tap_fd[i] = open("/dev/net/tun", O_RDWR);
+        if (tap->tap_fd[i] < 0) {
+            return false;
+        }
+        /* The first call picks a name, the others attach to it */
+        ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR | IFF_MULTI_QUEUE;
+        if (ioctl(tap->tap_fd[i], TUNSETIFF, &ifr) < 0) {
+            return false;
+        }
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return false;
+    }
+    ret = ioctl(sock, SIOCGIFINDEX, &ifr);
+    sll.sll_ifindex = ifr.ifr_ifindex;
+    if (!ret) {
+        ret = ioctl(sock, SIOCGIFFLAGS, &ifr);
+    }
+    if (!ret) {
+        ifr.ifr_flags |= IFF_UP;
+        ret = ioctl(sock, SIOCSIFFLAGS, &ifr);
+    }
+    close(sock);
+    if (ret < 0) {
+        return false;
+    }
+
+    tap->packet_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    return tap->packet_fd >= 0 &&
+           bind(tap->packet_fd, (struct sockaddr *)&sll, sizeof(sll)) == 0;
+}
+
+/*
+ * Without a tap device the test is skipped, but QEMU still needs a netdev
+ * for the device.
+ */
+static void *virtio_net_mq_tap_setup(GString *cmd_line, void *arg)
+{
+    VirtioNetMQTap *tap = g_new(VirtioNetMQTap, 1);
+    int i;
+
+    for (i = 0; i < MQ_QUEUES; i++) {
+        tap->tap_fd[i] = -1;
+    }
+    tap->packet_fd = -1;
+    g_test_queue_destroy(virtio_net_mq_tap_cleanup, tap);
+
+    if (!virtio_net_mq_tap_open(tap)) {
+        g_string_append(cmd_line, " -netdev hubport,hubid=0,id=hs0 ");
+        return NULL;
+    }
+
+    g_string_append_printf(cmd_line,
+        " -netdev tap,id=hs0,fds=%d:%d"
+        " -object iothread,id=iothread0 -object iothread,id=iothread1"
+        " -global virtio-net-pci.mq=on -global virtio-net-pci.rss=on"
+        " -global virtio-net-pci.hash=on"
+        " -global virtio-net-pci.len-iothreads=2"
+        " -global virtio-net-pci.iothreads[0]=iothread0"
+        " -global virtio-net-pci.iothreads[1]=iothread1 ",
+        tap->tap_fd[0], tap->tap_fd[1]);
+    return tap;
+}
+
+/* A broadcast UDP/IPv4 frame; the source port makes each flow different */
+static void mq_build_frame(uint8_t *frame, uint32_t index)
+{
+    uint8_t *ip = frame + MQ_ETH_LEN;
+    uint8_t *udp = ip + MQ_IP_LEN;
+    uint32_t sum = 0;
+    int i;
+
+    memset(frame, 0, MQ_FRAME_LEN);
+    memset(frame, 0xff, ETH_ALEN);
+    memcpy(frame + ETH_ALEN, "\x52\x54\x00\x12\x34\x99", ETH_ALEN);
+    stw_be_p(frame + 12, ETH_P_IP);
+
+    ip[0] = 0x45;
+    stw_be_p(ip + 2, MQ_IP_LEN + MQ_UDP_LEN + MQ_PAYLOAD_LEN);
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    stl_be_p(ip + 12, 0x0a000001);
+    stl_be_p(ip + 16, 0x0a000002);
+    for (i = 0; i < MQ_IP_LEN; i += 2) {
+        sum += lduw_be_p(ip + i);
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    stw_be_p(ip + 10, ~sum);
+
+    stw_be_p(udp, 1024 + index);
+    stw_be_p(udp + 2, 4000);
+    stw_be_p(udp + 4, MQ_UDP_LEN + MQ_PAYLOAD_LEN);
+    memcpy(udp + MQ_UDP_LEN, MQ_MAGIC, sizeof(MQ_MAGIC) - 1);
+    stl_be_p(udp + MQ_UDP_LEN + sizeof(MQ_MAGIC) - 1, index);
+}
+
+/* Returns the index of a frame built by mq_build_frame(), or -1 */
+static int mq_frame_index(const uint8_t *frame, size_t len)
+{
+    const uint8_t *payload = frame + MQ_ETH_LEN + MQ_IP_LEN + MQ_UDP_LEN;
+
+    if (len < MQ_FRAME_LEN || lduw_be_p(frame + 12) != ETH_P_IP ||
+        frame[MQ_ETH_LEN + 9] != IPPROTO_UDP ||
+        memcmp(payload, MQ_MAGIC, sizeof(MQ_MAGIC) - 1)) {
+        return -1;
+    }
+    return ldl_be_p(payload + sizeof(MQ_MAGIC) - 1);
+}
+
+/* Inject a frame on the host side; the kernel picks the tap queue */
+static void mq_send(VirtioNetMQTest *t, uint32_t index)
+{
+    uint8_t frame[MQ_FRAME_LEN];
+
+    mq_build_frame(frame, index);
+    g_assert_cmpint(send(t->tap->packet_fd, frame, sizeof(frame), 0), ==,
+                    sizeof(frame));
+}
+
+static uint8_t mq_ctrl(VirtioNetMQTest *t, uint8_t class, uint8_t cmd,
+                       const void *data, size_t len)
+{
+    QTestState *qts = global_qtest;
+    QVirtQueue *vq = t->net->queues[t->net->n_queues - 1];
+    uint8_t hdr[2] = { class, cmd };
+    uint64_t addr = guest_alloc(t->alloc, sizeof(hdr) + len + 1);
+    uint32_t free_head;
+    uint8_t ack;
+
+    memwrite(addr, hdr, sizeof(hdr));
+    memwrite(addr + sizeof(hdr), data, len);
+    writeb(addr + sizeof(hdr) + len, VIRTIO_NET_ERR);
+
+    free_head = qvirtqueue_add(qts, vq, addr, sizeof(hdr), false, true);
+    qvirtqueue_add(qts, vq, addr + sizeof(hdr), len, false, true);
+    qvirtqueue_add(qts, vq, addr + sizeof(hdr) + len, 1, true, false);
+    qvirtqueue_kick(qts, t->net->vdev, vq, free_head);
+    qvirtio_wait_used_elem(qts, t->net->vdev, vq, free_head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+
+    ack = readb(addr + sizeof(hdr) + len);
+    guest_free(t->alloc, addr);
+    return ack;
+}
+
+/* Hash UDP/IPv4 flows and steer them with mq_rss_table */
+static void mq_set_rss(VirtioNetMQTest *t)
+{
+    struct {
+        uint32_t hash_types;
+        uint16_t indirection_table_mask;
+        uint16_t unclassified_queue;
+        uint16_t indirection_table[ARRAY_SIZE(mq_rss_table)];
+        uint16_t max_tx_vq;
+        uint8_t hash_key_length;
+        uint8_t hash_key_data[sizeof(mq_rss_key)];
+    } QEMU_PACKED cfg = {
+        .hash_types = cpu_to_le32(VIRTIO_NET_RSS_HASH_TYPE_UDPv4),
+        .indirection_table_mask = cpu_to_le16(ARRAY_SIZE(mq_rss_table) - 1),
+        .max_tx_vq = cpu_to_le16(MQ_QUEUES),
+        .hash_key_length = sizeof(mq_rss_key),
+    };
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(mq_rss_table); i++) {
+        cfg.indirection_table[i] = cpu_to_le16(mq_rss_table[i]);
+    }
+    memcpy(cfg.hash_key_data, mq_rss_key, sizeof(mq_rss_key));
+
+    g_assert_cmpint(mq_ctrl(t, VIRTIO_NET_CTRL_MQ,
+                            VIRTIO_NET_CTRL_MQ_RSS_CONFIG, &cfg, sizeof(cfg)),
+                    ==, VIRTIO_NET_OK);
+}
+
+static void mq_post_rx(VirtioNetMQTest *t, int queue, uint64_t addr)
+{
+    QTestState *qts = global_qtest;
+    QVirtQueue *vq = t->net->queues[queue * 2];
+    uint32_t head;
+
+    head = qvirtqueue_add(qts, vq, addr, MQ_BUF_SIZE, true, false);
+    t->rx_buf[queue][head] = addr;
+    qvirtqueue_kick(qts, t->net->vdev, vq, head);
+}
+
+/*
+ * Take the used buffers of the receive queues, check that each test frame
+ * arrived once and on the queue that the indirection table selects for
+ * the reported hash, and give the buffers back to the device.  Other
+ * frames, such as IPv6 router solicitations from the host, are ignored.
+ */
+static void mq_poll_rx(VirtioNetMQTest *t)
+{
+    QTestState *qts = global_qtest;
+    uint8_t buf[MQ_BUF_SIZE];
+    uint32_t head, len;
+    int queue, index;
+
+    for (queue = 0; queue < MQ_QUEUES; queue++) {
+        QVirtQueue *vq = t->net->queues[queue * 2];
+
+        while (qvirtqueue_get_buf(qts, vq, &head, &len)) {
+            const struct virtio_net_hdr_v1_hash *hdr = (void *)buf;
+            uint64_t addr = t->rx_buf[queue][head];
+
+            g_assert_cmpint(len, <=, sizeof(buf));
+            memread(addr, buf, len);
+            index = len < MQ_HDR_LEN ? -1 :
+                    mq_frame_index(buf + MQ_HDR_LEN, len - MQ_HDR_LEN);
+            if (index >= 0) {
+                uint32_t hash = le32_to_cpu(hdr->hash_value);
+
+                g_assert_cmpint(index, <, MQ_MAX_PACKETS);
+                g_assert_false(t->seen[index]);
+                g_assert_cmpint(le16_to_cpu(hdr->hash_report), ==,
+                                VIRTIO_NET_HASH_REPORT_UDPv4);
+                g_assert_cmpint(queue, ==,
+                                mq_rss_table[hash % ARRAY_SIZE(mq_rss_table)]);
+                t->seen[index] = true;
+                t->rx_count[queue]++;
+            }
+            mq_post_rx(t, queue, addr);
+        }
+    }
+}
+
+static void mq_wait_rx(VirtioNetMQTest *t, int first, int count)
+{
+    gint64 deadline = g_get_monotonic_time() + QVIRTIO_NET_TIMEOUT_US;
+    int i;
+
+    for (;;) {
+        mq_poll_rx(t);
+        for (i = first; i < first + count && t->seen[i]; i++) {
+            /* nothing */
+        }
+        if (i == first + count) {
+            return;
+        }
+        g_assert_cmpint(g_get_monotonic_time(), <, deadline);
+        qtest_clock_step(global_qtest, 100);
+    }
+}
+
+/* Send a frame from each transmit queue and check that the host gets it */
+static void mq_test_tx(VirtioNetMQTest *t)
+{
+    QTestState *qts = global_qtest;
+    bool seen[MQ_QUEUES] = {};
+    gint64 deadline;
+    int queue, index;
+
+    for (queue = 0; queue < MQ_QUEUES; queue++) {
+        QVirtQueue *vq = t->net->queues[queue * 2 + 1];
+        uint8_t buf[MQ_HDR_LEN + MQ_FRAME_LEN] = {};
+        uint64_t addr = guest_alloc(t->alloc, sizeof(buf));
+        uint32_t free_head;
+
+        mq_build_frame(buf + MQ_HDR_LEN, MQ_MAX_PACKETS + queue);
+        memwrite(addr, buf, sizeof(buf));
+        free_head = qvirtqueue_add(qts, vq, addr, sizeof(buf), false, false);
+        qvirtqueue_kick(qts, t->net->vdev, vq, free_head);
+        qvirtio_wait_used_elem(qts, t->net->vdev, vq, free_head, NULL,
+                               QVIRTIO_NET_TIMEOUT_US);
+        guest_free(t->alloc, addr);
+    }
+
+    deadline = g_get_monotonic_time() + QVIRTIO_NET_TIMEOUT_US;
+    while (!seen[0] || !seen[1]) {
+        uint8_t frame[MQ_BUF_SIZE];
+        struct sockaddr_ll sll;
+        socklen_t sll_len = sizeof(sll);
+        ssize_t len;
+
+        len = recvfrom(t->tap->packet_fd, frame, sizeof(frame), MSG_DONTWAIT,
+                       (struct sockaddr *)&sll, &sll_len);
+        if (len < 0) {
+            g_assert_cmpint(errno, ==, EAGAIN);
+            g_assert_cmpint(g_get_monotonic_time(), <, deadline);
+            g_usleep(1000);
+            continue;
+        }
+        /* Skip the frames that the test itself sent */
+        index = mq_frame_index(frame, len) - MQ_MAX_PACKETS;
+        if (sll.sll_pkttype != PACKET_OUTGOING &&
+            index >= 0 && index < MQ_QUEUES) {
+            seen[index] = true;
+        }
+    }
+}
+
+/*
+ * Run both queue pairs in their own IOThread with RSS.  The kernel spreads
+ * the frames over the tap queues by its own hash, so many of them reach
+ * QEMU in the IOThread of the wrong queue and must be handed over to the
+ * other one.  Then flap the link, which moves the backend between the
+ * IOThreads and the main loop, and delete the backend, all while frames
+ * keep coming.
+ */
+static void mq_rss(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNetPCI *net_pci = obj;
+    VirtioNetMQTest t = {
+        .tap = data,
+        .net = &net_pci->net,
+        .alloc = t_alloc,
+    };
+    QDict *rsp;
+    int queue, round, i;
+
+    if (!t.tap) {
+        g_test_skip("cannot create a tap device");
+        return;
+    }
+    g_assert_cmpint(t.net->n_queues, ==, MQ_QUEUES * 2 + 1);
+
+    for (queue = 0; queue < MQ_QUEUES; queue++) {
+        t.rx_buf[queue] = g_new0(uint64_t, t.net->queues[queue * 2]->size);
+        for (i = 0; i < MQ_RX_BUFS; i++) {
+            mq_post_rx(&t, queue, guest_alloc(t_alloc, MQ_BUF_SIZE));
+        }
+    }
+    mq_set_rss(&t);
+
+    for (i = 0; i < MQ_FLOWS; i++) {
+        mq_send(&t, i);
+    }
+    mq_wait_rx(&t, 0, MQ_FLOWS);
+    for (queue = 0; queue < MQ_QUEUES; queue++) {
+        g_assert_cmpint(t.rx_count[queue], >, 0);
+    }
+    mq_test_tx(&t);
+
+    /* Frames that arrive while the link is down are dropped */
+    for (round = 1; round <= MQ_LINK_ROUNDS; round++) {
+        for (i = 0; i < MQ_FLOWS; i++) {
+            mq_send(&t, round * MQ_FLOWS + i);
+            if (i == MQ_FLOWS / 2) {
+                rsp = qmp("{ 'execute': 'set_link',"
+                          " 'arguments': { 'name': 'hs0', 'up': false } }");
+                g_assert(!qdict_haskey(rsp, "error"));
+                qobject_unref(rsp);
+            }
+        }
+        mq_poll_rx(&t);
+        rsp = qmp("{ 'execute': 'set_link',"
+                  " 'arguments': { 'name': 'hs0', 'up': true } }");
+        g_assert(!qdict_haskey(rsp, "error"));
+        qobject_unref(rsp);
+        mq_poll_rx(&t);
+    }
+
+    /* Steering must be back in place once the link is up again */
+    round = MQ_LINK_ROUNDS + 1;
+    for (i = 0; i < MQ_FLOWS; i++) {
+        mq_send(&t, round * MQ_FLOWS + i);
+    }
+    mq_wait_rx(&t, round * MQ_FLOWS, MQ_FLOWS);
+    mq_test_tx(&t);
+
+    /* These are never looked at, the backend goes away under them */
+    for (i = 0; i < MQ_FLOWS; i++) {
+        mq_send(&t, i);
+    }
+    rsp = qmp("{ 'execute': 'netdev_del', 'arguments': { 'id': 'hs0' } }");
+    g_assert(!qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+    rsp = qmp("{ 'execute': 'query-status' }");
+    g_assert(qdict_haskey(rsp, "return"));
+    qobject_unref(rsp);
+
+    for (queue = 0; queue < MQ_QUEUES; queue++) {
+        g_free(t.rx_buf[queue]);
+    }
+}
+
+#endif
+
 static void register_virtio_net_test(void)
 {
     QOSGraphTestOptions opts = {
@@ -332,6 +798,12 @@ static void register_virtio_net_test(void)
     qos_add_test("large_tx/uint_max", "virtio-net", large_tx, &opts);
     opts.arg = (gpointer)NET_BUFSIZE;
     qos_add_test("large_tx/net_bufsize", "virtio-net", large_tx, &opts);
+
+#ifdef __linux__
+    opts.before = virtio_net_mq_tap_setup;
+    opts.arg = NULL;
+    qos_add_test("mq-rss-iothreads", "virtio-net-pci", mq_rss, &opts);
+#endif
 }
 
 libqos_init(register_virtio_net_test);
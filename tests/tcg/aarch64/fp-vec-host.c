@@ -0,0 +1,311 @@
+/*
+ * Check the host FPU paths of the AdvSIMD FADD, FSUB, FMUL and FMUL
+ * (by element) helpers against softfloat.
+ *
+ * QEMU only computes these on the host when FPSR.IXC is already set, so
+ * each operation is run once with FPSR clear (softfloat) and once with
+ * IXC set (host FPU, or softfloat again if a lane is not suitable).  The
+ * results must be bit-identical and the flags identical apart from IXC.
+ * The operands include values that overflow, that give tiny results and
+ * that are not normal, both alone and mixed with ordinary lanes.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ITERATIONS 20000
+#define MAX_ERRORS 20
+
+#define FPSR_IXC    (1 << 4)
+#define FPCR_FZ     (1 << 24)
+#define FPCR_DN     (1 << 25)
+
+typedef uint32_t v4s __attribute__((vector_size(16)));
+typedef uint64_t v2d __attribute__((vector_size(16)));
+
+enum { FADD, FSUB, FMUL, FMUL_IDX, N_OPS };
+
+static const char *op_names[N_OPS] = {
+    "fadd", "fsub", "fmul", "fmul_idx",
+};
+
+static const uint32_t f32_specials[] = {
+    0x00000000, 0x80000000,             /* zeroes */
+    0x00000001, 0x807fffff,             /* denormals */
+    0x00800000, 0x80800001,             /* smallest normals */
+    0x1f800000, 0x9f800000,             /* 2^-64, whose square is tiny */
+    0x3f800000, 0xbf800000,             /* 1 */
+    0x5f800000, 0xdf800000,             /* 2^64, whose square overflows */
+    0x7f7fffff, 0xff7fffff,             /* largest normals */
+    0x7f800000, 0xff800000,             /* infinities */
+    0x7fc00000, 0x7f800001,             /* NaNs */
+};
+
+static const uint64_t f64_specials[] = {
+    0x0000000000000000ULL, 0x8000000000000000ULL,
+    0x0000000000000001ULL, 0x800fffffffffffffULL,
+    0x0010000000000000ULL, 0x8010000000000001ULL,
+    0x1ff0000000000000ULL, 0x9ff0000000000000ULL,
+    0x3ff0000000000000ULL, 0xbff0000000000000ULL,
+    0x5ff0000000000000ULL, 0xdff0000000000000ULL,
+    0x7fefffffffffffffULL, 0xffefffffffffffffULL,
+    0x7ff0000000000000ULL, 0xfff0000000000000ULL,
+    0x7ff8000000000000ULL, 0x7ff0000000000001ULL,
+};
+
+static uint64_t seed = 0x0123456789abcdefULL;
+static unsigned long n_errors;
+
+static uint64_t rand64(void)
+{
+    /* Knuth's MMIX LCG */
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed ^ (seed >> 29);
+}
+
+/*
+ * Mostly ordinary values with exponents close to 0, so that most vectors
+ * can use the host FPU; sometimes any encoding or a special value.
+ */
+static uint32_t rand_f32(void)
+{
+    uint64_t r = rand64();
+
+    switch (r & 7) {
+    case 0:
+        return r >> 32;
+    case 1:
+        return f32_specials[(r >> 8) % (sizeof(f32_specials) / 4)];
+    default:
+        return (r >> 32 & 0x807fffff) |
+               (uint32_t)(127 - 16 + (r >> 3) % 32) << 23;
+    }
+}
+
+static uint64_t rand_f64(void)
+{
+    uint64_t r = rand64();
+
+    switch (r & 7) {
+    case 0:
+        return rand64();
+    case 1:
+        return f64_specials[(r >> 8) % (sizeof(f64_specials) / 8)];
+    default:
+        return (rand64() & 0x800fffffffffffffULL) |
+               (uint64_t)(1023 - 32 + (r >> 3) % 64) << 52;
+    }
+}
+
+static uint64_t get_fpsr(void)
+{
+    uint64_t r;
+
+    asm volatile("mrs %0, fpsr" : "=r"(r));
+    return r;
+}
+
+static void set_fpsr(uint64_t v)
+{
+    asm volatile("msr fpsr, %0" : : "r"(v));
+}
+
+static void set_fpcr(uint64_t v)
+{
+    asm volatile("msr fpcr, %0" : : "r"(v));
+}
+
+static v4s op_s(int op, v4s n, v4s m)
+{
+    v4s d;
+
+    switch (op) {
+    case FADD:
+        asm volatile("fadd %0.4s, %1.4s, %2.4s" : "=w"(d) : "w"(n), "w"(m));
+        break;
+    case FSUB:
+        asm volatile("fsub %0.4s, %1.4s, %2.4s" : "=w"(d) : "w"(n), "w"(m));
+        break;
+    case FMUL:
+        asm volatile("fmul %0.4s, %1.4s, %2.4s" : "=w"(d) : "w"(n), "w"(m));
+        break;
+    default:
+        asm volatile("fmul %0.4s, %1.4s, %2.s[1]" : "=w"(d) : "w"(n), "w"(m));
+        break;
+    }
+    return d;
+}
+
+static v2d op_d(int op, v2d n, v2d m)
+{
+    v2d d;
+
+    switch (op) {
+    case FADD:
+        asm volatile("fadd %0.2d, %1.2d, %2.2d" : "=w"(d) : "w"(n), "w"(m));
+        break;
+    case FSUB:
+        asm volatile("fsub %0.2d, %1.2d, %2.2d" : "=w"(d) : "w"(n), "w"(m));
+        break;
+    case FMUL:
+        asm volatile("fmul %0.2d, %1.2d, %2.2d" : "=w"(d) : "w"(n), "w"(m));
+        break;
+    default:
+        asm volatile("fmul %0.2d, %1.2d, %2.d[1]" : "=w"(d) : "w"(n), "w"(m));
+        break;
+    }
+    return d;
+}
+
+static void report(const char *type, int op, const void *n, const void *m,
+                   const void *soft, uint64_t soft_fpsr,
+                   const void *host, uint64_t host_fpsr, int lanes, int size)
+{
+    const void *vecs[] = { n, m, soft, host };
+    static const char *labels[] = { "n", "m", "soft", "host" };
+    int v, i;
+
+    if (++n_errors > MAX_ERRORS) {
+        return;
+    }
+    fprintf(stderr, "%s.%s mismatch: soft fpsr 0x%llx, host fpsr 0x%llx\n",
+            op_names[op], type, (unsigned long long)soft_fpsr,
+            (unsigned long long)host_fpsr);
+    for (v = 0; v < 4; v++) {
+        fprintf(stderr, "  %-4s", labels[v]);
+        for (i = 0; i < lanes; i++) {
+            uint64_t x = 0;
+
+            memcpy(&x, (const char *)vecs[v] + i * size, size);
+            fprintf(stderr, " 0x%0*llx", size * 2, (unsigned long long)x);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+static void test_s(int op, v4s n, v4s m)
+{
+    v4s soft, host;
+    uint64_t soft_fpsr, host_fpsr;
+
+    set_fpsr(0);
+    soft = op_s(op, n, m);
+    soft_fpsr = get_fpsr();
+
+    set_fpsr(FPSR_IXC);
+    host = op_s(op, n, m);
+    host_fpsr = get_fpsr();
+
+    if (memcmp(&soft, &host, sizeof(soft)) ||
+        (soft_fpsr | FPSR_IXC) != host_fpsr) {
+        report("4s", op, &n, &m, &soft, soft_fpsr, &host, host_fpsr, 4, 4);
+    }
+}
+
+static void test_d(int op, v2d n, v2d m)
+{
+    v2d soft, host;
+    uint64_t soft_fpsr, host_fpsr;
+
+    set_fpsr(0);
+    soft = op_d(op, n, m);
+    soft_fpsr = get_fpsr();
+
+    set_fpsr(FPSR_IXC);
+    host = op_d(op, n, m);
+    host_fpsr = get_fpsr();
+
+    if (memcmp(&soft, &host, sizeof(soft)) ||
+        (soft_fpsr | FPSR_IXC) != host_fpsr) {
+        report("2d", op, &n, &m, &soft, soft_fpsr, &host, host_fpsr, 2, 8);
+    }
+}
+
+/*
+ * Lane 0 of n and every lane of m, so that the by-element multiply sees
+ * it too; the other lanes of n are ordinary.
+ */
+static const uint32_t f32_directed[][2] = {
+    { 0x5f800000, 0x5f800000 },         /* 2^64 * 2^64 overflows */
+    { 0x7f7fffff, 0x7f7fffff },         /* max + max overflows */
+    { 0x7f7fffff, 0xff7fffff },         /* max - -max overflows */
+    { 0x1f800000, 0x1f800000 },         /* 2^-64 * 2^-64 is tiny */
+    { 0x00c00000, 0x80800000 },         /* 1.5 * 2^-126 + -2^-126 is tiny */
+    { 0x00800000, 0x00800000 },         /* exact results of 2^-126 */
+    { 0x3f800000, 0xbf800000 },         /* 1 - 1 */
+};
+
+static const uint64_t f64_directed[][2] = {
+    { 0x5ff0000000000000ULL, 0x5ff0000000000000ULL },
+    { 0x7fefffffffffffffULL, 0x7fefffffffffffffULL },
+    { 0x7fefffffffffffffULL, 0xffefffffffffffffULL },
+    { 0x1ff0000000000000ULL, 0x1ff0000000000000ULL },
+    { 0x0018000000000000ULL, 0x8010000000000000ULL },
+    { 0x0010000000000000ULL, 0x0010000000000000ULL },
+    { 0x3ff0000000000000ULL, 0xbff0000000000000ULL },
+};
+
+static void test_directed(int op)
+{
+    int i;
+
+    for (i = 0; i < sizeof(f32_directed) / sizeof(f32_directed[0]); i++) {
+        uint32_t a = f32_directed[i][0], b = f32_directed[i][1];
+
+        test_s(op, (v4s){ a, 0x3f800000, 0x40000000, 0xbfc00000 },
+               (v4s){ b, b, b, b });
+    }
+    for (i = 0; i < sizeof(f64_directed) / sizeof(f64_directed[0]); i++) {
+        uint64_t a = f64_directed[i][0], b = f64_directed[i][1];
+
+        test_d(op, (v2d){ a, 0x3ff8000000000000ULL }, (v2d){ b, b });
+    }
+}
+
+static void test_random(int op)
+{
+    v4s n4, m4;
+    v2d n2, m2;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        n4[i] = rand_f32();
+        m4[i] = rand_f32();
+    }
+    for (i = 0; i < 2; i++) {
+        n2[i] = rand_f64();
+        m2[i] = rand_f64();
+    }
+    test_s(op, n4, m4);
+    test_d(op, n2, m2);
+}
+
+int main(void)
+{
+    static const uint64_t fpcrs[] = { 0, FPCR_FZ | FPCR_DN };
+    int f, op, i;
+
+    for (f = 0; f < 2; f++) {
+        set_fpcr(fpcrs[f]);
+        for (op = 0; op < N_OPS; op++) {
+            test_directed(op);
+            for (i = 0; i < ITERATIONS; i++) {
+                test_random(op);
+            }
+        }
+    }
+    set_fpcr(0);
+    set_fpsr(0);
+
+    if (n_errors) {
+        fprintf(stderr, "%lu mismatches\n", n_errors);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,423 @@
+/*
+ * GICv3 highest priority pending interrupt
+ *
+ * The GIC files pending interrupts by priority instead of scanning them
+ * on every update.  Check ICC_HPPIR1_EL1 and ICC_IAR1_EL1 against a plain
+ * scan of the state the test has set up, which is how the GIC used to
+ * find the best interrupt:
+ *  - ties between SGIs and SPIs of equal priority;
+ *  - a pending SPI retargeted to another CPU through GICD_IROUTER;
+ *  - the current best interrupt changing group;
+ *  - an LPI and an SPI of equal priority.
+ *
+ * Needs -M virt,gic-version=3 -smp 2.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdbool.h>
+#include "gicv3.h"
+
+#define NCPUS           2
+
+#define GITS_CTLR       0x0000
+#define GITS_CBASER     0x0080
+#define GITS_CWRITER    0x0088
+#define GITS_CREADR     0x0090
+#define GITS_BASER      0x0100
+#define GITS_CTLR_ENABLED   (1U << 0)
+#define GITS_VALID      (1ULL << 63)
+
+#define GITS_CMD_INT    0x03
+#define GITS_CMD_SYNC   0x05
+#define GITS_CMD_MAPD   0x08
+#define GITS_CMD_MAPC   0x09
+#define GITS_CMD_MAPTI  0x0a
+
+/* 16384 interrupt IDs, i.e. 8192 LPIs */
+#define LPI_IDBITS      13
+#define LPI_INTID_START 8192
+#define LPI_INTID       (LPI_INTID_START + 5)
+#define LPI_ENABLED     (1 << 0)
+#define DEVICE_ID       0
+#define EVENT_ID        1
+#define COLLECTION_ID   0
+
+#define GICV3_G0        0
+#define GICV3_G1        1
+
+typedef struct {
+    uint32_t intid;
+    uint8_t prio;
+    uint8_t group;
+    uint8_t cpu;
+    bool pending;
+} IrqModel;
+
+/* Every interrupt the test uses; all of them are enabled */
+static IrqModel irqs[] = {
+    { .intid = 3 },
+    { .intid = 40 }, { .intid = 41 }, { .intid = 42 }, { .intid = 43 },
+    { .intid = 44 }, { .intid = 45 }, { .intid = 46 }, { .intid = 47 },
+    { .intid = LPI_INTID },
+};
+
+static uint32_t gicd_ctlr;
+static int errors;
+
+static uint8_t lpi_prop_table[8192] __attribute__((aligned(4096)));
+static uint8_t lpi_pend_table[2048] __attribute__((aligned(65536)));
+static uint64_t its_device_table[512] __attribute__((aligned(4096)));
+static uint64_t its_coll_table[512] __attribute__((aligned(4096)));
+static uint64_t its_cmdq[512] __attribute__((aligned(4096)));
+static uint8_t its_itt[256] __attribute__((aligned(256)));
+static uint64_t its_cwriter;
+
+/* CPU 1 reads its ICC_HPPIR1_EL1 on request */
+static volatile uint32_t remote_req, remote_ack, remote_hppir;
+
+static IrqModel *irq(uint32_t intid)
+{
+    int i;
+
+    for (i = 0; i < sizeof(irqs) / sizeof(irqs[0]); i++) {
+        if (irqs[i].intid == intid) {
+            return &irqs[i];
+        }
+    }
+    ml_printf("FAIL: interrupt %d is not modelled\n", intid);
+    errors++;
+    return &irqs[0];
+}
+
+/*
+ * The best interrupt the way the GIC used to scan for it: the lowest
+ * priority value wins, ties go to the lowest INTID, and an LPI only wins
+ * with a strictly higher priority.  ICC_HPPIR1_EL1 reads as spurious if
+ * the best interrupt is in group 0.
+ */
+static uint32_t ref_hppir(unsigned int cpu)
+{
+    IrqModel *best = NULL;
+    int i;
+
+    for (i = 0; i < sizeof(irqs) / sizeof(irqs[0]); i++) {
+        IrqModel *m = &irqs[i];
+        bool lpi = m->intid >= LPI_INTID_START;
+
+        if (!m->pending || m->prio == 0xff || m->cpu != cpu) {
+            continue;
+        }
+        if (!lpi && !(gicd_ctlr & (m->group == GICV3_G0 ?
+                                   GICD_CTLR_EN_GRP0 : GICD_CTLR_EN_GRP1))) {
+            continue;
+        }
+        if (!best || m->prio < best->prio ||
+            (!lpi && m->prio == best->prio && m->intid < best->intid)) {
+            best = m;
+        }
+    }
+    if (!best || best->group == GICV3_G0) {
+        return INTID_SPURIOUS;
+    }
+    return best->intid;
+}
+
+static void set_gicd_ctlr(uint32_t val)
+{
+    gicd_ctlr = val;
+    mmio_write32(GICD_BASE + GICD_CTLR, val);
+}
+
+static void set_prio(uint32_t intid, uint8_t prio)
+{
+    if (intid < 32) {
+        mmio_write8(gicr_sgi(0) + GICR_IPRIORITYR + intid, prio);
+    } else if (intid < LPI_INTID_START) {
+        mmio_write8(GICD_BASE + GICD_IPRIORITYR + intid, prio);
+    } else {
+        /* Only read when the LPI becomes pending */
+        lpi_prop_table[intid - LPI_INTID_START] = prio | LPI_ENABLED;
+        asm volatile("dsb sy" : : : "memory");
+    }
+    irq(intid)->prio = prio;
+}
+
+static void set_group(uint32_t intid, uint8_t group)
+{
+    uintptr_t reg = intid < 32 ? gicr_sgi(0) + GICR_IGROUPR0 :
+                    GICD_BASE + GICD_IGROUPR + intid / 32 * 4;
+    uint32_t val = mmio_read32(reg);
+
+    if (group == GICV3_G1) {
+        val |= 1U << (intid % 32);
+    } else {
+        val &= ~(1U << (intid % 32));
+    }
+    mmio_write32(reg, val);
+    irq(intid)->group = group;
+}
+
+static void route(uint32_t intid, unsigned int cpu)
+{
+    mmio_write64(GICD_BASE + GICD_IROUTER + 8 * intid, cpu);
+    irq(intid)->cpu = cpu;
+}
+
+static void its_cmd(uint64_t dw0, uint64_t dw1, uint64_t dw2)
+{
+    uint64_t *cmd = &its_cmdq[its_cwriter / 8];
+
+    cmd[0] = dw0;
+    cmd[1] = dw1;
+    cmd[2] = dw2;
+    cmd[3] = 0;
+    asm volatile("dsb sy" : : : "memory");
+    its_cwriter += 32;
+    mmio_write64(ITS_BASE + GITS_CWRITER, its_cwriter);
+    if (mmio_read64(ITS_BASE + GITS_CREADR) != its_cwriter) {
+        ml_printf("FAIL: ITS command 0x%x not processed\n", (int)dw0 & 0xff);
+        errors++;
+    }
+}
+
+static void set_pending(uint32_t intid)
+{
+    if (intid < 32) {
+        mmio_write32(gicr_sgi(0) + GICR_ISPENDR0, 1U << intid);
+    } else if (intid < LPI_INTID_START) {
+        mmio_write32(GICD_BASE + GICD_ISPENDR + intid / 32 * 4,
+                     1U << (intid % 32));
+    } else {
+        its_cmd(GITS_CMD_INT | (uint64_t)DEVICE_ID << 32, EVENT_ID, 0);
+    }
+    irq(intid)->pending = true;
+}
+
+static uint32_t read_hppir(unsigned int cpu)
+{
+    if (cpu == 0) {
+        return read_sysreg(ICC_HPPIR1_EL1) & 0xffffff;
+    }
+    remote_req = remote_req + 1;
+    smp_mb();
+    while (remote_ack != remote_req) {
+        /* wait */
+    }
+    smp_mb();
+    return remote_hppir;
+}
+
+static void check_hppir(const char *what, unsigned int cpu)
+{
+    uint32_t expected = ref_hppir(cpu);
+    uint32_t hppir = read_hppir(cpu);
+
+    if (hppir != expected) {
+        ml_printf("FAIL: %s: CPU %d HPPIR1 %d, expected %d\n",
+                  what, cpu, hppir, expected);
+        errors++;
+    }
+}
+
+/* Acknowledge everything pending on CPU 0, checking the order */
+static void drain(const char *what)
+{
+    while (true) {
+        uint32_t expected = ref_hppir(0);
+        uint32_t intid;
+
+        check_hppir(what, 0);
+        intid = read_sysreg(ICC_IAR1_EL1) & 0xffffff;
+        if (intid != expected) {
+            ml_printf("FAIL: %s: IAR1 %d, expected %d\n",
+                      what, intid, expected);
+            errors++;
+        }
+        if (intid == INTID_SPURIOUS) {
+            break;
+        }
+        irq(intid)->pending = false;
+        write_sysreg(intid, ICC_EOIR1_EL1);
+        asm volatile("isb");
+    }
+}
+
+static void remote_hppir_loop(unsigned int cpu)
+{
+    gicv3_cpu_init(cpu);
+    while (true) {
+        while (remote_ack == remote_req) {
+            /* wait */
+        }
+        smp_mb();
+        remote_hppir = read_sysreg(ICC_HPPIR1_EL1) & 0xffffff;
+        smp_mb();
+        remote_ack = remote_req;
+    }
+}
+
+static void its_init(void)
+{
+    uintptr_t rd = gicr_rd(0);
+
+    mmio_write64(rd + GICR_PROPBASER,
+                 (uintptr_t)lpi_prop_table | LPI_IDBITS);
+    mmio_write64(rd + GICR_PENDBASER, (uintptr_t)lpi_pend_table);
+    mmio_write32(rd + GICR_CTLR, GICR_CTLR_ENABLE_LPIS);
+
+    mmio_write64(ITS_BASE + GITS_BASER,
+                 GITS_VALID | (uintptr_t)its_device_table);
+    mmio_write64(ITS_BASE + GITS_BASER + 8,
+                 GITS_VALID | (uintptr_t)its_coll_table);
+    mmio_write64(ITS_BASE + GITS_CBASER, GITS_VALID | (uintptr_t)its_cmdq);
+    mmio_write32(ITS_BASE + GITS_CTLR, GITS_CTLR_ENABLED);
+
+    /* A one bit EventID, collection on CPU 0 */
+    its_cmd(GITS_CMD_MAPD | (uint64_t)DEVICE_ID << 32, 0,
+            GITS_VALID | (uintptr_t)its_itt);
+    its_cmd(GITS_CMD_MAPC, 0, GITS_VALID | 0 << 16 | COLLECTION_ID);
+    its_cmd(GITS_CMD_MAPTI | (uint64_t)DEVICE_ID << 32,
+            (uint64_t)LPI_INTID << 32 | EVENT_ID, COLLECTION_ID);
+    its_cmd(GITS_CMD_SYNC, 0, 0);
+}
+
+static void gic_init(void)
+{
+    int i;
+
+    set_gicd_ctlr(GICD_CTLR_ARE);
+    set_gicd_ctlr(GICD_CTLR_ARE | GICD_CTLR_EN_GRP1);
+    gicv3_cpu_init(0);
+
+    for (i = 0; i < sizeof(irqs) / sizeof(irqs[0]); i++) {
+        uint32_t intid = irqs[i].intid;
+
+        set_prio(intid, 0x80);
+        if (intid < LPI_INTID_START) {
+            set_group(intid, GICV3_G1);
+        } else {
+            irqs[i].group = GICV3_G1;
+        }
+        if (intid < 32) {
+            mmio_write32(gicr_sgi(0) + GICR_ISENABLER0, 1U << intid);
+        } else if (intid < LPI_INTID_START) {
+            route(intid, 0);
+            mmio_write32(GICD_BASE + GICD_ISENABLER + intid / 32 * 4,
+                         1U << (intid % 32));
+        }
+    }
+    its_init();
+}
+
+static void test_ties(void)
+{
+    set_prio(44, 0x80);
+    set_pending(44);
+    check_hppir("ties", 0);
+    set_prio(42, 0x80);
+    set_pending(42);
+    check_hppir("ties", 0);
+    set_prio(3, 0x80);
+    set_pending(3);
+    check_hppir("ties", 0);
+    set_prio(47, 0x40);
+    set_pending(47);
+    check_hppir("ties", 0);
+
+    /* A pending interrupt whose priority changes */
+    set_prio(44, 0x20);
+    check_hppir("ties", 0);
+    set_prio(44, 0x80);
+    check_hppir("ties", 0);
+    drain("ties");
+}
+
+static void test_retarget(void)
+{
+    set_prio(43, 0x40);
+    set_prio(46, 0x60);
+    set_pending(43);
+    set_pending(46);
+    check_hppir("retarget", 0);
+    check_hppir("retarget", 1);
+
+    route(43, 1);
+    check_hppir("retarget", 0);
+    check_hppir("retarget", 1);
+    route(46, 1);
+    check_hppir("retarget", 0);
+    check_hppir("retarget", 1);
+    route(43, 0);
+    check_hppir("retarget", 0);
+    check_hppir("retarget", 1);
+    route(46, 0);
+    check_hppir("retarget", 1);
+    drain("retarget");
+}
+
+static void test_group_change(void)
+{
+    set_prio(40, 0x40);
+    set_prio(41, 0x60);
+    set_pending(40);
+    set_pending(41);
+    check_hppir("group", 0);
+
+    /* Group 0 is disabled, so the next interrupt becomes the best */
+    set_group(40, GICV3_G0);
+    check_hppir("group", 0);
+    /* The best is in group 0 now */
+    set_gicd_ctlr(GICD_CTLR_ARE | GICD_CTLR_EN_GRP0 | GICD_CTLR_EN_GRP1);
+    check_hppir("group", 0);
+    set_gicd_ctlr(GICD_CTLR_ARE | GICD_CTLR_EN_GRP1);
+    check_hppir("group", 0);
+    set_group(40, GICV3_G1);
+    check_hppir("group", 0);
+    drain("group");
+}
+
+static void test_lpi_vs_spi(void)
+{
+    /* The SPI wins a tie whichever becomes pending first */
+    set_prio(45, 0xa0);
+    set_prio(LPI_INTID, 0xa0);
+    set_pending(LPI_INTID);
+    check_hppir("lpi", 0);
+    set_pending(45);
+    check_hppir("lpi", 0);
+    drain("lpi");
+
+    set_pending(45);
+    set_pending(LPI_INTID);
+    check_hppir("lpi", 0);
+    drain("lpi");
+
+    /* A strictly higher priority LPI wins */
+    set_prio(45, 0xc0);
+    set_prio(LPI_INTID, 0xa0);
+    set_pending(45);
+    set_pending(LPI_INTID);
+    check_hppir("lpi", 0);
+    drain("lpi");
+}
+
+int main(void)
+{
+    map_devices();
+    gic_init();
+    if (start_secondaries(NCPUS, remote_hppir_loop)) {
+        return 1;
+    }
+
+    test_ties();
+    test_retarget();
+    test_group_change();
+    test_lpi_vs_spi();
+
+    if (!errors) {
+        ml_printf("PASS\n");
+    }
+    return errors;
+}
@@ -0,0 +1,144 @@
+/*
+ * Concurrent GICv3 SGIs and SPIs
+ *
+ * Every CPU sends SGIs from the ICC_SGI1R_EL1 system register and pends
+ * SPIs through the distributor, both aimed at the next CPU, while it
+ * acknowledges its own with ICC_IAR1_EL1.  The GIC CPU interface and
+ * distributor run under the GIC's own lock rather than the BQL, so this
+ * checks that no interrupt is lost and, since a deadlock between the two
+ * locks would hang the test, that the lock order holds.
+ *
+ * Interrupts stay masked in PSTATE: they are polled from ICC_IAR1_EL1.
+ * Needs -M virt,gic-version=3 -smp 4.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "gicv3.h"
+
+#define NCPUS           4
+#define ROUNDS          2000
+
+#define SGI_INTID       1
+#define SPI_INTID(cpu)  (32 + (cpu))
+
+/* Each element has a single writer */
+static volatile uint32_t sgi_sent[NCPUS], sgi_received[NCPUS];
+static volatile uint32_t spi_sent[NCPUS], spi_received[NCPUS];
+static volatile uint32_t bad_intid[NCPUS], done[NCPUS];
+
+static void gicd_init(void)
+{
+    int i;
+
+    mmio_write32(GICD_BASE + GICD_CTLR, GICD_CTLR_ARE);
+    mmio_write32(GICD_BASE + GICD_CTLR, GICD_CTLR_ARE | GICD_CTLR_EN_GRP1);
+    for (i = 0; i < NCPUS; i++) {
+        mmio_write64(GICD_BASE + GICD_IROUTER + 8 * SPI_INTID(i), i);
+    }
+    mmio_write32(GICD_BASE + GICD_IGROUPR + 4, 0xffffffff);
+    mmio_write32(GICD_BASE + GICD_ISENABLER + 4, (1U << NCPUS) - 1);
+}
+
+static void cpu_init(unsigned int cpu)
+{
+    uintptr_t sgi = gicr_sgi(cpu);
+
+    gicv3_cpu_init(cpu);
+    mmio_write32(sgi + GICR_IGROUPR0, 0xffffffff);
+    mmio_write32(sgi + GICR_ISENABLER0, 1U << SGI_INTID);
+}
+
+/* Acknowledge whatever is pending for this CPU */
+static void poll_irqs(unsigned int cpu)
+{
+    uint32_t intid;
+
+    while ((intid = read_sysreg(ICC_IAR1_EL1) & 0xffffff) != INTID_SPURIOUS) {
+        if (intid == SGI_INTID) {
+            sgi_received[cpu] = sgi_received[cpu] + 1;
+        } else if (intid == SPI_INTID(cpu)) {
+            spi_received[cpu] = spi_received[cpu] + 1;
+        } else {
+            bad_intid[cpu] = intid;
+        }
+        write_sysreg(intid, ICC_EOIR1_EL1);
+        asm volatile("isb");
+        smp_mb();
+    }
+}
+
+/*
+ * A new SGI or SPI is only sent once the previous one has been taken, so
+ * that none of them are merged while pending and every one must arrive.
+ */
+static void run(unsigned int cpu)
+{
+    unsigned int next = (cpu + 1) % NCPUS;
+
+    cpu_init(cpu);
+
+    while (sgi_sent[cpu] < ROUNDS || spi_sent[cpu] < ROUNDS) {
+        poll_irqs(cpu);
+        smp_mb();
+        if (sgi_sent[cpu] < ROUNDS && sgi_received[next] == sgi_sent[cpu]) {
+            sgi_sent[cpu] = sgi_sent[cpu] + 1;
+            smp_mb();
+            write_sysreg((uint64_t)SGI_INTID << 24 | 1U << next,
+                         ICC_SGI1R_EL1);
+            asm volatile("isb");
+        }
+        if (spi_sent[cpu] < ROUNDS && spi_received[next] == spi_sent[cpu]) {
+            spi_sent[cpu] = spi_sent[cpu] + 1;
+            smp_mb();
+            mmio_write32(GICD_BASE + GICD_ISPENDR + 4, 1U << next);
+        }
+    }
+
+    /* Keep taking interrupts until the previous CPU has finished too */
+    while (sgi_received[cpu] < ROUNDS || spi_received[cpu] < ROUNDS) {
+        poll_irqs(cpu);
+    }
+    smp_mb();
+    done[cpu] = 1;
+}
+
+int main(void)
+{
+    int i, errors = 0;
+
+    if (this_cpu() != 0) {
+        ml_printf("FAIL: not started on CPU 0\n");
+        return 1;
+    }
+
+    map_devices();
+    gicd_init();
+
+    if (start_secondaries(NCPUS, run)) {
+        return 1;
+    }
+
+    run(0);
+
+    for (i = 0; i < NCPUS; i++) {
+        while (!done[i]) {
+            /* wait */
+        }
+    }
+    smp_mb();
+
+    for (i = 0; i < NCPUS; i++) {
+        if (sgi_received[i] != ROUNDS || spi_received[i] != ROUNDS ||
+            bad_intid[i]) {
+            ml_printf("FAIL: CPU %d took %d SGIs and %d SPIs, intid %d\n",
+                      i, sgi_received[i], spi_received[i], bad_intid[i]);
+            errors++;
+        }
+    }
+    if (!errors) {
+        ml_printf("PASS\n");
+    }
+    return errors;
+}
@@ -0,0 +1,233 @@
+/*
+ * Helpers for the GICv3 system tests on the virt board
+ *
+ * Each test is a single translation unit, so this header also defines the
+ * secondary CPU entry code and its data.  Needs -M virt,gic-version=3.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef GICV3_TEST_H
+#define GICV3_TEST_H
+
+#include <inttypes.h>
+#include <minilib.h>
+
+#define GICV3_MAX_CPUS  4
+#define STACK_SIZE      16384
+
+#define GICD_BASE       0x08000000UL
+#define ITS_BASE        0x08080000UL
+#define GICR_BASE       0x080a0000UL
+#define GICR_STRIDE     0x20000UL
+#define GICR_SGI_OFFSET 0x10000UL
+
+#define GICD_CTLR       0x0000
+#define GICD_IGROUPR    0x0080
+#define GICD_ISENABLER  0x0100
+#define GICD_ICENABLER  0x0180
+#define GICD_ISPENDR    0x0200
+#define GICD_ICPENDR    0x0280
+#define GICD_IPRIORITYR 0x0400
+#define GICD_IROUTER    0x6000
+#define GICD_CTLR_EN_GRP0   (1U << 0)
+#define GICD_CTLR_EN_GRP1   (1U << 1)
+#define GICD_CTLR_ARE       (1U << 4)
+
+#define GICR_CTLR       0x0000
+#define GICR_WAKER      0x0014
+#define GICR_PROPBASER  0x0070
+#define GICR_PENDBASER  0x0078
+#define GICR_CTLR_ENABLE_LPIS   (1U << 0)
+#define GICR_WAKER_PS   (1U << 1)
+#define GICR_WAKER_CA   (1U << 2)
+
+/* In the SGI_base frame */
+#define GICR_IGROUPR0   0x0080
+#define GICR_ISENABLER0 0x0100
+#define GICR_ISPENDR0   0x0200
+#define GICR_IPRIORITYR 0x0400
+
+#define INTID_SPURIOUS  1023
+
+#define PSCI_CPU_ON_64  0xc4000003UL
+
+/* Device-nGnRnE (MAIR attribute 1), AF, XN, 1GB block at 0 */
+#define DEVICE_BLOCK    ((3UL << 53) | (1UL << 10) | (1UL << 2) | 1UL)
+
+#define read_sysreg(r) ({                                       \
+    uint64_t __val;                                             \
+    asm volatile("mrs %0, " #r : "=r"(__val));                  \
+    __val;                                                      \
+})
+
+#define write_sysreg(v, r) do {                                 \
+    asm volatile("msr " #r ", %0" : : "r"((uint64_t)(v)));      \
+} while (0)
+
+#define ICC_PMR_EL1     S3_0_C4_C6_0
+#define ICC_IAR1_EL1    S3_0_C12_C12_0
+#define ICC_EOIR1_EL1   S3_0_C12_C12_1
+#define ICC_HPPIR1_EL1  S3_0_C12_C12_2
+#define ICC_SGI1R_EL1   S3_0_C12_C11_5
+#define ICC_SRE_EL1     S3_0_C12_C12_5
+#define ICC_IGRPEN1_EL1 S3_0_C12_C12_7
+
+/* System registers a secondary CPU copies from the boot CPU */
+uint64_t secondary_regs[6];
+uint8_t secondary_stacks[GICV3_MAX_CPUS][STACK_SIZE]
+    __attribute__((aligned(16)));
+static void (*secondary_fn)(unsigned int cpu);
+
+void secondary_main(uint64_t cpu);
+
+asm(".text\n"
+    ".align 4\n"
+    "secondary_entry:\n"
+    "    adrp x1, secondary_regs\n"
+    "    add x1, x1, :lo12:secondary_regs\n"
+    "    ldp x2, x3, [x1, #0]\n"
+    "    msr vbar_el1, x2\n"
+    "    msr ttbr0_el1, x3\n"
+    "    ldp x2, x3, [x1, #16]\n"
+    "    msr tcr_el1, x2\n"
+    "    msr mair_el1, x3\n"
+    "    isb\n"
+    "    ldp x2, x3, [x1, #32]\n"
+    "    dsb sy\n"
+    "    msr sctlr_el1, x2\n"
+    "    isb\n"
+    "    msr cpacr_el1, x3\n"
+    "    isb\n"
+    "    adrp x1, secondary_stacks\n"
+    "    add x1, x1, :lo12:secondary_stacks\n"
+    "    add x2, x0, #1\n"
+    "    add x1, x1, x2, lsl #14\n"
+    "    mov sp, x1\n"
+    "    bl secondary_main\n"
+    "1:  wfe\n"
+    "    b 1b\n");
+
+extern char secondary_entry[];
+
+void secondary_main(uint64_t cpu)
+{
+    secondary_fn(cpu);
+}
+
+static inline void mmio_write8(uintptr_t addr, uint8_t val)
+{
+    *(volatile uint8_t *)addr = val;
+}
+
+static inline void mmio_write32(uintptr_t addr, uint32_t val)
+{
+    *(volatile uint32_t *)addr = val;
+}
+
+static inline void mmio_write64(uintptr_t addr, uint64_t val)
+{
+    *(volatile uint64_t *)addr = val;
+}
+
+static inline uint32_t mmio_read32(uintptr_t addr)
+{
+    return *(volatile uint32_t *)addr;
+}
+
+static inline uint64_t mmio_read64(uintptr_t addr)
+{
+    return *(volatile uint64_t *)addr;
+}
+
+static inline void smp_mb(void)
+{
+    asm volatile("dmb ish" : : : "memory");
+}
+
+static inline unsigned int this_cpu(void)
+{
+    return read_sysreg(mpidr_el1) & 0xff;
+}
+
+static inline uintptr_t gicr_rd(unsigned int cpu)
+{
+    return GICR_BASE + cpu * GICR_STRIDE;
+}
+
+static inline uintptr_t gicr_sgi(unsigned int cpu)
+{
+    return gicr_rd(cpu) + GICR_SGI_OFFSET;
+}
+
+/* boot.S only maps RAM; add the GIC with a device mapping */
+static void map_devices(void)
+{
+    uint64_t *ttb = (uint64_t *)(read_sysreg(ttbr0_el1) & ~0xfffUL);
+
+    ttb[0] = DEVICE_BLOCK;
+    asm volatile("dsb ishst\n"
+                 "tlbi vmalle1\n"
+                 "dsb ish\n"
+                 "isb" : : : "memory");
+}
+
+static int64_t psci_cpu_on(uint64_t mpidr, uint64_t entry, uint64_t context)
+{
+    register uint64_t x0 asm("x0") = PSCI_CPU_ON_64;
+    register uint64_t x1 asm("x1") = mpidr;
+    register uint64_t x2 asm("x2") = entry;
+    register uint64_t x3 asm("x3") = context;
+
+    asm volatile("hvc #0"
+                 : "+r"(x0)
+                 : "r"(x1), "r"(x2), "r"(x3)
+                 : "memory");
+    return x0;
+}
+
+/* Run @fn on CPUs 1 to @ncpus - 1, with the MMU set up like on CPU 0 */
+static int start_secondaries(unsigned int ncpus, void (*fn)(unsigned int))
+{
+    unsigned int i;
+
+    secondary_fn = fn;
+    secondary_regs[0] = read_sysreg(vbar_el1);
+    secondary_regs[1] = read_sysreg(ttbr0_el1);
+    secondary_regs[2] = read_sysreg(tcr_el1);
+    secondary_regs[3] = read_sysreg(mair_el1);
+    secondary_regs[4] = read_sysreg(sctlr_el1);
+    secondary_regs[5] = read_sysreg(cpacr_el1);
+    asm volatile("dsb sy" : : : "memory");
+
+    for (i = 1; i < ncpus; i++) {
+        int64_t ret = psci_cpu_on(i, (uintptr_t)secondary_entry, i);
+
+        if (ret) {
+            ml_printf("FAIL: CPU_ON for CPU %d returned %d\n", i, (int)ret);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Wake up the redistributor and enable group 1 in the CPU interface */
+static void gicv3_cpu_init(unsigned int cpu)
+{
+    uintptr_t rd = gicr_rd(cpu);
+
+    mmio_write32(rd + GICR_WAKER,
+                 mmio_read32(rd + GICR_WAKER) & ~GICR_WAKER_PS);
+    while (mmio_read32(rd + GICR_WAKER) & GICR_WAKER_CA) {
+        /* wait */
+    }
+
+    write_sysreg(read_sysreg(ICC_SRE_EL1) | 1, ICC_SRE_EL1);
+    asm volatile("isb");
+    write_sysreg(0xff, ICC_PMR_EL1);
+    write_sysreg(1, ICC_IGRPEN1_EL1);
+    asm volatile("isb");
+}
+
+#endif /* GICV3_TEST_H */
@@ -0,0 +1,222 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * fdmon-io_uring tests
+ *
+ * The main loop runs from a GSource and therefore never uses fdmon-io_uring,
+ * so these tests run a separate AioContext in the main thread and make it
+ * the current one.
+ */
+
+#include "qemu/osdep.h"
+#include <liburing.h>
+#include "block/aio.h"
+#include "block/raw-aio.h"
+#include "qapi/error.h"
+#include "qemu/coroutine.h"
+#include "qemu/main-loop.h"
+
+/* More than the cq ring of fdmon-io_uring can take */
+#define NUM_REQUESTS    512
+#define NUM_NOTIFIERS   64
+#define BLOCK_SIZE      4096
+
+static AioContext *ctx;
+
+AioContext *qemu_get_current_aio_context(void)
+{
+    return ctx ? ctx : qemu_get_aio_context();
+}
+
+static void dummy_fd_handler(EventNotifier *notifier)
+{
+}
+
+/*
+ * Event notifiers that are always ready, so that every aio_poll() also
+ * completes an IORING_OP_POLL_ADD for each of them.
+ */
+static void add_event_notifiers(EventNotifier *notifiers, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        event_notifier_init(&notifiers[i], true);
+        aio_set_event_notifier(ctx, &notifiers[i], false,
+                               dummy_fd_handler, NULL);
+    }
+}
+
+static void remove_event_notifiers(EventNotifier *notifiers, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        aio_set_event_notifier(ctx, &notifiers[i], false, NULL, NULL);
+        event_notifier_cleanup(&notifiers[i]);
+    }
+}
+
+static bool setup(void)
+{
+    ctx = aio_context_new(&error_abort);
+    if (!aio_has_io_uring(ctx)) {
+        aio_context_unref(ctx);
+        ctx = NULL;
+        g_test_skip("io_uring is not available");
+        return false;
+    }
+    return true;
+}
+
+static void teardown(void)
+{
+    while (aio_poll(ctx, false)) {
+        /* Do nothing */
+    }
+    aio_context_unref(ctx);
+    ctx = NULL;
+}
+
+typedef struct {
+    CqeHandler cqe_handler;
+    int *completed;
+} NopRequest;
+
+static void prep_nop(struct io_uring_sqe *sqe, void *opaque)
+{
+    io_uring_prep_nop(sqe);
+}
+
+static void nop_cb(CqeHandler *cqe_handler)
+{
+    NopRequest *req = container_of(cqe_handler, NopRequest, cqe_handler);
+
+    g_assert_cmpint(cqe_handler->cqe_res, ==, 0);
+    (*req->completed)++;
+}
+
+/* Check that aio_add_sqe() refuses requests instead of overflowing */
+static void test_add_sqe_limit(void)
+{
+    EventNotifier notifiers[NUM_NOTIFIERS];
+    NopRequest reqs[NUM_REQUESTS];
+    int queued = 0, completed = 0;
+    int i;
+
+    if (!setup()) {
+        return;
+    }
+    add_event_notifiers(notifiers, NUM_NOTIFIERS);
+
+    for (i = 0; i < NUM_REQUESTS; i++) {
+        reqs[i] = (NopRequest) {
+            .cqe_handler.cb = nop_cb,
+            .completed = &completed,
+        };
+        if (!aio_add_sqe(prep_nop, NULL, &reqs[i].cqe_handler)) {
+            break;
+        }
+        queued++;
+    }
+    g_assert_cmpint(queued, >, 0);
+    g_assert_cmpint(queued, <, NUM_REQUESTS);
+
+    while (completed < queued) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(completed, ==, queued);
+
+    /* The completed requests have made room again */
+    g_assert(aio_add_sqe(prep_nop, NULL, &reqs[0].cqe_handler));
+    while (completed < queued + 1) {
+        aio_poll(ctx, true);
+    }
+
+    remove_event_notifiers(notifiers, NUM_NOTIFIERS);
+    teardown();
+}
+
+typedef struct {
+    LuringState *s;
+    int fd;
+    int index;
+    int *completed;
+} ReadRequest;
+
+static void coroutine_fn read_entry(void *opaque)
+{
+    ReadRequest *req = opaque;
+    uint8_t *buf = g_malloc(BLOCK_SIZE);
+    QEMUIOVector qiov;
+    int ret;
+
+    qemu_iovec_init_buf(&qiov, buf, BLOCK_SIZE);
+    ret = luring_co_submit(NULL, req->s, req->fd,
+                           (uint64_t)req->index * BLOCK_SIZE, &qiov,
+                           QEMU_AIO_READ);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert_cmpint(buf[0], ==, req->index & 0xff);
+    g_assert_cmpint(buf[BLOCK_SIZE - 1], ==, req->index & 0xff);
+
+    g_free(buf);
+    (*req->completed)++;
+}
+
+/*
+ * Start more reads than the shared ring takes, so that some of them have to
+ * go through the LuringState ring, and check that they all complete.
+ */
+static void test_luring_many_requests(void)
+{
+    EventNotifier notifiers[NUM_NOTIFIERS];
+    ReadRequest reqs[NUM_REQUESTS];
+    uint8_t *buf = g_malloc(BLOCK_SIZE);
+    LuringState *s;
+    char *filename;
+    int completed = 0;
+    int fd, i;
+
+    if (!setup()) {
+        g_free(buf);
+        return;
+    }
+    s = aio_setup_linux_io_uring(ctx, &error_abort);
+    add_event_notifiers(notifiers, NUM_NOTIFIERS);
+
+    fd = g_file_open_tmp("qemu-test-fdmon-io-uring.XXXXXX", &filename, NULL);
+    g_assert_cmpint(fd, >=, 0);
+    for (i = 0; i < NUM_REQUESTS; i++) {
+        memset(buf, i & 0xff, BLOCK_SIZE);
+        g_assert_cmpint(pwrite(fd, buf, BLOCK_SIZE, (off_t)i * BLOCK_SIZE),
+                        ==, BLOCK_SIZE);
+    }
+
+    for (i = 0; i < NUM_REQUESTS; i++) {
+        reqs[i] = (ReadRequest) {
+            .s = s,
+            .fd = fd,
+            .index = i,
+            .completed = &completed,
+        };
+        qemu_coroutine_enter(qemu_coroutine_create(read_entry, &reqs[i]));
+    }
+
+    while (completed < NUM_REQUESTS) {
+        aio_poll(ctx, true);
+    }
+
+    remove_event_notifiers(notifiers, NUM_NOTIFIERS);
+    teardown();
+
+    close(fd);
+    unlink(filename);
+    g_free(filename);
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    qemu_init_main_loop(&error_fatal);
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/fdmon-io_uring/add-sqe/limit", test_add_sqe_limit);
+    g_test_add_func("/fdmon-io_uring/luring/many-requests",
+                    test_luring_many_requests);
+    return g_test_run();
+}
@@ -0,0 +1,638 @@
+/*
+ * Checksum and segmentation offload tests
+ *
+ * The checksums are compared against a plain RFC 1071 sum of big-endian
+ * 16-bit words, and the frames that net_gso_sendv() sends are captured
+ * by a stub of qemu_sendv_packet_async().
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/gso.h"
+
+/* Offset of the IP header, after an Ethernet header without VLAN tag */
+#define L3OFF 14
+
+#define IP6_FRAG_HDR_LEN 8
+
+typedef struct SentFrame {
+    GByteArray *data;
+    bool last;          /* sent with the completion callback */
+} SentFrame;
+
+typedef struct TestFrame {
+    uint8_t *buf;
+    size_t size;
+    size_t l4off;
+    size_t l5off;
+} TestFrame;
+
+static GPtrArray *sent;
+
+ssize_t qemu_sendv_packet_async(NetClientState *nc, const struct iovec *iov,
+                                int iovcnt, NetPacketSent *sent_cb)
+{
+    SentFrame *f = g_new0(SentFrame, 1);
+    size_t size = iov_size(iov, iovcnt);
+
+    f->data = g_byte_array_sized_new(size);
+    g_byte_array_set_size(f->data, size);
+    iov_to_buf(iov, iovcnt, 0, f->data->data, size);
+    f->last = sent_cb != NULL;
+    g_ptr_array_add(sent, f);
+    return size;
+}
+
+static void sent_frame_free(gpointer p)
+{
+    SentFrame *f = p;
+
+    g_byte_array_unref(f->data);
+    g_free(f);
+}
+
+static void test_sent_cb(NetClientState *nc, ssize_t len)
+{
+}
+
+static uint64_t ref_sum(const uint8_t *buf, size_t len, uint64_t sum)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        sum += buf[i] << 8 | buf[i + 1];
+    }
+    if (len & 1) {
+        sum += buf[len - 1] << 8;
+    }
+    return sum;
+}
+
+static uint16_t ref_fold(uint64_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+/* 0 and 0xffff are the same number in one's complement */
+static void assert_sum_eq(uint64_t a, uint64_t b)
+{
+    g_assert_cmphex(ref_fold(a) % 0xffff, ==, ref_fold(b) % 0xffff);
+}
+
+static void fill(uint8_t *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = 0xff - i * 7 - (i >> 8);
+    }
+}
+
+static void test_checksum_offsets(void)
+{
+    uint8_t buf[256 + 8];
+    int off, len;
+
+    fill(buf, sizeof(buf));
+    for (off = 0; off < 8; off++) {
+        for (len = 0; len <= 256; len++) {
+            assert_sum_eq(net_checksum_add_cont(len, buf + off, 0),
+                          ref_sum(buf + off, len, 0));
+        }
+    }
+}
+
+static void test_checksum_cont(void)
+{
+    uint8_t buf[80];
+    int len, k, j;
+
+    fill(buf, sizeof(buf));
+    for (len = 0; len <= 64; len++) {
+        /* A chunk at an odd position sums to the byte-swapped value */
+        assert_sum_eq(net_checksum_add_cont(len, buf + 1, 1),
+                      bswap16(ref_fold(ref_sum(buf + 1, len, 0))));
+
+        for (k = 0; k <= len; k++) {
+            for (j = k; j <= len; j++) {
+                uint32_t sum = net_checksum_add_cont(k, buf, 0) +
+                               net_checksum_add_cont(j - k, buf + k, k) +
+                               net_checksum_add_cont(len - j, buf + j, j);
+
+                assert_sum_eq(sum, ref_sum(buf, len, 0));
+            }
+        }
+    }
+}
+
+static void test_checksum_fold(void)
+{
+    /* The example from RFC 1071 */
+    static uint8_t rfc1071[] = {
+        0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6, 0xf7,
+    };
+    size_t len = 2 * 65536 + 5;
+    g_autofree uint8_t *buf = g_malloc(len);
+    g_autofree uint8_t *swapped = g_malloc(len);
+    size_t i;
+
+    g_assert_cmphex(net_checksum_add(sizeof(rfc1071), rfc1071), ==, 0xddf2);
+    g_assert_cmphex(net_raw_checksum(rfc1071, sizeof(rfc1071)), ==, 0x220d);
+    g_assert_cmphex(net_checksum_add(0, rfc1071), ==, 0);
+
+    /* Every word carries into the upper half */
+    memset(buf, 0xff, len);
+    for (i = len - 40; i <= len; i++) {
+        assert_sum_eq(net_checksum_add(i, buf), ref_sum(buf, i, 0));
+    }
+
+    /* The sum of the byte-swapped data is the byte-swapped sum */
+    fill(buf, len);
+    for (i = 0; i + 1 < len; i += 2) {
+        swapped[i] = buf[i + 1];
+        swapped[i + 1] = buf[i];
+    }
+    assert_sum_eq(net_checksum_add(len - 1, swapped),
+                  bswap16(ref_fold(ref_sum(buf, len - 1, 0))));
+    assert_sum_eq(net_checksum_add(len - 1, buf), ref_sum(buf, len - 1, 0));
+}
+
+static void test_checksum_iov(void)
+{
+    static const size_t lens[] = { 1, 7, 64, 3, 225 };
+    uint8_t buf[300];
+    struct iovec iov[ARRAY_SIZE(lens)];
+    size_t off, size, pos = 0;
+    unsigned cso;
+    int i;
+
+    fill(buf, sizeof(buf));
+    for (i = 0; i < ARRAY_SIZE(lens); i++) {
+        iov[i].iov_base = buf + pos;
+        iov[i].iov_len = lens[i];
+        pos += lens[i];
+    }
+    g_assert_cmpuint(pos, ==, sizeof(buf));
+
+    for (off = 0; off < 80; off++) {
+        for (size = 0; off + size <= sizeof(buf); size += 13) {
+            for (cso = 0; cso < 4; cso++) {
+                uint16_t ref = ref_fold(ref_sum(buf + off, size, 0));
+
+                assert_sum_eq(net_checksum_add_iov(iov, ARRAY_SIZE(lens),
+                                                   off, size, cso),
+                              cso & 1 ? bswap16(ref) : ref);
+            }
+        }
+    }
+}
+
+static void build_frame(TestFrame *f, bool ip6, uint8_t proto,
+                        size_t payload)
+{
+    size_t l4len = proto == IP_PROTO_TCP ? sizeof(tcp_header)
+                                         : sizeof(udp_header);
+    uint8_t *ip, *l4;
+    size_t i;
+
+    f->l4off = L3OFF + (ip6 ? sizeof(struct ip6_header)
+                            : sizeof(struct ip_header));
+    f->l5off = f->l4off + l4len;
+    f->size = f->l5off + payload;
+    f->buf = g_malloc0(f->size);
+
+    memset(f->buf, 0x52, 6);
+    memset(f->buf + 6, 0x54, 6);
+    stw_be_p(f->buf + 12, ip6 ? ETH_P_IPV6 : ETH_P_IP);
+
+    ip = f->buf + L3OFF;
+    if (ip6) {
+        ip[0] = 0x60;
+        stw_be_p(ip + 4, l4len + payload);
+        ip[6] = proto;
+        ip[7] = 64;
+        for (i = 0; i < 32; i++) {
+            ip[8 + i] = 0xf0 + i;
+        }
+    } else {
+        ip[0] = 0x45;
+        stw_be_p(ip + 2, sizeof(struct ip_header) + l4len + payload);
+        stw_be_p(ip + 4, 0xfffe);
+        ip[8] = 64;
+        ip[9] = proto;
+        stl_be_p(ip + 12, 0x0a00020f);
+        stl_be_p(ip + 16, 0x0a000202);
+    }
+
+    l4 = f->buf + f->l4off;
+    stw_be_p(l4, 0x1234);
+    stw_be_p(l4 + 2, 0xfedc);
+    if (proto == IP_PROTO_TCP) {
+        stl_be_p(l4 + 4, 0xfffffc00);
+        stl_be_p(l4 + 8, 1);
+        stw_be_p(l4 + 12, 5 << 12 | TH_CWR | TH_ACK | TH_PUSH | TH_FIN);
+        stw_be_p(l4 + 14, 0xffff);
+    } else {
+        stw_be_p(l4 + 4, l4len + payload);
+    }
+
+    for (i = 0; i < payload; i++) {
+        f->buf[f->l5off + i] = i * 31 + (i >> 8);
+    }
+}
+
+/* Sum of the pseudo header for an L4 length of @len */
+static uint64_t ref_pseudo_sum(const uint8_t *frame, bool ip6, uint8_t proto,
+                               size_t len)
+{
+    const uint8_t *ip = frame + L3OFF;
+    uint64_t sum = ip6 ? ref_sum(ip + 8, 32, 0) : ref_sum(ip + 12, 8, 0);
+
+    return sum + proto + len;
+}
+
+static void init_hdr(struct virtio_net_hdr *hdr, TestFrame *f,
+                     uint8_t gso_type, uint16_t gso_size)
+{
+    bool tcp = f->l5off - f->l4off == sizeof(tcp_header);
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    hdr->gso_type = gso_type;
+    hdr->hdr_len = f->l5off;
+    hdr->gso_size = gso_size;
+    hdr->csum_start = f->l4off;
+    hdr->csum_offset = tcp ? offsetof(tcp_header, th_sum)
+                           : offsetof(udp_header, uh_sum);
+}
+
+/* Send @f split into elements of odd sizes, which also split the headers */
+static ssize_t send_frame(TestFrame *f, const struct virtio_net_hdr *hdr)
+{
+    static const size_t chunk[] = { 5, 37, 700, 1, 1201 };
+    g_autofree uint8_t *orig = g_memdup(f->buf, f->size);
+    struct iovec iov[256];
+    size_t off = 0;
+    ssize_t ret;
+    int cnt = 0;
+
+    while (off < f->size) {
+        size_t len = MIN(chunk[cnt % ARRAY_SIZE(chunk)], f->size - off);
+
+        g_assert_cmpint(cnt, <, ARRAY_SIZE(iov));
+        iov[cnt].iov_base = f->buf + off;
+        iov[cnt].iov_len = len;
+        off += len;
+        cnt++;
+    }
+
+    g_ptr_array_remove_range(sent, 0, sent->len);
+    ret = net_gso_sendv(NULL, hdr, iov, cnt, test_sent_cb);
+    g_assert(memcmp(orig, f->buf, f->size) == 0);
+    return ret;
+}
+
+static void check_tcp_segments(TestFrame *f, bool ip6, size_t mss)
+{
+    size_t payload = f->size - f->l5off;
+    size_t nseg = DIV_ROUND_UP(payload, mss);
+    uint32_t seq = ldl_be_p(f->buf + f->l4off + 4);
+    uint16_t ip_id = lduw_be_p(f->buf + L3OFF + 4);
+    size_t off = 0;
+    int i;
+
+    g_assert_cmpuint(sent->len, ==, nseg);
+    for (i = 0; i < nseg; i++) {
+        SentFrame *s = g_ptr_array_index(sent, i);
+        const uint8_t *d = s->data->data;
+        const uint8_t *ip = d + L3OFF;
+        const uint8_t *tcp = d + f->l4off;
+        size_t len = MIN(mss, payload - off);
+        size_t tcp_len = sizeof(tcp_header) + len;
+        uint16_t flags = lduw_be_p(tcp + 12);
+        bool last = i == nseg - 1;
+
+        g_assert_cmpuint(s->data->len, ==, f->l5off + len);
+        g_assert(s->last == last);
+        g_assert(memcmp(d, f->buf, L3OFF) == 0);
+        g_assert(memcmp(d + f->l5off, f->buf + f->l5off + off, len) == 0);
+
+        g_assert_cmphex(ldl_be_p(tcp + 4), ==, (uint32_t)(seq + off));
+        g_assert_cmphex(flags & TH_CWR, ==, i ? 0 : TH_CWR);
+        g_assert_cmphex(flags & (TH_FIN | TH_PUSH), ==,
+                        last ? TH_FIN | TH_PUSH : 0);
+        g_assert_cmphex(flags & TH_ACK, ==, TH_ACK);
+
+        if (ip6) {
+            g_assert_cmpuint(lduw_be_p(ip + 4), ==, tcp_len);
+        } else {
+            g_assert_cmpuint(lduw_be_p(ip + 2), ==,
+                             sizeof(struct ip_header) + tcp_len);
+            g_assert_cmphex(lduw_be_p(ip + 4), ==, (uint16_t)(ip_id + i));
+            g_assert_cmphex(ref_fold(ref_sum(ip, sizeof(struct ip_header), 0)),
+                            ==, 0xffff);
+        }
+        g_assert_cmphex(ref_fold(ref_sum(tcp, tcp_len,
+                                         ref_pseudo_sum(d, ip6, IP_PROTO_TCP,
+                                                        tcp_len))),
+                        ==, 0xffff);
+        off += len;
+    }
+}
+
+static void check_udp_datagram(TestFrame *f, bool ip6, const uint8_t *dgram)
+{
+    size_t udp_len = f->size - f->l4off;
+
+    g_assert(memcmp(dgram, f->buf + f->l4off, 4) == 0);
+    g_assert_cmpuint(lduw_be_p(dgram + 4), ==, udp_len);
+    g_assert(memcmp(dgram + sizeof(udp_header), f->buf + f->l5off,
+                    f->size - f->l5off) == 0);
+    g_assert_cmphex(ref_fold(ref_sum(dgram, udp_len,
+                                     ref_pseudo_sum(f->buf, ip6, IP_PROTO_UDP,
+                                                    udp_len))),
+                    ==, 0xffff);
+}
+
+static void check_udp_fragments(TestFrame *f, bool ip6, size_t frag)
+{
+    size_t udp_len = f->size - f->l4off;
+    size_t nfrag = DIV_ROUND_UP(udp_len, frag);
+    size_t hdr_len = f->l4off + (ip6 ? IP6_FRAG_HDR_LEN : 0);
+    g_autofree uint8_t *dgram = g_malloc(udp_len);
+    uint32_t frag_id = 0;
+    size_t off = 0;
+    int i;
+
+    if (udp_len <= frag) {
+        SentFrame *s;
+
+        g_assert_cmpuint(sent->len, ==, 1);
+        s = g_ptr_array_index(sent, 0);
+        g_assert(s->last);
+        g_assert_cmpuint(s->data->len, ==, f->size);
+        g_assert(memcmp(s->data->data, f->buf, f->l4off) == 0);
+        check_udp_datagram(f, ip6, s->data->data + f->l4off);
+        return;
+    }
+
+    g_assert_cmpuint(sent->len, ==, nfrag);
+    for (i = 0; i < nfrag; i++) {
+        SentFrame *s = g_ptr_array_index(sent, i);
+        const uint8_t *d = s->data->data;
+        const uint8_t *ip = d + L3OFF;
+        size_t len = MIN(frag, udp_len - off);
+        bool more = i < nfrag - 1;
+
+        g_assert_cmpuint(s->data->len, ==, hdr_len + len);
+        g_assert(s->last == !more);
+        g_assert(memcmp(d, f->buf, L3OFF) == 0);
+
+        if (ip6) {
+            const uint8_t *fh = d + f->l4off;
+
+            g_assert_cmpuint(ip[6], ==, IP6_FRAGMENT);
+            g_assert_cmpuint(lduw_be_p(ip + 4), ==, IP6_FRAG_HDR_LEN + len);
+            g_assert_cmpuint(fh[0], ==, IP_PROTO_UDP);
+            g_assert_cmpuint(fh[1], ==, 0);
+            g_assert_cmphex(lduw_be_p(fh + 2), ==, off | more);
+            if (!i) {
+                frag_id = ldl_be_p(fh + 4);
+            }
+            g_assert_cmphex(ldl_be_p(fh + 4), ==, frag_id);
+        } else {
+            g_assert_cmpuint(lduw_be_p(ip + 2), ==,
+                             sizeof(struct ip_header) + len);
+            g_assert_cmphex(lduw_be_p(ip + 4), ==,
+                            lduw_be_p(f->buf + L3OFF + 4));
+            g_assert_cmphex(lduw_be_p(ip + 6), ==,
+                            off / 8 | (more ? IP_MF : 0));
+            g_assert_cmphex(ref_fold(ref_sum(ip, sizeof(struct ip_header), 0)),
+                            ==, 0xffff);
+        }
+
+        memcpy(dgram + off, d + hdr_len, len);
+        off += len;
+    }
+    check_udp_datagram(f, ip6, dgram);
+}
+
+static void test_gso_tcp(const void *opaque)
+{
+    static const struct {
+        size_t payload, mss;
+    } cases[] = {
+        { 1, 1448 }, { 1448, 1448 }, { 1449, 1448 },
+        { 3000, 1000 }, { 4001, 1448 }, { 65000, 1448 },
+    };
+    bool ip6 = *(const bool *)opaque;
+    struct virtio_net_hdr hdr;
+    TestFrame f;
+    SentFrame *s;
+    ssize_t ret;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        build_frame(&f, ip6, IP_PROTO_TCP, cases[i].payload);
+        init_hdr(&hdr, &f, ip6 ? VIRTIO_NET_HDR_GSO_TCPV6
+                               : VIRTIO_NET_HDR_GSO_TCPV4, cases[i].mss);
+        ret = send_frame(&f, &hdr);
+        check_tcp_segments(&f, ip6, cases[i].mss);
+
+        /* The result is that of the last segment */
+        s = g_ptr_array_index(sent, sent->len - 1);
+        g_assert_cmpint(ret, ==, s->data->len);
+        g_free(f.buf);
+    }
+}
+
+static void test_gso_udp(const void *opaque)
+{
+    static const struct {
+        size_t payload, gso_size;
+    } cases[] = {
+        { 100, 1000 }, { 992, 1000 }, { 993, 1000 },
+        { 2992, 1000 }, { 3001, 1003 }, { 60000, 1480 },
+    };
+    bool ip6 = *(const bool *)opaque;
+    struct virtio_net_hdr hdr;
+    TestFrame f;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        build_frame(&f, ip6, IP_PROTO_UDP, cases[i].payload);
+        init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_UDP, cases[i].gso_size);
+        send_frame(&f, &hdr);
+        check_udp_fragments(&f, ip6, cases[i].gso_size & ~7);
+        g_free(f.buf);
+    }
+}
+
+static void test_gso_csum(void)
+{
+    struct virtio_net_hdr hdr;
+    TestFrame f;
+    SentFrame *s;
+    size_t tcp_len;
+
+    /* The guest leaves the pseudo header sum in the checksum field */
+    build_frame(&f, false, IP_PROTO_TCP, 333);
+    tcp_len = f.size - f.l4off;
+    stw_be_p(f.buf + f.l4off + 16,
+             ref_fold(ref_pseudo_sum(f.buf, false, IP_PROTO_TCP, tcp_len)));
+    init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_NONE, 0);
+    g_assert_cmpint(send_frame(&f, &hdr), ==, f.size);
+
+    g_assert_cmpuint(sent->len, ==, 1);
+    s = g_ptr_array_index(sent, 0);
+    g_assert(s->last);
+    g_assert_cmpuint(s->data->len, ==, f.size);
+    g_assert(memcmp(s->data->data, f.buf, f.l4off + 16) == 0);
+    g_assert(memcmp(s->data->data + f.l4off + 18, f.buf + f.l4off + 18,
+                    f.size - f.l4off - 18) == 0);
+    g_assert_cmphex(ref_fold(ref_sum(s->data->data + f.l4off, tcp_len,
+                                     ref_pseudo_sum(f.buf, false, IP_PROTO_TCP,
+                                                    tcp_len))),
+                    ==, 0xffff);
+
+    /* Without NEEDS_CSUM the frame is passed on as is */
+    hdr.flags = 0;
+    send_frame(&f, &hdr);
+    g_assert_cmpuint(sent->len, ==, 1);
+    s = g_ptr_array_index(sent, 0);
+    g_assert_cmpuint(s->data->len, ==, f.size);
+    g_assert(memcmp(s->data->data, f.buf, f.size) == 0);
+    g_free(f.buf);
+}
+
+static void expect_drop(TestFrame *f, const struct virtio_net_hdr *hdr)
+{
+    g_assert_cmpint(send_frame(f, hdr), ==, f->size);
+    g_assert_cmpuint(sent->len, ==, 0);
+}
+
+static void test_gso_malformed(void)
+{
+    struct virtio_net_hdr hdr;
+    TestFrame f;
+    uint8_t *buf;
+
+    /* Frame ends within the TCP header */
+    build_frame(&f, false, IP_PROTO_TCP, 2000);
+    init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_TCPV4, 1000);
+    f.size = f.l4off + 10;
+    expect_drop(&f, &hdr);
+    g_free(f.buf);
+
+    /* Frame ends within the IPv6 header */
+    build_frame(&f, true, IP_PROTO_TCP, 2000);
+    init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_TCPV6, 1000);
+    f.size = L3OFF + 20;
+    expect_drop(&f, &hdr);
+    g_free(f.buf);
+
+    /* Frame ends within the IPv4 header */
+    build_frame(&f, false, IP_PROTO_UDP, 2000);
+    init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_UDP, 1000);
+    f.size = L3OFF + 12;
+    expect_drop(&f, &hdr);
+    g_free(f.buf);
+
+    /* TCP data offset shorter than the TCP header */
+    build_frame(&f, false, IP_PROTO_TCP, 2000);
+    init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_TCPV4, 1000);
+    stw_be_p(f.buf + f.l4off + 12, 4 << 12 | TH_ACK);
+    expect_drop(&f, &hdr);
+
+    /* TCP data offset past the end of the frame */
+    f.size = f.l5off + 10;
+    stw_be_p(f.buf + f.l4off + 12, 15 << 12 | TH_ACK);
+    expect_drop(&f, &hdr);
+    g_free(f.buf);
+
+    /* IPv4 header length shorter than the IPv4 header */
+    build_frame(&f, false, IP_PROTO_TCP, 2000);
+    init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_TCPV4, 1000);
+    f.buf[L3OFF] = 0x44;
+    expect_drop(&f, &hdr);
+    f.buf[L3OFF] = 0x45;
+
+    /* No segment size */
+    hdr.gso_size = 0;
+    expect_drop(&f, &hdr);
+
+    /* UDP fragmentation of a TCP frame and the other way round */
+    init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_UDP, 1000);
+    expect_drop(&f, &hdr);
+    g_free(f.buf);
+    build_frame(&f, false, IP_PROTO_UDP, 2000);
+    init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_TCPV4, 1000);
+    expect_drop(&f, &hdr);
+
+    /* Fragments smaller than the fragment unit */
+    init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_UDP, 7);
+    expect_drop(&f, &hdr);
+
+    /* Unknown GSO type */
+    init_hdr(&hdr, &f, 5, 1000);
+    expect_drop(&f, &hdr);
+
+    /* Checksum offset past the end of the frame */
+    init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_NONE, 0);
+    hdr.csum_start = f.size - 1;
+    expect_drop(&f, &hdr);
+    g_free(f.buf);
+
+    /* UDP datagram that does not fit into an IP packet */
+    build_frame(&f, false, IP_PROTO_UDP, UINT16_MAX - 27);
+    init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_UDP, 1480);
+    expect_drop(&f, &hdr);
+    g_free(f.buf);
+
+    /* IPv6 extension header before the UDP header */
+    build_frame(&f, true, IP_PROTO_UDP, 2000);
+    buf = g_malloc0(f.size + 8);
+    memcpy(buf, f.buf, f.l4off);
+    memcpy(buf + f.l4off + 8, f.buf + f.l4off, f.size - f.l4off);
+    buf[L3OFF + 6] = IP6_HOP_BY_HOP;
+    stw_be_p(buf + L3OFF + 4, lduw_be_p(f.buf + L3OFF + 4) + 8);
+    buf[f.l4off] = IP_PROTO_UDP;
+    g_free(f.buf);
+    f.buf = buf;
+    f.size += 8;
+    init_hdr(&hdr, &f, VIRTIO_NET_HDR_GSO_UDP, 1000);
+    expect_drop(&f, &hdr);
+    g_free(f.buf);
+}
+
+int main(int argc, char **argv)
+{
+    static const bool ip4 = false, ip6 = true;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+    sent = g_ptr_array_new_with_free_func(sent_frame_free);
+
+    g_test_add_func("/net/checksum/offsets", test_checksum_offsets);
+    g_test_add_func("/net/checksum/cont", test_checksum_cont);
+    g_test_add_func("/net/checksum/fold", test_checksum_fold);
+    g_test_add_func("/net/checksum/iov", test_checksum_iov);
+    g_test_add_data_func("/net/gso/tcp4", &ip4, test_gso_tcp);
+    g_test_add_data_func("/net/gso/tcp6", &ip6, test_gso_tcp);
+    g_test_add_data_func("/net/gso/udp4", &ip4, test_gso_udp);
+    g_test_add_data_func("/net/gso/udp6", &ip6, test_gso_udp);
+    g_test_add_func("/net/gso/csum", test_gso_csum);
+    g_test_add_func("/net/gso/malformed", test_gso_malformed);
+
+    ret = g_test_run();
+    g_ptr_array_unref(sent);
+    return ret;
+}
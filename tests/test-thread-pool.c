@@ -7,6 +7,7 @@
 #include "qemu/timer.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "iothread.h"
 
 static AioContext *ctx;
 static ThreadPool *pool;
@@ -136,6 +137,62 @@ static void test_submit_many(void)
     }
 }
 
+#define SUBMIT_IOTHREADS     8
+#define SUBMIT_IOTHREAD_REQS 1000
+
+typedef struct {
+    AioContext *ctx;
+    WorkerTestData data[SUBMIT_IOTHREAD_REQS];
+    int done;
+} IOThreadSubmitData;
+
+static void iothread_done_cb(void *opaque, int ret)
+{
+    IOThreadSubmitData *d = opaque;
+
+    g_assert_cmpint(ret, ==, 0);
+    qatomic_inc(&d->done);
+}
+
+static void iothread_submit_bh(void *opaque)
+{
+    IOThreadSubmitData *d = opaque;
+    ThreadPool *iothread_pool = aio_get_thread_pool(d->ctx);
+    int i;
+
+    for (i = 0; i < SUBMIT_IOTHREAD_REQS; i++) {
+        thread_pool_submit_aio(iothread_pool, worker_cb, &d->data[i],
+                               iothread_done_cb, d);
+    }
+}
+
+/* Many IOThreads submitting to their thread pools at the same time */
+static void test_submit_iothreads(void)
+{
+    IOThread *iothreads[SUBMIT_IOTHREADS];
+    IOThreadSubmitData *d = g_new0(IOThreadSubmitData, SUBMIT_IOTHREADS);
+    int i, j;
+
+    for (i = 0; i < SUBMIT_IOTHREADS; i++) {
+        iothreads[i] = iothread_new();
+        d[i].ctx = iothread_get_aio_context(iothreads[i]);
+    }
+    for (i = 0; i < SUBMIT_IOTHREADS; i++) {
+        aio_bh_schedule_oneshot(d[i].ctx, iothread_submit_bh, &d[i]);
+    }
+
+    for (i = 0; i < SUBMIT_IOTHREADS; i++) {
+        while (qatomic_read(&d[i].done) < SUBMIT_IOTHREAD_REQS) {
+            g_usleep(1000);
+        }
+        for (j = 0; j < SUBMIT_IOTHREAD_REQS; j++) {
+            g_assert_cmpint(d[i].data[j].n, ==, 1);
+        }
+        iothread_join(iothreads[i]);
+    }
+    g_free(d);
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -243,6 +300,7 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/submit-iothreads", test_submit_iothreads);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
@@ -20,8 +20,10 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/coroutine.h"
 #include "block/throttle-groups.h"
 #include "sysemu/block-backend.h"
+#include "qom/object.h"
 
 static AioContext     *ctx;
 static LeakyBucket    bkt;
@@ -738,6 +740,124 @@ static void test_groups(void)
     g_assert(tgm3->throttle_state == NULL);
 }
 
+typedef struct {
+    ThrottleGroupMember *tgm;
+    unsigned int bytes;
+    int id;
+} GroupRequest;
+
+static int group_order[4];
+static int group_done;
+
+static void coroutine_fn group_request_entry(void *opaque)
+{
+    GroupRequest *req = opaque;
+
+    throttle_group_co_io_limits_intercept(req->tgm, req->bytes, true);
+    group_order[group_done++] = req->id;
+}
+
+/* Submit writes from two members of a group while the group is throttled
+ * and record in group_order the order in which they get through: request
+ * 0 fills the bucket, request 1 of @tgm1 then arms the timer, and requests
+ * 2 of @tgm2 and 3 of @tgm1 wait behind it.  When request 1 is done the
+ * group picks either of them. */
+static void run_group_requests(ThrottleGroupMember *tgm1,
+                               ThrottleGroupMember *tgm2)
+{
+    GroupRequest reqs[] = {
+        { tgm1, 200000, 0 },
+        { tgm1, 100000, 1 },
+        { tgm2, 100000, 2 },
+        { tgm1, 100000, 3 },
+    };
+    ThrottleConfig cfg1;
+    int i;
+
+    /* 1 MB/s, so each request waits 100 ms for the previous one; this
+     * also empties the bucket */
+    throttle_config_init(&cfg1);
+    cfg1.buckets[THROTTLE_BPS_TOTAL].avg = 1000000;
+    throttle_group_config(tgm1, &cfg1);
+
+    group_done = 0;
+    for (i = 0; i < ARRAY_SIZE(reqs); i++) {
+        qemu_coroutine_enter(qemu_coroutine_create(group_request_entry,
+                                                   &reqs[i]));
+    }
+    g_assert_cmpint(group_done, ==, 1);
+
+    while (group_done < ARRAY_SIZE(reqs)) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(group_order[0], ==, 0);
+    g_assert_cmpint(group_order[1], ==, 1);
+}
+
+static void test_groups_latency_target(void)
+{
+    BlockBackend *blk1, *blk2;
+    ThrottleGroupMember *tgm1, *tgm2;
+    Object *tg;
+    int64_t now;
+    int i;
+
+    /* Create the group explicitly so that its properties can be set */
+    tg = object_new_with_props(TYPE_THROTTLE_GROUP, object_get_objects_root(),
+                               "lat", &error_abort, NULL);
+
+    blk1 = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    blk2 = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    tgm1 = &blk_get_public(blk1)->throttle_group_member;
+    tgm2 = &blk_get_public(blk2)->throttle_group_member;
+
+    throttle_group_register_tgm(tgm1, "lat", blk_get_aio_context(blk1));
+    throttle_group_register_tgm(tgm2, "lat", blk_get_aio_context(blk2));
+
+    /* Members of the same class take turns */
+    run_group_requests(tgm1, tgm2);
+    g_assert_cmpint(group_order[2], ==, 2);
+    g_assert_cmpint(group_order[3], ==, 3);
+
+    /* A foreground member goes before a background one */
+    throttle_group_set_priority(tgm2, THROTTLE_GROUP_PRIORITY_BACKGROUND);
+    run_group_requests(tgm1, tgm2);
+    g_assert_cmpint(group_order[2], ==, 3);
+    g_assert_cmpint(group_order[3], ==, 2);
+
+    /* Without a target no latency is measured */
+    g_assert(throttle_group_latency_start(tgm1) == 0);
+
+    object_property_set_int(tg, "latency-target", SCALE_MS, &error_abort);
+    g_assert_cmpint(object_property_get_int(tg, "latency-target",
+                                            &error_abort), ==, SCALE_MS);
+    g_assert(throttle_group_latency_start(tgm1) != 0);
+    /* Only foreground requests count */
+    g_assert(throttle_group_latency_start(tgm2) == 0);
+    g_assert(!object_property_get_bool(tg, "congested", &error_abort));
+
+    /* A window of slow foreground requests makes the group congested */
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    for (i = 0; i < 1024; i++) {
+        throttle_group_account_latency(tgm1, now - 10 * SCALE_MS);
+    }
+    g_assert(object_property_get_bool(tg, "congested", &error_abort));
+
+    /* A single slow request in a hundred is within the 99th percentile */
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    for (i = 0; i < 1024; i++) {
+        throttle_group_account_latency(tgm1, i % 128 ? now :
+                                             now - 10 * SCALE_MS);
+    }
+    g_assert(!object_property_get_bool(tg, "congested", &error_abort));
+
+    throttle_group_unregister_tgm(tgm1);
+    throttle_group_unregister_tgm(tgm2);
+    blk_unref(blk1);
+    blk_unref(blk2);
+    object_unparent(tg);
+}
+
 int main(int argc, char **argv)
 {
     qemu_init_main_loop(&error_fatal);
@@ -765,6 +885,8 @@ int main(int argc, char **argv)
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
     g_test_add_func("/throttle/groups",             test_groups);
+    g_test_add_func("/throttle/groups/latency_target",
+                    test_groups_latency_target);
     return g_test_run();
 }
 
@@ -385,8 +385,18 @@ void aio_dispatch(AioContext *ctx)
     timerlistgroup_run_timers(&ctx->tlg);
 }
 
+/* Weight of a new sample in AioHandlerPollState.avg_latency_ns is 1/8 */
+#define POLL_LATENCY_SHIFT 3
+
+static void poll_account_event(AioHandlerPollState *poll, int64_t latency_ns)
+{
+    poll->avg_latency_ns += (latency_ns - poll->avg_latency_ns) >>
+                            POLL_LATENCY_SHIFT;
+}
+
 static bool run_poll_handlers_once(AioContext *ctx,
                                    int64_t now,
+                                   int64_t elapsed,
                                    int64_t *timeout)
 {
     bool progress = false;
@@ -394,9 +404,20 @@ static bool run_poll_handlers_once(AioContext *ctx,
     AioHandler *tmp;
 
     QLIST_FOREACH_SAFE(node, &ctx->poll_aio_handlers, node_poll, tmp) {
+        /*
+         * Only keep polling handlers whose events usually arrive within the
+         * time polled so far.  The AioContext's own notifier is always
+         * polled so that aio_notify() ends polling immediately.
+         */
+        if (elapsed >= node->poll.ns && node->opaque != &ctx->notifier) {
+            continue;
+        }
+
         if (aio_node_check(ctx, node->is_external) &&
             node->io_poll(node->opaque)) {
             node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
+            node->poll.hits++;
+            poll_account_event(&node->poll, elapsed);
 
             /*
              * Polling was successful, exit try_poll_mode immediately
@@ -461,6 +482,7 @@ static bool remove_idle_poll_handlers(AioContext *ctx, int64_t now)
 /* run_poll_handlers:
  * @ctx: the AioContext
  * @max_ns: maximum time to poll for, in nanoseconds
+ * @idle_ns: set to the time polled if no handler made progress, else 0
  *
  * Polls for a given time.
  *
@@ -468,7 +490,8 @@ static bool remove_idle_poll_handlers(AioContext *ctx, int64_t now)
  *
  * Returns: true if progress was made, false otherwise
  */
-static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
+static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout,
+                              int64_t *idle_ns)
 {
     bool progress;
     int64_t start_time, elapsed_time;
@@ -488,13 +511,20 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
     RCU_READ_LOCK_GUARD();
 
     start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    elapsed_time = 0;
     do {
-        progress = run_poll_handlers_once(ctx, start_time, timeout);
+        progress = run_poll_handlers_once(ctx, start_time, elapsed_time,
+                                          timeout);
         elapsed_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_time;
         max_ns = qemu_soonest_timeout(*timeout, max_ns);
         assert(!(max_ns && progress));
     } while (elapsed_time < max_ns && !ctx->fdmon_ops->need_wait(ctx));
 
+    /* Not if aio_notify() ended polling early */
+    if (!progress && *timeout != 0) {
+        *idle_ns = elapsed_time;
+    }
+
     if (remove_idle_poll_handlers(ctx, start_time + elapsed_time)) {
         *timeout = 0;
         progress = true;
@@ -515,24 +545,35 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
  * @ctx: the AioContext
  * @timeout: timeout for blocking wait, computed by the caller and updated if
  *    polling succeeds.
+ * @idle_ns: set to the time polled if polling ran and no handler made
+ *    progress, else 0
  *
  * Note that the caller must have incremented ctx->list_lock.
  *
  * Returns: true if progress was made, false otherwise
  */
-static bool try_poll_mode(AioContext *ctx, int64_t *timeout)
+static bool try_poll_mode(AioContext *ctx, int64_t *timeout, int64_t *idle_ns)
 {
+    AioHandler *node;
     int64_t max_ns;
 
+    *idle_ns = 0;
     if (QLIST_EMPTY_RCU(&ctx->poll_aio_handlers)) {
         return false;
     }
 
+    /* Poll for as long as the handler that waits the longest */
+    ctx->poll_ns = 0;
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        ctx->poll_ns = MAX(ctx->poll_ns, node->poll.ns);
+    }
+    ctx->poll_ns = MIN(ctx->poll_ns, ctx->poll_max_ns);
+
     max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
     if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
         poll_set_started(ctx, true);
 
-        if (run_poll_handlers(ctx, max_ns, timeout)) {
+        if (run_poll_handlers(ctx, max_ns, timeout, idle_ns)) {
             return true;
         }
     }
@@ -545,6 +586,88 @@ static bool try_poll_mode(AioContext *ctx, int64_t *timeout)
     return false;
 }
 
+static void shrink_polling_time(AioContext *ctx, AioHandler *node)
+{
+    int64_t old = node->poll.ns;
+
+    if (ctx->poll_shrink) {
+        node->poll.ns /= ctx->poll_shrink;
+    } else {
+        node->poll.ns = 0;
+    }
+
+    trace_poll_shrink(ctx, node, old, node->poll.ns);
+}
+
+/* shrink_idle_polling_time:
+ * @ctx: the AioContext
+ * @idle_ns: time that polling ran without any handler making progress
+ *
+ * A handler whose event arrives after its polling time grows it again in
+ * adjust_polling_time(), but one whose event does not arrive at all would
+ * keep its polling time.  Shrink it for every poll that covered its whole
+ * polling time in vain.
+ */
+static void shrink_idle_polling_time(AioContext *ctx, int64_t idle_ns)
+{
+    AioHandler *node;
+
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        if (node->poll.ns && node->poll.ns <= idle_ns &&
+            node->opaque != &ctx->notifier &&
+            /* Its event arrived after all */
+            !QLIST_IS_INSERTED(node, node_ready)) {
+            shrink_polling_time(ctx, node);
+        }
+    }
+}
+
+/* adjust_polling_time:
+ * @ctx: the AioContext
+ * @node: a handler whose event was reported by ->wait()
+ * @block_ns: time from the start of aio_poll() until the event was seen
+ *
+ * Each handler has its own polling time, so that a busy handler next to an
+ * idle one does not make the whole AioContext either poll in vain or miss
+ * the window in which the busy handler's events arrive.
+ */
+static void adjust_polling_time(AioContext *ctx, AioHandler *node,
+                                int64_t block_ns)
+{
+    AioHandlerPollState *poll = &node->poll;
+
+    poll->misses++;
+    poll_account_event(poll, block_ns);
+
+    if (block_ns <= poll->ns) {
+        /* This is the sweet spot, no adjustment needed */
+    } else if (block_ns > ctx->poll_max_ns) {
+        /* We'd have to poll for too long, poll less */
+        shrink_polling_time(ctx, node);
+    } else if (poll->ns < ctx->poll_max_ns &&
+               block_ns < ctx->poll_max_ns) {
+        /* There is room to grow, poll longer */
+        int64_t old = poll->ns;
+        int64_t grow = ctx->poll_grow;
+
+        if (grow == 0) {
+            grow = 2;
+        }
+
+        if (poll->ns) {
+            poll->ns *= grow;
+        } else {
+            poll->ns = 4000; /* start polling at 4 microseconds */
+        }
+
+        if (poll->ns > ctx->poll_max_ns) {
+            poll->ns = ctx->poll_max_ns;
+        }
+
+        trace_poll_grow(ctx, node, old, poll->ns);
+    }
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
@@ -553,6 +676,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
     bool use_notify_me;
     int64_t timeout;
     int64_t start = 0;
+    int64_t idle_ns;
 
     /*
      * There cannot be two concurrent aio_poll calls for the same AioContext (or
@@ -568,7 +692,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
     }
 
     timeout = blocking ? aio_compute_timeout(ctx) : 0;
-    progress = try_poll_mode(ctx, &timeout);
+    progress = try_poll_mode(ctx, &timeout, &idle_ns);
     assert(!(timeout && progress));
 
     /*
@@ -609,51 +733,29 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     aio_notify_accept(ctx);
 
-    /* Adjust polling time */
-    if (ctx->poll_max_ns) {
+    /* Adjust polling time of the handlers that polling did not catch */
+    if (ctx->poll_max_ns && ret > 0) {
         int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+        AioHandler *node;
 
-        if (block_ns <= ctx->poll_ns) {
-            /* This is the sweet spot, no adjustment needed */
-        } else if (block_ns > ctx->poll_max_ns) {
-            /* We'd have to poll for too long, poll less */
-            int64_t old = ctx->poll_ns;
-
-            if (ctx->poll_shrink) {
-                ctx->poll_ns /= ctx->poll_shrink;
-            } else {
-                ctx->poll_ns = 0;
-            }
-
-            trace_poll_shrink(ctx, old, ctx->poll_ns);
-        } else if (ctx->poll_ns < ctx->poll_max_ns &&
-                   block_ns < ctx->poll_max_ns) {
-            /* There is room to grow, poll longer */
-            int64_t old = ctx->poll_ns;
-            int64_t grow = ctx->poll_grow;
-
-            if (grow == 0) {
-                grow = 2;
-            }
-
-            if (ctx->poll_ns) {
-                ctx->poll_ns *= grow;
-            } else {
-                ctx->poll_ns = 4000; /* start polling at 4 microseconds */
-            }
-
-            if (ctx->poll_ns > ctx->poll_max_ns) {
-                ctx->poll_ns = ctx->poll_max_ns;
+        QLIST_FOREACH(node, &ready_list, node_ready) {
+            if (node->io_poll) {
+                adjust_polling_time(ctx, node, block_ns);
             }
-
-            trace_poll_grow(ctx, old, ctx->poll_ns);
         }
     }
+    if (idle_ns) {
+        shrink_idle_polling_time(ctx, idle_ns);
+    }
 
     progress |= aio_bh_poll(ctx);
 
     if (ret > 0) {
         progress |= aio_dispatch_ready_handlers(ctx, &ready_list);
+
+        if (ctx->fdmon_ops->dispatch) {
+            progress |= ctx->fdmon_ops->dispatch(ctx);
+        }
     }
 
     aio_free_deleted_handlers(ctx);
@@ -697,6 +799,35 @@ void aio_context_use_g_source(AioContext *ctx)
     aio_free_deleted_handlers(ctx);
 }
 
+/* aio_context_foreach_poll_stats:
+ * Must be called from @ctx's home thread.
+ */
+void aio_context_foreach_poll_stats(AioContext *ctx, AioPollStatsFn *fn,
+                                    void *opaque)
+{
+    AioHandler *node;
+
+    qemu_lockcnt_inc(&ctx->list_lock);
+    QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+        AioPollStats stats;
+
+        if (!node->io_poll || QLIST_IS_INSERTED(node, node_deleted)) {
+            continue;
+        }
+
+        stats = (AioPollStats) {
+            .fd             = node->pfd.fd,
+            .polling        = QLIST_IS_INSERTED(node, node_poll),
+            .poll_ns        = MIN(node->poll.ns, ctx->poll_max_ns),
+            .hits           = node->poll.hits,
+            .misses         = node->poll.misses,
+            .avg_latency_ns = node->poll.avg_latency_ns,
+        };
+        fn(opaque, &stats);
+    }
+    qemu_lockcnt_dec(&ctx->list_lock);
+}
+
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink, Error **errp)
 {
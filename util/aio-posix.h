@@ -19,6 +19,14 @@
 
 #include "block/aio.h"
 
+/* Userspace polling state of a handler, see adjust_polling_time() */
+typedef struct {
+    int64_t ns;             /* polling time for this handler in nanoseconds */
+    uint64_t hits;          /* events seen by ->io_poll() */
+    uint64_t misses;        /* events that had to be reported by ->wait() */
+    int64_t avg_latency_ns; /* moving average of the time until an event */
+} AioHandlerPollState;
+
 struct AioHandler {
     GPollFD pfd;
     IOHandler *io_read;
@@ -33,9 +41,11 @@ struct AioHandler {
     QLIST_ENTRY(AioHandler) node_poll;
 #ifdef CONFIG_LINUX_IO_URING
     QSLIST_ENTRY(AioHandler) node_submitted;
+    QLIST_ENTRY(AioHandler) node_deferred;
     unsigned flags; /* see fdmon-io_uring.c */
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
+    AioHandlerPollState poll;
     bool is_external;
 };
 
@@ -427,6 +427,11 @@ void aio_context_use_g_source(AioContext *ctx)
 {
 }
 
+void aio_context_foreach_poll_stats(AioContext *ctx, AioPollStatsFn *fn,
+                                    void *opaque)
+{
+}
+
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink, Error **errp)
 {
@@ -375,6 +375,21 @@ ThreadPool *aio_get_thread_pool(AioContext *ctx)
     return ctx->thread_pool;
 }
 
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t max,
+                                        Error **errp)
+{
+    if (max < 1 || max > THREAD_POOL_MAX_THREADS_LIMIT) {
+        error_setg(errp, "thread pool size must be in range [1, %d]",
+                   THREAD_POOL_MAX_THREADS_LIMIT);
+        return;
+    }
+
+    ctx->thread_pool_max = max;
+    if (ctx->thread_pool) {
+        thread_pool_update_params(ctx->thread_pool, ctx);
+    }
+}
+
 #ifdef CONFIG_LINUX_AIO
 LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp)
 {
@@ -529,6 +544,7 @@ AioContext *aio_context_new(Error **errp)
 #endif
 
     ctx->thread_pool = NULL;
+    ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
     qemu_rec_mutex_init(&ctx->lock);
     timerlistgroup_init(&ctx->tlg, aio_timerlist_notify, ctx);
 
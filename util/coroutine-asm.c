@@ -0,0 +1,308 @@
+/*
+ * Host assembly coroutine backend
+ *
+ * Copyright (C) 2006  Anthony Liguori <anthony@codemonkey.ws>
+ * Copyright (C) 2011  Kevin Wolf <kwolf@redhat.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The ucontext backend switches with sigsetjmp()/siglongjmp(), which save
+ * and restore more state than a coroutine switch needs and go through
+ * libc's pointer mangling and shadow stack checks.  This backend instead
+ * uses a small assembly routine that pushes the callee-saved registers of
+ * the host ABI on the current stack, swaps stack pointers and pops them
+ * from the new stack.  All other registers are already dead across the
+ * call as far as the compiler is concerned.  The control bits of the FP
+ * environment (MXCSR and the x87 control word, or FPCR) are callee-saved
+ * as well, so each coroutine keeps its own rounding mode and exception
+ * masks.  They are only written when they differ between the two
+ * coroutines, because writing them is much slower than the rest of the
+ * switch on some CPUs.
+ *
+ * The routine returns with an indirect jump rather than a return
+ * instruction.  The return address almost never matches the call that the
+ * CPU's return stack predicted, so "ret" would be mispredicted on every
+ * switch, while the indirect branch predictor learns the pattern quickly.
+ *
+ * A new coroutine's stack is prepared to look as if it had been switched
+ * away from right before calling coroutine_trampoline(), so the first
+ * switch to it "returns" there.
+ *
+ * Neither CET shadow stacks and indirect branch tracking nor aarch64
+ * pointer authentication and branch target identification are supported:
+ * the switch returns to an address that is not a landing pad and does not
+ * switch shadow stacks.  configure rejects builds that enable them.
+ *
+ * Only ELF hosts on x86_64 and aarch64 are supported.  Signal masks are not
+ * saved, just like with the ucontext backend.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/coroutine_int.h"
+
+#if defined(__CET__) || defined(__ARM_FEATURE_BTI_DEFAULT) || \
+    defined(__ARM_FEATURE_PAC_DEFAULT)
+#error "The asm coroutine backend does not support control-flow protection"
+#endif
+
+#ifdef CONFIG_VALGRIND_H
+#include <valgrind/valgrind.h>
+#endif
+
+typedef struct {
+    Coroutine base;
+    void *stack;
+    size_t stack_size;
+
+    /* Saved stack pointer while the coroutine is not running */
+    void *sp;
+
+#ifdef CONFIG_VALGRIND_H
+    unsigned int valgrind_stack_id;
+#endif
+} CoroutineAsm;
+
+/**
+ * Per-thread coroutine bookkeeping
+ */
+static __thread CoroutineAsm leader;
+static __thread Coroutine *current;
+
+/*
+ * Save the callee-saved registers on the current stack, store the stack
+ * pointer in *@from_sp, load @to_sp and restore the registers saved there.
+ * Returns @action in the context that is switched to.
+ */
+int qemu_co_switch_asm(void **from_sp, void *to_sp, int action);
+
+#if defined(__x86_64__)
+
+/* MXCSR and the x87 control word, rbp, rbx, r12-r15 and the return address */
+#define CO_ASM_FRAME_SLOTS 8
+#define CO_ASM_FRAME_FPCTL 0
+#define CO_ASM_FRAME_RET   7
+
+/* The status flags in bits 0-5 are not callee-saved */
+#define CO_ASM_MXCSR_CONTROL 0xffc0
+
+asm(".text\n"
+    ".globl qemu_co_switch_asm\n"
+    ".hidden qemu_co_switch_asm\n"
+    ".type qemu_co_switch_asm, @function\n"
+    "qemu_co_switch_asm:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    pushq $0\n"
+    "    stmxcsr (%rsp)\n"
+    "    andl $" stringify(CO_ASM_MXCSR_CONTROL) ", (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq (%rsp), %r8\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    cmpq (%rsp), %r8\n"
+    "    je 1f\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "1:  addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    movl %edx, %eax\n"
+    "    popq %rcx\n"
+    "    jmpq *%rcx\n"
+    ".size qemu_co_switch_asm, .-qemu_co_switch_asm\n");
+
+/* The FP control slot as laid out by qemu_co_switch_asm() */
+static uintptr_t co_asm_fp_control(void)
+{
+    uint32_t mxcsr;
+    uint16_t fpucw;
+
+    asm("stmxcsr %0" : "=m"(mxcsr));
+    asm("fnstcw %0" : "=m"(fpucw));
+    return (mxcsr & CO_ASM_MXCSR_CONTROL) | (uintptr_t)fpucw << 32;
+}
+
+#elif defined(__aarch64__)
+
+/* x19-x28, x29 (fp), x30 (lr), d8-d15 and FPCR, padded to 16 bytes */
+#define CO_ASM_FRAME_SLOTS 22
+#define CO_ASM_FRAME_RET   11
+#define CO_ASM_FRAME_FPCTL 20
+
+asm(".text\n"
+    ".globl qemu_co_switch_asm\n"
+    ".hidden qemu_co_switch_asm\n"
+    ".type qemu_co_switch_asm, %function\n"
+    "qemu_co_switch_asm:\n"
+    "    sub sp, sp, #176\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mrs x4, fpcr\n"
+    "    str x4, [sp, #160]\n"
+    "    mov x3, sp\n"
+    "    str x3, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    ldr x5, [sp, #160]\n"
+    "    cmp x4, x5\n"
+    "    b.eq 1f\n"
+    "    msr fpcr, x5\n"
+    "1:  add sp, sp, #176\n"
+    "    mov w0, w2\n"
+    "    br x30\n"
+    ".size qemu_co_switch_asm, .-qemu_co_switch_asm\n");
+
+static uintptr_t co_asm_fp_control(void)
+{
+    uint64_t fpcr;
+
+    asm("mrs %0, fpcr" : "=r"(fpcr));
+    return fpcr;
+}
+
+#else
+#error "The asm coroutine backend does not support this host"
+#endif
+
+/*
+ * Runs on the coroutine stack.  Must not return: the frame that
+ * qemu_coroutine_new() sets up has no caller to return to.
+ */
+static void QEMU_NORETURN coroutine_trampoline(void)
+{
+    Coroutine *co = current;
+
+    while (true) {
+        co->entry(co->entry_arg);
+        qemu_coroutine_switch(co, co->caller, COROUTINE_TERMINATE);
+    }
+}
+
+Coroutine *qemu_coroutine_new(void)
+{
+    CoroutineAsm *co;
+    uintptr_t *frame;
+
+    co = g_malloc0(sizeof(*co));
+    co->stack_size = COROUTINE_STACK_SIZE;
+    co->stack = qemu_alloc_stack(&co->stack_size);
+
+#ifdef CONFIG_VALGRIND_H
+    co->valgrind_stack_id =
+        VALGRIND_STACK_REGISTER(co->stack, co->stack + co->stack_size);
+#endif
+
+    /*
+     * The top of the stack is page aligned.  On x86_64 leave one slot as
+     * the (null) return address of coroutine_trampoline() so that it is
+     * entered with the stack alignment of a normal function call.  Saved
+     * registers, including the frame pointer, start out as zero and the FP
+     * environment is inherited from the creator.
+     */
+    frame = co->stack + co->stack_size;
+#if defined(__x86_64__)
+    *--frame = 0;
+#endif
+    frame -= CO_ASM_FRAME_SLOTS;
+    memset(frame, 0, CO_ASM_FRAME_SLOTS * sizeof(*frame));
+    frame[CO_ASM_FRAME_FPCTL] = co_asm_fp_control();
+    frame[CO_ASM_FRAME_RET] = (uintptr_t)coroutine_trampoline;
+    co->sp = frame;
+
+    return &co->base;
+}
+
+#ifdef CONFIG_VALGRIND_H
+/* Work around an unused variable in the valgrind.h macro... */
+#if !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#endif
+static inline void valgrind_stack_deregister(CoroutineAsm *co)
+{
+    VALGRIND_STACK_DEREGISTER(co->valgrind_stack_id);
+}
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+void qemu_coroutine_delete(Coroutine *co_)
+{
+    CoroutineAsm *co = DO_UPCAST(CoroutineAsm, base, co_);
+
+#ifdef CONFIG_VALGRIND_H
+    valgrind_stack_deregister(co);
+#endif
+
+    qemu_free_stack(co->stack, co->stack_size);
+    g_free(co);
+}
+
+/*
+ * This function is marked noinline for the same reason as in the ucontext
+ * backend: the address of the TLS variable "current" must not be cached
+ * across a switch, because the coroutine may be resumed in another thread.
+ */
+CoroutineAction __attribute__((noinline))
+qemu_coroutine_switch(Coroutine *from_, Coroutine *to_,
+                      CoroutineAction action)
+{
+    CoroutineAsm *from = DO_UPCAST(CoroutineAsm, base, from_);
+    CoroutineAsm *to = DO_UPCAST(CoroutineAsm, base, to_);
+
+    current = to_;
+
+    return qemu_co_switch_asm(&from->sp, to->sp, action);
+}
+
+Coroutine *qemu_coroutine_self(void)
+{
+    if (!current) {
+        current = &leader.base;
+    }
+    return current;
+}
+
+bool qemu_in_coroutine(void)
+{
+    return current && current->caller;
+}
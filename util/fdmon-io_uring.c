@@ -19,9 +19,15 @@
  * 4. Nanosecond timeouts are supported so it requires fewer syscalls than
  *    epoll(7).
  *
- * This code only monitors file descriptors and does not do asynchronous disk
- * I/O.  Implementing disk I/O efficiently has other requirements and should
- * use a separate io_uring so it does not make sense to unify the code.
+ * Other io_uring requests can be placed on the same ring with aio_add_sqe().
+ * block/io_uring.c does this for disk I/O, so that request submission,
+ * request completion and file descriptor monitoring all share a single
+ * io_uring_enter(2) call per event loop iteration instead of each needing
+ * their own syscalls.  The user_data field of these requests points to a
+ * CqeHandler with FDMON_IO_URING_CQE_HANDLER_TAG set, to tell them apart from
+ * AioHandlers.  At most FDMON_IO_URING_MAX_CQE_HANDLERS of them can be in
+ * flight so that the cq ring cannot overflow; aio_add_sqe() fails beyond
+ * that and the caller has to fall back to another way of submitting I/O.
  *
  * File descriptor monitoring is implemented using the following operations:
  *
@@ -37,10 +43,17 @@
  * io_uring calls the submission queue the "sq ring" and the completion queue
  * the "cq ring".  Ring entries are called "sqe" and "cqe", respectively.
  *
- * The code is structured so that sq/cq rings are only modified within
- * fdmon_io_uring_wait().  Changes to AioHandlers are made by enqueuing them on
- * ctx->submit_list so that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD
- * and/or IORING_OP_POLL_REMOVE sqes for them.
+ * The code is structured so that sq/cq rings are only modified in the
+ * AioContext's home thread, by fdmon_io_uring_wait() and aio_add_sqe().
+ * Changes to AioHandlers are made by enqueuing them on ctx->submit_list so
+ * that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD and/or
+ * IORING_OP_POLL_REMOVE sqes for them.
+ *
+ * While external clients are disabled, the IORING_OP_POLL_ADD of external
+ * AioHandlers is not re-armed after it completes.  The handlers are kept on
+ * ctx->deferred_aio_handlers instead and re-armed when external clients are
+ * enabled again.  This way the event loop keeps using io_uring, and
+ * aio_add_sqe() requests keep completing, in drained sections.
  */
 
 #include "qemu/osdep.h"
@@ -49,7 +62,7 @@
 #include "aio-posix.h"
 
 enum {
-    FDMON_IO_URING_ENTRIES  = 128, /* sq/cq ring size */
+    FDMON_IO_URING_ENTRIES  = 128, /* sq ring size, the cq ring is twice that */
 
     /* AioHandler::flags */
     FDMON_IO_URING_PENDING  = (1 << 0),
@@ -57,6 +70,21 @@ enum {
     FDMON_IO_URING_REMOVE   = (1 << 2),
 };
 
+/*
+ * Limit on the aio_add_sqe() requests in flight.  Each of them takes a cq
+ * ring entry when it completes, so leave the other half of the cq ring to
+ * IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE and IORING_OP_TIMEOUT.
+ */
+#define FDMON_IO_URING_MAX_CQE_HANDLERS FDMON_IO_URING_ENTRIES
+
+/*
+ * Set in the user_data of aio_add_sqe() requests to tell them apart from
+ * AioHandlers.  Both are pointers to structs, so bit 0 is free.
+ */
+#define FDMON_IO_URING_CQE_HANDLER_TAG ((uintptr_t)1)
+
+static int process_cq_ring(AioContext *ctx, AioHandlerList *ready_list);
+
 static inline int poll_events_from_pfd(int pfd_events)
 {
     return (pfd_events & G_IO_IN ? POLLIN : 0) |
@@ -74,8 +102,8 @@ static inline int pfd_events_from_poll(int poll_events)
 }
 
 /*
- * Returns an sqe for submitting a request.  Only be called within
- * fdmon_io_uring_wait().
+ * Returns an sqe for submitting a request.  Only be called from the
+ * AioContext's home thread.
  */
 static struct io_uring_sqe *get_sqe(AioContext *ctx)
 {
@@ -87,10 +115,17 @@ static struct io_uring_sqe *get_sqe(AioContext *ctx)
         return sqe;
     }
 
-    /* No free sqes left, submit pending sqes first */
+    /*
+     * No free sqes left, submit pending sqes first.  The kernel refuses
+     * with -EBUSY while completions that did not fit in the cq ring are
+     * backed up, so make room for them.
+     */
     do {
         ret = io_uring_submit(ring);
-    } while (ret == -EINTR);
+        if (ret == -EBUSY) {
+            process_cq_ring(ctx, NULL);
+        }
+    } while (ret == -EINTR || ret == -EBUSY);
 
     assert(ret > 1);
     sqe = io_uring_get_sqe(ring);
@@ -210,17 +245,44 @@ static void fill_sq_ring(AioContext *ctx)
             add_poll_add_sqe(ctx, node);
         }
         if (flags & FDMON_IO_URING_REMOVE) {
-            add_poll_remove_sqe(ctx, node);
+            if (QLIST_IS_INSERTED(node, node_deferred)) {
+                /* Not armed, so there is no IORING_OP_POLL_ADD to wait for */
+                QLIST_SAFE_REMOVE(node, node_deferred);
+                qatomic_and(&node->flags, ~FDMON_IO_URING_REMOVE);
+                QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node,
+                                      node_deleted);
+            } else {
+                add_poll_remove_sqe(ctx, node);
+            }
         }
     }
 }
 
-/* Returns true if a handler became ready */
+/* Re-arm AioHandlers that were skipped while external clients were disabled */
+static void rearm_deferred_handlers(AioContext *ctx)
+{
+    AioHandler *node;
+
+    while ((node = QLIST_FIRST(&ctx->deferred_aio_handlers))) {
+        QLIST_SAFE_REMOVE(node, node_deferred);
+        add_poll_add_sqe(ctx, node);
+    }
+}
+
+/*
+ * Returns true if a handler became ready.
+ *
+ * @ready_list is NULL when get_sqe() only needs to empty the cq ring.  The
+ * events of AioHandlers are then dropped and their fds are polled again by
+ * the next fill_sq_ring(), which reports them again because poll is
+ * level-triggered.
+ */
 static bool process_cqe(AioContext *ctx,
                         AioHandlerList *ready_list,
                         struct io_uring_cqe *cqe)
 {
     AioHandler *node = io_uring_cqe_get_data(cqe);
+    uintptr_t data = (uintptr_t)node;
     unsigned flags;
 
     /* poll_timeout and poll_remove have a zero user_data field */
@@ -228,6 +290,16 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    if (data & FDMON_IO_URING_CQE_HANDLER_TAG) {
+        CqeHandler *cqe_handler =
+            (CqeHandler *)(data & ~FDMON_IO_URING_CQE_HANDLER_TAG);
+
+        cqe_handler->cqe_res = cqe->res;
+        cqe_handler->cqe_flags = cqe->flags;
+        QSIMPLEQ_INSERT_TAIL(&ctx->cqe_handler_ready_list, cqe_handler, next);
+        return true;
+    }
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -239,6 +311,20 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    /*
+     * aio_dispatch_handler() would ignore the event anyway, so don't re-arm
+     * the fd and spin on it until external clients are enabled again.
+     */
+    if (node->is_external && qatomic_read(&ctx->external_disable_cnt)) {
+        QLIST_INSERT_HEAD(&ctx->deferred_aio_handlers, node, node_deferred);
+        return false;
+    }
+
+    if (!ready_list) {
+        enqueue(&ctx->submit_list, node, FDMON_IO_URING_ADD);
+        return false;
+    }
+
     aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
 
     /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
@@ -272,9 +358,9 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
     unsigned wait_nr = 1; /* block until at least one cqe is ready */
     int ret;
 
-    /* Fall back while external clients are disabled */
-    if (qatomic_read(&ctx->external_disable_cnt)) {
-        return fdmon_poll_ops.wait(ctx, ready_list, timeout);
+    /* get_sqe() may have moved completions to the list already */
+    if (!QSIMPLEQ_EMPTY(&ctx->cqe_handler_ready_list)) {
+        timeout = 0;
     }
 
     if (timeout == 0) {
@@ -283,21 +369,35 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
         add_timeout_sqe(ctx, timeout);
     }
 
+    /* aio_enable_external() calls aio_notify() so we get here in time */
+    if (!qatomic_read(&ctx->external_disable_cnt)) {
+        rearm_deferred_handlers(ctx);
+    }
+
     fill_sq_ring(ctx);
 
     do {
         ret = io_uring_submit_and_wait(&ctx->fdmon_io_uring, wait_nr);
     } while (ret == -EINTR);
 
-    assert(ret >= 0);
+    /*
+     * -EBUSY means that completions are backed up and that the sqes were
+     * not submitted.  Process the cq ring, the next call submits them.
+     */
+    assert(ret >= 0 || ret == -EBUSY);
 
-    return process_cq_ring(ctx, ready_list);
+    ret = process_cq_ring(ctx, ready_list);
+    if (!QSIMPLEQ_EMPTY(&ctx->cqe_handler_ready_list)) {
+        ret = MAX(ret, 1);
+    }
+    return ret;
 }
 
 static bool fdmon_io_uring_need_wait(AioContext *ctx)
 {
     /* Have io_uring events completed? */
-    if (io_uring_cq_ready(&ctx->fdmon_io_uring)) {
+    if (io_uring_cq_ready(&ctx->fdmon_io_uring) ||
+        !QSIMPLEQ_EMPTY(&ctx->cqe_handler_ready_list)) {
         return true;
     }
 
@@ -311,16 +411,61 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
         return true;
     }
 
-    /* Are we falling back to fdmon-poll? */
-    return qatomic_read(&ctx->external_disable_cnt);
+    /* Do deferred AioHandlers need to be re-armed? */
+    return !QLIST_EMPTY(&ctx->deferred_aio_handlers) &&
+           !qatomic_read(&ctx->external_disable_cnt);
+}
+
+static bool fdmon_io_uring_dispatch(AioContext *ctx)
+{
+    CqeHandler *cqe_handler;
+    bool progress = false;
+
+    /* Callbacks may call aio_poll() and consume other list entries */
+    while ((cqe_handler = QSIMPLEQ_FIRST(&ctx->cqe_handler_ready_list))) {
+        QSIMPLEQ_REMOVE_HEAD(&ctx->cqe_handler_ready_list, next);
+
+        /* Only now, so that cb can always resubmit the request */
+        ctx->cqe_handlers_in_flight--;
+        cqe_handler->cb(cqe_handler);
+        progress = true;
+    }
+
+    return progress;
 }
 
 static const FDMonOps fdmon_io_uring_ops = {
     .update = fdmon_io_uring_update,
     .wait = fdmon_io_uring_wait,
     .need_wait = fdmon_io_uring_need_wait,
+    .dispatch = fdmon_io_uring_dispatch,
 };
 
+bool aio_has_io_uring(AioContext *ctx)
+{
+    return ctx->fdmon_ops == &fdmon_io_uring_ops;
+}
+
+bool aio_add_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                 void *opaque, CqeHandler *cqe_handler)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    struct io_uring_sqe *sqe;
+
+    assert(aio_has_io_uring(ctx));
+
+    if (ctx->cqe_handlers_in_flight >= FDMON_IO_URING_MAX_CQE_HANDLERS) {
+        return false;
+    }
+    ctx->cqe_handlers_in_flight++;
+
+    sqe = get_sqe(ctx);
+    prep_sqe(sqe, opaque);
+    io_uring_sqe_set_data(sqe, (void *)((uintptr_t)cqe_handler |
+                                        FDMON_IO_URING_CQE_HANDLER_TAG));
+    return true;
+}
+
 bool fdmon_io_uring_setup(AioContext *ctx)
 {
     int ret;
@@ -331,6 +476,9 @@ bool fdmon_io_uring_setup(AioContext *ctx)
     }
 
     QSLIST_INIT(&ctx->submit_list);
+    QLIST_INIT(&ctx->deferred_aio_handlers);
+    QSIMPLEQ_INIT(&ctx->cqe_handler_ready_list);
+    ctx->cqe_handlers_in_flight = 0;
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
 }
@@ -356,6 +504,13 @@ void fdmon_io_uring_destroy(AioContext *ctx)
             QSLIST_REMOVE_HEAD_RCU(&ctx->submit_list, node_submitted);
         }
 
+        while ((node = QLIST_FIRST(&ctx->deferred_aio_handlers))) {
+            QLIST_SAFE_REMOVE(node, node_deferred);
+        }
+
+        /* aio_add_sqe() requests must not be in flight anymore */
+        assert(ctx->cqe_handlers_in_flight == 0);
+
         ctx->fdmon_ops = &fdmon_poll_ops;
     }
 }
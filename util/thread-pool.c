@@ -25,6 +25,7 @@
 static void do_spawn_thread(ThreadPool *pool);
 
 typedef struct ThreadPoolElement ThreadPoolElement;
+typedef struct ThreadPoolWorker ThreadPoolWorker;
 
 enum ThreadState {
     THREAD_QUEUED,
@@ -38,68 +39,208 @@ struct ThreadPoolElement {
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
+    /* Moving state out of THREAD_QUEUED is protected by worker->lock.
+     * After that, only the worker thread can write to it.  Reads and writes
      * of state and ret are ordered with memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Queue that the request was submitted to */
+    ThreadPoolWorker *worker;
+
+    /* Access to this list is protected by worker->lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
+    /* pool->completed, or pool->completion_list once taken by the BH */
+    QSLIST_ENTRY(ThreadPoolElement) completed;
+
     /* Access to this list is protected by the global mutex.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
 
+/*
+ * Requests are spread over one queue per worker thread instead of a single
+ * list, so that the submitting thread and the workers do not all contend
+ * on one lock.  Workers serve their own queue first and steal from the
+ * other queues when it is empty.
+ *
+ * Queues outlive the threads that serve them: a thread that starts takes
+ * over an unused queue, and requests left on the queue of a thread that
+ * exits are stolen by the others.
+ */
+struct ThreadPoolWorker {
+    QemuMutex lock;
+    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+
+    /* The following variables are protected by pool->lock.  */
+    unsigned int index;
+    bool has_thread;
+};
+
 struct ThreadPool {
     AioContext *ctx;
     QEMUBH *completion_bh;
     QemuMutex lock;
     QemuCond worker_stopped;
     QemuSemaphore sem;
-    int max_threads;
     QEMUBH *new_thread_bh;
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QSLIST_HEAD(, ThreadPoolElement) completion_list;
+    unsigned int next_worker;
+
+    /* Finished requests, added by worker threads without taking a lock */
+    QSLIST_HEAD(, ThreadPoolElement) completed;
+
+    /*
+     * workers[0..nr_workers-1] are valid and not freed before the pool.
+     * New entries are added with lock taken.
+     */
+    ThreadPoolWorker *workers[THREAD_POOL_MAX_THREADS_LIMIT];
+    unsigned int nr_workers;
+
+    /*
+     * The following variables are shared by the submitting AioContext and
+     * the worker threads, and accessed with atomic operations: the number
+     * of requests on the queues, i.e. the value of sem, and the number of
+     * threads waiting on sem.
+     */
+    unsigned int queued;
+    int idle_threads;
 
     /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    int max_threads;
     int cur_threads;
-    int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     bool stopping;
 };
 
+/* Runs with pool->lock taken.  */
+static ThreadPoolWorker *thread_pool_add_worker(ThreadPool *pool)
+{
+    ThreadPoolWorker *worker = g_new0(ThreadPoolWorker, 1);
+    unsigned int nr = pool->nr_workers;
+
+    assert(nr < THREAD_POOL_MAX_THREADS_LIMIT);
+    qemu_mutex_init(&worker->lock);
+    QTAILQ_INIT(&worker->request_list);
+    worker->index = nr;
+
+    pool->workers[nr] = worker;
+    qatomic_store_release(&pool->nr_workers, nr + 1);
+    return worker;
+}
+
+/* Pick a queue for a new thread to serve.  Runs with pool->lock taken.  */
+static ThreadPoolWorker *thread_pool_attach_worker(ThreadPool *pool)
+{
+    ThreadPoolWorker *worker = NULL;
+    unsigned int i;
+
+    for (i = 0; i < pool->nr_workers; i++) {
+        if (!pool->workers[i]->has_thread) {
+            worker = pool->workers[i];
+            break;
+        }
+    }
+    if (!worker) {
+        worker = thread_pool_add_worker(pool);
+    }
+
+    worker->has_thread = true;
+    return worker;
+}
+
+/*
+ * Take a request off @worker's queue, or steal one from another queue.
+ * The caller must have decremented pool->sem, which guarantees that a
+ * request is available.
+ */
+static ThreadPoolElement *thread_pool_take_request(ThreadPool *pool,
+                                                   ThreadPoolWorker *worker)
+{
+    unsigned int nr = qatomic_load_acquire(&pool->nr_workers);
+    unsigned int i;
+
+    for (i = 0; i < nr; i++) {
+        ThreadPoolWorker *w = pool->workers[(worker->index + i) % nr];
+        ThreadPoolElement *req;
+
+        if (QTAILQ_EMPTY(&w->request_list)) {
+            continue;
+        }
+
+        qemu_mutex_lock(&w->lock);
+        req = QTAILQ_FIRST(&w->request_list);
+        if (req) {
+            QTAILQ_REMOVE(&w->request_list, req, reqs);
+            req->state = THREAD_ACTIVE;
+            qemu_mutex_unlock(&w->lock);
+
+            qatomic_dec(&pool->queued);
+            if (w != worker) {
+                trace_thread_pool_steal(pool, req, w->index, worker->index);
+            }
+            return req;
+        }
+        qemu_mutex_unlock(&w->lock);
+    }
+
+    /* The unlocked QTAILQ_EMPTY() checks can race with submission */
+    return NULL;
+}
+
+/* Hand a finished request to the AioContext */
+static void thread_pool_complete_request(ThreadPool *pool,
+                                         ThreadPoolElement *req)
+{
+    /* Write ret and state before the request becomes visible to the BH */
+    QSLIST_INSERT_HEAD_ATOMIC(&pool->completed, req, completed);
+    qemu_bh_schedule(pool->completion_bh);
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
+    ThreadPoolWorker *worker;
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
+    worker = thread_pool_attach_worker(pool);
     do_spawn_thread(pool);
+    qemu_mutex_unlock(&pool->lock);
 
-    while (!pool->stopping) {
+    while (!qatomic_read(&pool->stopping)) {
         ThreadPoolElement *req;
         int ret;
 
-        do {
-            pool->idle_threads++;
-            qemu_mutex_unlock(&pool->lock);
-            ret = qemu_sem_timedwait(&pool->sem, 10000);
-            qemu_mutex_lock(&pool->lock);
-            pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
-        if (ret == -1 || pool->stopping) {
+        qatomic_inc(&pool->idle_threads);
+        ret = qemu_sem_timedwait(&pool->sem, 10000);
+        qatomic_dec(&pool->idle_threads);
+
+        if (ret == -1) {
+            /*
+             * Only exit if nothing was queued while we gave up waiting.
+             * Pairs with smp_mb() in thread_pool_submit_aio(): either we see
+             * the request or the submitter sees that we are not idle anymore
+             * and makes sure that a thread is available.
+             */
+            smp_mb();
+            if (qatomic_read(&pool->queued)) {
+                continue;
+            }
+            break;
+        }
+        if (qatomic_read(&pool->stopping)) {
             break;
         }
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
-        qemu_mutex_unlock(&pool->lock);
+        do {
+            req = thread_pool_take_request(pool, worker);
+        } while (!req);
 
         ret = req->func(req->arg);
 
@@ -108,11 +249,11 @@ static void *worker_thread(void *opaque)
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_mutex_lock(&pool->lock);
-
-        qemu_bh_schedule(pool->completion_bh);
+        thread_pool_complete_request(pool, req);
     }
 
+    qemu_mutex_lock(&pool->lock);
+    worker->has_thread = false;
     pool->cur_threads--;
     qemu_cond_signal(&pool->worker_stopped);
     qemu_mutex_unlock(&pool->lock);
@@ -162,14 +303,23 @@ static void spawn_thread(ThreadPool *pool)
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
     aio_context_acquire(pool->ctx);
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
+    for (;;) {
+        /*
+         * completion_list is kept in the pool rather than on the stack so
+         * that a nested invocation, see below, picks up where we left.
+         */
+        elem = QSLIST_FIRST(&pool->completion_list);
+        if (!elem) {
+            QSLIST_MOVE_ATOMIC(&pool->completion_list, &pool->completed);
+            elem = QSLIST_FIRST(&pool->completion_list);
+            if (!elem) {
+                break;
+            }
         }
+        QSLIST_REMOVE_HEAD(&pool->completion_list, completed);
 
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
@@ -189,16 +339,12 @@ restart:
             aio_context_acquire(pool->ctx);
 
             /* We can safely cancel the completion_bh here regardless of someone
-             * else having scheduled it meanwhile because we reenter the
-             * completion function anyway (goto restart).
+             * else having scheduled it meanwhile because we continue with
+             * the remaining requests anyway.
              */
             qemu_bh_cancel(pool->completion_bh);
-
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
     aio_context_release(pool->ctx);
 }
@@ -207,10 +353,11 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 {
     ThreadPoolElement *elem = (ThreadPoolElement *)acb;
     ThreadPool *pool = elem->pool;
+    ThreadPoolWorker *worker = elem->worker;
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    QEMU_LOCK_GUARD(&pool->lock);
+    QEMU_LOCK_GUARD(&worker->lock);
     if (elem->state == THREAD_QUEUED &&
         /* No thread has yet started working on elem. we can try to "steal"
          * the item from the worker if we can get a signal from the
@@ -218,11 +365,12 @@ static void thread_pool_cancel(BlockAIOCB *acb)
          * the lock taken and ensure that elem will remain THREAD_QUEUED.
          */
         qemu_sem_timedwait(&pool->sem, 0) == 0) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+        QTAILQ_REMOVE(&worker->request_list, elem, reqs);
+        qatomic_dec(&pool->queued);
 
         elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
+        thread_pool_complete_request(pool, elem);
     }
 
 }
@@ -245,6 +393,8 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    ThreadPoolWorker *worker;
+    unsigned int nr_workers;
 
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
@@ -256,12 +406,27 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    /* Spread requests evenly, idle workers steal them anyway */
+    nr_workers = qatomic_load_acquire(&pool->nr_workers);
+    worker = pool->workers[pool->next_worker++ % nr_workers];
+    req->worker = worker;
+
+    qemu_mutex_lock(&worker->lock);
+    QTAILQ_INSERT_TAIL(&worker->request_list, req, reqs);
+    qemu_mutex_unlock(&worker->lock);
+
+    qatomic_inc(&pool->queued);
+
+    /* Pairs with smp_mb() in worker_thread() */
+    smp_mb();
+
+    if (qatomic_read(&pool->idle_threads) == 0) {
+        qemu_mutex_lock(&pool->lock);
+        if (pool->cur_threads < pool->max_threads) {
+            spawn_thread(pool);
+        }
+        qemu_mutex_unlock(&pool->lock);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
     qemu_sem_post(&pool->sem);
     return &req->common;
 }
@@ -306,11 +471,15 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
     qemu_sem_init(&pool->sem, 0);
-    pool->max_threads = 64;
+    pool->max_threads = ctx->thread_pool_max;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    QSLIST_INIT(&pool->completion_list);
+    QSLIST_INIT(&pool->completed);
+
+    /* Requests can be queued before the first thread has started */
+    thread_pool_add_worker(pool);
 }
 
 ThreadPool *thread_pool_new(AioContext *ctx)
@@ -320,8 +489,21 @@ ThreadPool *thread_pool_new(AioContext *ctx)
     return pool;
 }
 
+void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
+{
+    QEMU_LOCK_GUARD(&pool->lock);
+
+    /*
+     * No new threads are started beyond the new maximum, but surplus
+     * threads only exit after they have been idle for 10 seconds.
+     */
+    pool->max_threads = ctx->thread_pool_max;
+}
+
 void thread_pool_free(ThreadPool *pool)
 {
+    unsigned int i;
+
     if (!pool) {
         return;
     }
@@ -336,7 +518,7 @@ void thread_pool_free(ThreadPool *pool)
     pool->new_threads = 0;
 
     /* Wait for worker threads to terminate */
-    pool->stopping = true;
+    qatomic_set(&pool->stopping, true);
     while (pool->cur_threads > 0) {
         qemu_sem_post(&pool->sem);
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
@@ -344,6 +526,12 @@ void thread_pool_free(ThreadPool *pool)
 
     qemu_mutex_unlock(&pool->lock);
 
+    for (i = 0; i < pool->nr_workers; i++) {
+        assert(QTAILQ_EMPTY(&pool->workers[i]->request_list));
+        qemu_mutex_destroy(&pool->workers[i]->lock);
+        g_free(pool->workers[i]);
+    }
+
     qemu_bh_delete(pool->completion_bh);
     qemu_sem_destroy(&pool->sem);
     qemu_cond_destroy(&pool->worker_stopped);